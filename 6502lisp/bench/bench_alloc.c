@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "mpc.h"
+
+// Count the heap calls made to parse a 1 MB generated Lisp source and free
+// its AST, with the nodes on the heap and in an mpc_arena_t. The makefile
+// links this with -Wl,--wrap for malloc, calloc, realloc and free, so the
+// counters see every call made by mpc.c. Each mode runs in its own process
+// so peak RSS and page faults are per mode, and the ASTs are compared by
+// hash. Modes alternate for RUNS rounds and the fastest parse of each is
+// reported, in CPU time so other load on the machine does not count.
+
+#define SOURCE_BYTES (1 << 20)
+#define MAX_DEPTH 7
+#define RUNS 5
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+static long mallocs, reallocs, frees;
+
+void *__wrap_malloc(size_t size) { mallocs++; return __real_malloc(size); }
+void *__wrap_calloc(size_t n, size_t size) { mallocs++; return __real_calloc(n, size); }
+void *__wrap_realloc(void *p, size_t size) { reallocs++; return __real_realloc(p, size); }
+void __wrap_free(void *p) { if (p) frees++; __real_free(p); }
+
+static const char *grammar =
+    " number : /-?[0-9]+/ ;                                   "
+    " symbol : /[a-zA-Z_+\\-*\\/<>=!?][a-zA-Z0-9_+\\-*\\/<>=!?]*/ ; "
+    " string : /\"(\\\\.|[^\"])*\"/ ;                          "
+    " list   : '(' <expr>* ')' ;                              "
+    " quote  : '\\'' <expr> ;                                 "
+    " expr   : <list> | <quote> | <number> | <symbol> | <string> ; "
+    " lisp   : /^/ <expr>* /$/ ;                              ";
+
+enum { NUMBER, SYMBOL, STRING, LIST, QUOTE, EXPR, LISP, NUM_RULES };
+
+static const char *rule_names[NUM_RULES] = {
+    "number", "symbol", "string", "list", "quote", "expr", "lisp"
+};
+
+typedef struct {
+    int ok;
+    double parse_seconds;   // CPU time
+    double free_seconds;
+    long parse_faults;      // minor page faults
+    long peak_kb;           // VmHWM
+    long parse_mallocs;     // malloc and calloc
+    long parse_reallocs;
+    long parse_frees;
+    long free_frees;        // to free the AST
+    long arena_allocs;
+    long arena_kb;
+    unsigned long hash;     // of the AST, to check both modes agree
+    long nodes;
+} result_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long minor_faults(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+static long peak_kb(void) {
+    char line[256];
+    long kb = 0;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) sscanf(line, "VmHWM: %ld", &kb);
+    fclose(f);
+    return kb;
+}
+
+static unsigned long next_random(unsigned long *seed) {
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    return *seed >> 33;
+}
+
+static const char *symbols[] = {
+    "define", "lambda", "if", "let", "car", "cdr", "cons", "+", "-", "<", "n", "acc", "xs", "fib", "loop"
+};
+
+static void write_expr(FILE *f, unsigned long *seed, int depth) {
+    unsigned long r = next_random(seed);
+    if (depth >= MAX_DEPTH || r % 8 < 3) {
+        switch (r / 8 % 6) {
+        case 0: case 1: fprintf(f, "%ld", (long)(r % 2000) - 1000); break;
+        case 2: fprintf(f, "\"s%lu\"", r % 100); break;
+        default: fputs(symbols[r / 64 % (sizeof(symbols) / sizeof(symbols[0]))], f); break;
+        }
+        return;
+    }
+    if (r % 8 == 3) {
+        fputc('\'', f);
+        write_expr(f, seed, depth + 1);
+        return;
+    }
+    int n = 1 + r / 8 % 6;
+    fputc('(', f);
+    for (int i = 0; i < n; i++) {
+        if (i) fputc(' ', f);
+        write_expr(f, seed, depth + 1);
+    }
+    fputc(')', f);
+}
+
+// Top level definitions of nested expressions, one per line
+static char *make_source(size_t size) {
+    char *text = NULL;
+    size_t len = 0;
+    unsigned long seed = 6502;
+    FILE *f = open_memstream(&text, &len);
+    if (!f) return NULL;
+    while ((size_t)ftell(f) < size) {
+        fprintf(f, "(define (f%lu n acc) ", next_random(&seed) % 10000);
+        write_expr(f, &seed, 2);
+        fputs(")\n", f);
+    }
+    fclose(f);
+    return text;
+}
+
+static void hash_ast(mpc_ast_t *a, unsigned long *hash, long *nodes) {
+    for (const char *s = a->tag; *s; s++) *hash = (*hash ^ (unsigned char)*s) * 1099511628211UL;
+    for (const char *s = a->contents; *s; s++) *hash = (*hash ^ (unsigned char)*s) * 1099511628211UL;
+    *hash = (*hash ^ (unsigned long)a->children_num) * 1099511628211UL;
+    (*nodes)++;
+    for (int i = 0; i < a->children_num; i++) hash_ast(a->children[i], hash, nodes);
+}
+
+static result_t run_mode(int use_arena, const char *text) {
+    result_t res = { 0 };
+    mpc_parser_t *rules[NUM_RULES];
+    mpc_arena_t *arena = use_arena ? mpc_arena_new() : NULL;
+    mpc_result_t r;
+
+    res.hash = 14695981039346656037UL;
+    for (int i = 0; i < NUM_RULES; i++) rules[i] = mpc_new(rule_names[i]);
+    mpc_err_t *err = mpca_lang(MPCA_LANG_DEFAULT, grammar, rules[NUMBER], rules[SYMBOL], rules[STRING],
+                               rules[LIST], rules[QUOTE], rules[EXPR], rules[LISP], NULL);
+    if (err) {
+        mpc_err_print_to(err, stderr);
+        mpc_err_delete(err);
+        return res;
+    }
+
+    long m0 = mallocs, r0 = reallocs, f0 = frees, faults = minor_faults();
+    double start = now();
+    res.ok = mpc_parse_arena("<bench>", text, rules[LISP], &r, arena);
+    res.parse_seconds = now() - start;
+    res.parse_faults = minor_faults() - faults;
+    res.parse_mallocs = mallocs - m0;
+    res.parse_reallocs = reallocs - r0;
+    res.parse_frees = frees - f0;
+    res.peak_kb = peak_kb();
+
+    if (res.ok) {
+        hash_ast(r.output, &res.hash, &res.nodes);
+        if (arena) {
+            res.arena_allocs = mpc_arena_allocs(arena);
+            res.arena_kb = mpc_arena_bytes(arena) / 1024;
+        }
+        f0 = frees;
+        start = now();
+        mpc_ast_delete(r.output);
+        mpc_arena_delete(arena);
+        arena = NULL;
+        res.free_seconds = now() - start;
+        res.free_frees = frees - f0;
+    } else {
+        mpc_err_print_to(r.error, stderr);
+        mpc_err_delete(r.error);
+    }
+    mpc_arena_delete(arena);
+    mpc_cleanup(NUM_RULES, rules[NUMBER], rules[SYMBOL], rules[STRING], rules[LIST], rules[QUOTE],
+                rules[EXPR], rules[LISP]);
+    return res;
+}
+
+// Fork so that every mode starts from a fresh peak RSS
+static int measure(int use_arena, const char *text, result_t *r) {
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        close(fds[0]);
+        result_t child = run_mode(use_arena, text);
+        _exit(write(fds[1], &child, sizeof(child)) == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    int ok = read(fds[0], r, sizeof(*r)) == sizeof(*r);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return ok && r->ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(void) {
+    static const char *mode_names[2] = { "heap", "arena" };
+    result_t results[2];
+    int failed = 0;
+
+    char *text = make_source(SOURCE_BYTES);
+    if (!text) {
+        perror("bench_alloc");
+        return 1;
+    }
+    size_t len = strlen(text);
+
+    for (int run = 0; run < RUNS && !failed; run++) {
+        for (int m = 0; m < 2; m++) {
+            result_t r;
+            if (!measure(m, text, &r)) {
+                fprintf(stderr, "bench_alloc: %s parse failed\n", mode_names[m]);
+                failed = 1;
+                break;
+            }
+            if (run == 0 || r.parse_seconds < results[m].parse_seconds) results[m] = r;
+        }
+    }
+    for (int m = 0; m < 2 && !failed; m++) {
+        const result_t *r = &results[m];
+        printf("bench_alloc: %-5s %.2f MB, %ld AST nodes, parse %.3f s: %ld malloc, %ld realloc, %ld free, "
+               "%ld page faults; AST free %.4f s: %ld free; peak RSS %.1f MB\n",
+               mode_names[m], len / 1048576.0, r->nodes, r->parse_seconds, r->parse_mallocs,
+               r->parse_reallocs, r->parse_frees, r->parse_faults, r->free_seconds, r->free_frees,
+               r->peak_kb / 1024.0);
+        if (m == 1) printf("bench_alloc: arena %ld allocations, %ld KB\n", r->arena_allocs, r->arena_kb);
+    }
+    if (!failed && (results[0].hash != results[1].hash || results[0].nodes != results[1].nodes)) {
+        fprintf(stderr, "bench_alloc: arena AST differs\n");
+        failed = 1;
+    }
+    free(text);
+    return failed;
+}
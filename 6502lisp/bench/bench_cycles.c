@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "assembler.h"
+#include "sim6502.h"
+
+// Compile Lisp programs, assemble them with the peephole pass and count
+// the cycles they take in the simulator, with the default code and with
+// every value in absolute memory (--no-zp) or tail calls as JSR/RTS
+// (--no-tail-calls). Results are checked, so the cycles are of right code.
+
+#define TRAP 0xFFFA
+#define MAX_CYCLES 100000000ULL
+
+typedef struct {
+    const char *name;
+    const char *source;
+    int expected;
+} program_t;
+
+static const program_t programs[] = {
+    { "fib", "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n"
+             "(fib 20)\n", 6765 },
+    { "fib-iter", "(define (fib a b n) (if (= n 0) a (fib b (+ a b) (- n 1))))\n"
+                  "(let ((k 0) (acc 0)) (while (< k 100) (set! acc (fib 0 1 21)) (set! k (+ k 1))) acc)\n", 10946 },
+    { "even-odd", "(define (even? n) (if (= n 0) 1 (odd? (- n 1))))\n"
+                  "(define (odd? n) (if (= n 0) 0 (even? (- n 1))))\n"
+                  "(let ((k 0) (acc 0))\n"
+                  "  (while (< k 100) (set! acc (+ acc (even? 60) (odd? 59))) (set! k (+ k 1)))\n"
+                  "  acc)\n", 200 },
+    { "sieve", "(define (sieve n)\n"
+               "  (let ((i 2) (count 0))\n"
+               "    (declare (byte i))\n"
+               "    (while (< i n) (poke (+ $3000 i) 1) (set! i (+ i 1)))\n"
+               "    (set! i 2)\n"
+               "    (while (< i n)\n"
+               "      (when (= (peek (+ $3000 i)) 1)\n"
+               "        (set! count (+ count 1))\n"
+               "        (when (< i 16)\n"
+               "          (let ((j (* i i)))\n"
+               "            (while (< j n) (poke (+ $3000 j) 0) (set! j (+ j i))))))\n"
+               "      (set! i (+ i 1)))\n"
+               "    count))\n"
+               "(let ((k 0) (acc 0)) (while (< k 10) (set! acc (+ acc (sieve 250))) (set! k (+ k 1))) acc)\n", 530 },
+    { "sort", "(define (range n acc) (if (= n 0) acc (range (- n 1) (cons (mod (* n 37) 101) acc))))\n"
+              "(define (insert x l)\n"
+              "  (cond ((null? l) (cons x '()))\n"
+              "        ((<= x (car l)) (cons x l))\n"
+              "        (else (cons (car l) (insert x (cdr l))))))\n"
+              "(define (sort l acc) (if (null? l) acc (sort (cdr l) (insert (car l) acc))))\n"
+              "(define (sorted? l) (or (null? (cdr l)) (and (<= (car l) (car (cdr l))) (sorted? (cdr l)))))\n"
+              "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))\n"
+              "(define xs (sort (range 30 '()) '()))\n"
+              "(+ (* 10000 (sorted? xs)) (sum xs 0))\n", 11550 },
+    { "arith", "(define (gcd a b) (if (= b 0) a (gcd b (mod a b))))\n"
+               "(define (loop i acc)\n"
+               "  (if (= i 0) acc (loop (- i 1) (+ acc (gcd (* i 7) 91) (/ (* i i) 13)))))\n"
+               "(loop 80 0)\n", 14403 },
+};
+
+#define NUM_PROGRAMS (int)(sizeof(programs) / sizeof(programs[0]))
+
+typedef struct {
+    const char *name;
+    int zero_page;
+    int tail_calls;
+} variant_t;
+
+static const variant_t modes[] = {
+    { "default", 1, 1 },
+    { "no-zp", 0, 1 },
+    { "no-tail-calls", 1, 0 },
+};
+
+#define NUM_MODES (int)(sizeof(modes) / sizeof(modes[0]))
+
+// Cycles of one run, 0 on any failure; *size is the code size
+static unsigned long long run(const program_t *p, const variant_t *m, cpu_t *cpu, int *size) {
+    compile_options_t options = { m->zero_page, m->tail_calls };
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
+    if (!f) return 0;
+    int errors = compile_lisp(p->name, p->source, f, &options);
+    fclose(f);
+    if (errors) {
+        fprintf(stderr, "bench_cycles: %s (%s) does not compile\n", p->name, m->name);
+        free(text);
+        return 0;
+    }
+
+    object_t image;
+    object_init(&image);
+    if (assemble_6502_image(text, &image, ASM_OPTIMIZE) != 0 || image.section_count == 0) {
+        fprintf(stderr, "bench_cycles: %s (%s) does not assemble\n", p->name, m->name);
+        free(text);
+        object_free(&image);
+        return 0;
+    }
+    free(text);
+
+    memset(cpu, 0, sizeof(*cpu));
+    *size = 0;
+    for (int s = 0; s < image.section_count; s++) {
+        memcpy(cpu->mem + image.sections[s].org, image.sections[s].data, image.sections[s].size);
+        *size += image.sections[s].size;
+    }
+    sim_reset(cpu, image.sections[0].org);
+    cpu->mem[0x100 | cpu->sp--] = ((TRAP - 1) >> 8) & 0xFF;
+    cpu->mem[0x100 | cpu->sp--] = (TRAP - 1) & 0xFF;
+    object_free(&image);
+
+    sim_status_t status = sim_run(cpu, MAX_CYCLES, TRAP, NULL);
+    int value = (short)(cpu->a | (cpu->x << 8)) >> 1;    // ints come back doubled
+    if (status != SIM_TRAP || value != p->expected) {
+        fprintf(stderr, "bench_cycles: %s (%s) returned %d, expected %d\n", p->name, m->name, value, p->expected);
+        return 0;
+    }
+    return cpu->cycles;
+}
+
+int main(void) {
+    cpu_t *cpu = malloc(sizeof(cpu_t));
+    unsigned long long totals[NUM_MODES] = { 0 };
+    int failed = 0;
+    if (!cpu) return 1;
+    sim_init();
+
+    printf("bench_cycles: %-10s", "program");
+    for (int m = 0; m < NUM_MODES; m++) printf(" %14s", modes[m].name);
+    printf("   code bytes\n");
+    for (int i = 0; i < NUM_PROGRAMS; i++) {
+        int size = 0, default_size = 0;
+        printf("bench_cycles: %-10s", programs[i].name);
+        for (int m = 0; m < NUM_MODES; m++) {
+            unsigned long long cycles = run(&programs[i], &modes[m], cpu, &size);
+            if (m == 0) default_size = size;
+            if (!cycles) failed = 1;
+            totals[m] += cycles;
+            printf(" %14llu", cycles);
+        }
+        printf("   %10d\n", default_size);
+    }
+    printf("bench_cycles: %-10s", "total");
+    for (int m = 0; m < NUM_MODES; m++) printf(" %14llu", totals[m]);
+    printf("\n");
+    for (int m = 1; m < NUM_MODES; m++) {
+        printf("bench_cycles: %s takes %.2fx the cycles of the default\n", modes[m].name,
+               totals[0] ? (double)totals[m] / totals[0] : 0.0);
+    }
+
+    free(cpu);
+    return failed;
+}
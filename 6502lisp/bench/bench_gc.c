@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "assembler.h"
+#include "sim6502.h"
+#include "runtime.h"
+
+// Cycles of the cons heap in runtime/heap.s. Compiled programs show what
+// allocation and collection cost in a whole run; single collections of a
+// full heap, with the live cells packed at the bottom or every other cell,
+// show how a collection grows with what survives it.
+
+#define TRAP 0xFFFA
+#define MAX_CYCLES 100000000ULL
+#define CELLS 255
+#define HP 0x0A
+
+typedef struct {
+    const char *name;
+    const char *source;
+    int expected;
+} program_t;
+
+static const program_t programs[] = {
+    { "garbage", "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))\n"
+                 "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))\n"
+                 "(define keep (build 40 '()))\n"
+                 "(let ((k 0) (acc 0))\n"
+                 "  (while (< k 50) (set! acc (+ acc (sum (build 100 '()) 0))) (set! k (+ k 1)))\n"
+                 "  (+ acc (sum keep 0)))\n", -8824 },
+    { "live", "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))\n"
+              "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))\n"
+              "(define keep (build 200 '()))\n"
+              "(let ((k 0) (acc 0))\n"
+              "  (while (< k 40) (set! acc (+ acc (sum (build 20 '()) 0))) (set! k (+ k 1)))\n"
+              "  (+ acc (sum keep 0)))\n", -4268 },
+    { "nested", "(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))\n"
+                "(define (map-sq l) (if (null? l) '() (cons (* (car l) (car l)) (map-sq (cdr l)))))\n"
+                "(define (rev l acc) (if (null? l) acc (rev (cdr l) (cons (car l) acc))))\n"
+                "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))\n"
+                "(define (sum2 ls acc) (if (null? ls) acc (sum2 (cdr ls) (+ acc (sum (car ls) 0)))))\n"
+                "(define (len l n) (if (null? l) n (len (cdr l) (+ n 1))))\n"
+                "(define (take l n) (if (or (= n 0) (null? l)) '() (cons (car l) (take (cdr l) (- n 1)))))\n"
+                "(define (loop k ls)\n"
+                "  (if (= k 0) ls\n"
+                "      (loop (- k 1) (cons (rev (map-sq (iota (+ 1 (mod k 7)) '())) '()) (take ls 8)))))\n"
+                "(define result (loop 200 '()))\n"
+                "(let ((c (cons 1 2)))\n"
+                "  (set-car! c (sum2 result 0))\n"
+                "  (set-cdr! c (len result 0))\n"
+                "  (+ (* 1000 (cdr c)) (car c)))\n", 9355 },
+    { "sort", "(define (range n acc) (if (= n 0) acc (range (- n 1) (cons (mod (* n 37) 101) acc))))\n"
+              "(define (insert x l)\n"
+              "  (cond ((null? l) (cons x '()))\n"
+              "        ((<= x (car l)) (cons x l))\n"
+              "        (else (cons (car l) (insert x (cdr l))))))\n"
+              "(define (sort l acc) (if (null? l) acc (sort (cdr l) (insert (car l) acc))))\n"
+              "(define (sorted? l) (or (null? (cdr l)) (and (<= (car l) (car (cdr l))) (sorted? (cdr l)))))\n"
+              "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))\n"
+              "(define xs (sort (range 30 '()) '()))\n"
+              "(+ (* 10000 (sorted? xs)) (sum xs 0))\n", 11550 },
+};
+
+#define NUM_PROGRAMS (int)(sizeof(programs) / sizeof(programs[0]))
+
+typedef struct {
+    unsigned long long cycles;
+    unsigned long long alloc_cycles;    // in rt_cons, collections left out
+    unsigned long long gc_cycles;
+    unsigned long long conses;
+    int gcs;
+    int value;
+} result_t;
+
+static int symbol_address(const symbol_table_t *symbols, const char *name) {
+    for (int i = 0; i < symbols->count; i++) {
+        if (symbols->symbols[i].defined && strcmp(symbols->symbols[i].name, name) == 0) {
+            return symbols->symbols[i].address;
+        }
+    }
+    return -1;
+}
+
+static unsigned long long range_cycles(const sim_profile_t *profile, int from, int to) {
+    unsigned long long cycles = 0;
+    for (int address = from; address < to; address++) cycles += profile->cycles[address];
+    return cycles;
+}
+
+// Assemble and run source, splitting its cycles between the program and
+// the runtime: everything from rt_cons to rt_gc allocates, from rt_gc to
+// the collection counter collects. Returns 0 on any failure.
+static int run(const char *name, const char *text, cpu_t *cpu, sim_profile_t *profile, result_t *r) {
+    object_t image;
+    object_init(&image);
+    asm6502_ctx *ctx = asm6502_create(ASM_OPTIMIZE);
+    if (!ctx || assemble_6502_image_ex(ctx, text, strlen(text), &image, NULL) != 0 || image.section_count == 0) {
+        fprintf(stderr, "bench_gc: %s does not assemble\n", name);
+        asm6502_destroy(ctx);
+        object_free(&image);
+        return 0;
+    }
+    const symbol_table_t *symbols = asm6502_symbols(ctx);
+    int cons = symbol_address(symbols, "rt_cons"), gc = symbol_address(symbols, "rt_gc");
+    int gcs = symbol_address(symbols, "rt_gcs"), gcs_hi = symbol_address(symbols, "rt_gcs_hi");
+    asm6502_destroy(ctx);
+
+    memset(cpu, 0, sizeof(*cpu));
+    memset(profile, 0, sizeof(*profile));
+    for (int s = 0; s < image.section_count; s++) {
+        memcpy(cpu->mem + image.sections[s].org, image.sections[s].data, image.sections[s].size);
+    }
+    sim_reset(cpu, image.sections[0].org);
+    cpu->mem[0x100 | cpu->sp--] = ((TRAP - 1) >> 8) & 0xFF;
+    cpu->mem[0x100 | cpu->sp--] = (TRAP - 1) & 0xFF;
+    object_free(&image);
+
+    sim_status_t status = sim_run(cpu, MAX_CYCLES, TRAP, profile);
+    if (status != SIM_TRAP || cons < 0 || gc < 0 || gcs < 0 || gcs_hi < 0) {
+        fprintf(stderr, "bench_gc: %s did not finish\n", name);
+        return 0;
+    }
+    r->cycles = cpu->cycles;
+    r->alloc_cycles = range_cycles(profile, cons, gc);
+    r->gc_cycles = range_cycles(profile, gc, gcs);
+    r->conses = profile->instructions[cons];
+    r->gcs = cpu->mem[gcs] | (cpu->mem[gcs_hi] << 8);
+    r->value = (short)(cpu->a | (cpu->x << 8)) >> 1;    // ints come back doubled
+    return 1;
+}
+
+static int run_program(const program_t *p, cpu_t *cpu, sim_profile_t *profile, result_t *r) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
+    if (!f) return 0;
+    int errors = compile_lisp(p->name, p->source, f, NULL);
+    fclose(f);
+    if (errors) {
+        fprintf(stderr, "bench_gc: %s does not compile\n", p->name);
+        free(text);
+        return 0;
+    }
+    int ok = run(p->name, text, cpu, profile, r);
+    free(text);
+    if (ok && r->value != p->expected) {
+        fprintf(stderr, "bench_gc: %s returned %d, expected %d\n", p->name, r->value, p->expected);
+        ok = 0;
+    }
+    return ok;
+}
+
+// Fill the heap with a list of live cells, kept in the only global, and
+// garbage around it, collect once and sum the list. The cars are ints, so
+// doubled, and the list ends at the nil low byte.
+static int run_collection(int live, int interleave, cpu_t *cpu, sim_profile_t *profile, result_t *r) {
+    static const char driver[] =
+        "RT_GLOBAL_WORDS = 1\n"
+        "        .ORG $0800\n"
+        "main:\n"
+        "        JSR rt_init\n"
+        "        LDA #%d\n"
+        "        STA $20\n"
+        "        LDA #%d\n"
+        "        STA $21\n"
+        ".loop:\n"
+        "        LDA $20\n"
+        "        BEQ .garbage\n"
+        "        DEC $20\n"
+        "        LDA $20\n"
+        "        ASL\n"
+        "        STA $02\n"
+        "        LDA #$00\n"
+        "        STA $03\n"
+        "        LDA $0200\n"
+        "        STA $04\n"
+        "        LDA $0201\n"
+        "        STA $05\n"
+        "        JSR rt_cons\n"
+        "        STA $0200\n"
+        "        STX $0201\n"
+        "        LDA #%d\n"
+        "        BEQ .loop\n"
+        ".garbage:\n"
+        "        LDA $21\n"
+        "        BEQ .full\n"
+        "        DEC $21\n"
+        "        LDA #$00\n"
+        "        STA $02\n"
+        "        STA $03\n"
+        "        STA $04\n"
+        "        STA $05\n"
+        "        JSR rt_cons\n"
+        "        JMP .loop\n"
+        ".full:\n"
+        "        JSR rt_gc\n"
+        "        LDA #$00\n"
+        "        STA $22\n"
+        "        STA $23\n"
+        ".sum:\n"
+        "        LDA $0200\n"
+        "        BEQ .done\n"
+        "        LDX $0201\n"
+        "        CLC\n"
+        "        LDA RT_CAR_LO,X\n"
+        "        ADC $22\n"
+        "        STA $22\n"
+        "        LDA RT_CAR_HI,X\n"
+        "        ADC $23\n"
+        "        STA $23\n"
+        "        LDA RT_CDR_LO,X\n"
+        "        STA $0200\n"
+        "        LDA RT_CDR_HI,X\n"
+        "        STA $0201\n"
+        "        JMP .sum\n"
+        ".done:\n"
+        "        LDA $22\n"
+        "        LDX $23\n"
+        "        RTS\n";
+    char name[32];
+    size_t size = sizeof(driver) + sizeof(runtime_heap) + 32;
+    char *text = malloc(size);
+    if (!text) return 0;
+    int n = snprintf(text, size, driver, live, CELLS - live, interleave);
+    snprintf(text + n, size - n, "%s", runtime_heap);
+    snprintf(name, sizeof(name), "%d live cells", live);
+
+    int ok = run(name, text, cpu, profile, r);
+    free(text);
+    if (ok && (r->value != live * (live - 1) / 2 || cpu->mem[HP] != live || r->gcs != 1)) {
+        fprintf(stderr, "bench_gc: %s: sum %d, %d cells in use after %d collections\n", name, r->value,
+                cpu->mem[HP], r->gcs);
+        ok = 0;
+    }
+    return ok;
+}
+
+int main(void) {
+    static const int live_cells[] = { 0, 32, 64, 96, 127 };
+    cpu_t *cpu = malloc(sizeof(cpu_t));
+    sim_profile_t *profile = malloc(sizeof(sim_profile_t));
+    result_t r;
+    int failed = 0;
+    if (!cpu || !profile) return 1;
+    sim_init();
+
+    printf("bench_gc: %-10s %10s %8s %6s %12s %14s %8s\n", "program", "cycles", "conses", "gcs", "cycles/cons",
+           "cycles/gc", "gc share");
+    for (int i = 0; i < NUM_PROGRAMS; i++) {
+        if (!run_program(&programs[i], cpu, profile, &r)) {
+            failed = 1;
+            continue;
+        }
+        printf("bench_gc: %-10s %10llu %8llu %6d %12.1f %14.0f %7.1f%%\n", programs[i].name, r.cycles, r.conses,
+               r.gcs, r.conses ? (double)r.alloc_cycles / r.conses : 0.0,
+               r.gcs ? (double)r.gc_cycles / r.gcs : 0.0, 100.0 * r.gc_cycles / r.cycles);
+    }
+
+    printf("bench_gc: collection of %d cells %14s %14s\n", CELLS, "packed", "interleaved");
+    for (int i = 0; i < (int)(sizeof(live_cells) / sizeof(live_cells[0])); i++) {
+        unsigned long long cycles[2] = { 0, 0 };
+        for (int interleave = 0; interleave < 2; interleave++) {
+            if (run_collection(live_cells[i], interleave, cpu, profile, &r)) cycles[interleave] = r.gc_cycles;
+            else failed = 1;
+        }
+        printf("bench_gc: %3d live cells %23llu %14llu\n", live_cells[i], cycles[0], cycles[1]);
+    }
+
+    free(cpu);
+    free(profile);
+    return failed;
+}
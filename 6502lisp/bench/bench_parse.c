@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "mpc.h"
+
+// Parse a 1 MB generated Lisp source with and without packrat memoization
+// (MPCA_LANG_MEMOIZE). The grammar tries dotted pairs before plain lists,
+// so every list is parsed by the `pair` rule first and, when that fails at
+// the closing paren, again by `list`; without memoization the work doubles
+// with every level of nesting. Each mode runs in its own process so peak
+// RSS is per mode, and the ASTs are compared by hash.
+
+#define SOURCE_BYTES (1 << 20)
+#define MAX_DEPTH 7
+
+static const char *grammar =
+    " number : /-?[0-9]+/ ;                                   "
+    " symbol : /[a-zA-Z_+\\-*\\/<>=!?][a-zA-Z0-9_+\\-*\\/<>=!?]*/ ; "
+    " string : /\"(\\\\.|[^\"])*\"/ ;                          "
+    " pair   : '(' <expr>+ '.' <expr> ')' ;                   "
+    " list   : '(' <expr>* ')' ;                              "
+    " quote  : '\\'' <expr> ;                                 "
+    " expr   : <pair> | <list> | <quote> | <number> | <symbol> | <string> ; "
+    " lisp   : /^/ <expr>* /$/ ;                              ";
+
+enum { NUMBER, SYMBOL, STRING, PAIR, LIST, QUOTE, EXPR, LISP, NUM_RULES };
+
+static const char *rule_names[NUM_RULES] = {
+    "number", "symbol", "string", "pair", "list", "quote", "expr", "lisp"
+};
+
+typedef struct {
+    int ok;
+    double seconds;
+    long peak_kb;           // VmHWM
+    unsigned long hash;     // of the AST, to check both modes agree
+    long nodes;
+} result_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_kb(void) {
+    char line[256];
+    long kb = 0;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) sscanf(line, "VmHWM: %ld", &kb);
+    fclose(f);
+    return kb;
+}
+
+static unsigned long next_random(unsigned long *seed) {
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    return *seed >> 33;
+}
+
+static const char *symbols[] = {
+    "define", "lambda", "if", "let", "car", "cdr", "cons", "+", "-", "<", "n", "acc", "xs", "fib", "loop"
+};
+
+static void write_expr(FILE *f, unsigned long *seed, int depth) {
+    unsigned long r = next_random(seed);
+    if (depth >= MAX_DEPTH || r % 8 < 3) {
+        switch (r / 8 % 6) {
+        case 0: case 1: fprintf(f, "%ld", (long)(r % 2000) - 1000); break;
+        case 2: fprintf(f, "\"s%lu\"", r % 100); break;
+        default: fputs(symbols[r / 64 % (sizeof(symbols) / sizeof(symbols[0]))], f); break;
+        }
+        return;
+    }
+    if (r % 8 == 3) {
+        fputc('\'', f);
+        write_expr(f, seed, depth + 1);
+        return;
+    }
+    int n = 1 + r / 8 % 4;
+    fputc('(', f);
+    for (int i = 0; i < n; i++) {
+        if (i) fputc(' ', f);
+        write_expr(f, seed, depth + 1);
+    }
+    if (r % 16 == 15) {
+        fputs(" . ", f);
+        write_expr(f, seed, depth + 1);
+    }
+    fputc(')', f);
+}
+
+// Top level definitions of nested expressions, one per line
+static char *make_source(size_t size) {
+    char *text = NULL;
+    size_t len = 0;
+    unsigned long seed = 6502;
+    FILE *f = open_memstream(&text, &len);
+    if (!f) return NULL;
+    while ((size_t)ftell(f) < size) {
+        fprintf(f, "(define (f%lu n acc) ", next_random(&seed) % 10000);
+        write_expr(f, &seed, 2);
+        fputs(")\n", f);
+    }
+    fclose(f);
+    return text;
+}
+
+static void hash_ast(mpc_ast_t *a, unsigned long *hash, long *nodes) {
+    for (const char *s = a->tag; *s; s++) *hash = (*hash ^ (unsigned char)*s) * 1099511628211UL;
+    for (const char *s = a->contents; *s; s++) *hash = (*hash ^ (unsigned char)*s) * 1099511628211UL;
+    *hash = (*hash ^ (unsigned long)a->children_num) * 1099511628211UL;
+    (*nodes)++;
+    for (int i = 0; i < a->children_num; i++) hash_ast(a->children[i], hash, nodes);
+}
+
+static int build_grammar(int flags, mpc_parser_t **rules) {
+    for (int i = 0; i < NUM_RULES; i++) rules[i] = mpc_new(rule_names[i]);
+    mpc_err_t *err = mpca_lang(flags, grammar, rules[NUMBER], rules[SYMBOL], rules[STRING], rules[PAIR],
+                               rules[LIST], rules[QUOTE], rules[EXPR], rules[LISP], NULL);
+    if (err) {
+        mpc_err_print_to(err, stderr);
+        mpc_err_delete(err);
+        return 0;
+    }
+    return 1;
+}
+
+static void free_grammar(mpc_parser_t **rules) {
+    mpc_cleanup(NUM_RULES, rules[NUMBER], rules[SYMBOL], rules[STRING], rules[PAIR], rules[LIST],
+                rules[QUOTE], rules[EXPR], rules[LISP]);
+}
+
+// Error message for a parse that is meant to fail; the caller frees it
+static char *parse_error(int flags, const char *text) {
+    mpc_parser_t *rules[NUM_RULES];
+    mpc_result_t r;
+    char *msg = NULL;
+    if (!build_grammar(flags, rules)) return NULL;
+    if (mpc_parse("<bench>", text, rules[LISP], &r)) {
+        mpc_ast_delete(r.output);
+    } else {
+        msg = mpc_err_string(r.error);
+        mpc_err_delete(r.error);
+    }
+    free_grammar(rules);
+    return msg;
+}
+
+static result_t run_mode(int flags, const char *text) {
+    result_t res = { 0, 0, 0, 14695981039346656037UL, 0 };
+    mpc_parser_t *rules[NUM_RULES];
+    mpc_result_t r;
+    if (!build_grammar(flags, rules)) return res;
+
+    double start = now();
+    res.ok = mpc_parse("<bench>", text, rules[LISP], &r);
+    res.seconds = now() - start;
+    res.peak_kb = peak_kb();
+    if (res.ok) {
+        hash_ast(r.output, &res.hash, &res.nodes);
+        mpc_ast_delete(r.output);
+    } else {
+        mpc_err_print_to(r.error, stderr);
+        mpc_err_delete(r.error);
+    }
+    free_grammar(rules);
+    return res;
+}
+
+// Fork so that every mode starts from a fresh peak RSS
+static int measure(int flags, const char *text, result_t *r) {
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        close(fds[0]);
+        result_t child = run_mode(flags, text);
+        _exit(write(fds[1], &child, sizeof(child)) == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    int ok = read(fds[0], r, sizeof(*r)) == sizeof(*r);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return ok && r->ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(void) {
+    static const char *broken = "(define (f n) (if (< n 2) n (+ (f (- n 1)) . )))";
+    static const int modes[2] = { MPCA_LANG_DEFAULT, MPCA_LANG_MEMOIZE };
+    static const char *mode_names[2] = { "backtracking", "memoized" };
+    result_t results[2];
+
+    char *text = make_source(SOURCE_BYTES);
+    if (!text) {
+        perror("bench_parse");
+        return 1;
+    }
+    size_t len = strlen(text);
+
+    // Replayed errors must read exactly like the ones found by parsing
+    char *plain = parse_error(modes[0], broken);
+    char *memo = parse_error(modes[1], broken);
+    int failed = !plain || !memo || strcmp(plain, memo) != 0;
+    if (failed) fprintf(stderr, "bench_parse: error messages differ:\n%s%s", plain ? plain : "", memo ? memo : "");
+    free(plain);
+    free(memo);
+
+    for (int m = 0; m < 2; m++) {
+        if (!measure(modes[m], text, &results[m])) {
+            fprintf(stderr, "bench_parse: %s parse failed\n", mode_names[m]);
+            failed = 1;
+            continue;
+        }
+        printf("bench_parse: %-12s %.2f MB, %ld AST nodes, %.3f s, %.2f MB/s, peak RSS %.1f MB\n",
+               mode_names[m], len / 1048576.0, results[m].nodes, results[m].seconds,
+               len / 1048576.0 / results[m].seconds, results[m].peak_kb / 1024.0);
+    }
+    if (!failed) {
+        if (results[0].hash != results[1].hash || results[0].nodes != results[1].nodes) {
+            fprintf(stderr, "bench_parse: memoized AST differs\n");
+            failed = 1;
+        } else {
+            printf("bench_parse: speedup %.1fx\n", results[0].seconds / results[1].seconds);
+        }
+    }
+    free(text);
+    return failed;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mpc.h"
+
+// Tokenize a 4 MB generated Lisp source with regexes run as combinators
+// and compiled to DFA tables (MPC_RE_DFA), and report tokens per second.
+// The tokens of both modes are compared by hash. The whole grammar is then
+// parsed with and without MPCA_LANG_DFA, and those ASTs compared too.
+
+#define SOURCE_BYTES (4 << 20)
+#define GRAMMAR_BYTES (1 << 20)
+#define MAX_DEPTH 7
+
+#define NUMBER_RE "-?[0-9]+"
+#define SYMBOL_RE "[a-zA-Z_+\\-*\\/<>=!?][a-zA-Z0-9_+\\-*\\/<>=!?]*"
+#define STRING_RE "\"(\\\\.|[^\"])*\""
+
+static const char *grammar =
+    " number : /" NUMBER_RE "/ ;                  "
+    " symbol : /" SYMBOL_RE "/ ;                  "
+    " string : /" STRING_RE "/ ;                  "
+    " list   : '(' <expr>* ')' ;                  "
+    " quote  : '\\'' <expr> ;                     "
+    " expr   : <list> | <quote> | <number> | <symbol> | <string> ; "
+    " lisp   : /^/ <expr>* /$/ ;                  ";
+
+enum { NUMBER, SYMBOL, STRING, LIST, QUOTE, EXPR, LISP, NUM_RULES };
+
+static const char *rule_names[NUM_RULES] = {
+    "number", "symbol", "string", "list", "quote", "expr", "lisp"
+};
+
+static long token_count;
+static unsigned long token_hash;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long next_random(unsigned long *seed) {
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    return *seed >> 33;
+}
+
+static const char *symbols[] = {
+    "define", "lambda", "if", "let", "car", "cdr", "cons", "+", "-", "<", "n", "acc", "xs", "fib", "loop"
+};
+
+static void write_expr(FILE *f, unsigned long *seed, int depth) {
+    unsigned long r = next_random(seed);
+    if (depth >= MAX_DEPTH || r % 8 < 3) {
+        switch (r / 8 % 6) {
+        case 0: case 1: fprintf(f, "%ld", (long)(r % 200000) - 100000); break;
+        case 2: fprintf(f, "\"s%lu \\\"q\\\" %lu\"", r % 100, r % 7); break;
+        default: fprintf(f, "%s%lu", symbols[r / 64 % (sizeof(symbols) / sizeof(symbols[0]))], r % 10); break;
+        }
+        return;
+    }
+    if (r % 8 == 3) {
+        fputc('\'', f);
+        write_expr(f, seed, depth + 1);
+        return;
+    }
+    int n = 1 + r / 8 % 6;
+    fputc('(', f);
+    for (int i = 0; i < n; i++) {
+        if (i) fputc(' ', f);
+        write_expr(f, seed, depth + 1);
+    }
+    fputc(')', f);
+}
+
+// Top level definitions of nested expressions, one per line
+static char *make_source(size_t size) {
+    char *text = NULL;
+    size_t len = 0;
+    unsigned long seed = 6502;
+    FILE *f = open_memstream(&text, &len);
+    if (!f) return NULL;
+    while ((size_t)ftell(f) < size) {
+        fprintf(f, "(define (f%lu n acc) ", next_random(&seed) % 10000);
+        write_expr(f, &seed, 2);
+        fputs(")\n", f);
+    }
+    fclose(f);
+    return text;
+}
+
+static mpc_val_t *count_token(mpc_val_t *x) {
+    for (const char *s = x; *s; s++) token_hash = (token_hash ^ (unsigned char)*s) * 1099511628211UL;
+    token_hash = (token_hash ^ 0xff) * 1099511628211UL;
+    token_count++;
+    free(x);
+    return NULL;
+}
+
+// Tokens only: every token is hashed and dropped as it is scanned
+static int tokenize(int mode, const char *text, double *seconds) {
+    mpc_parser_t *token = mpc_or(4,
+        mpc_re_mode(NUMBER_RE, mode),
+        mpc_re_mode(SYMBOL_RE, mode),
+        mpc_re_mode(STRING_RE, mode),
+        mpc_oneof("()'"));
+    mpc_parser_t *lexer = mpc_whole(mpc_many(mpcf_null, mpc_apply(mpc_tok(token), count_token)), free);
+    mpc_result_t r;
+
+    token_count = 0;
+    token_hash = 14695981039346656037UL;
+    double start = now();
+    int ok = mpc_parse("<bench>", text, lexer, &r);
+    *seconds = now() - start;
+    if (!ok) {
+        mpc_err_print_to(r.error, stderr);
+        mpc_err_delete(r.error);
+    }
+    mpc_delete(lexer);
+    return ok;
+}
+
+static void hash_ast(mpc_ast_t *a, unsigned long *hash, long *nodes) {
+    for (const char *s = a->tag; *s; s++) *hash = (*hash ^ (unsigned char)*s) * 1099511628211UL;
+    for (const char *s = a->contents; *s; s++) *hash = (*hash ^ (unsigned char)*s) * 1099511628211UL;
+    *hash = (*hash ^ (unsigned long)a->children_num) * 1099511628211UL;
+    (*nodes)++;
+    for (int i = 0; i < a->children_num; i++) hash_ast(a->children[i], hash, nodes);
+}
+
+static int parse(int flags, const char *text, double *seconds, unsigned long *hash, long *nodes) {
+    mpc_parser_t *rules[NUM_RULES];
+    mpc_result_t r;
+    for (int i = 0; i < NUM_RULES; i++) rules[i] = mpc_new(rule_names[i]);
+    mpc_err_t *err = mpca_lang(flags, grammar, rules[NUMBER], rules[SYMBOL], rules[STRING], rules[LIST],
+                               rules[QUOTE], rules[EXPR], rules[LISP], NULL);
+    if (err) {
+        mpc_err_print_to(err, stderr);
+        mpc_err_delete(err);
+        return 0;
+    }
+    double start = now();
+    int ok = mpc_parse("<bench>", text, rules[LISP], &r);
+    *seconds = now() - start;
+    *hash = 14695981039346656037UL;
+    *nodes = 0;
+    if (ok) {
+        hash_ast(r.output, hash, nodes);
+        mpc_ast_delete(r.output);
+    } else {
+        mpc_err_print_to(r.error, stderr);
+        mpc_err_delete(r.error);
+    }
+    mpc_cleanup(NUM_RULES, rules[NUMBER], rules[SYMBOL], rules[STRING], rules[LIST], rules[QUOTE],
+                rules[EXPR], rules[LISP]);
+    return ok;
+}
+
+int main(void) {
+    static const int modes[2] = { MPC_RE_DEFAULT, MPC_RE_DFA };
+    static const int flags[2] = { MPCA_LANG_DEFAULT, MPCA_LANG_DFA };
+    static const char *mode_names[2] = { "combinators", "dfa" };
+    double seconds[2];
+    long tokens[2], nodes[2];
+    unsigned long hashes[2];
+    int failed = 0;
+
+    char *text = make_source(SOURCE_BYTES);
+    if (!text) {
+        perror("bench_regex");
+        return 1;
+    }
+    size_t len = strlen(text);
+
+    for (int m = 0; m < 2; m++) {
+        if (!tokenize(modes[m], text, &seconds[m])) {
+            fprintf(stderr, "bench_regex: %s tokenize failed\n", mode_names[m]);
+            failed = 1;
+            continue;
+        }
+        tokens[m] = token_count;
+        hashes[m] = token_hash;
+        printf("bench_regex: tokenize %-11s %.2f MB, %ld tokens, %.3f s, %.0f tokens/s, %.2f MB/s\n",
+               mode_names[m], len / 1048576.0, tokens[m], seconds[m], tokens[m] / seconds[m],
+               len / 1048576.0 / seconds[m]);
+    }
+    if (!failed && (tokens[0] != tokens[1] || hashes[0] != hashes[1])) {
+        fprintf(stderr, "bench_regex: dfa tokens differ\n");
+        failed = 1;
+    } else if (!failed) {
+        printf("bench_regex: tokenize speedup %.1fx\n", seconds[0] / seconds[1]);
+    }
+
+    // The grammar on a prefix of the source, cut at a line end
+    char *end = text + GRAMMAR_BYTES;
+    while (*end && *end != '\n') end++;
+    if (*end) end[1] = '\0';
+    len = strlen(text);
+
+    for (int m = 0; m < 2; m++) {
+        if (!parse(flags[m], text, &seconds[m], &hashes[m], &nodes[m])) {
+            fprintf(stderr, "bench_regex: %s parse failed\n", mode_names[m]);
+            failed = 1;
+            continue;
+        }
+        printf("bench_regex: grammar  %-11s %.2f MB, %ld AST nodes, %.3f s, %.2f MB/s\n",
+               mode_names[m], len / 1048576.0, nodes[m], seconds[m], len / 1048576.0 / seconds[m]);
+    }
+    if (!failed && (nodes[0] != nodes[1] || hashes[0] != hashes[1])) {
+        fprintf(stderr, "bench_regex: dfa AST differs\n");
+        failed = 1;
+    } else if (!failed) {
+        printf("bench_regex: grammar speedup %.1fx\n", seconds[0] / seconds[1]);
+    }
+
+    free(text);
+    return failed;
+}
@@ -0,0 +1,1020 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "runtime.h"
+
+// IR to assembler source. Values are bytes at fixed addresses, so every
+// operation is a short LDA/op/STA run per byte; the accumulator carries
+// results of calls (with X for the high byte) and nothing else across
+// instructions. An int n is held as 2n, which adds, subtracts, compares and
+// masks like n and keeps bit 0 clear for the references of runtime/heap.s;
+// bytes are held as they are.
+
+#define MAX_OPERAND 24
+#define MAX_LABEL 80
+#define RUNTIME_STACK 8         // rt_cons down to gc_mark, and the arithmetic routines
+
+typedef struct {
+    const ir_program_t *prog;
+    const ir_func_t *fn;
+    const int *guard;           // per function: stack bytes checked at entry, 0 for none
+    FILE *out;
+    int next_label;             // labels of the templates, after the IR ones
+    char a_imm[MAX_OPERAND];    // immediate known to be in A, "" if none
+} emit_t;
+
+// An operand as bytes: a constant, or width bytes from an address
+typedef struct {
+    int imm;
+    int value;
+    int width;
+} loc_t;
+
+typedef struct {
+    int dst;
+    int imm;
+    int src;                    // address, or the byte value when imm
+} byte_move_t;
+
+static loc_t loc(const emit_t *e, opnd_t o) {
+    loc_t l = { 0, o.value, o.width };
+    switch (o.kind) {
+        case OPND_VREG:
+            l.value = e->fn->vregs[o.value].location;
+            break;
+        case OPND_MEM:
+            break;
+        default:
+            l.imm = 1;
+            l.value = o.kind != OPND_CONST ? 0 : o.width == 2 ? o.value * 2 : o.value;
+            if (l.width < 1) l.width = 1;
+            break;
+    }
+    return l;
+}
+
+static loc_t at(int address, int width) {
+    loc_t l = { 0, address, width };
+    return l;
+}
+
+static int imm_byte(loc_t l, int k) {
+    return (l.value >> (8 * k)) & 0xFF;
+}
+
+// Bytes past the width of an operand are zero
+static int is_imm(loc_t l, int k) {
+    return l.imm || k >= l.width;
+}
+
+static const char* address_text(int address, char *buf) {
+    snprintf(buf, MAX_OPERAND, address < 0x100 ? "$%02X" : "$%04X", address);
+    return buf;
+}
+
+static const char* byte_text(loc_t l, int k, char *buf) {
+    if (is_imm(l, k)) {
+        snprintf(buf, MAX_OPERAND, "#$%02X", l.imm ? imm_byte(l, k) : 0);
+        return buf;
+    }
+    return address_text(l.value + k, buf);
+}
+
+static int same_loc(loc_t a, loc_t b) {
+    return !a.imm && !b.imm && a.value == b.value && a.width == b.width;
+}
+
+static int modifies_a(const char *mnemonic, const char *operand) {
+    static const char *writers[] = { "LDA", "ADC", "SBC", "AND", "ORA", "EOR", "PLA", "TXA", "TYA", "JSR" };
+    for (size_t i = 0; i < sizeof(writers) / sizeof(writers[0]); i++) {
+        if (strcmp(mnemonic, writers[i]) == 0) return 1;
+    }
+    // Accumulator shifts and rotates
+    return !*operand && (strcmp(mnemonic, "ASL") == 0 || strcmp(mnemonic, "LSR") == 0 ||
+                         strcmp(mnemonic, "ROL") == 0 || strcmp(mnemonic, "ROR") == 0);
+}
+
+// One instruction; loads of the immediate already in A are left out
+static void op(emit_t *e, const char *mnemonic, const char *operand) {
+    if (!operand) operand = "";
+    if (strcmp(mnemonic, "LDA") == 0 && operand[0] == '#' && strcmp(operand, e->a_imm) == 0) return;
+    if (*operand) fprintf(e->out, "        %s %s\n", mnemonic, operand);
+    else fprintf(e->out, "        %s\n", mnemonic);
+    if (strcmp(mnemonic, "LDA") == 0 && operand[0] == '#') snprintf(e->a_imm, sizeof(e->a_imm), "%s", operand);
+    else if (modifies_a(mnemonic, operand)) e->a_imm[0] = '\0';
+}
+
+static void op_byte(emit_t *e, const char *mnemonic, loc_t l, int k) {
+    char buf[MAX_OPERAND];
+    op(e, mnemonic, byte_text(l, k, buf));
+}
+
+static void op_addr(emit_t *e, const char *mnemonic, int address) {
+    char buf[MAX_OPERAND];
+    op(e, mnemonic, address_text(address, buf));
+}
+
+static void op_imm(emit_t *e, const char *mnemonic, int value) {
+    char buf[MAX_OPERAND];
+    snprintf(buf, sizeof(buf), "#$%02X", value & 0xFF);
+    op(e, mnemonic, buf);
+}
+
+static void op_label(emit_t *e, const char *mnemonic, int label) {
+    char buf[MAX_OPERAND];
+    snprintf(buf, sizeof(buf), ".L%d", label);
+    op(e, mnemonic, buf);
+}
+
+static void op_indirect(emit_t *e, const char *mnemonic, int pointer) {
+    char buf[MAX_OPERAND];
+    snprintf(buf, sizeof(buf), "($%02X),Y", pointer);
+    op(e, mnemonic, buf);
+}
+
+static void label(emit_t *e, int label) {
+    fprintf(e->out, ".L%d:\n", label);
+    e->a_imm[0] = '\0';
+}
+
+static void named_label(emit_t *e, const char *name) {
+    fprintf(e->out, "%s:\n", name);
+    e->a_imm[0] = '\0';
+}
+
+// Byte k of src to byte kd of dst
+static void copy_byte(emit_t *e, loc_t src, int k, loc_t dst, int kd) {
+    if (!is_imm(src, k) && src.value + k == dst.value + kd) return;
+    op_byte(e, "LDA", src, k);
+    op_byte(e, "STA", dst, kd);
+}
+
+static void zero_fill(emit_t *e, loc_t dst, int from) {
+    for (int k = from; k < dst.width; k++) {
+        op(e, "LDA", "#$00");
+        op_byte(e, "STA", dst, k);
+    }
+}
+
+static void copy(emit_t *e, loc_t src, loc_t dst, int n) {
+    for (int k = 0; k < n; k++) copy_byte(e, src, k, dst, k);
+    zero_fill(e, dst, n);
+}
+
+static int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+// A zero page pointer holding the address in l: a byte as it is, an int
+// shifted back, so computed addresses reach $0000-$7FFF
+static int pointer(emit_t *e, loc_t l) {
+    if (l.width == 1) {
+        copy(e, l, at(RT_P, 2), 1);
+        return RT_P;
+    }
+    op_byte(e, "LDA", l, 1);
+    op(e, "LSR", NULL);
+    op_addr(e, "STA", RT_P + 1);
+    op_byte(e, "LDA", l, 0);
+    op(e, "ROR", NULL);
+    op_addr(e, "STA", RT_P);
+    return RT_P;
+}
+
+// Moves between widths convert: a byte b widens to the int 2b, and an
+// int narrows to its low 8 bits
+static void gen_move(emit_t *e, loc_t a, loc_t d) {
+    if (a.imm || a.width == d.width) {
+        copy(e, a, d, min(a.width, d.width));
+    } else if (d.width == 2) {
+        op_byte(e, "LDA", a, 0);
+        op(e, "ASL", NULL);
+        op_byte(e, "STA", d, 0);
+        op(e, "LDA", "#$00");
+        op(e, "ROL", NULL);
+        op_byte(e, "STA", d, 1);
+    } else {
+        op_byte(e, "LDA", a, 1);
+        op(e, "LSR", NULL);
+        op_byte(e, "LDA", a, 0);
+        op(e, "ROR", NULL);
+        op_byte(e, "STA", d, 0);
+    }
+}
+
+// Bytes moved all at once: a move goes when nothing else still reads its
+// destination, and a cycle is broken through RT_T, or the stack when the
+// scratch byte is taken
+static void parallel_move(emit_t *e, byte_move_t *moves, int count) {
+    char buf[MAX_OPERAND];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (moves[i].imm || moves[i].src != moves[i].dst) moves[n++] = moves[i];
+    }
+    while (n > 0) {
+        int progress = 0;
+        for (int i = 0; i < n; i++) {
+            int blocked = 0;
+            for (int j = 0; j < n && !blocked; j++) blocked = j != i && !moves[j].imm && moves[j].src == moves[i].dst;
+            if (blocked) continue;
+            if (moves[i].imm) op_imm(e, "LDA", moves[i].src);
+            else op_addr(e, "LDA", moves[i].src);
+            op_addr(e, "STA", moves[i].dst);
+            moves[i--] = moves[--n];
+            progress = 1;
+        }
+        if (progress) continue;
+
+        int scratch_free = 1;
+        for (int j = 0; j < n; j++) scratch_free &= moves[j].imm || moves[j].src != RT_T;
+        if (scratch_free) {
+            int saved = moves[0].dst;
+            op(e, "LDA", address_text(saved, buf));
+            op_addr(e, "STA", RT_T);
+            for (int j = 0; j < n; j++) {
+                if (!moves[j].imm && moves[j].src == saved) moves[j].src = RT_T;
+            }
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (moves[i].imm) op_imm(e, "LDA", moves[i].src);
+            else op_addr(e, "LDA", moves[i].src);
+            op(e, "PHA", NULL);
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            op(e, "PLA", NULL);
+            op_addr(e, "STA", moves[i].dst);
+        }
+        n = 0;
+    }
+}
+
+static int add_moves(byte_move_t *moves, int n, loc_t src, int dst, int width) {
+    for (int k = 0; k < width; k++) {
+        moves[n].dst = dst + k;
+        moves[n].imm = is_imm(src, k);
+        moves[n].src = moves[n].imm ? (src.imm ? imm_byte(src, k) : 0) : src.value + k;
+        n++;
+    }
+    return n;
+}
+
+// Arguments into the slots of the callee's parameters
+static void pass_args(emit_t *e, const ir_instr_t *ins) {
+    const ir_func_t *callee = &e->prog->funcs[ins->func];
+    byte_move_t moves[2 * MAX_PARAMS];
+    int n = 0;
+    for (int i = 0; i < ins->arg_count; i++) {
+        n = add_moves(moves, n, loc(e, ins->args[i]), ARG_BASE + 2 * i, callee->param_width[i]);
+    }
+    parallel_move(e, moves, n);
+}
+
+static void gen_pmove(emit_t *e, const ir_instr_t *ins) {
+    byte_move_t moves[2 * MAX_PARAMS];
+    int n = 0;
+    for (int i = 0; i < ins->arg_count; i++) {
+        loc_t d = loc(e, ins->dsts[i]);
+        if (d.value >= 0) n = add_moves(moves, n, loc(e, ins->args[i]), d.value, d.width);
+    }
+    parallel_move(e, moves, n);
+}
+
+// +1 and -1 in place
+static void gen_step(emit_t *e, ir_op_t opcode, loc_t d, int n) {
+    int skip = e->next_label++;
+    if (opcode == I_ADD) {
+        op_byte(e, "INC", d, 0);
+        if (n == 2) {
+            op_label(e, "BNE", skip);
+            op_byte(e, "INC", d, 1);
+            label(e, skip);
+        }
+    } else {
+        if (n == 2) {
+            op_byte(e, "LDA", d, 0);
+            op_label(e, "BNE", skip);
+            op_byte(e, "DEC", d, 1);
+            label(e, skip);
+        }
+        op_byte(e, "DEC", d, 0);
+    }
+}
+
+static void gen_arith(emit_t *e, const ir_instr_t *ins) {
+    static const char *mnemonics[] = { [I_ADD] = "ADC", [I_SUB] = "SBC", [I_AND] = "AND", [I_OR] = "ORA",
+                                       [I_XOR] = "EOR" };
+    loc_t d = loc(e, ins->dst), a = loc(e, ins->a), b = loc(e, ins->b);
+    int n = min(ins->width, d.width);
+    int carry = ins->op == I_ADD || ins->op == I_SUB;
+
+    if (carry && b.imm && same_loc(a, d)) {
+        if ((b.value & 0xFFFF) == 1) {
+            gen_step(e, ins->op, d, n);
+            return;
+        }
+        // Constant bytes: the high byte only changes on a carry
+        if (n == 2 && imm_byte(b, 1) == 0) {
+            int skip = e->next_label++;
+            op(e, ins->op == I_ADD ? "CLC" : "SEC", NULL);
+            op_byte(e, "LDA", d, 0);
+            op_byte(e, mnemonics[ins->op], b, 0);
+            op_byte(e, "STA", d, 0);
+            op_label(e, ins->op == I_ADD ? "BCC" : "BCS", skip);
+            op_byte(e, ins->op == I_ADD ? "INC" : "DEC", d, 1);
+            label(e, skip);
+            return;
+        }
+    }
+
+    // Low bytes that add or subtract zero leave the carry alone
+    int k = 0;
+    if (carry) {
+        for (; k < n && is_imm(b, k) && (!b.imm || imm_byte(b, k) == 0); k++) copy_byte(e, a, k, d, k);
+        if (k < n) op(e, ins->op == I_ADD ? "CLC" : "SEC", NULL);
+    }
+    for (; k < n; k++) {
+        if (!carry && is_imm(b, k)) {
+            int v = b.imm ? imm_byte(b, k) : 0;
+            if ((ins->op == I_AND && v == 0xFF) || (ins->op != I_AND && v == 0)) {
+                copy_byte(e, a, k, d, k);
+                continue;
+            }
+            if ((ins->op == I_AND && v == 0) || (ins->op == I_OR && v == 0xFF)) {
+                op_imm(e, "LDA", v);
+                op_byte(e, "STA", d, k);
+                continue;
+            }
+        }
+        op_byte(e, "LDA", a, k);
+        op_byte(e, mnemonics[ins->op], b, k);
+        op_byte(e, "STA", d, k);
+    }
+    zero_fill(e, d, n);
+}
+
+static void gen_shift_left(emit_t *e, loc_t d, loc_t a, int count, int n) {
+    if (count >= 8 * n) {
+        zero_fill(e, d, 0);
+        return;
+    }
+    if (n == 1) {
+        op_byte(e, "LDA", a, 0);
+        for (int i = 0; i < count; i++) op(e, "ASL", NULL);
+        op_byte(e, "STA", d, 0);
+    } else if (count >= 8) {
+        op_byte(e, "LDA", a, 0);
+        for (int i = 8; i < count; i++) op(e, "ASL", NULL);
+        op_byte(e, "STA", d, 1);
+        op(e, "LDA", "#$00");
+        op_byte(e, "STA", d, 0);
+    } else {
+        // High byte in A
+        copy_byte(e, a, 0, d, 0);
+        op_byte(e, "LDA", a, 1);
+        for (int i = 0; i < count; i++) {
+            op_byte(e, "ASL", d, 0);
+            op(e, "ROL", NULL);
+        }
+        op_byte(e, "STA", d, 1);
+    }
+    zero_fill(e, d, n);
+}
+
+// Logical for bytes, arithmetic for ints: CMP #$80 copies the sign to
+// the carry, which ROR shifts back in, and the bit shifted into bit 0 of
+// an int is cleared
+static void gen_shift_right(emit_t *e, loc_t d, loc_t a, int count, int width) {
+    if (width == 1) {
+        if (count >= 8) {
+            op(e, "LDA", "#$00");
+        } else {
+            op_byte(e, "LDA", a, 0);
+            for (int i = 0; i < count; i++) op(e, "LSR", NULL);
+        }
+        op_byte(e, "STA", d, 0);
+        zero_fill(e, d, 1);
+        return;
+    }
+    if (count > 15) count = 15;
+    loc_t lo = d.width >= 2 ? d : at(RT_T, 1);
+    if (count >= 8) {
+        op_byte(e, "LDA", a, 1);
+        op_byte(e, "STA", lo, 0);
+        op(e, "ASL", NULL);
+        op(e, "LDA", "#$00");
+        op(e, "ADC", "#$FF");
+        op(e, "EOR", "#$FF");
+        count -= 8;
+    } else {
+        copy_byte(e, a, 0, lo, 0);
+        op_byte(e, "LDA", a, 1);
+    }
+    for (int i = 0; i < count; i++) {
+        op(e, "CMP", "#$80");
+        op(e, "ROR", NULL);
+        op_byte(e, "ROR", lo, 0);
+    }
+    if (d.width >= 2) {
+        op_byte(e, "STA", d, 1);
+        op_byte(e, "LDA", d, 0);
+        op(e, "AND", "#$FE");
+        op_byte(e, "STA", d, 0);
+    } else {
+        op_addr(e, "LDA", RT_T);
+        op(e, "AND", "#$FE");
+        op_byte(e, "STA", d, 0);
+    }
+}
+
+static void store_result(emit_t *e, loc_t d, int n) {
+    op_byte(e, "STA", d, 0);
+    if (n == 2) op_byte(e, "STX", d, 1);
+    zero_fill(e, d, n);
+}
+
+// Operands of the runtime routines in RT_A and RT_B
+static void runtime_call(emit_t *e, loc_t a, loc_t b, const char *routine) {
+    copy(e, a, at(RT_A, 2), 2);
+    copy(e, b, at(RT_B, 2), 2);
+    op(e, "JSR", routine);
+}
+
+// 2a * 2b is twice too big, so rt_mul_int halves the multiplier first; a
+// constant one is passed as it is
+static void gen_multiply(emit_t *e, const ir_instr_t *ins) {
+    loc_t d = loc(e, ins->dst), b = loc(e, ins->b);
+    const char *routine = "rt_mul";
+    if (ins->width == 2 && b.imm) b.value = ins->b.value;
+    else if (ins->width == 2) routine = "rt_mul_int";
+    runtime_call(e, loc(e, ins->a), b, routine);
+    store_result(e, d, min(ins->width, d.width));
+}
+
+// 2a / 2b is a / b, which is doubled back; 2a mod 2b is already 2(a mod b)
+static void gen_divide(emit_t *e, const ir_instr_t *ins) {
+    loc_t d = loc(e, ins->dst);
+    int n = min(ins->width, d.width);
+    runtime_call(e, loc(e, ins->a), loc(e, ins->b), "rt_div");
+    if (ins->op == I_MOD) {
+        copy(e, at(RT_R, 2), d, n);
+        return;
+    }
+    if (n == 2) {
+        op_byte(e, "STX", d, 1);
+        op(e, "ASL", NULL);
+        op_byte(e, "STA", d, 0);
+        op_byte(e, "ROL", d, 1);
+        return;
+    }
+    store_result(e, d, n);
+}
+
+static void op_indexed(emit_t *e, const char *mnemonic, int address) {
+    char buf[MAX_OPERAND];
+    snprintf(buf, sizeof(buf), address < 0x100 ? "$%02X,X" : "$%04X,X", address);
+    op(e, mnemonic, buf);
+}
+
+// Constant addresses are plain addresses, not ints
+static void gen_load(emit_t *e, const ir_instr_t *ins) {
+    loc_t d = loc(e, ins->dst), a = loc(e, ins->a);
+    int n = min(ins->width, d.width);
+    if (ins->index.kind != OPND_NONE) {
+        op_byte(e, "LDX", loc(e, ins->index), 0);
+        for (int k = 0; k < n; k++) {
+            op_indexed(e, "LDA", (ins->a.value + k) & 0xFFFF);
+            op_byte(e, "STA", d, k);
+        }
+        zero_fill(e, d, n);
+        return;
+    }
+    if (a.imm) {
+        copy(e, at(ins->a.value & 0xFFFF, n), d, n);
+        return;
+    }
+    int p = pointer(e, a);
+    if (n == 2) {
+        op_imm(e, "LDY", 1);
+        op_indirect(e, "LDA", p);
+        op(e, "TAX", NULL);
+        op(e, "DEY", NULL);
+        op_indirect(e, "LDA", p);
+        store_result(e, d, 2);
+        return;
+    }
+    op_imm(e, "LDY", 0);
+    op_indirect(e, "LDA", p);
+    op_byte(e, "STA", d, 0);
+    zero_fill(e, d, 1);
+}
+
+static void gen_store(emit_t *e, const ir_instr_t *ins) {
+    loc_t a = loc(e, ins->a), b = loc(e, ins->b);
+    if (ins->index.kind != OPND_NONE) {
+        op_byte(e, "LDX", loc(e, ins->index), 0);
+        for (int k = 0; k < ins->width; k++) {
+            op_byte(e, "LDA", b, k);
+            op_indexed(e, "STA", (ins->a.value + k) & 0xFFFF);
+        }
+        return;
+    }
+    if (a.imm) {
+        for (int k = 0; k < ins->width; k++) copy_byte(e, b, k, at((ins->a.value & 0xFFFF) + k, 1), 0);
+        return;
+    }
+    int p = pointer(e, a);
+    op_imm(e, "LDY", 0);
+    op_byte(e, "LDA", b, 0);
+    op_indirect(e, "STA", p);
+    if (ins->width == 2) {
+        op(e, "INY", NULL);
+        op_byte(e, "LDA", b, 1);
+        op_indirect(e, "STA", p);
+    }
+}
+
+// Byte k of the car or cdr of the cell in X
+static void op_field(emit_t *e, const char *mnemonic, const char *field, int k) {
+    char buf[MAX_OPERAND];
+    snprintf(buf, sizeof(buf), "%s_%s,X", field, k ? "HI" : "LO");
+    op(e, mnemonic, buf);
+}
+
+// A reference's high byte is the cell index
+static void gen_access(emit_t *e, const ir_instr_t *ins, const char *field) {
+    loc_t d = loc(e, ins->dst);
+    op_byte(e, "LDX", loc(e, ins->a), 1);
+    for (int k = 0; k < min(d.width, 2); k++) {
+        op_field(e, "LDA", field, k);
+        op_byte(e, "STA", d, k);
+    }
+}
+
+static void gen_mutate(emit_t *e, const ir_instr_t *ins, const char *field) {
+    loc_t b = loc(e, ins->b);
+    op_byte(e, "LDX", loc(e, ins->a), 1);
+    for (int k = 0; k < 2; k++) {
+        op_byte(e, "LDA", b, k);
+        op_field(e, "STA", field, k);
+    }
+}
+
+// Bytes of a and b that decide equality; constant pairs are skipped
+static int equal_bytes(loc_t a, loc_t b, int width, int *bytes) {
+    int n = 0;
+    for (int k = 0; k < width; k++) {
+        if (is_imm(a, k) && is_imm(b, k)) continue;
+        if (!is_imm(a, k) && !is_imm(b, k) && a.value + k == b.value + k) continue;
+        bytes[n++] = k;
+    }
+    return n;
+}
+
+static void gen_branch(emit_t *e, const ir_instr_t *ins) {
+    loc_t a = loc(e, ins->a), b = loc(e, ins->b);
+    int w = ins->width;
+
+    if (ins->cond == COND_EQ || ins->cond == COND_NE) {
+        int eq = ins->cond == COND_EQ;
+        if (a.imm) {
+            loc_t t = a;
+            a = b;
+            b = t;
+        }
+        if (b.imm && (b.value & 0xFFFF) == 0) {
+            op_byte(e, "LDA", a, 0);
+            if (w == 2 && a.width == 2) op_byte(e, "ORA", a, 1);
+            op_label(e, eq ? "BEQ" : "BNE", ins->label);
+            return;
+        }
+        int bytes[2], n = equal_bytes(a, b, w, bytes);
+        if (n == 0) {
+            if (eq) op_label(e, "JMP", ins->label);
+            return;
+        }
+        int skip = e->next_label++;
+        for (int i = 0; i < n; i++) {
+            int last = i == n - 1;
+            op_byte(e, "LDA", a, bytes[i]);
+            op_byte(e, "CMP", b, bytes[i]);
+            if (!eq) op_label(e, "BNE", ins->label);
+            else op_label(e, last ? "BEQ" : "BNE", last ? ins->label : skip);
+        }
+        if (eq && n > 1) label(e, skip);
+        return;
+    }
+
+    int lt = ins->cond == COND_LT;
+    if (b.imm && (b.value & 0xFFFF) == 0 && !a.imm) {
+        // Bytes are never negative
+        if (w == 1 || a.width == 1) {
+            if (!lt) op_label(e, "JMP", ins->label);
+            return;
+        }
+        op_byte(e, "LDA", a, 1);
+        op_label(e, lt ? "BMI" : "BPL", ins->label);
+        return;
+    }
+    if (w == 1) {
+        op_byte(e, "LDA", a, 0);
+        op_byte(e, "CMP", b, 0);
+        op_label(e, lt ? "BCC" : "BCS", ins->label);
+        return;
+    }
+    // Signed: N of the subtraction, corrected when it overflowed
+    int skip = e->next_label++;
+    op_byte(e, "LDA", a, 0);
+    op_byte(e, "CMP", b, 0);
+    op_byte(e, "LDA", a, 1);
+    op_byte(e, "SBC", b, 1);
+    op_label(e, "BVC", skip);
+    op(e, "EOR", "#$80");
+    label(e, skip);
+    op_label(e, lt ? "BMI" : "BPL", ins->label);
+}
+
+// Ints the collector may move go on the root stack before a cons or a
+// call that may collect
+static void push_roots(emit_t *e, const ir_instr_t *ins) {
+    if (!ins->root_count) return;
+    op_addr(e, "LDX", RT_RSP);
+    for (int r = 0; r < ins->root_count; r++) {
+        const vreg_t *v = &e->fn->vregs[ins->roots[r]];
+        op_addr(e, "LDA", v->location);
+        op(e, "STA", "RT_ROOTS_LO,X");
+        op_addr(e, "LDA", v->location + 1);
+        op(e, "STA", "RT_ROOTS_HI,X");
+        op(e, "INX", NULL);
+    }
+    op_addr(e, "STX", RT_RSP);
+}
+
+// and come back as it left them. It only ever changes the high byte of a
+// reference, so the low byte is reloaded only where the callee may have
+// written it.
+static void pop_roots(emit_t *e, const ir_instr_t *ins) {
+    const unsigned char *clobber = ins->op == I_CALL ? e->prog->funcs[ins->func].clobber : NULL;
+    if (!ins->root_count) return;
+    op_addr(e, "LDX", RT_RSP);
+    for (int r = ins->root_count - 1; r >= 0; r--) {
+        const vreg_t *v = &e->fn->vregs[ins->roots[r]];
+        int lo = v->location;
+        op(e, "DEX", NULL);
+        if (clobber && (lo >= ADDR_LIMIT || ((clobber[lo / 8] >> (lo % 8)) & 1))) {
+            op(e, "LDA", "RT_ROOTS_LO,X");
+            op_addr(e, "STA", lo);
+        }
+        op(e, "LDA", "RT_ROOTS_HI,X");
+        op_addr(e, "STA", lo + 1);
+    }
+    op_addr(e, "STX", RT_RSP);
+}
+
+// Values the callee may change are pushed around the JSR
+static void gen_call(emit_t *e, const ir_instr_t *ins) {
+    const ir_func_t *callee = &e->prog->funcs[ins->func];
+    push_roots(e, ins);
+    for (int s = 0; s < ins->save_count; s++) {
+        const vreg_t *v = &e->fn->vregs[ins->saves[s]];
+        for (int k = 0; k < v->width; k++) {
+            op_addr(e, "LDA", v->location + k);
+            op(e, "PHA", NULL);
+        }
+    }
+    pass_args(e, ins);
+    op(e, "JSR", callee->label);
+    if (ins->dst.kind == OPND_VREG) {
+        loc_t d = loc(e, ins->dst);
+        store_result(e, d, d.width);
+    }
+    for (int s = ins->save_count - 1; s >= 0; s--) {
+        const vreg_t *v = &e->fn->vregs[ins->saves[s]];
+        for (int k = v->width - 1; k >= 0; k--) {
+            op(e, "PLA", NULL);
+            op_addr(e, "STA", v->location + k);
+        }
+    }
+    pop_roots(e, ins);
+}
+
+// Whether prev left the int in o in A and X
+static int in_ax(const emit_t *e, const ir_instr_t *prev, opnd_t o) {
+    if (!prev || o.kind != OPND_VREG || prev->dst.kind != OPND_VREG || prev->dst.value != o.value ||
+        e->fn->vregs[o.value].width != 2) return 0;
+    switch (prev->op) {
+        case I_CALL: return prev->save_count == 0 && prev->root_count == 0;
+        case I_MUL: return prev->width == 2;
+        case I_CONS: return prev->root_count == 0;
+        default: return 0;
+    }
+}
+
+static void gen_return(emit_t *e, const ir_instr_t *ins, const ir_instr_t *prev) {
+    loc_t a = loc(e, ins->a);
+    if (!in_ax(e, prev, ins->a)) {
+        op_byte(e, "LDA", a, 0);
+        op_byte(e, "LDX", a, 1);
+    }
+    op(e, "RTS", NULL);
+}
+
+static void gen_instr(emit_t *e, const ir_instr_t *ins, const ir_instr_t *prev) {
+    loc_t d = loc(e, ins->dst), a = loc(e, ins->a);
+    switch (ins->op) {
+        case I_MOVE:
+            gen_move(e, a, d);
+            break;
+        case I_ADD:
+        case I_SUB:
+        case I_AND:
+        case I_OR:
+        case I_XOR:
+            gen_arith(e, ins);
+            break;
+        case I_SHL:
+            gen_shift_left(e, d, a, ins->b.value, min(ins->width, d.width));
+            break;
+        case I_SHR:
+            gen_shift_right(e, d, a, ins->b.value, ins->width);
+            break;
+        case I_MUL:
+            gen_multiply(e, ins);
+            break;
+        case I_DIV:
+        case I_MOD:
+            gen_divide(e, ins);
+            break;
+        case I_HI:
+            // Bits 8-15 of n are bits 9-15 of 2n and the sign
+            op_byte(e, "LDA", a, 1);
+            op(e, "CMP", "#$80");
+            op(e, "ROR", NULL);
+            op_byte(e, "STA", d, 0);
+            zero_fill(e, d, 1);
+            break;
+        case I_LOAD:
+            gen_load(e, ins);
+            break;
+        case I_STORE:
+            gen_store(e, ins);
+            break;
+        case I_CONS:
+            push_roots(e, ins);
+            runtime_call(e, a, loc(e, ins->b), "rt_cons");
+            store_result(e, d, d.width);
+            pop_roots(e, ins);
+            break;
+        case I_CAR:
+        case I_CDR:
+            gen_access(e, ins, ins->op == I_CAR ? "RT_CAR" : "RT_CDR");
+            break;
+        case I_SETCAR:
+        case I_SETCDR:
+            gen_mutate(e, ins, ins->op == I_SETCAR ? "RT_CAR" : "RT_CDR");
+            break;
+        case I_LABEL:
+            label(e, ins->label);
+            break;
+        case I_JUMP:
+            op_label(e, "JMP", ins->label);
+            break;
+        case I_BRANCH:
+            gen_branch(e, ins);
+            break;
+        case I_CALL:
+            gen_call(e, ins);
+            break;
+        case I_TAILCALL: {
+            // Past the stack check: a tail call does not grow the stack
+            char target[MAX_LABEL];
+            snprintf(target, sizeof(target), e->guard[ins->func] ? "%s_body" : "%s",
+                     e->prog->funcs[ins->func].label);
+            pass_args(e, ins);
+            op(e, "JMP", target);
+            break;
+        }
+        case I_PMOVE:
+            gen_pmove(e, ins);
+            break;
+        case I_RET:
+            gen_return(e, ins, prev);
+            break;
+    }
+}
+
+// Where the named values ended up, as a comment above the function
+static void describe(emit_t *e, const ir_func_t *fn) {
+    fprintf(e->out, "\n; %s", fn->name ? fn->name : "top level");
+    for (int v = 0; v < fn->vreg_count; v++) {
+        const vreg_t *r = &fn->vregs[v];
+        if (!r->name || r->location < 0) continue;
+        fprintf(e->out, r->location < 0x100 ? ", %s $%02X" : ", %s $%04X", r->name, r->location);
+    }
+    fputc('\n', e->out);
+}
+
+// RT_A * RT_B to A and X: shift and add until the multiplier runs out.
+// rt_mul_int takes two ints, the multiplier halved first.
+static void emit_mul(emit_t *e) {
+    named_label(e, "rt_mul_int");
+    op_addr(e, "LSR", RT_B + 1);
+    op_addr(e, "ROR", RT_B);
+    named_label(e, "rt_mul");
+    op(e, "LDA", "#$00");
+    op_addr(e, "STA", RT_R);
+    op_addr(e, "STA", RT_R + 1);
+    named_label(e, ".loop");
+    op_addr(e, "LDA", RT_B);
+    op_addr(e, "ORA", RT_B + 1);
+    op(e, "BEQ", ".done");
+    op_addr(e, "LSR", RT_B + 1);
+    op_addr(e, "ROR", RT_B);
+    op(e, "BCC", ".next");
+    op(e, "CLC", NULL);
+    op_addr(e, "LDA", RT_R);
+    op_addr(e, "ADC", RT_A);
+    op_addr(e, "STA", RT_R);
+    op_addr(e, "LDA", RT_R + 1);
+    op_addr(e, "ADC", RT_A + 1);
+    op_addr(e, "STA", RT_R + 1);
+    named_label(e, ".next");
+    op_addr(e, "ASL", RT_A);
+    op_addr(e, "ROL", RT_A + 1);
+    op(e, "JMP", ".loop");
+    named_label(e, ".done");
+    op_addr(e, "LDA", RT_R);
+    op_addr(e, "LDX", RT_R + 1);
+    op(e, "RTS", NULL);
+}
+
+static void emit_negate(emit_t *e, int address) {
+    op(e, "SEC", NULL);
+    op(e, "LDA", "#$00");
+    op_addr(e, "SBC", address);
+    op_addr(e, "STA", address);
+    op(e, "LDA", "#$00");
+    op_addr(e, "SBC", address + 1);
+    op_addr(e, "STA", address + 1);
+}
+
+// RT_A / RT_B to A and X, truncating; the remainder, with the sign of
+// the dividend, in RT_R
+static void emit_div(emit_t *e) {
+    named_label(e, "rt_div");
+    op_addr(e, "LDA", RT_A + 1);
+    op_addr(e, "STA", RT_RSIGN);
+    op_addr(e, "EOR", RT_B + 1);
+    op_addr(e, "STA", RT_QSIGN);
+    op_addr(e, "LDA", RT_A + 1);
+    op(e, "BPL", ".apos");
+    emit_negate(e, RT_A);
+    named_label(e, ".apos");
+    op_addr(e, "LDA", RT_B + 1);
+    op(e, "BPL", ".bpos");
+    emit_negate(e, RT_B);
+    named_label(e, ".bpos");
+    op(e, "LDA", "#$00");
+    op_addr(e, "STA", RT_R);
+    op_addr(e, "STA", RT_R + 1);
+    op(e, "LDX", "#$10");
+    named_label(e, ".loop");
+    op_addr(e, "ASL", RT_A);
+    op_addr(e, "ROL", RT_A + 1);
+    op_addr(e, "ROL", RT_R);
+    op_addr(e, "ROL", RT_R + 1);
+    op(e, "SEC", NULL);
+    op_addr(e, "LDA", RT_R);
+    op_addr(e, "SBC", RT_B);
+    op(e, "TAY", NULL);
+    op_addr(e, "LDA", RT_R + 1);
+    op_addr(e, "SBC", RT_B + 1);
+    op(e, "BCC", ".next");
+    op_addr(e, "STA", RT_R + 1);
+    op_addr(e, "STY", RT_R);
+    op_addr(e, "INC", RT_A);
+    named_label(e, ".next");
+    op(e, "DEX", NULL);
+    op(e, "BNE", ".loop");
+    op_addr(e, "LDA", RT_RSIGN);
+    op(e, "BPL", ".rpos");
+    emit_negate(e, RT_R);
+    named_label(e, ".rpos");
+    op_addr(e, "LDA", RT_QSIGN);
+    op(e, "BPL", ".qpos");
+    emit_negate(e, RT_A);
+    named_label(e, ".qpos");
+    op_addr(e, "LDA", RT_A);
+    op_addr(e, "LDX", RT_A + 1);
+    op(e, "RTS", NULL);
+}
+
+// Stack bytes function f may push below its entry, up to the entry check
+// of the next guarded function it calls, given the same for every other
+// function. Parallel moves are counted at their worst everywhere. Tail
+// calls carry on from the entry level into the callee's body.
+static int stack_need(const ir_program_t *prog, const int *guarded, const int *need, int f) {
+    const ir_func_t *fn = &prog->funcs[f];
+    int bytes = 2 * MAX_PARAMS;
+    for (int p = 0; p < fn->count; p++) {
+        const ir_instr_t *ins = &fn->code[p];
+        int n = 0;
+        if (ins->op == I_CALL) {
+            for (int s = 0; s < ins->save_count; s++) n += fn->vregs[ins->saves[s]].width;
+            n += 2 * MAX_PARAMS + 2 + (guarded[ins->func] ? 0 : need[ins->func]);
+        } else if (ins->op == I_TAILCALL) {
+            n = need[ins->func];
+        } else if (ins->op == I_CONS || ins->op == I_MUL || ins->op == I_DIV || ins->op == I_MOD) {
+            n = RUNTIME_STACK;
+        }
+        if (n > bytes) bytes = n;
+    }
+    return bytes < 0x100 ? bytes : 0x100;
+}
+
+// Recursion through calls that are not tail calls grows the hardware
+// stack without bound, so every function such a call enters checks at its
+// entry that the stack still has room for what it pushes before the next
+// check, and stops at BRK when not. Returns the bytes per function, 0 for
+// functions left unchecked, or NULL when out of memory.
+static int* stack_guards(const ir_program_t *prog) {
+    int *guard = calloc(prog->func_count, sizeof(int));
+    int *need = calloc(prog->func_count, sizeof(int));
+    if (!guard || !need) {
+        free(guard);
+        free(need);
+        return NULL;
+    }
+    for (int f = 0; f < prog->func_count; f++) {
+        const ir_func_t *fn = &prog->funcs[f];
+        for (int p = 0; p < fn->count; p++) {
+            const ir_instr_t *ins = &fn->code[p];
+            if (ins->op == I_CALL && prog->funcs[ins->func].scc == fn->scc) guard[ins->func] = 1;
+        }
+    }
+
+    // Unchecked calls cannot form a cycle, and a cycle of tail calls only
+    // spreads its largest need, so this settles
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int f = 0; f < prog->func_count; f++) {
+            int bytes = stack_need(prog, guard, need, f);
+            if (bytes > need[f]) need[f] = bytes, changed = 1;
+        }
+    }
+    for (int f = 0; f < prog->func_count; f++) {
+        if (guard[f]) guard[f] = need[f] < 0xFF ? need[f] : 0xFF;
+    }
+    free(need);
+    return guard;
+}
+
+// The check for a guarded function; its BRK sits just above the entry so
+// the branch to it is short and not taken
+static void stack_check(emit_t *e, const ir_func_t *fn, int bytes) {
+    char name[MAX_LABEL];
+    snprintf(name, sizeof(name), "%s_overflow", fn->label);
+    named_label(e, name);
+    op(e, "BRK", NULL);
+    named_label(e, fn->label);
+    op(e, "TSX", NULL);
+    op_imm(e, "CPX", bytes);
+    op(e, "BCC", name);
+    snprintf(name, sizeof(name), "%s_body", fn->label);
+    named_label(e, name);
+}
+
+int emit_program(const ir_program_t *prog, FILE *out) {
+    emit_t e;
+    memset(&e, 0, sizeof(e));
+    e.prog = prog;
+    e.out = out;
+    int *guard = stack_guards(prog);
+    if (!guard) return 1;
+    e.guard = guard;
+
+    fprintf(out, "; 6502lisp output: call main, the value comes back in A (low) and X (high), an int doubled\n");
+    fprintf(out, "        .ORG $%04X\n", CODE_ORG);
+    for (int f = 0; f < prog->func_count; f++) {
+        const ir_func_t *fn = &prog->funcs[f];
+        e.fn = fn;
+        e.next_label = fn->label_count;
+        describe(&e, fn);
+        if (guard[f]) stack_check(&e, fn, guard[f]);
+        else named_label(&e, fn->label);
+        if (f == 0 && prog->uses_cons) op(&e, "JSR", "rt_init");
+        for (int p = 0; p < fn->count; p++) gen_instr(&e, &fn->code[p], p > 0 ? &fn->code[p - 1] : NULL);
+    }
+
+    fprintf(out, "\n; runtime\n");
+    if (prog->uses_mul) emit_mul(&e);
+    if (prog->uses_div) emit_div(&e);
+    if (prog->uses_cons) {
+        // The collector's roots include every global
+        fprintf(out, "\nRT_GLOBAL_WORDS = %d\n", prog->global_count);
+        fputs(runtime_heap, out);
+    }
+    free(guard);
+    return ferror(out) ? 1 : 0;
+}
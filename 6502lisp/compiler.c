@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <string.h>
+#include "compiler.h"
+#include "ir.h"
+
+void compile_default_options(compile_options_t *options) {
+    options->zero_page = 1;
+    options->tail_calls = 1;
+}
+
+int compile_lisp(const char *name, const char *text, FILE *out, const compile_options_t *options) {
+    node_t *forms = read_program(name, text);
+    if (!forms) return 1;
+
+    ir_program_t prog;
+    memset(&prog, 0, sizeof(prog));
+    if (options) prog.options = *options;
+    else compile_default_options(&prog.options);
+
+    int errors = lower_program(&prog, forms);
+    if (!errors) errors = allocate_registers(&prog);
+    if (!errors) errors = emit_program(&prog, out);
+
+    free_program(&prog);
+    node_free(forms);
+    return errors;
+}
@@ -0,0 +1,19 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stdio.h>
+
+// Code generation choices, so the benchmarks can compare them
+typedef struct {
+    int zero_page;          // values in zero page; otherwise all in absolute memory
+    int tail_calls;         // calls in tail position become JMP
+} compile_options_t;
+
+void compile_default_options(compile_options_t *options);
+
+// Lisp source to 6502as source: main at $0800 returns the value of the last
+// top level form in A (low) and X (high). Returns the number of errors,
+// which are printed to stderr; name is used in parse errors.
+int compile_lisp(const char *name, const char *text, FILE *out, const compile_options_t *options);
+
+#endif
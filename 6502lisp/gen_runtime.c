@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+// Build time generator for runtime.h: the assembler source of the runtime
+// library as a string, which the compiler appends to programs that cons
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s runtime.s\n", argv[0]);
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (!in) {
+        fprintf(stderr, "ERROR - cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    printf("// Generated by gen_runtime from %s; do not edit\n", argv[1]);
+    printf("static const char runtime_heap[] =\n    \"");
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        if (c == '\n') {
+            printf("\\n\"\n    \"");
+            continue;
+        }
+        if (c == '"' || c == '\\') putchar('\\');
+        if (c == '\t') printf("\\t");
+        else putchar(c);
+    }
+    printf("\";\n");
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+#include "compiler.h"
+#include "sexpr.h"
+
+// Zero page map. The runtime scratch bytes and the argument slots are
+// fixed; everything from ZP_POOL up is handed out by the allocator.
+#define RT_A        0x02    // runtime operands and results
+#define RT_B        0x04
+#define RT_R        0x06    // remainder of division
+#define RT_P        0x08    // pointer for indirect loads and stores
+#define RT_HP       0x0A    // next free cell
+#define RT_RSP      0x0B    // root stack depth
+#define RT_T        0x0C    // parallel move scratch
+#define RT_QSIGN    0x0D    // division signs
+#define RT_RSIGN    0x0E
+#define RT_EPOCH    0x0F    // collector mark, kept between collections
+#define ARG_BASE    0x10    // argument i in ARG_BASE + 2 * i
+#define MAX_PARAMS  8
+#define ZP_POOL     0x20
+#define ZP_END      0x100
+
+// Globals and the slots of values that do not fit in zero page live in
+// absolute memory below the code; the cells and the root stack of the
+// runtime in runtime/heap.s above it
+#define SLOW_BASE   0x0200
+#define SLOW_END    0x0800
+#define CODE_ORG    0x0800
+#define ADDR_LIMIT  SLOW_END
+
+// Calls that are not tail calls use the 256 byte hardware stack: 2 bytes
+// of return address plus the values saved around the call, so recursion
+// that is not in tail position goes a few dozen levels deep. Functions entered
+// that way from their own call graph cycle check the stack pointer at
+// entry and stop at BRK (at <label>_overflow) before it can wrap. Tail
+// calls jump past the check and use no stack.
+
+typedef enum {
+    OPND_NONE,
+    OPND_VREG,
+    OPND_CONST,
+    OPND_MEM        // fixed address: globals and argument slots
+} opnd_kind_t;
+
+// Ints are 15 bit, held doubled so that bit 0 tells them from references
+// to cells (runtime/heap.s); constants are the numbers themselves, and the
+// code generator doubles them
+typedef struct {
+    opnd_kind_t kind;
+    int width;      // 1 for bytes, 2 for ints
+    int value;      // vreg index, constant or address
+} opnd_t;
+
+typedef enum {
+    I_MOVE,         // dst = a, converted to the width of dst
+    I_ADD,          // dst = a op b at the instruction width
+    I_SUB,
+    I_AND,
+    I_OR,
+    I_XOR,
+    I_SHL,          // dst = a shifted by the constant b
+    I_SHR,          // arithmetic for ints, logical for bytes
+    I_MUL,          // runtime routines
+    I_DIV,
+    I_MOD,
+    I_HI,           // dst = high byte of the int a
+    I_LOAD,         // dst = byte or int at address a, plus index
+    I_STORE,        // store b at address a plus index
+    I_CONS,
+    I_CAR,
+    I_CDR,
+    I_SETCAR,
+    I_SETCDR,
+    I_LABEL,
+    I_JUMP,
+    I_BRANCH,       // to label if a cond b
+    I_CALL,         // dst = func(args)
+    I_TAILCALL,     // JMP to func with args
+    I_PMOVE,        // dsts = args, all at once
+    I_RET
+} ir_op_t;
+
+typedef enum {
+    COND_EQ,
+    COND_NE,
+    COND_LT,        // signed for ints, unsigned for bytes
+    COND_GE
+} ir_cond_t;
+
+typedef struct {
+    ir_op_t op;
+    int width;              // operation width, 1 or 2
+    ir_cond_t cond;
+    int label;
+    int func;
+    opnd_t dst, a, b;
+    opnd_t index;           // loads and stores: byte added to the constant a, in X
+    opnd_t *args;           // call arguments, parallel move sources
+    opnd_t *dsts;           // parallel move destinations
+    int arg_count;
+    int *saves;             // calls: vregs pushed around the JSR
+    int save_count;
+    int *roots;             // calls that may collect and conses: ints kept
+    int root_count;         // on the root stack, where the collector fixes them
+    int line;
+} ir_instr_t;
+
+typedef struct {
+    int width;
+    const char *name;       // variable name, NULL for temporaries
+    int param;              // parameter index, or -1
+    int start, end;         // live interval in instruction positions
+    double weight;          // uses and definitions, by loop depth
+    int crosses_call;       // live after some call
+    int may_ref;            // may hold a reference to a cell
+    int location;           // address of the low byte, -1 if unallocated
+} vreg_t;
+
+typedef struct {
+    char *name;             // NULL for the top level code
+    char label[64];
+    int line;
+    const node_t *params;   // (name param ...)
+    const node_t **body;
+    int body_count;
+    int param_count;
+    int param_width[MAX_PARAMS];
+    ir_instr_t *code;
+    int count;
+    int cap;
+    vreg_t *vregs;
+    int vreg_count;
+    int vreg_cap;
+    int label_count;
+    int scc;                // strongly connected component of the call graph
+    int may_gc;             // conses, or calls something that does
+    unsigned char *clobber; // bitmap over ADDR_LIMIT: bytes a call may change
+    int zp_bytes;           // zero page and absolute bytes used by its values
+    int slow_bytes;
+} ir_func_t;
+
+typedef struct {
+    char *name;
+    int address;
+} ir_global_t;
+
+typedef struct {
+    ir_func_t *funcs;       // funcs[0] is the top level code
+    int func_count;
+    ir_global_t *globals;
+    int global_count;
+    int slow_base;          // first absolute address after the globals
+    int uses_cons;
+    int uses_mul;
+    int uses_div;
+    compile_options_t options;
+    int errors;
+} ir_program_t;
+
+int lower_program(ir_program_t *prog, const node_t *forms);
+void free_program(ir_program_t *prog);
+
+int allocate_registers(ir_program_t *prog);
+int emit_program(const ir_program_t *prog, FILE *out);
+
+#endif
@@ -0,0 +1,1150 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+// Lisp forms to IR over virtual registers. Every value is an int (15 bit,
+// signed, in 16 bits with the tag of runtime/heap.s) or a byte (8 bit,
+// unsigned); operations take the widest operand width, so arithmetic on
+// bytes wraps at 8 bits, and operands are converted to it. Constants stay
+// plain numbers here. Conditions compile to branches, never to booleans.
+
+typedef struct {
+    const char *name;
+    int vreg;
+} binding_t;
+
+typedef struct {
+    ir_program_t *prog;
+    ir_func_t *fn;
+    int func;
+    binding_t *env;         // innermost binding last
+    int env_count;
+    int env_cap;
+    int body_label;         // self tail calls jump here, past the entry moves
+} lower_t;
+
+typedef enum {
+    PRIM_ARITH,             // n-ary + - * / mod logand logior logxor
+    PRIM_COMPARE,
+    PRIM_TEST,              // zero? null? not
+    PRIM_UNARY,             // lo hi lognot
+    PRIM_ASH,
+    PRIM_LOAD,
+    PRIM_STORE,
+    PRIM_CONS,
+    PRIM_ACCESS,            // car cdr
+    PRIM_MUTATE             // set-car! set-cdr!
+} prim_kind_t;
+
+typedef struct {
+    const char *name;
+    prim_kind_t kind;
+    ir_op_t op;
+    int width;              // loads and stores
+} prim_t;
+
+static const prim_t prims[] = {
+    { "+", PRIM_ARITH, I_ADD, 0 },          { "-", PRIM_ARITH, I_SUB, 0 },
+    { "*", PRIM_ARITH, I_MUL, 0 },          { "/", PRIM_ARITH, I_DIV, 0 },
+    { "mod", PRIM_ARITH, I_MOD, 0 },        { "logand", PRIM_ARITH, I_AND, 0 },
+    { "logior", PRIM_ARITH, I_OR, 0 },      { "logxor", PRIM_ARITH, I_XOR, 0 },
+    { "=", PRIM_COMPARE, I_BRANCH, 0 },     { "/=", PRIM_COMPARE, I_BRANCH, 0 },
+    { "<", PRIM_COMPARE, I_BRANCH, 0 },     { ">", PRIM_COMPARE, I_BRANCH, 0 },
+    { "<=", PRIM_COMPARE, I_BRANCH, 0 },    { ">=", PRIM_COMPARE, I_BRANCH, 0 },
+    { "zero?", PRIM_TEST, I_BRANCH, 0 },    { "null?", PRIM_TEST, I_BRANCH, 0 },
+    { "not", PRIM_TEST, I_BRANCH, 0 },      { "lo", PRIM_UNARY, I_MOVE, 1 },
+    { "hi", PRIM_UNARY, I_HI, 1 },          { "lognot", PRIM_UNARY, I_XOR, 0 },
+    { "ash", PRIM_ASH, I_SHL, 0 },          { "peek", PRIM_LOAD, I_LOAD, 1 },
+    { "peekw", PRIM_LOAD, I_LOAD, 2 },      { "poke", PRIM_STORE, I_STORE, 1 },
+    { "pokew", PRIM_STORE, I_STORE, 2 },    { "cons", PRIM_CONS, I_CONS, 2 },
+    { "car", PRIM_ACCESS, I_CAR, 2 },       { "cdr", PRIM_ACCESS, I_CDR, 2 },
+    { "set-car!", PRIM_MUTATE, I_SETCAR, 2 }, { "set-cdr!", PRIM_MUTATE, I_SETCDR, 2 }
+};
+
+static const char *special_forms[] = {
+    "quote", "if", "cond", "when", "unless", "begin", "let", "let*", "set!", "while", "and", "or",
+    "declare", "define"
+};
+
+static opnd_t lower(lower_t *lw, const node_t *node, const opnd_t *target, int tail);
+static void lower_cond(lower_t *lw, const node_t *node, int label, int when);
+
+static const opnd_t no_opnd = { OPND_NONE, 0, 0 };
+
+static void error(lower_t *lw, const node_t *node, const char *fmt, ...) {
+    va_list ap;
+    fprintf(stderr, "ERROR - line %d: ", node->line);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    lw->prog->errors++;
+}
+
+static void out_of_memory(lower_t *lw) {
+    if (lw->prog->errors++ == 0) fprintf(stderr, "ERROR - out of memory\n");
+}
+
+static const prim_t* find_prim(const char *name) {
+    for (size_t i = 0; i < sizeof(prims) / sizeof(prims[0]); i++) {
+        if (strcmp(prims[i].name, name) == 0) return &prims[i];
+    }
+    return NULL;
+}
+
+static int is_special(const char *name) {
+    for (size_t i = 0; i < sizeof(special_forms) / sizeof(special_forms[0]); i++) {
+        if (strcmp(special_forms[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+static int find_func(const ir_program_t *prog, const char *name) {
+    for (int i = 1; i < prog->func_count; i++) {
+        if (strcmp(prog->funcs[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int find_global(const ir_program_t *prog, const char *name) {
+    for (int i = 0; i < prog->global_count; i++) {
+        if (strcmp(prog->globals[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int find_var(const lower_t *lw, const char *name) {
+    for (int i = lw->env_count - 1; i >= 0; i--) {
+        if (strcmp(lw->env[i].name, name) == 0) return lw->env[i].vreg;
+    }
+    return -1;
+}
+
+static int bind(lower_t *lw, const char *name, int vreg) {
+    if (lw->env_count == lw->env_cap) {
+        int cap = lw->env_cap ? lw->env_cap * 2 : 16;
+        binding_t *env = realloc(lw->env, cap * sizeof(binding_t));
+        if (!env) return 0;
+        lw->env = env;
+        lw->env_cap = cap;
+    }
+    lw->env[lw->env_count].name = name;
+    lw->env[lw->env_count++].vreg = vreg;
+    return 1;
+}
+
+static int new_vreg(lower_t *lw, int width, const char *name, int param) {
+    ir_func_t *fn = lw->fn;
+    if (fn->vreg_count == fn->vreg_cap) {
+        int cap = fn->vreg_cap ? fn->vreg_cap * 2 : 32;
+        vreg_t *vregs = realloc(fn->vregs, cap * sizeof(vreg_t));
+        if (!vregs) {
+            out_of_memory(lw);
+            return 0;
+        }
+        fn->vregs = vregs;
+        fn->vreg_cap = cap;
+    }
+    vreg_t *v = &fn->vregs[fn->vreg_count];
+    memset(v, 0, sizeof(*v));
+    v->width = width;
+    v->name = name;
+    v->param = param;
+    v->start = v->end = -1;
+    v->location = -1;
+    return fn->vreg_count++;
+}
+
+static int new_label(lower_t *lw) {
+    return lw->fn->label_count++;
+}
+
+static opnd_t vreg_opnd(lower_t *lw, int vreg) {
+    opnd_t o = { OPND_VREG, lw->fn->vregs[vreg].width, vreg };
+    return o;
+}
+
+// Constants are bytes when they fit, so they never widen an operation
+static opnd_t const_opnd(int value) {
+    opnd_t o = { OPND_CONST, value >= 0 && value <= 0xFF ? 1 : 2, value };
+    return o;
+}
+
+static opnd_t mem_opnd(int address, int width) {
+    opnd_t o = { OPND_MEM, width, address };
+    return o;
+}
+
+static opnd_t temp(lower_t *lw, int width) {
+    return vreg_opnd(lw, new_vreg(lw, width, NULL, -1));
+}
+
+// Wrap to the operation width: bytes are unsigned, ints signed 15 bit
+static int wrap(int value, int width) {
+    return width == 1 ? value & 0xFF : ((value & 0x7FFF) ^ 0x4000) - 0x4000;
+}
+
+static int same_opnd(opnd_t a, opnd_t b) {
+    return a.kind == b.kind && a.value == b.value && (a.kind != OPND_CONST || a.width == b.width);
+}
+
+static int is_temp(const lower_t *lw, opnd_t o) {
+    return o.kind == OPND_VREG && !lw->fn->vregs[o.value].name;
+}
+
+static int emit(lower_t *lw, const ir_instr_t *ins) {
+    ir_func_t *fn = lw->fn;
+    if (fn->count == fn->cap) {
+        int cap = fn->cap ? fn->cap * 2 : 64;
+        ir_instr_t *code = realloc(fn->code, cap * sizeof(ir_instr_t));
+        if (!code) {
+            out_of_memory(lw);
+            return 0;
+        }
+        fn->code = code;
+        fn->cap = cap;
+    }
+    fn->code[fn->count++] = *ins;
+    return 1;
+}
+
+static void emit_op(lower_t *lw, ir_op_t op, int width, opnd_t dst, opnd_t a, opnd_t b, int line);
+
+// An operand at another width: constants are retyped, and bytes and ints
+// go through a move, which converts
+static opnd_t convert(lower_t *lw, opnd_t o, int width, int line) {
+    if (o.kind == OPND_NONE || o.width == width) return o;
+    if (o.kind == OPND_CONST) {
+        o.width = width;
+        o.value = wrap(o.value, width);
+        return o;
+    }
+    opnd_t t = temp(lw, width);
+    emit_op(lw, I_MOVE, width, t, o, no_opnd, line);
+    return t;
+}
+
+// Operands are converted to the operation width, except addresses, shift
+// counts and the int whose high byte is taken
+static void emit_op(lower_t *lw, ir_op_t op, int width, opnd_t dst, opnd_t a, opnd_t b, int line) {
+    if (op != I_MOVE && op != I_HI && op != I_LOAD && op != I_STORE) a = convert(lw, a, width, line);
+    if (op != I_SHL && op != I_SHR) b = convert(lw, b, width, line);
+    ir_instr_t ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = op;
+    ins.width = width;
+    ins.dst = dst;
+    ins.a = a;
+    ins.b = b;
+    ins.line = line;
+    emit(lw, &ins);
+}
+
+static void emit_move(lower_t *lw, opnd_t dst, opnd_t src, int line) {
+    if (src.kind == OPND_CONST) src = convert(lw, src, dst.width, line);
+    if (!same_opnd(dst, src)) emit_op(lw, I_MOVE, dst.width, dst, src, no_opnd, line);
+}
+
+static void emit_label(lower_t *lw, int label) {
+    ir_instr_t ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = I_LABEL;
+    ins.label = label;
+    emit(lw, &ins);
+}
+
+static void emit_jump(lower_t *lw, int label) {
+    ir_instr_t ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = I_JUMP;
+    ins.label = label;
+    emit(lw, &ins);
+}
+
+static void emit_branch(lower_t *lw, ir_cond_t cond, opnd_t a, opnd_t b, int label, int line) {
+    ir_instr_t ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = I_BRANCH;
+    ins.cond = cond;
+    ins.width = a.width > b.width ? a.width : b.width;
+    ins.a = convert(lw, a, ins.width, line);
+    ins.b = convert(lw, b, ins.width, line);
+    ins.label = label;
+    ins.line = line;
+    emit(lw, &ins);
+}
+
+static void emit_ret(lower_t *lw, opnd_t value, int line) {
+    emit_op(lw, I_RET, 2, no_opnd, value, no_opnd, line);
+}
+
+// Where an expression leaves its value: the target if there is one of the
+// width, the caller moving it there otherwise
+static opnd_t result(lower_t *lw, const opnd_t *target, int width) {
+    return target && target->width == width ? *target : temp(lw, width);
+}
+
+static opnd_t lower_into(lower_t *lw, const node_t *node, opnd_t dst) {
+    opnd_t v = lower(lw, node, &dst, 0);
+    emit_move(lw, dst, v, node->line);
+    return dst;
+}
+
+static int power_of_two(int value) {
+    for (int k = 0; k < 15; k++) {
+        if (value == 1 << k) return k;
+    }
+    return -1;
+}
+
+// Forms that can change a variable, global or memory behind an operand
+// that was evaluated before them
+static int has_effects(const lower_t *lw, const node_t *node) {
+    if (node->kind != NODE_LIST || node->count == 0) return 0;
+    const node_t *head = node->items[0];
+    if (head->kind == NODE_SYMBOL) {
+        if (node_is(head, "quote")) return 0;
+        if (node_is(head, "set!") || node_is(head, "poke") || node_is(head, "pokew") ||
+            node_is(head, "set-car!") || node_is(head, "set-cdr!")) return 1;
+        if (find_func(lw->prog, head->symbol) >= 0) return 1;
+    }
+    for (int i = 0; i < node->count; i++) {
+        if (has_effects(lw, node->items[i])) return 1;
+    }
+    return 0;
+}
+
+// Copy a variable operand to a temporary when a later operand may change it
+static opnd_t stabilize(lower_t *lw, opnd_t o, const node_t *const *rest, int count) {
+    if (o.kind == OPND_CONST || o.kind == OPND_NONE || is_temp(lw, o)) return o;
+    for (int i = 0; i < count; i++) {
+        if (has_effects(lw, rest[i])) {
+            opnd_t t = temp(lw, o.width);
+            emit_move(lw, t, o, rest[i]->line);
+            return t;
+        }
+    }
+    return o;
+}
+
+// Static width of an expression, for the temporaries of conditionals
+static int expr_width(lower_t *lw, const node_t *node) {
+    if (node->kind == NODE_NUMBER) return node->number >= 0 && node->number <= 0xFF ? 1 : 2;
+    if (node->kind == NODE_SYMBOL) {
+        int v = find_var(lw, node->symbol);
+        if (v >= 0) return lw->fn->vregs[v].width;
+        return node_is(node, "t") || node_is(node, "nil") ? 1 : 2;
+    }
+    if (node->count == 0 || node->items[0]->kind != NODE_SYMBOL) return 2;
+    const char *head = node->items[0]->symbol;
+    if (find_var(lw, head) < 0 && find_func(lw->prog, head) < 0) {
+        const prim_t *prim = find_prim(head);
+        if (prim) {
+            int width = 1;
+            switch (prim->kind) {
+                case PRIM_ARITH:
+                    if (prim->op == I_SUB && node->count == 2) return 2;
+                    for (int i = 1; i < node->count; i++) {
+                        if (expr_width(lw, node->items[i]) == 2) width = 2;
+                    }
+                    return width;
+                case PRIM_COMPARE: case PRIM_TEST: return 1;
+                case PRIM_UNARY: return prim->width ? 1 : node->count > 1 ? expr_width(lw, node->items[1]) : 2;
+                case PRIM_ASH: return node->count > 1 ? expr_width(lw, node->items[1]) : 2;
+                case PRIM_LOAD: return prim->width;
+                default: return 2;
+            }
+        }
+        if (strcmp(head, "if") == 0) {
+            int then = node->count > 2 ? expr_width(lw, node->items[2]) : 1;
+            int other = node->count > 3 ? expr_width(lw, node->items[3]) : 1;
+            return then > other ? then : other;
+        }
+        if (strcmp(head, "while") == 0 || strcmp(head, "quote") == 0) return 1;
+        if (strcmp(head, "begin") == 0 && node->count > 1) return expr_width(lw, node->items[node->count - 1]);
+    }
+    return 2;
+}
+
+static void declare_error(lower_t *lw, const node_t *decl) {
+    error(lw, decl, "declare takes (byte name ...) or (int name ...)");
+}
+
+// Width of a name from the (declare (byte a b) (int c)) forms at the
+// start of a body; ints unless declared otherwise
+static int declared_width(const node_t *const *body, int count, const char *name) {
+    int width = 2;
+    for (int i = 0; i < count && node_is_form(body[i], "declare"); i++) {
+        for (int d = 1; d < body[i]->count; d++) {
+            const node_t *decl = body[i]->items[d];
+            if (decl->kind != NODE_LIST || decl->count == 0 ||
+                !(node_is(decl->items[0], "byte") || node_is(decl->items[0], "int"))) continue;
+            for (int n = 1; n < decl->count; n++) {
+                if (node_is(decl->items[n], name)) width = node_is(decl->items[0], "byte") ? 1 : 2;
+            }
+        }
+    }
+    return width;
+}
+
+static int check_declarations(lower_t *lw, const node_t *const *body, int count) {
+    int skip = 0;
+    for (; skip < count && node_is_form(body[skip], "declare"); skip++) {
+        for (int d = 1; d < body[skip]->count; d++) {
+            const node_t *decl = body[skip]->items[d];
+            int ok = decl->kind == NODE_LIST && decl->count > 0 &&
+                     (node_is(decl->items[0], "byte") || node_is(decl->items[0], "int"));
+            for (int n = 1; ok && n < decl->count; n++) ok = decl->items[n]->kind == NODE_SYMBOL;
+            if (!ok) declare_error(lw, decl);
+        }
+    }
+    return skip;
+}
+
+static opnd_t ret_value(lower_t *lw, opnd_t v, int tail, int line) {
+    if (tail) emit_ret(lw, v, line);
+    return v;
+}
+
+// Forms in sequence; the last one gets the target and the tail position
+static opnd_t lower_body(lower_t *lw, const node_t *const *forms, int count, const opnd_t *target, int tail,
+                         int line) {
+    if (count == 0) {
+        opnd_t zero = const_opnd(0);
+        if (target) emit_move(lw, *target, zero, line);
+        return ret_value(lw, target ? *target : zero, tail, line);
+    }
+    for (int i = 0; i < count - 1; i++) {
+        if (node_is_form(forms[i], "declare")) {
+            error(lw, forms[i], "declare is only allowed at the start of a body");
+            continue;
+        }
+        lower(lw, forms[i], NULL, 0);
+    }
+    return lower(lw, forms[count - 1], target, tail);
+}
+
+// One arm of a conditional: into the result, or returned from the function
+static void lower_arm(lower_t *lw, const node_t *const *forms, int count, opnd_t res, int tail, int line) {
+    opnd_t v = lower_body(lw, forms, count, tail ? NULL : &res, tail, line);
+    if (!tail) emit_move(lw, res, v, line);
+}
+
+static opnd_t lower_if(lower_t *lw, const node_t *node, const opnd_t *target, int tail) {
+    if (node->count < 3 || node->count > 4) {
+        error(lw, node, "if takes a test, a consequent and an optional alternative");
+        return const_opnd(0);
+    }
+    int other = new_label(lw), end = new_label(lw);
+    opnd_t res = tail ? no_opnd : result(lw, target, expr_width(lw, node));
+    const node_t *const *items = (const node_t *const *)node->items;
+
+    lower_cond(lw, node->items[1], other, 0);
+    lower_arm(lw, items + 2, 1, res, tail, node->line);
+    if (!tail) emit_jump(lw, end);
+    emit_label(lw, other);
+    lower_arm(lw, items + 3, node->count - 3, res, tail, node->line);
+    if (!tail) emit_label(lw, end);
+    return res;
+}
+
+// (when test body...) and (unless test body...)
+static opnd_t lower_when(lower_t *lw, const node_t *node, int when, const opnd_t *target, int tail) {
+    if (node->count < 2) {
+        error(lw, node, "%s needs a test", node->items[0]->symbol);
+        return const_opnd(0);
+    }
+    int other = new_label(lw), end = new_label(lw);
+    opnd_t res = tail ? no_opnd : result(lw, target, 2);
+
+    lower_cond(lw, node->items[1], other, !when);
+    lower_arm(lw, (const node_t *const *)node->items + 2, node->count - 2, res, tail, node->line);
+    if (!tail) emit_jump(lw, end);
+    emit_label(lw, other);
+    lower_arm(lw, NULL, 0, res, tail, node->line);
+    if (!tail) emit_label(lw, end);
+    return res;
+}
+
+static opnd_t lower_cond_form(lower_t *lw, const node_t *node, const opnd_t *target, int tail) {
+    int end = new_label(lw);
+    opnd_t res = tail ? no_opnd : result(lw, target, 2);
+
+    for (int i = 1; i < node->count; i++) {
+        const node_t *clause = node->items[i];
+        if (clause->kind != NODE_LIST || clause->count == 0) {
+            error(lw, clause, "cond clauses are (test body...)");
+            continue;
+        }
+        const node_t *const *body = (const node_t *const *)clause->items + 1;
+        if (node_is(clause->items[0], "else") || node_is(clause->items[0], "t")) {
+            lower_arm(lw, body, clause->count - 1, res, tail, clause->line);
+            if (!tail) emit_label(lw, end);
+            return res;
+        }
+        int next = new_label(lw);
+        lower_cond(lw, clause->items[0], next, 0);
+        lower_arm(lw, body, clause->count - 1, res, tail, clause->line);
+        if (!tail) emit_jump(lw, end);
+        emit_label(lw, next);
+    }
+    lower_arm(lw, NULL, 0, res, tail, node->line);
+    if (!tail) emit_label(lw, end);
+    return res;
+}
+
+// (let ((name init) ...) body...): bindings are sequential, as in let*
+static opnd_t lower_let(lower_t *lw, const node_t *node, const opnd_t *target, int tail) {
+    if (node->count < 2 || node->items[1]->kind != NODE_LIST) {
+        error(lw, node, "let takes a binding list and a body");
+        return const_opnd(0);
+    }
+    const node_t *bindings = node->items[1];
+    const node_t *const *body = (const node_t *const *)node->items + 2;
+    int body_count = node->count - 2;
+    int saved = lw->env_count;
+    int skip = check_declarations(lw, body, body_count);
+
+    for (int i = 0; i < bindings->count; i++) {
+        const node_t *b = bindings->items[i];
+        if (b->kind != NODE_LIST || b->count != 2 || b->items[0]->kind != NODE_SYMBOL) {
+            error(lw, b, "let bindings are (name value)");
+            continue;
+        }
+        const char *name = b->items[0]->symbol;
+        int v = new_vreg(lw, declared_width(body, skip, name), name, -1);
+        lower_into(lw, b->items[1], vreg_opnd(lw, v));
+        if (!bind(lw, name, v)) out_of_memory(lw);
+    }
+    opnd_t res = lower_body(lw, body + skip, body_count - skip, target, tail, node->line);
+    lw->env_count = saved;
+    return res;
+}
+
+static opnd_t lower_set(lower_t *lw, const node_t *node) {
+    if (node->count != 3 || node->items[1]->kind != NODE_SYMBOL) {
+        error(lw, node, "set! takes a variable and a value");
+        return const_opnd(0);
+    }
+    const char *name = node->items[1]->symbol;
+    int v = find_var(lw, name);
+    if (v >= 0) return lower_into(lw, node->items[2], vreg_opnd(lw, v));
+
+    int g = find_global(lw->prog, name);
+    if (g < 0) {
+        error(lw, node, "unknown variable %s", name);
+        return const_opnd(0);
+    }
+    opnd_t value = lower(lw, node->items[2], NULL, 0);
+    emit_move(lw, mem_opnd(lw->prog->globals[g].address, 2), value, node->line);
+    return value;
+}
+
+// (while test body...) with the test at the bottom: one branch per iteration
+static opnd_t lower_while(lower_t *lw, const node_t *node) {
+    if (node->count < 2) {
+        error(lw, node, "while needs a test");
+        return const_opnd(0);
+    }
+    int body = new_label(lw), test = new_label(lw);
+    emit_jump(lw, test);
+    emit_label(lw, body);
+    for (int i = 2; i < node->count; i++) lower(lw, node->items[i], NULL, 0);
+    emit_label(lw, test);
+    lower_cond(lw, node->items[1], body, 1);
+    return const_opnd(0);
+}
+
+// (and a b ...) is the first false value or the last one, (or ...) the
+// first true value; values that decide the result are already in it
+static opnd_t lower_logic(lower_t *lw, const node_t *node, int is_and, const opnd_t *target) {
+    if (node->count == 1) return const_opnd(is_and);
+    int end = new_label(lw);
+    opnd_t res = target && is_temp(lw, *target) ? *target : temp(lw, expr_width(lw, node));
+    for (int i = 1; i < node->count; i++) {
+        lower_into(lw, node->items[i], res);
+        if (i < node->count - 1) emit_branch(lw, is_and ? COND_EQ : COND_NE, res, const_opnd(0), end, node->line);
+    }
+    emit_label(lw, end);
+    return res;
+}
+
+// A number literal as a 15 bit value; $4000-$7FFF wrap, as addresses
+static opnd_t lower_number(lower_t *lw, const node_t *node) {
+    if (node->number < -16384 || node->number > 32767) error(lw, node, "%ld does not fit in 15 bits", node->number);
+    return const_opnd(wrap((int)node->number, node->number > 255 || node->number < 0 ? 2 : 1));
+}
+
+static opnd_t lower_quote(lower_t *lw, const node_t *node) {
+    const node_t *q = node->count == 2 ? node->items[1] : NULL;
+    if (q && q->kind == NODE_LIST && q->count == 0) return const_opnd(0);
+    if (q && q->kind == NODE_NUMBER) return lower_number(lw, q);
+    error(lw, node, "only numbers and '() can be quoted");
+    return const_opnd(0);
+}
+
+static opnd_t fold(ir_op_t op, int a, int b, int width) {
+    int v = 0;
+    switch (op) {
+        case I_ADD: v = a + b; break;
+        case I_SUB: v = a - b; break;
+        case I_MUL: v = a * b; break;
+        case I_DIV: v = b ? a / b : 0; break;
+        case I_MOD: v = b ? a % b : 0; break;
+        case I_AND: v = a & b; break;
+        case I_OR: v = a | b; break;
+        case I_XOR: v = a ^ b; break;
+        default: break;
+    }
+    return const_opnd(wrap(v, width));
+}
+
+// One step of an n-ary operation. Multiplication by powers of two, and
+// division and remainder of bytes by them, become shifts and masks.
+static opnd_t arith(lower_t *lw, ir_op_t op, opnd_t a, opnd_t b, const opnd_t *target, int line) {
+    int width = a.width > b.width ? a.width : b.width;
+    if (a.kind == OPND_CONST && b.kind == OPND_CONST) return fold(op, a.value, b.value, 2);
+
+    if (b.kind == OPND_CONST) {
+        if ((op == I_ADD || op == I_SUB || op == I_OR || op == I_XOR) && b.value == 0) return a;
+        if ((op == I_MUL || op == I_DIV) && b.value == 1) return a;
+        int k = power_of_two(b.value);
+        if (op == I_MUL && k > 0) op = I_SHL, b = const_opnd(k);
+        else if (op == I_DIV && k > 0 && width == 1) op = I_SHR, b = const_opnd(k);
+        else if (op == I_MOD && k >= 0 && width == 1) op = I_AND, b = const_opnd(b.value - 1);
+    } else if (a.kind == OPND_CONST && (op == I_ADD || op == I_MUL || op == I_AND || op == I_OR || op == I_XOR)) {
+        opnd_t t = a;
+        a = b;
+        b = t;
+        return arith(lw, op, a, b, target, line);
+    }
+
+    if (op == I_MUL) lw->prog->uses_mul = 1;
+    if (op == I_DIV || op == I_MOD) lw->prog->uses_div = 1;
+    opnd_t dst = result(lw, target, width);
+    emit_op(lw, op, width, dst, a, b, line);
+    return dst;
+}
+
+static opnd_t lower_arith(lower_t *lw, const node_t *node, const prim_t *prim, const opnd_t *target) {
+    const node_t *const *args = (const node_t *const *)node->items + 1;
+    int count = node->count - 1;
+    if (count == 0 || (count == 1 && prim->op != I_SUB && prim->op != I_ADD)) {
+        error(lw, node, "%s needs %s", prim->name, count ? "two operands" : "operands");
+        return const_opnd(0);
+    }
+    if (count == 1 && prim->op == I_SUB) {
+        opnd_t a = lower(lw, args[0], NULL, 0);
+        if (a.kind == OPND_CONST) return const_opnd(wrap(-a.value, 2));
+        opnd_t dst = result(lw, target, 2);
+        emit_op(lw, I_SUB, 2, dst, const_opnd(0), a, node->line);
+        return dst;
+    }
+
+    opnd_t acc = lower(lw, args[0], NULL, 0);
+    for (int i = 1; i < count; i++) {
+        acc = stabilize(lw, acc, args + i, count - i);
+        opnd_t b = lower(lw, args[i], NULL, 0);
+        acc = arith(lw, prim->op, acc, b, i == count - 1 ? target : NULL, node->line);
+    }
+    return acc;
+}
+
+// Comparison operands in the order the branch tests them
+static int lower_compare(lower_t *lw, const node_t *node, ir_cond_t *cond, opnd_t *a, opnd_t *b) {
+    const char *name = node->items[0]->symbol;
+    if (node->count != 3) {
+        error(lw, node, "%s takes two operands", name);
+        return 0;
+    }
+    *a = lower(lw, node->items[1], NULL, 0);
+    *a = stabilize(lw, *a, (const node_t *const *)node->items + 2, 1);
+    *b = lower(lw, node->items[2], NULL, 0);
+
+    int swap = strcmp(name, ">") == 0 || strcmp(name, "<=") == 0;
+    if (strcmp(name, "=") == 0) *cond = COND_EQ;
+    else if (strcmp(name, "/=") == 0) *cond = COND_NE;
+    else if (strcmp(name, "<") == 0 || strcmp(name, ">") == 0) *cond = COND_LT;
+    else *cond = COND_GE;
+    if (swap) {
+        opnd_t t = *a;
+        *a = *b;
+        *b = t;
+    }
+    return 1;
+}
+
+static int cond_holds(ir_cond_t cond, int a, int b) {
+    switch (cond) {
+        case COND_EQ: return a == b;
+        case COND_NE: return a != b;
+        case COND_LT: return a < b;
+        default: return a >= b;
+    }
+}
+
+// Comparisons of two constants are decided here
+static void branch(lower_t *lw, ir_cond_t cond, opnd_t a, opnd_t b, int label, int when, int line) {
+    if (!when) cond = cond == COND_EQ ? COND_NE : cond == COND_NE ? COND_EQ : cond == COND_LT ? COND_GE : COND_LT;
+    if (a.kind == OPND_CONST && b.kind == OPND_CONST) {
+        if (cond_holds(cond, a.value, b.value)) emit_jump(lw, label);
+        return;
+    }
+    emit_branch(lw, cond, a, b, label, line);
+}
+
+// Branch to label when the truth of node equals when
+static void lower_cond(lower_t *lw, const node_t *node, int label, int when) {
+    if (node->kind == NODE_LIST && node->count > 0 && node->items[0]->kind == NODE_SYMBOL &&
+        find_var(lw, node->items[0]->symbol) < 0 && find_func(lw->prog, node->items[0]->symbol) < 0) {
+        const char *head = node->items[0]->symbol;
+        const prim_t *prim = find_prim(head);
+
+        if (strcmp(head, "not") == 0 || strcmp(head, "zero?") == 0 || strcmp(head, "null?") == 0) {
+            if (node->count != 2) {
+                error(lw, node, "%s takes one operand", head);
+                return;
+            }
+            lower_cond(lw, node->items[1], label, !when);
+            return;
+        }
+        if (strcmp(head, "and") == 0 || strcmp(head, "or") == 0) {
+            // Jump when the whole form decides 'when'; skip out when an
+            // operand decides the opposite
+            int is_and = head[0] == 'a';
+            int skip = new_label(lw);
+            for (int i = 1; i < node->count; i++) {
+                if (i == node->count - 1) lower_cond(lw, node->items[i], label, when);
+                else if (is_and == when) lower_cond(lw, node->items[i], skip, !when);
+                else lower_cond(lw, node->items[i], label, when);
+            }
+            if (node->count == 1 && is_and == when) emit_jump(lw, label);
+            emit_label(lw, skip);
+            return;
+        }
+        if (prim && prim->kind == PRIM_COMPARE) {
+            ir_cond_t cond;
+            opnd_t a, b;
+            if (lower_compare(lw, node, &cond, &a, &b)) branch(lw, cond, a, b, label, when, node->line);
+            return;
+        }
+    }
+    opnd_t v = lower(lw, node, NULL, 0);
+    branch(lw, COND_NE, v, const_opnd(0), label, when, node->line);
+}
+
+// Conditions in value position: 1 or 0
+static opnd_t lower_truth(lower_t *lw, const node_t *node, const opnd_t *target) {
+    int yes = new_label(lw), end = new_label(lw);
+    opnd_t res = result(lw, target, 1);
+    lower_cond(lw, node, yes, 1);
+    emit_move(lw, res, const_opnd(0), node->line);
+    emit_jump(lw, end);
+    emit_label(lw, yes);
+    emit_move(lw, res, const_opnd(1), node->line);
+    emit_label(lw, end);
+    return res;
+}
+
+// Addresses of peek and poke. Literals are plain 16 bit addresses. A byte
+// added to a constant base, or a byte on its own, becomes an index in X;
+// zero page bases other than 0 would wrap, so they are computed like any
+// other address.
+static void lower_address(lower_t *lw, const node_t *node, int width, const node_t *const *rest, int count,
+                          opnd_t *base, opnd_t *index) {
+    *index = no_opnd;
+    if (node->kind == NODE_NUMBER) {
+        if (node->number < 0 || node->number > 0xFFFF) error(lw, node, "%ld is not an address", node->number);
+        *base = const_opnd((int)node->number & 0xFFFF);
+        return;
+    }
+    if (node_is_form(node, "+") && node->count == 3 && find_var(lw, "+") < 0) {
+        for (int i = 1; i <= 2; i++) {
+            const node_t *k = node->items[i], *x = node->items[3 - i];
+            if (k->kind != NODE_NUMBER || k->number < 0x100 || k->number > 0xFFFF || expr_width(lw, x) != 1) continue;
+            opnd_t offset = lower(lw, x, NULL, 0);
+            if (offset.kind == OPND_CONST) {
+                *base = const_opnd((int)(k->number + offset.value) & 0xFFFF);
+            } else if (offset.width != 1) {
+                *base = arith(lw, I_ADD, offset, const_opnd((int)k->number), NULL, node->line);
+            } else {
+                *base = const_opnd((int)k->number);
+                *index = offset;
+            }
+            *base = stabilize(lw, *base, rest, count);
+            *index = stabilize(lw, *index, rest, count);
+            return;
+        }
+    }
+    *base = lower(lw, node, NULL, 0);
+    if (base->kind != OPND_CONST && base->width == 1 && width == 1) {
+        *index = *base;
+        *base = const_opnd(0);
+    }
+    *base = stabilize(lw, *base, rest, count);
+    *index = stabilize(lw, *index, rest, count);
+}
+
+static opnd_t lower_prim(lower_t *lw, const node_t *node, const prim_t *prim, const opnd_t *target) {
+    int argc = node->count - 1;
+    static const int arity[] = { -1, 2, 1, 1, 2, 1, 2, 2, 1, 2 };
+    if (arity[prim->kind] >= 0 && argc != arity[prim->kind]) {
+        error(lw, node, "%s takes %d operand%s", prim->name, arity[prim->kind], arity[prim->kind] == 1 ? "" : "s");
+        return const_opnd(0);
+    }
+
+    switch (prim->kind) {
+        case PRIM_ARITH:
+            return lower_arith(lw, node, prim, target);
+        case PRIM_COMPARE:
+        case PRIM_TEST:
+            return lower_truth(lw, node, target);
+        case PRIM_UNARY: {
+            opnd_t a = lower(lw, node->items[1], NULL, 0);
+            if (prim->op == I_XOR) return arith(lw, I_XOR, a, const_opnd(a.width == 1 ? 0xFF : -1), target, node->line);
+            if (a.kind == OPND_CONST) return const_opnd(prim->op == I_HI ? (a.value >> 8) & 0xFF : a.value & 0xFF);
+            if (prim->op == I_MOVE) return convert(lw, a, 1, node->line);
+            opnd_t dst = result(lw, target, 1);
+            if (a.width == 1) emit_move(lw, dst, const_opnd(0), node->line);
+            else emit_op(lw, I_HI, 1, dst, a, no_opnd, node->line);
+            return dst;
+        }
+        case PRIM_ASH: {
+            if (node->items[2]->kind != NODE_NUMBER) {
+                error(lw, node, "ash needs a constant shift count");
+                return const_opnd(0);
+            }
+            int count = (int)node->items[2]->number;
+            opnd_t a = lower(lw, node->items[1], NULL, 0);
+            if (count == 0) return a;
+            if (a.kind == OPND_CONST) {
+                return const_opnd(wrap(count > 0 ? a.value << count : a.value >> -count, a.width));
+            }
+            opnd_t dst = result(lw, target, a.width);
+            emit_op(lw, count > 0 ? I_SHL : I_SHR, a.width, dst, a, const_opnd(count > 0 ? count : -count), node->line);
+            return dst;
+        }
+        case PRIM_LOAD: {
+            opnd_t base, index;
+            lower_address(lw, node->items[1], prim->width, NULL, 0, &base, &index);
+            opnd_t dst = result(lw, target, prim->width);
+            emit_op(lw, I_LOAD, prim->width, dst, base, no_opnd, node->line);
+            lw->fn->code[lw->fn->count - 1].index = index;
+            return dst;
+        }
+        case PRIM_STORE: {
+            opnd_t base, index;
+            lower_address(lw, node->items[1], prim->width, (const node_t *const *)node->items + 2, 1, &base, &index);
+            opnd_t value = lower(lw, node->items[2], NULL, 0);
+            emit_op(lw, I_STORE, prim->width, no_opnd, base, value, node->line);
+            lw->fn->code[lw->fn->count - 1].index = index;
+            return value;
+        }
+        case PRIM_MUTATE: {
+            opnd_t addr = lower(lw, node->items[1], NULL, 0);
+            addr = stabilize(lw, addr, (const node_t *const *)node->items + 2, 1);
+            opnd_t value = lower(lw, node->items[2], NULL, 0);
+            emit_op(lw, prim->op, prim->width, no_opnd, addr, value, node->line);
+            return value;
+        }
+        case PRIM_CONS: {
+            opnd_t a = lower(lw, node->items[1], NULL, 0);
+            a = stabilize(lw, a, (const node_t *const *)node->items + 2, 1);
+            opnd_t b = lower(lw, node->items[2], NULL, 0);
+            opnd_t dst = result(lw, target, 2);
+            emit_op(lw, I_CONS, 2, dst, a, b, node->line);
+            lw->prog->uses_cons = 1;
+            return dst;
+        }
+        case PRIM_ACCESS: {
+            opnd_t a = lower(lw, node->items[1], NULL, 0);
+            opnd_t dst = result(lw, target, 2);
+            emit_op(lw, prim->op, 2, dst, a, no_opnd, node->line);
+            return dst;
+        }
+    }
+    return const_opnd(0);
+}
+
+// Calls to defined functions; in tail position a call replaces the
+// current activation, and a call to itself is a jump back to the top
+static opnd_t lower_call(lower_t *lw, const node_t *node, int func, const opnd_t *target, int tail) {
+    ir_func_t *callee = &lw->prog->funcs[func];
+    int argc = node->count - 1;
+    if (argc != callee->param_count) {
+        error(lw, node, "%s takes %d argument%s", callee->name, callee->param_count,
+              callee->param_count == 1 ? "" : "s");
+        return const_opnd(0);
+    }
+
+    ir_instr_t ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.func = func;
+    ins.arg_count = argc;
+    ins.width = 2;
+    ins.line = node->line;
+    ins.args = malloc((argc ? argc : 1) * sizeof(opnd_t));
+    if (!ins.args) {
+        out_of_memory(lw);
+        return const_opnd(0);
+    }
+    for (int i = 0; i < argc; i++) {
+        ins.args[i] = lower(lw, node->items[i + 1], NULL, 0);
+        ins.args[i] = stabilize(lw, ins.args[i], (const node_t *const *)node->items + i + 2, argc - i - 1);
+    }
+    for (int i = 0; i < argc; i++) ins.args[i] = convert(lw, ins.args[i], callee->param_width[i], node->line);
+
+    if (tail && lw->prog->options.tail_calls && func == lw->func) {
+        ins.op = I_PMOVE;
+        ins.dsts = malloc((argc ? argc : 1) * sizeof(opnd_t));
+        if (!ins.dsts) {
+            free(ins.args);
+            out_of_memory(lw);
+            return const_opnd(0);
+        }
+        for (int i = 0; i < argc; i++) ins.dsts[i] = vreg_opnd(lw, i);
+        if (!emit(lw, &ins)) free(ins.args), free(ins.dsts);
+        emit_jump(lw, lw->body_label);
+        return no_opnd;
+    }
+    if (tail && lw->prog->options.tail_calls) {
+        ins.op = I_TAILCALL;
+        if (!emit(lw, &ins)) free(ins.args);
+        return no_opnd;
+    }
+    ins.op = I_CALL;
+    ins.dst = result(lw, target, 2);
+    if (!emit(lw, &ins)) free(ins.args);
+    return ret_value(lw, ins.dst, tail, node->line);
+}
+
+static opnd_t lower_symbol(lower_t *lw, const node_t *node) {
+    int v = find_var(lw, node->symbol);
+    if (v >= 0) return vreg_opnd(lw, v);
+    int g = find_global(lw->prog, node->symbol);
+    if (g >= 0) return mem_opnd(lw->prog->globals[g].address, 2);
+    if (node_is(node, "t")) return const_opnd(1);
+    if (node_is(node, "nil")) return const_opnd(0);
+    error(lw, node, "unknown variable %s", node->symbol);
+    return const_opnd(0);
+}
+
+// Value of node, in target when given (the returned operand may still be
+// something else, e.g. a constant). In tail position the value is returned
+// from the function.
+static opnd_t lower(lower_t *lw, const node_t *node, const opnd_t *target, int tail) {
+    if (node->kind == NODE_NUMBER) return ret_value(lw, lower_number(lw, node), tail, node->line);
+    if (node->kind == NODE_SYMBOL) return ret_value(lw, lower_symbol(lw, node), tail, node->line);
+    if (node->count == 0) {
+        error(lw, node, "empty application; write '() for the empty list");
+        return const_opnd(0);
+    }
+
+    const node_t *head = node->items[0];
+    if (head->kind != NODE_SYMBOL) {
+        error(lw, node, "only named functions can be called");
+        return const_opnd(0);
+    }
+    const char *name = head->symbol;
+    const node_t *const *rest = (const node_t *const *)node->items + 1;
+    int func = find_func(lw->prog, name);
+
+    if (func >= 0) return lower_call(lw, node, func, target, tail);
+    if (strcmp(name, "if") == 0) return lower_if(lw, node, target, tail);
+    if (strcmp(name, "cond") == 0) return lower_cond_form(lw, node, target, tail);
+    if (strcmp(name, "when") == 0) return lower_when(lw, node, 1, target, tail);
+    if (strcmp(name, "unless") == 0) return lower_when(lw, node, 0, target, tail);
+    if (strcmp(name, "begin") == 0) return lower_body(lw, rest, node->count - 1, target, tail, node->line);
+    if (strcmp(name, "let") == 0 || strcmp(name, "let*") == 0) return lower_let(lw, node, target, tail);
+
+    opnd_t v;
+    const prim_t *prim = find_prim(name);
+    if (strcmp(name, "quote") == 0) v = lower_quote(lw, node);
+    else if (strcmp(name, "set!") == 0) v = lower_set(lw, node);
+    else if (strcmp(name, "while") == 0) v = lower_while(lw, node);
+    else if (strcmp(name, "and") == 0 || strcmp(name, "or") == 0) v = lower_logic(lw, node, name[0] == 'a', target);
+    else if (prim) v = lower_prim(lw, node, prim, target);
+    else if (is_special(name)) {
+        error(lw, node, "%s is not allowed here", name);
+        v = const_opnd(0);
+    } else {
+        error(lw, node, "unknown function %s", name);
+        v = const_opnd(0);
+    }
+    return ret_value(lw, v, tail, node->line);
+}
+
+// Parameters arrive in the argument slots and are copied to their own
+// registers; the allocator puts them in their slot when it can, which
+// turns the copy into nothing
+static void lower_function(ir_program_t *prog, int index) {
+    ir_func_t *fn = &prog->funcs[index];
+    lower_t lw = { prog, fn, index, NULL, 0, 0, 0 };
+    int skip = check_declarations(&lw, fn->body, fn->body_count);
+
+    for (int i = 0; i < fn->param_count; i++) {
+        const char *name = fn->params->items[i + 1]->symbol;
+        int v = new_vreg(&lw, fn->param_width[i], name, i);
+        emit_move(&lw, vreg_opnd(&lw, v), mem_opnd(ARG_BASE + 2 * i, fn->param_width[i]), fn->line);
+        if (!bind(&lw, name, v)) out_of_memory(&lw);
+    }
+    lw.body_label = new_label(&lw);
+    emit_label(&lw, lw.body_label);
+    lower_body(&lw, fn->body + skip, fn->body_count - skip, NULL, 1, fn->line);
+    free(lw.env);
+}
+
+// Top level code: globals are set in order and the value of the last
+// expression is returned
+static void lower_toplevel(ir_program_t *prog, const node_t *forms) {
+    ir_func_t *fn = &prog->funcs[0];
+    lower_t lw = { prog, fn, 0, NULL, 0, 0, 0 };
+    opnd_t value = const_opnd(0);
+
+    lw.body_label = new_label(&lw);
+    emit_label(&lw, lw.body_label);
+    for (int i = 0; i < forms->count; i++) {
+        const node_t *form = forms->items[i];
+        int last = i == forms->count - 1;
+        if (node_is_form(form, "define")) {
+            if (form->count == 3 && form->items[1]->kind == NODE_SYMBOL) {
+                int g = find_global(prog, form->items[1]->symbol);
+                value = lower(&lw, form->items[2], NULL, 0);
+                emit_move(&lw, mem_opnd(prog->globals[g].address, 2), value, form->line);
+            }
+            if (last) emit_ret(&lw, value, form->line);
+            continue;
+        }
+        if (node_is_form(form, "declare")) {
+            error(&lw, form, "declare is only allowed at the start of a body");
+            continue;
+        }
+        value = lower(&lw, form, NULL, last);
+    }
+    if (forms->count == 0) emit_ret(&lw, value, 1);
+    free(lw.env);
+}
+
+// Assembler labels for Lisp names: letters, digits and '_' stay, '_' is
+// doubled and everything else becomes _xx
+static void mangle(const char *name, char *label, size_t size) {
+    size_t n = snprintf(label, size, "fn_");
+    for (const char *p = name; *p && n + 4 < size; p++) {
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')) {
+            label[n++] = *p;
+        } else if (*p == '_') {
+            label[n++] = '_';
+            label[n++] = '_';
+        } else {
+            n += snprintf(label + n, size - n, "_%02x", (unsigned char)*p);
+        }
+    }
+    label[n] = '\0';
+}
+
+// Functions and globals are collected first, so calls may come before the
+// definition
+static int collect(ir_program_t *prog, const node_t *forms) {
+    lower_t lw = { prog, NULL, 0, NULL, 0, 0, 0 };
+    prog->funcs = calloc(forms->count + 1, sizeof(ir_func_t));
+    prog->globals = calloc(forms->count + 1, sizeof(ir_global_t));
+    if (!prog->funcs || !prog->globals) {
+        out_of_memory(&lw);
+        return 0;
+    }
+    prog->func_count = 1;
+    strcpy(prog->funcs[0].label, "main");
+
+    for (int i = 0; i < forms->count; i++) {
+        const node_t *form = forms->items[i];
+        if (!node_is_form(form, "define")) continue;
+        if (form->count == 3 && form->items[1]->kind == NODE_SYMBOL) {
+            const char *name = form->items[1]->symbol;
+            if (find_global(prog, name) >= 0) {
+                error(&lw, form, "%s is defined twice", name);
+                continue;
+            }
+            if (SLOW_BASE + 2 * (prog->global_count + 1) > SLOW_END) {
+                error(&lw, form, "too many globals");
+                continue;
+            }
+            ir_global_t *g = &prog->globals[prog->global_count];
+            g->name = strdup(name);
+            g->address = SLOW_BASE + 2 * prog->global_count++;
+            if (!g->name) out_of_memory(&lw);
+            continue;
+        }
+
+        const node_t *sig = form->count >= 3 ? form->items[1] : NULL;
+        if (!sig || sig->kind != NODE_LIST || sig->count == 0 || sig->items[0]->kind != NODE_SYMBOL) {
+            error(&lw, form, "define takes (define name value) or (define (name params...) body...)");
+            continue;
+        }
+        const char *name = sig->items[0]->symbol;
+        if (find_func(prog, name) >= 0 || find_prim(name) || is_special(name)) {
+            error(&lw, form, "%s is already defined", name);
+            continue;
+        }
+        if (sig->count - 1 > MAX_PARAMS) {
+            error(&lw, form, "%s has more than %d parameters", name, MAX_PARAMS);
+            continue;
+        }
+        int ok = 1;
+        for (int p = 1; p < sig->count; p++) ok &= sig->items[p]->kind == NODE_SYMBOL;
+        if (!ok) {
+            error(&lw, form, "parameters of %s must be names", name);
+            continue;
+        }
+
+        ir_func_t *fn = &prog->funcs[prog->func_count++];
+        fn->name = strdup(name);
+        if (!fn->name) {
+            out_of_memory(&lw);
+            return 0;
+        }
+        fn->line = form->line;
+        fn->params = sig;
+        fn->param_count = sig->count - 1;
+        fn->body = (const node_t **)form->items + 2;
+        fn->body_count = form->count - 2;
+        mangle(name, fn->label, sizeof(fn->label));
+
+        // Parameter widths, which calls convert their arguments to
+        int skip = 0;
+        while (skip < fn->body_count && node_is_form(fn->body[skip], "declare")) skip++;
+        for (int p = 0; p < fn->param_count; p++) {
+            fn->param_width[p] = declared_width(fn->body, skip, sig->items[p + 1]->symbol);
+        }
+    }
+    prog->slow_base = SLOW_BASE + 2 * prog->global_count;
+    return prog->errors == 0;
+}
+
+int lower_program(ir_program_t *prog, const node_t *forms) {
+    if (!collect(prog, forms)) return prog->errors;
+    lower_toplevel(prog, forms);
+    for (int i = 1; i < prog->func_count; i++) lower_function(prog, i);
+    return prog->errors;
+}
+
+void free_program(ir_program_t *prog) {
+    for (int i = 0; i < prog->func_count; i++) {
+        ir_func_t *fn = &prog->funcs[i];
+        for (int j = 0; j < fn->count; j++) {
+            free(fn->code[j].args);
+            free(fn->code[j].dsts);
+            free(fn->code[j].saves);
+            free(fn->code[j].roots);
+        }
+        free(fn->code);
+        free(fn->vregs);
+        free(fn->clobber);
+        free(fn->name);
+    }
+    for (int i = 0; i < prog->global_count; i++) free(prog->globals[i].name);
+    free(prog->funcs);
+    free(prog->globals);
+    memset(prog, 0, sizeof(*prog));
+}
@@ -1 +1,76 @@
-// TODO
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+
+void print_usage(const char* prog_name) {
+    printf("Usage: %s [options] lisp_file\n", prog_name);
+    printf("  -o output_file   Write the assembly to a file (default: stdout)\n");
+    printf("  --no-zp          Keep every value in absolute memory instead of zero page\n");
+    printf("  --no-tail-calls  Compile calls in tail position as JSR/RTS\n");
+    printf("The output is 6502as source; main returns the last top level value in A and X.\n");
+}
+
+static char* read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = size >= 0 ? malloc(size + 1) : NULL;
+    if (text && fread(text, 1, size, f) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    if (text) text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+int main(int argc, char *argv[]) {
+    const char *input = NULL, *output = NULL;
+    compile_options_t options;
+    compile_default_options(&options);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--no-zp") == 0) {
+            options.zero_page = 0;
+        } else if (strcmp(argv[i], "--no-tail-calls") == 0) {
+            options.tail_calls = 0;
+        } else if (argv[i][0] != '-' && !input) {
+            input = argv[i];
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!input) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    char *text = read_file(input);
+    if (!text) {
+        perror(input);
+        return 1;
+    }
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror(output);
+        free(text);
+        return 1;
+    }
+
+    int errors = compile_lisp(input, text, out, &options);
+    if (output) fclose(out);
+    free(text);
+    if (errors) {
+        fprintf(stderr, "%d errors\n", errors);
+        if (output) remove(output);
+        return 1;
+    }
+    return 0;
+}
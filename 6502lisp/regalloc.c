@@ -0,0 +1,666 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+// Linear scan allocation of virtual registers to zero page bytes.
+//
+// Every register gets one live interval over the instruction positions of
+// its function, from liveness over the basic blocks. Intervals are handed
+// the lowest free zero page bytes in order of their start; when zero page
+// is full, the interval with the least weight (uses, times ten per loop
+// level) moves to absolute memory below the code.
+//
+// Calls need no frame: functions are allocated callees first, and each
+// records the bytes it and everything it calls may change. A value live
+// across a call prefers bytes outside that set, and only values that could
+// not get such bytes are pushed around the JSR. Within a recursive cycle
+// the set is not known until all its members are allocated, so those calls
+// save whatever the final set says.
+//
+// The collector moves cells, so it has to see every int that may hold a
+// reference when it runs: across a cons, or a call to a function that may
+// cons, those go on the runtime's root stack rather than anywhere a frame
+// would have to describe.
+
+typedef unsigned long long word_t;
+
+#define WORD_BITS 64
+#define CLOBBER_BYTES (ADDR_LIMIT / 8)
+#define MAX_DEPTH_WEIGHT 4
+
+typedef struct {
+    int words;              // per set
+    word_t *live_in;        // per block
+    word_t *live_out;
+    word_t *use;
+    word_t *def;
+    int *block_start;       // first position of each block
+    int block_count;
+    int *label_pos;
+} liveness_t;
+
+static int set_has(const word_t *set, int i) { return (set[i / WORD_BITS] >> (i % WORD_BITS)) & 1; }
+static void set_add(word_t *set, int i) { set[i / WORD_BITS] |= 1ULL << (i % WORD_BITS); }
+static void set_remove(word_t *set, int i) { set[i / WORD_BITS] &= ~(1ULL << (i % WORD_BITS)); }
+
+static int clobbers(const unsigned char *bitmap, int address) { return (bitmap[address / 8] >> (address % 8)) & 1; }
+static void mark(unsigned char *bitmap, int address) { bitmap[address / 8] |= 1 << (address % 8); }
+
+static void add_vreg(opnd_t o, int *list, int *n) {
+    if (o.kind == OPND_VREG) list[(*n)++] = o.value;
+}
+
+// Registers read and written by an instruction; lists hold MAX_PARAMS + 2
+static void instr_vregs(const ir_instr_t *ins, int *uses, int *nu, int *defs, int *nd) {
+    *nu = *nd = 0;
+    switch (ins->op) {
+        case I_LABEL:
+        case I_JUMP:
+            break;
+        case I_STORE:
+            add_vreg(ins->a, uses, nu);
+            add_vreg(ins->b, uses, nu);
+            add_vreg(ins->index, uses, nu);
+            break;
+        case I_SETCAR:
+        case I_SETCDR:
+        case I_BRANCH:
+            add_vreg(ins->a, uses, nu);
+            add_vreg(ins->b, uses, nu);
+            break;
+        case I_RET:
+            add_vreg(ins->a, uses, nu);
+            break;
+        case I_CALL:
+        case I_TAILCALL:
+        case I_PMOVE:
+            for (int i = 0; i < ins->arg_count; i++) add_vreg(ins->args[i], uses, nu);
+            if (ins->op == I_CALL) add_vreg(ins->dst, defs, nd);
+            for (int i = 0; ins->dsts && i < ins->arg_count; i++) add_vreg(ins->dsts[i], defs, nd);
+            break;
+        default:
+            add_vreg(ins->a, uses, nu);
+            add_vreg(ins->b, uses, nu);
+            add_vreg(ins->index, uses, nu);
+            add_vreg(ins->dst, defs, nd);
+            break;
+    }
+}
+
+static int ends_block(ir_op_t op) {
+    return op == I_JUMP || op == I_BRANCH || op == I_RET || op == I_TAILCALL;
+}
+
+static void free_liveness(liveness_t *lv) {
+    free(lv->live_in);
+    free(lv->live_out);
+    free(lv->use);
+    free(lv->def);
+    free(lv->block_start);
+    free(lv->label_pos);
+}
+
+// Blocks start at labels and after control transfers
+static int build_blocks(const ir_func_t *fn, liveness_t *lv, int *block_of) {
+    lv->label_pos = malloc((fn->label_count ? fn->label_count : 1) * sizeof(int));
+    lv->block_start = malloc((fn->count + 1) * sizeof(int));
+    if (!lv->label_pos || !lv->block_start) return 0;
+    lv->block_count = 0;
+    for (int p = 0; p < fn->count; p++) {
+        const ir_instr_t *ins = &fn->code[p];
+        if (ins->op == I_LABEL) lv->label_pos[ins->label] = p;
+        if (p == 0 || ins->op == I_LABEL || ends_block(fn->code[p - 1].op)) lv->block_start[lv->block_count++] = p;
+        block_of[p] = lv->block_count - 1;
+    }
+    lv->block_start[lv->block_count] = fn->count;
+    return 1;
+}
+
+static int successors(const ir_func_t *fn, const liveness_t *lv, const int *block_of, int b, int *succ) {
+    int last = lv->block_start[b + 1] - 1, n = 0;
+    const ir_instr_t *ins = &fn->code[last];
+    if (ins->op == I_JUMP || ins->op == I_BRANCH) succ[n++] = block_of[lv->label_pos[ins->label]];
+    if (ins->op != I_JUMP && ins->op != I_RET && ins->op != I_TAILCALL && last + 1 < fn->count) {
+        succ[n++] = b + 1;
+    }
+    return n;
+}
+
+// Live sets at the ends of every block
+static int compute_liveness(const ir_func_t *fn, liveness_t *lv, int *block_of) {
+    int uses[MAX_PARAMS + 2], defs[MAX_PARAMS + 2], nu, nd, succ[2];
+    lv->words = (fn->vreg_count + WORD_BITS - 1) / WORD_BITS + 1;
+    if (!build_blocks(fn, lv, block_of)) return 0;
+
+    size_t set_bytes = (size_t)lv->block_count * lv->words * sizeof(word_t);
+    lv->live_in = calloc(1, set_bytes);
+    lv->live_out = calloc(1, set_bytes);
+    lv->use = calloc(1, set_bytes);
+    lv->def = calloc(1, set_bytes);
+    if (!lv->live_in || !lv->live_out || !lv->use || !lv->def) return 0;
+
+    // Upward exposed uses and definitions per block
+    for (int b = 0; b < lv->block_count; b++) {
+        word_t *use = lv->use + b * lv->words, *def = lv->def + b * lv->words;
+        for (int p = lv->block_start[b + 1] - 1; p >= lv->block_start[b]; p--) {
+            instr_vregs(&fn->code[p], uses, &nu, defs, &nd);
+            for (int i = 0; i < nd; i++) set_add(def, defs[i]), set_remove(use, defs[i]);
+            for (int i = 0; i < nu; i++) set_add(use, uses[i]);
+        }
+    }
+
+    for (int changed = 1; changed; ) {
+        changed = 0;
+        for (int b = lv->block_count - 1; b >= 0; b--) {
+            word_t *in = lv->live_in + b * lv->words, *out = lv->live_out + b * lv->words;
+            int n = successors(fn, lv, block_of, b, succ);
+            for (int w = 0; w < lv->words; w++) {
+                word_t o = 0;
+                for (int s = 0; s < n; s++) o |= lv->live_in[succ[s] * lv->words + w];
+                word_t i = lv->use[b * lv->words + w] | (o & ~lv->def[b * lv->words + w]);
+                if (o != out[w] || i != in[w]) changed = 1;
+                out[w] = o;
+                in[w] = i;
+            }
+        }
+    }
+    return 1;
+}
+
+// Operations that only compute their result
+static int is_pure(ir_op_t op) {
+    switch (op) {
+        case I_MOVE: case I_ADD: case I_SUB: case I_AND: case I_OR: case I_XOR: case I_SHL: case I_SHR:
+        case I_MUL: case I_DIV: case I_MOD: case I_HI: case I_CAR: case I_CDR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Drop computations whose value is never read, such as the value of an if
+// used as a statement; again until nothing changes, since one dead value
+// can be all that kept its operands alive
+static int remove_dead_code(ir_func_t *fn) {
+    int uses[MAX_PARAMS + 2], defs[MAX_PARAMS + 2], nu, nd;
+    for (;;) {
+        liveness_t lv = { 0 };
+        int *block_of = malloc((fn->count ? fn->count : 1) * sizeof(int));
+        char *dead = calloc(fn->count ? fn->count : 1, 1);
+        word_t *live = NULL;
+        int ok = block_of && dead && compute_liveness(fn, &lv, block_of) &&
+                 (live = malloc(lv.words * sizeof(word_t))) != NULL;
+        int removed = 0;
+
+        for (int b = 0; ok && b < lv.block_count; b++) {
+            memcpy(live, lv.live_out + b * lv.words, lv.words * sizeof(word_t));
+            for (int p = lv.block_start[b + 1] - 1; p >= lv.block_start[b]; p--) {
+                const ir_instr_t *ins = &fn->code[p];
+                if (is_pure(ins->op) && ins->dst.kind == OPND_VREG && !set_has(live, ins->dst.value)) {
+                    dead[p] = 1;
+                    removed++;
+                    continue;
+                }
+                instr_vregs(ins, uses, &nu, defs, &nd);
+                for (int i = 0; i < nd; i++) set_remove(live, defs[i]);
+                for (int i = 0; i < nu; i++) set_add(live, uses[i]);
+            }
+        }
+        if (ok && removed) {
+            int n = 0;
+            for (int p = 0; p < fn->count; p++) {
+                if (!dead[p]) fn->code[n++] = fn->code[p];
+            }
+            fn->count = n;
+        }
+        free(block_of);
+        free(dead);
+        free(live);
+        free_liveness(&lv);
+        if (!ok || !removed) return ok;
+    }
+}
+
+// Registers that may hold a reference to a cell: everything but constants,
+// results of arithmetic and copies of those
+static void find_references(ir_func_t *fn) {
+    for (int v = 0; v < fn->vreg_count; v++) fn->vregs[v].may_ref = fn->vregs[v].param >= 0;
+    for (int changed = 1; changed; ) {
+        changed = 0;
+        for (int p = 0; p < fn->count; p++) {
+            const ir_instr_t *ins = &fn->code[p];
+            int n = ins->op == I_PMOVE ? ins->arg_count : 1;
+            for (int i = 0; i < n; i++) {
+                opnd_t d = ins->op == I_PMOVE ? ins->dsts[i] : ins->dst;
+                opnd_t src = ins->op == I_PMOVE ? ins->args[i] : ins->a;
+                if (d.kind != OPND_VREG || fn->vregs[d.value].may_ref) continue;
+                int ref;
+                switch (ins->op) {
+                    case I_MOVE: case I_PMOVE:
+                        ref = src.kind == OPND_MEM || (src.kind == OPND_VREG && fn->vregs[src.value].may_ref);
+                        break;
+                    case I_ADD: case I_SUB: case I_AND: case I_OR: case I_XOR: case I_SHL: case I_SHR:
+                    case I_MUL: case I_DIV: case I_MOD: case I_HI:
+                        ref = 0;
+                        break;
+                    default:
+                        ref = 1;
+                        break;
+                }
+                if (ref) fn->vregs[d.value].may_ref = changed = 1;
+            }
+        }
+    }
+}
+
+// Values live after a call, other than its result, cross it; the list is
+// cut down to the ones to save once the callee's clobbers are known.
+// Across a cons, or a call that may collect, ints that may be references
+// go on the root stack instead.
+static int record_crossings(const ir_program_t *prog, ir_func_t *fn, ir_instr_t *ins, const word_t *live, int def) {
+    int gc = ins->op == I_CONS || prog->funcs[ins->func].may_gc;
+    int count = 0;
+    for (int v = 0; v < fn->vreg_count; v++) count += set_has(live, v) && v != def;
+    free(ins->saves);
+    free(ins->roots);
+    ins->saves = malloc((count ? count : 1) * sizeof(int));
+    ins->roots = malloc((count ? count : 1) * sizeof(int));
+    ins->save_count = ins->root_count = 0;
+    if (!ins->saves || !ins->roots) return 0;
+    for (int v = 0; v < fn->vreg_count; v++) {
+        if (!set_has(live, v) || v == def) continue;
+        if (gc && fn->vregs[v].width == 2 && fn->vregs[v].may_ref) ins->roots[ins->root_count++] = v;
+        else if (ins->op == I_CALL) ins->saves[ins->save_count++] = v;
+        if (ins->op == I_CALL) fn->vregs[v].crosses_call = 1;
+    }
+    return 1;
+}
+
+// Live intervals, call crossings and weights of every register
+static int analyze(const ir_program_t *prog, ir_func_t *fn) {
+    liveness_t lv = { 0 };
+    int uses[MAX_PARAMS + 2], defs[MAX_PARAMS + 2], nu, nd;
+    if (!remove_dead_code(fn)) return 0;
+    find_references(fn);
+
+    int *block_of = malloc((fn->count ? fn->count : 1) * sizeof(int));
+    int *depth = calloc(fn->count ? fn->count : 1, sizeof(int));
+    word_t *live = NULL;
+    int ok = block_of && depth && compute_liveness(fn, &lv, block_of) &&
+             (live = calloc(lv.words, sizeof(word_t))) != NULL;
+    if (!ok) {
+        free(block_of);
+        free(depth);
+        free(live);
+        free_liveness(&lv);
+        return 0;
+    }
+
+    // Loop nesting from backward jumps
+    for (int p = 0; p < fn->count; p++) {
+        const ir_instr_t *ins = &fn->code[p];
+        if ((ins->op == I_JUMP || ins->op == I_BRANCH) && lv.label_pos[ins->label] <= p) {
+            for (int q = lv.label_pos[ins->label]; q <= p; q++) depth[q]++;
+        }
+    }
+
+    for (int v = 0; v < fn->vreg_count; v++) {
+        fn->vregs[v].start = fn->vregs[v].end = -1;
+        fn->vregs[v].weight = 0;
+        fn->vregs[v].crosses_call = 0;
+    }
+    for (int b = 0; b < lv.block_count; b++) {
+        memcpy(live, lv.live_out + b * lv.words, lv.words * sizeof(word_t));
+        for (int p = lv.block_start[b + 1] - 1; p >= lv.block_start[b]; p--) {
+            ir_instr_t *ins = &fn->code[p];
+            instr_vregs(ins, uses, &nu, defs, &nd);
+
+            if ((ins->op == I_CALL || ins->op == I_CONS) &&
+                !record_crossings(prog, fn, ins, live, nd ? defs[0] : -1)) {
+                free(block_of);
+                free(depth);
+                free(live);
+                free_liveness(&lv);
+                return 0;
+            }
+
+            double weight = 1;
+            for (int d = 0; d < depth[p] && d < MAX_DEPTH_WEIGHT; d++) weight *= 10;
+            for (int i = 0; i < nd; i++) set_add(live, defs[i]), fn->vregs[defs[i]].weight += weight;
+            for (int i = 0; i < nu; i++) fn->vregs[uses[i]].weight += weight;
+            for (int w = 0; w < lv.words; w++) {
+                for (word_t bits = live[w]; bits; bits &= bits - 1) {
+                    vreg_t *v = &fn->vregs[w * WORD_BITS + __builtin_ctzll(bits)];
+                    if (v->end < p) v->end = p;
+                    if (v->start < 0 || v->start > p) v->start = p;
+                }
+            }
+            for (int i = 0; i < nu; i++) {
+                vreg_t *v = &fn->vregs[uses[i]];
+                if (v->end < p) v->end = p;
+                if (v->start < 0 || v->start > p) v->start = p;
+            }
+            for (int i = 0; i < nd; i++) set_remove(live, defs[i]);
+            for (int i = 0; i < nu; i++) set_add(live, uses[i]);
+        }
+    }
+
+    free(block_of);
+    free(depth);
+    free(live);
+    free_liveness(&lv);
+    return 1;
+}
+
+static const vreg_t *sorting;
+
+static int by_start(const void *a, const void *b) {
+    const vreg_t *x = &sorting[*(const int *)a], *y = &sorting[*(const int *)b];
+    return x->start != y->start ? x->start - y->start : *(const int *)a - *(const int *)b;
+}
+
+// Bytes [address, address + width) free from start on
+static int is_free(const int *busy, int address, int width, int start) {
+    for (int k = 0; k < width; k++) {
+        if (busy[address + k] >= start) return 0;
+    }
+    return 1;
+}
+
+static int avoided(const unsigned char *avoid, int address, int width) {
+    for (int k = 0; avoid && k < width; k++) {
+        if (clobbers(avoid, address + k)) return 1;
+    }
+    return 0;
+}
+
+// Lowest free address in [first, end), outside avoid when given
+static int find_free(const int *busy, int first, int end, int width, int start, const unsigned char *avoid) {
+    for (int a = first; a + width <= end; a++) {
+        if (is_free(busy, a, width, start) && !avoided(avoid, a, width)) return a;
+    }
+    return -1;
+}
+
+static void occupy(int *busy, int address, int width, int end) {
+    for (int k = 0; k < width; k++) busy[address + k] = end;
+}
+
+// Bytes a call to func may change; all of them while func is in the
+// cycle being allocated
+static const unsigned char* callee_clobber(const ir_program_t *prog, int func, int scc) {
+    static unsigned char all[CLOBBER_BYTES];
+    if (prog->funcs[func].scc == scc || !prog->funcs[func].clobber) {
+        memset(all, 0xFF, sizeof(all));
+        return all;
+    }
+    return prog->funcs[func].clobber;
+}
+
+// Bytes a value would like: the argument slot of the call that is its
+// last use, or those of an operand that dies where it is computed, since
+// the templates read each byte of their operands before writing it
+static int hint(const ir_func_t *fn, const int *busy, int v) {
+    const vreg_t *r = &fn->vregs[v];
+    const ir_instr_t *use = &fn->code[r->end];
+    for (int i = 0; !r->crosses_call && (use->op == I_CALL || use->op == I_TAILCALL) && i < use->arg_count; i++) {
+        if (use->args[i].kind == OPND_VREG && use->args[i].value == v &&
+            is_free(busy, ARG_BASE + 2 * i, r->width, r->start)) return ARG_BASE + 2 * i;
+    }
+    const ir_instr_t *def = &fn->code[r->start];
+    switch (def->op) {
+        case I_MOVE: case I_ADD: case I_SUB: case I_AND: case I_OR: case I_XOR: case I_SHL: case I_SHR:
+            if (def->dst.kind != OPND_VREG || def->dst.value != v) break;
+            for (int i = 0; i < 2; i++) {
+                opnd_t o = i ? def->b : def->a;
+                if (o.kind != OPND_VREG || o.value == v) continue;
+                const vreg_t *u = &fn->vregs[o.value];
+                if (u->end == r->start && u->width == r->width && u->location >= 0 &&
+                    is_free(busy, u->location, r->width, r->start + 1)) return u->location;
+            }
+            break;
+        default:
+            break;
+    }
+    return -1;
+}
+
+static int allocate_function(ir_program_t *prog, ir_func_t *fn) {
+    int *order = malloc((fn->vreg_count ? fn->vreg_count : 1) * sizeof(int));
+    int *busy = malloc(ADDR_LIMIT * sizeof(int));
+    unsigned char *avoid = malloc(CLOBBER_BYTES);
+    int count = 0, ok = 1;
+    if (!order || !busy || !avoid) {
+        free(order);
+        free(busy);
+        free(avoid);
+        return 0;
+    }
+    for (int a = 0; a < ADDR_LIMIT; a++) busy[a] = -1;
+    for (int v = 0; v < fn->vreg_count; v++) {
+        fn->vregs[v].location = -1;
+        if (fn->vregs[v].start >= 0) order[count++] = v;
+    }
+    sorting = fn->vregs;
+    qsort(order, count, sizeof(int), by_start);
+
+    int zp_end = prog->options.zero_page ? ZP_END : ZP_POOL;
+    for (int i = 0; i < count && ok; i++) {
+        vreg_t *v = &fn->vregs[order[i]];
+
+        // A parameter that is dead by the first call stays in its slot
+        if (v->param >= 0 && !v->crosses_call) {
+            v->location = ARG_BASE + 2 * v->param;
+            occupy(busy, v->location, v->width, v->end);
+            continue;
+        }
+
+        const unsigned char *prefer = NULL;
+        if (v->crosses_call) {
+            memset(avoid, 0, CLOBBER_BYTES);
+            for (int p = 0; p < fn->count; p++) {
+                const ir_instr_t *ins = &fn->code[p];
+                if (ins->op != I_CALL) continue;
+                for (int s = 0; s < ins->save_count + ins->root_count; s++) {
+                    int u = s < ins->save_count ? ins->saves[s] : ins->roots[s - ins->save_count];
+                    if (u != order[i]) continue;
+                    const unsigned char *c = callee_clobber(prog, ins->func, fn->scc);
+                    for (int k = 0; k < CLOBBER_BYTES; k++) avoid[k] |= c[k];
+                }
+            }
+            prefer = avoid;
+        }
+
+        int address = hint(fn, busy, order[i]);
+        if (address >= 0 && prefer && avoided(prefer, address, v->width)) address = -1;
+        if (address >= (prog->options.zero_page ? ZP_END : ZP_POOL) && address < (prog->options.zero_page ? ADDR_LIMIT : ZP_END)) {
+            address = -1;
+        }
+        if (address < 0 && prefer) address = find_free(busy, ZP_POOL, zp_end, v->width, v->start, prefer);
+        if (address < 0) address = find_free(busy, ZP_POOL, zp_end, v->width, v->start, NULL);
+        if (address < 0 && prog->options.zero_page) {
+            // Zero page is full: the lightest active value leaves for
+            // absolute memory, which may be this one
+            vreg_t *victim = NULL;
+            for (int u = 0; u < fn->vreg_count; u++) {
+                vreg_t *w = &fn->vregs[u];
+                if (w->location < ZP_POOL || w->location >= ZP_END || w->end < v->start || w->width < v->width) continue;
+                if (w->weight < v->weight && (!victim || w->weight < victim->weight)) victim = w;
+            }
+            if (victim) {
+                int slow = find_free(busy, prog->slow_base, SLOW_END, victim->width, victim->start, NULL);
+                if (slow >= 0) {
+                    address = victim->location;
+                    victim->location = slow;
+                    occupy(busy, slow, victim->width, victim->end);
+                }
+            }
+        }
+        if (address < 0) address = find_free(busy, prog->slow_base, SLOW_END, v->width, v->start, NULL);
+        if (address < 0) {
+            fprintf(stderr, "ERROR - line %d: %s has more live values than fit in memory\n", fn->line,
+                    fn->name ? fn->name : "top level code");
+            ok = 0;
+            break;
+        }
+        v->location = address;
+        occupy(busy, address, v->width, v->end);
+    }
+
+    free(order);
+    free(busy);
+    free(avoid);
+    return ok;
+}
+
+// Bytes the function itself writes: its values and the arguments it passes
+static void own_clobber(const ir_program_t *prog, const ir_func_t *fn, unsigned char *bitmap) {
+    for (int v = 0; v < fn->vreg_count; v++) {
+        const vreg_t *r = &fn->vregs[v];
+        for (int k = 0; r->location >= 0 && k < r->width; k++) mark(bitmap, r->location + k);
+    }
+    for (int p = 0; p < fn->count; p++) {
+        const ir_instr_t *ins = &fn->code[p];
+        if (ins->op != I_CALL && ins->op != I_TAILCALL) continue;
+        for (int k = 0; k < 2 * prog->funcs[ins->func].param_count; k++) mark(bitmap, ARG_BASE + k);
+    }
+}
+
+// Keep only the values whose bytes the callee may change
+static void select_saves(const ir_program_t *prog, ir_func_t *fn) {
+    for (int p = 0; p < fn->count; p++) {
+        ir_instr_t *ins = &fn->code[p];
+        if (ins->op != I_CALL) continue;
+        const unsigned char *clobber = prog->funcs[ins->func].clobber;
+        int n = 0;
+        for (int s = 0; s < ins->save_count; s++) {
+            const vreg_t *v = &fn->vregs[ins->saves[s]];
+            if (avoided(clobber, v->location, v->width)) ins->saves[n++] = ins->saves[s];
+        }
+        ins->save_count = n;
+    }
+}
+
+// Tarjan's algorithm; components come out callees first
+typedef struct {
+    ir_program_t *prog;
+    int *index;
+    int *low;
+    int *stack;
+    int *on_stack;
+    int depth;
+    int next;
+    int *order;             // functions by component, in output order
+    int ordered;
+    int components;
+} scc_t;
+
+static void strongconnect(scc_t *s, int f) {
+    ir_func_t *fn = &s->prog->funcs[f];
+    s->index[f] = s->low[f] = s->next++;
+    s->stack[s->depth++] = f;
+    s->on_stack[f] = 1;
+    for (int p = 0; p < fn->count; p++) {
+        const ir_instr_t *ins = &fn->code[p];
+        if (ins->op != I_CALL && ins->op != I_TAILCALL) continue;
+        int g = ins->func;
+        if (s->index[g] < 0) {
+            strongconnect(s, g);
+            if (s->low[g] < s->low[f]) s->low[f] = s->low[g];
+        } else if (s->on_stack[g] && s->index[g] < s->low[f]) {
+            s->low[f] = s->index[g];
+        }
+    }
+    if (s->low[f] != s->index[f]) return;
+    int g;
+    do {
+        g = s->stack[--s->depth];
+        s->on_stack[g] = 0;
+        s->prog->funcs[g].scc = s->components;
+        s->order[s->ordered++] = g;
+    } while (g != f);
+    s->components++;
+}
+
+int allocate_registers(ir_program_t *prog) {
+    int n = prog->func_count;
+    scc_t s;
+    memset(&s, 0, sizeof(s));
+    s.prog = prog;
+    s.index = malloc(n * sizeof(int));
+    s.low = malloc(n * sizeof(int));
+    s.stack = malloc(n * sizeof(int));
+    s.on_stack = calloc(n, sizeof(int));
+    s.order = malloc(n * sizeof(int));
+    int errors = !s.index || !s.low || !s.stack || !s.on_stack || !s.order;
+    if (errors) fprintf(stderr, "ERROR - out of memory\n");
+
+    for (int f = 0; !errors && f < n; f++) s.index[f] = -1;
+    for (int f = 0; !errors && f < n; f++) {
+        if (s.index[f] < 0) strongconnect(&s, f);
+    }
+
+    for (int i = 0; !errors && i < n; ) {
+        int scc = prog->funcs[s.order[i]].scc, end = i;
+        while (end < n && prog->funcs[s.order[end]].scc == scc) end++;
+
+        unsigned char *clobber = calloc(1, CLOBBER_BYTES);
+        if (!clobber) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            errors++;
+            break;
+        }
+        // A cons anywhere in a cycle, or in anything it calls, may collect
+        int may_gc = 0;
+        for (int j = i; j < end; j++) {
+            const ir_func_t *fn = &prog->funcs[s.order[j]];
+            for (int p = 0; p < fn->count; p++) {
+                const ir_instr_t *ins = &fn->code[p];
+                may_gc |= ins->op == I_CONS ||
+                          ((ins->op == I_CALL || ins->op == I_TAILCALL) && prog->funcs[ins->func].may_gc);
+            }
+        }
+        for (int j = i; j < end; j++) prog->funcs[s.order[j]].may_gc = may_gc;
+
+        for (int j = i; j < end; j++) {
+            ir_func_t *fn = &prog->funcs[s.order[j]];
+            if (!analyze(prog, fn)) {
+                fprintf(stderr, "ERROR - out of memory\n");
+                errors++;
+            } else if (!allocate_function(prog, fn)) {
+                errors++;
+            }
+        }
+
+        // Every member of a cycle may run any other, so they share one set
+        for (int j = i; j < end && !errors; j++) {
+            const ir_func_t *fn = &prog->funcs[s.order[j]];
+            own_clobber(prog, fn, clobber);
+            for (int p = 0; p < fn->count; p++) {
+                const ir_instr_t *ins = &fn->code[p];
+                if ((ins->op != I_CALL && ins->op != I_TAILCALL) || prog->funcs[ins->func].scc == scc) continue;
+                for (int k = 0; k < CLOBBER_BYTES; k++) clobber[k] |= prog->funcs[ins->func].clobber[k];
+            }
+        }
+        for (int j = i; j < end; j++) {
+            ir_func_t *fn = &prog->funcs[s.order[j]];
+            fn->clobber = j == i ? clobber : malloc(CLOBBER_BYTES);
+            if (!fn->clobber) {
+                fprintf(stderr, "ERROR - out of memory\n");
+                errors++;
+                break;
+            }
+            if (j > i) memcpy(fn->clobber, clobber, CLOBBER_BYTES);
+        }
+        for (int j = i; j < end && !errors; j++) select_saves(prog, &prog->funcs[s.order[j]]);
+        i = end;
+    }
+
+    free(s.index);
+    free(s.low);
+    free(s.stack);
+    free(s.on_stack);
+    free(s.order);
+    return errors;
+}
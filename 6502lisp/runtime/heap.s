@@ -0,0 +1,354 @@
+; 6502lisp runtime: cons cell heap and mark-compact garbage collector
+;
+; Values are 16 bits, told apart by bit 0. A fixnum n is 2n, so bit 0 is
+; clear and compiled code adds and compares fixnums as plain ints, which
+; keeps the bit clear. A reference to a cell has RT_TAG as its low byte
+; and the cell index as its high byte. nil is $0000.
+;
+; The cells are four page-aligned arrays indexed by the cell: car and cdr,
+; low and high bytes apart, so LDX ref+1 / LDA RT_CAR_LO,X reaches a field
+; in four cycles. rt_cons hands out cells from the bottom. When they run out
+; the collector marks what the roots reach, slides the live cells down
+; into the holes with two fingers, leaving the new index of each moved
+; cell in its old car, and fixes every reference to a moved cell.
+;
+; Roots are the RT_ROOTS stack, RT_GLOBAL_WORDS words from RT_GLOBALS,
+; which the program defines, and the operands of rt_cons. Compiled code
+; pushes the ints it keeps across a cons or a call that may cons, and
+; pops them back as the collector left them.
+
+; Zero page, shared with the compiled code's runtime scratch bytes
+RT_A        = $02       ; rt_cons operands: car
+RT_AH       = $03
+RT_B        = $04       ; and cdr
+RT_BH       = $05
+GC_P        = $06       ; pointer into the globals
+GC_PH       = $07
+GC_N        = $08       ; globals left
+GC_NH       = $09
+RT_HP       = $0A       ; next free cell
+RT_RSP      = $0B       ; root stack depth
+GC_SP       = $0C       ; mark stack depth
+GC_F        = $0D       ; compaction fingers: first hole
+GC_S        = $0E       ; and first cell already moved or dead
+GC_EPOCH    = $0F       ; mark of the current collection
+
+; Heap layout; programs must end below RT_CAR_LO
+RT_TAG      = $01       ; low byte of references
+RT_CELLS    = 255       ; cells, at most 255 so RT_HP never wraps
+RT_CAR_LO   = $7800
+RT_CAR_HI   = $7900
+RT_CDR_LO   = $7A00
+RT_CDR_HI   = $7B00
+RT_MARK     = $7C00     ; GC_EPOCH for cells reached
+RT_STACK    = $7D00     ; cells marked but not yet scanned
+RT_ROOTS_LO = $7E00     ; the root stack
+RT_ROOTS_HI = $7F00
+RT_GLOBALS  = $0200
+
+; gc_mark on a field of cell Y, inline since it runs for every field of
+; every live cell
+        .MACRO GC_MARK_FIELD lo, hi
+        LDA lo,Y
+        LSR
+        BCC .skip\@
+        LDX hi,Y
+        CPX RT_HP
+        BCS .skip\@
+        LDA RT_MARK,X
+        CMP GC_EPOCH
+        BEQ .skip\@
+        LDA GC_EPOCH
+        STA RT_MARK,X
+        TXA
+        LDX GC_SP
+        STA RT_STACK,X
+        INC GC_SP
+.skip\@:
+        .ENDM
+
+; Empty heap and root stack, nil in every global. The epoch wraps on the
+; first collection, which clears the marks.
+rt_init:
+        LDA #$FF
+        STA GC_EPOCH
+        LDA #$00
+        STA RT_HP
+        STA RT_RSP
+        STA rt_gcs
+        STA rt_gcs_hi
+        JSR gc_first_global
+.loop:
+        LDA GC_N
+        ORA GC_NH
+        BEQ .done
+        LDA #$00
+        TAY
+        STA (GC_P),Y
+        INY
+        STA (GC_P),Y
+        JSR gc_next_global
+        JMP .loop
+.done:
+        RTS
+
+; (RT_A . RT_B) in a new cell, its reference to A and X. Collects when the
+; heap is full and stops at BRK when nothing could be freed.
+rt_cons:
+        LDX RT_HP
+        CPX #RT_CELLS
+        BCC .alloc
+        JSR rt_gc
+        LDX RT_HP
+        CPX #RT_CELLS
+        BCC .alloc
+        BRK
+.alloc:
+        LDA RT_A
+        STA RT_CAR_LO,X
+        LDA RT_AH
+        STA RT_CAR_HI,X
+        LDA RT_B
+        STA RT_CDR_LO,X
+        LDA RT_BH
+        STA RT_CDR_HI,X
+        INC RT_HP
+        LDA #RT_TAG
+        RTS
+
+; Collect: mark, compact, fix the references. Each collection marks with
+; a new epoch, so the marks of the last one need no clearing until the
+; epoch wraps.
+rt_gc:
+        INC rt_gcs
+        BNE .counted
+        INC rt_gcs_hi
+.counted:
+        INC GC_EPOCH
+        BNE .epoch
+        JSR gc_clear_marks
+.epoch:
+        LDA #$00
+        STA GC_SP
+
+        ; Roots
+        LDA RT_A
+        LDX RT_AH
+        JSR gc_mark
+        LDA RT_B
+        LDX RT_BH
+        JSR gc_mark
+        LDY #$00
+.roots:
+        CPY RT_RSP
+        BEQ .globals
+        LDA RT_ROOTS_LO,Y
+        LDX RT_ROOTS_HI,Y
+        JSR gc_mark
+        INY
+        JMP .roots
+.globals:
+        JSR gc_first_global
+.global:
+        LDA GC_N
+        ORA GC_NH
+        BEQ .trace
+        LDY #$01
+        LDA (GC_P),Y
+        TAX
+        DEY
+        LDA (GC_P),Y
+        JSR gc_mark
+        JSR gc_next_global
+        JMP .global
+
+        ; Everything reachable, a cell at a time off the mark stack
+.trace:
+        LDX GC_SP
+        BEQ .compact
+        DEX
+        STX GC_SP
+        LDY RT_STACK,X
+        GC_MARK_FIELD RT_CAR_LO, RT_CAR_HI
+        GC_MARK_FIELD RT_CDR_LO, RT_CDR_HI
+        JMP .trace
+
+        ; Two fingers: the lowest hole takes the highest live cell
+.compact:
+        LDA #$00
+        STA GC_F
+        LDA RT_HP
+        STA GC_S
+        LDX #$00
+.find:
+        CPX GC_S
+        BCS .compacted
+        LDA RT_MARK,X
+        CMP GC_EPOCH
+        BNE .hole
+        INX
+        JMP .find
+.hole:
+        STX GC_F
+        LDY GC_S
+.down:
+        DEY
+        CPY GC_F
+        BEQ .compacted
+        LDA RT_MARK,Y
+        CMP GC_EPOCH
+        BNE .down
+        LDA RT_CAR_LO,Y
+        STA RT_CAR_LO,X
+        LDA RT_CAR_HI,Y
+        STA RT_CAR_HI,X
+        LDA RT_CDR_LO,Y
+        STA RT_CDR_LO,X
+        LDA RT_CDR_HI,Y
+        STA RT_CDR_HI,X
+        TXA
+        STA RT_CAR_LO,Y
+        STY GC_S
+        INX
+        JMP .find
+.compacted:
+        STX RT_HP
+
+        ; References to cells at RT_HP and up go to their new index
+        LDY #$00
+.cells:
+        CPY RT_HP
+        BCS .fix_roots
+        LDA RT_CAR_LO,Y
+        LSR
+        BCC .cdr
+        LDX RT_CAR_HI,Y
+        CPX RT_HP
+        BCC .cdr
+        LDA RT_CAR_LO,X
+        STA RT_CAR_HI,Y
+.cdr:
+        LDA RT_CDR_LO,Y
+        LSR
+        BCC .next_cell
+        LDX RT_CDR_HI,Y
+        CPX RT_HP
+        BCC .next_cell
+        LDA RT_CAR_LO,X
+        STA RT_CDR_HI,Y
+.next_cell:
+        INY
+        JMP .cells
+.fix_roots:
+        LDA RT_A
+        LDX RT_AH
+        JSR gc_forward
+        STX RT_AH
+        LDA RT_B
+        LDX RT_BH
+        JSR gc_forward
+        STX RT_BH
+        LDY #$00
+.root:
+        CPY RT_RSP
+        BEQ .fix_globals
+        LDA RT_ROOTS_LO,Y
+        LDX RT_ROOTS_HI,Y
+        JSR gc_forward
+        TXA
+        STA RT_ROOTS_HI,Y
+        INY
+        JMP .root
+.fix_globals:
+        JSR gc_first_global
+.fix_global:
+        LDA GC_N
+        ORA GC_NH
+        BEQ .done
+        LDY #$01
+        LDA (GC_P),Y
+        TAX
+        DEY
+        LDA (GC_P),Y
+        JSR gc_forward
+        TXA
+        INY
+        STA (GC_P),Y
+        JSR gc_next_global
+        JMP .fix_global
+.done:
+        RTS
+
+; Mark the value with low byte A and high byte X, and push it to be
+; scanned, if it is a reference to an unmarked cell in use. Y is kept.
+gc_mark:
+        LSR
+        BCC .done
+        CPX RT_HP
+        BCS .done
+        LDA RT_MARK,X
+        CMP GC_EPOCH
+        BEQ .done
+        LDA GC_EPOCH
+        STA RT_MARK,X
+        TXA
+        LDX GC_SP
+        STA RT_STACK,X
+        INC GC_SP
+.done:
+        RTS
+
+; The high byte X of a value with low byte A, after compaction. Y is kept.
+gc_forward:
+        LSR
+        BCC .done
+        CPX RT_HP
+        BCC .done
+        LDA RT_CAR_LO,X
+        TAX
+.done:
+        RTS
+
+; No cell marked, epoch 1
+gc_clear_marks:
+        LDA #$00
+        TAX
+.loop:
+        STA RT_MARK,X
+        INX
+        BNE .loop
+        INX
+        STX GC_EPOCH
+        RTS
+
+gc_first_global:
+        LDA #<RT_GLOBALS
+        STA GC_P
+        LDA #>RT_GLOBALS
+        STA GC_PH
+        LDA #<RT_GLOBAL_WORDS
+        STA GC_N
+        LDA #>RT_GLOBAL_WORDS
+        STA GC_NH
+        RTS
+
+gc_next_global:
+        CLC
+        LDA GC_P
+        ADC #$02
+        STA GC_P
+        BCC .counted
+        INC GC_PH
+.counted:
+        LDA GC_N
+        BNE .low
+        DEC GC_NH
+.low:
+        DEC GC_N
+        RTS
+
+; Collections so far
+rt_gcs:
+        .BYTE $00
+rt_gcs_hi:
+        .BYTE $00
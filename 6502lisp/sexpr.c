@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpc.h"
+#include "sexpr.h"
+
+// Regexes are compiled to DFA tables; none of them depends on how
+// repetition backtracks, so longest match reads the same programs
+static const char *grammar =
+    " number : /-?[0-9]+/ | /\\$[0-9a-fA-F]+/ ;                 "
+    " symbol : /[a-zA-Z_+\\-*\\/<>=!?][a-zA-Z0-9_+\\-*\\/<>=!?]*/ ; "
+    " list   : '(' <expr>* ')' ;                                "
+    " quote  : '\\'' <expr> ;                                   "
+    " expr   : <number> | <symbol> | <list> | <quote> ;         "
+    " lisp   : /^/ <expr>* /$/ ;                                ";
+
+enum { NUMBER, SYMBOL, LIST, QUOTE, EXPR, LISP, NUM_RULES };
+
+static const char *rule_names[NUM_RULES] = { "number", "symbol", "list", "quote", "expr", "lisp" };
+
+static node_t* new_node(node_kind_t kind, int line) {
+    node_t *node = calloc(1, sizeof(node_t));
+    if (node) {
+        node->kind = kind;
+        node->line = line;
+    }
+    return node;
+}
+
+static int add_item(node_t *list, node_t *item) {
+    node_t **items = realloc(list->items, (list->count + 1) * sizeof(node_t *));
+    if (!items) return 0;
+    list->items = items;
+    list->items[list->count++] = item;
+    return 1;
+}
+
+// Tags carry every rule on the path down to the leaf, e.g. "expr|number|regex"
+static node_t* convert(mpc_ast_t *ast) {
+    int line = ast->state.row + 1;
+    node_t *node;
+
+    if (strstr(ast->tag, "number")) {
+        node = new_node(NODE_NUMBER, line);
+        if (node) node->number = ast->contents[0] == '$' ? strtol(ast->contents + 1, NULL, 16)
+                                                          : strtol(ast->contents, NULL, 10);
+        return node;
+    }
+    if (strstr(ast->tag, "symbol")) {
+        node = new_node(NODE_SYMBOL, line);
+        if (node && !(node->symbol = strdup(ast->contents))) {
+            free(node);
+            return NULL;
+        }
+        return node;
+    }
+
+    // Lists and quotes: the children between the punctuation
+    node = new_node(NODE_LIST, line);
+    if (!node) return NULL;
+    if (strstr(ast->tag, "quote")) {
+        node_t *quote = new_node(NODE_SYMBOL, line);
+        if (!quote || !(quote->symbol = strdup("quote")) || !add_item(node, quote)) {
+            free(quote);
+            node_free(node);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < ast->children_num; i++) {
+        mpc_ast_t *child = ast->children[i];
+        if (strcmp(child->tag, "char") == 0 || strcmp(child->tag, "regex") == 0) continue;
+        node_t *item = convert(child);
+        if (!item || !add_item(node, item)) {
+            node_free(item);
+            node_free(node);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+// ';' comments become blanks so line numbers stay the same
+static char* strip_comments(const char *text) {
+    char *copy = strdup(text);
+    if (!copy) return NULL;
+    for (char *p = copy; *p; p++) {
+        if (*p != ';') continue;
+        while (*p && *p != '\n') *p++ = ' ';
+        if (!*p) break;
+    }
+    return copy;
+}
+
+node_t* read_program(const char *name, const char *text) {
+    mpc_parser_t *rules[NUM_RULES];
+    mpc_result_t r;
+    node_t *program = NULL;
+
+    char *source = strip_comments(text);
+    if (!source) {
+        fprintf(stderr, "ERROR - out of memory\n");
+        return NULL;
+    }
+    for (int i = 0; i < NUM_RULES; i++) rules[i] = mpc_new(rule_names[i]);
+    mpc_err_t *err = mpca_lang(MPCA_LANG_DFA, grammar, rules[NUMBER], rules[SYMBOL], rules[LIST], rules[QUOTE],
+                               rules[EXPR], rules[LISP], NULL);
+    if (err) {
+        mpc_err_print_to(err, stderr);
+        mpc_err_delete(err);
+    } else if (mpc_parse(name, source, rules[LISP], &r)) {
+        program = convert(r.output);
+        if (!program) fprintf(stderr, "ERROR - out of memory\n");
+        mpc_ast_delete(r.output);
+    } else {
+        mpc_err_print_to(r.error, stderr);
+        mpc_err_delete(r.error);
+    }
+    mpc_cleanup(NUM_RULES, rules[NUMBER], rules[SYMBOL], rules[LIST], rules[QUOTE], rules[EXPR], rules[LISP]);
+    free(source);
+    return program;
+}
+
+void node_free(node_t *node) {
+    if (!node) return;
+    for (int i = 0; i < node->count; i++) node_free(node->items[i]);
+    free(node->items);
+    free(node->symbol);
+    free(node);
+}
+
+int node_is(const node_t *node, const char *symbol) {
+    return node && node->kind == NODE_SYMBOL && strcmp(node->symbol, symbol) == 0;
+}
+
+// (head ...)
+int node_is_form(const node_t *node, const char *head) {
+    return node && node->kind == NODE_LIST && node->count > 0 && node_is(node->items[0], head);
+}
@@ -0,0 +1,27 @@
+#ifndef SEXPR_H
+#define SEXPR_H
+
+typedef enum {
+    NODE_NUMBER,
+    NODE_SYMBOL,
+    NODE_LIST
+} node_kind_t;
+
+// Program text as a tree; 'x is read as (quote x)
+typedef struct node {
+    node_kind_t kind;
+    int line;
+    long number;
+    char *symbol;
+    struct node **items;
+    int count;
+} node_t;
+
+// A list of the top level forms, or NULL after printing the parse error
+node_t* read_program(const char *name, const char *text);
+void node_free(node_t *node);
+
+int node_is(const node_t *node, const char *symbol);
+int node_is_form(const node_t *node, const char *head);
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE 65536
+
+void arena_init(arena_t *arena) {
+    arena->head = NULL;
+    arena->spare = NULL;
+}
+
+static void free_blocks(arena_block_t *block) {
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void arena_free(arena_t *arena) {
+    free_blocks(arena->head);
+    free_blocks(arena->spare);
+    arena_init(arena);
+}
+
+// Forget every allocation but keep the blocks for the next ones
+void arena_reset(arena_t *arena) {
+    while (arena->head) {
+        arena_block_t *block = arena->head;
+        arena->head = block->next;
+        block->next = arena->spare;
+        arena->spare = block;
+    }
+}
+
+void* arena_alloc(arena_t *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    arena_block_t *block = arena->head;
+    if (!block || block->used + size > block->size) {
+        if (arena->spare && arena->spare->size >= size) {
+            block = arena->spare;
+            arena->spare = block->next;
+        } else {
+            size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            if (!(block = malloc(sizeof(arena_block_t) + block_size))) return NULL;
+            block->size = block_size;
+        }
+        block->next = arena->head;
+        block->used = 0;
+        arena->head = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char* arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
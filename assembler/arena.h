@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator made of chained blocks, freed or rewound all at once
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;
+    arena_block_t *spare;   // blocks of a rewound arena, reused before new ones
+} arena_t;
+
+void arena_init(arena_t *arena);
+void arena_free(arena_t *arena);
+void arena_reset(arena_t *arena);
+void* arena_alloc(arena_t *arena, size_t size);
+char* arena_strndup(arena_t *arena, const char *str, size_t len);
+
+#endif
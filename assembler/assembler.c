@@ -1,25 +1,1086 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "assembler.h"
 #include "types.h"
 #include "symbols.h"
 #include "utils.h"
-#include "instructions.h" 
+#include "instructions.h"
+#include "object.h"
+#include "listing.h"
+#include "peephole.h"
+#include "lexer.h"
+#include "preproc.h"
 
-#define MAX_OUTPUT 4096
-#define MAX_PASSES 2
+#define MAX_RELAX_PASSES 64
+#define MAX_PEEPHOLE_ROUNDS 8
+#define MAX_MNEMONIC 12
+#define OUTPUT_CHUNK 4096
+#define STREAM_CHUNK 65536      // stream window, also the longest stream line
 
-char* assemble_6502(char* assembly_code) {
-    static char hex_output[MAX_OUTPUT];
-    unsigned char binary[MAX_OUTPUT/3];
-    int output_pos = 0;
+// Line source: text of a known length that can be rewound per pass, a
+// stream that is read once through a window of STREAM_CHUNK bytes, a
+// preprocessed program whose lines are already tokenized, or an array of
+// tokenized lines. Lines are handed out as views into the text, the window
+// or the program.
+typedef struct {
+    const char *text;
+    const char *pos;
+    const char *end;
+    FILE *in;
+    char *window;
+    int discard;                // skip the rest of an overlong stream line
+    const preproc_t *pp;        // also names included files for array readers
+    int span;                   // position in pp->spans
+    int next;
+    int line_no;                // lines read from text or stream
+    const source_line_t *lines;
+    int line_count;
+} line_reader_t;
+
+static line_reader_t text_reader(const char *src, size_t len) {
+    line_reader_t reader = { src, src, src + len, NULL, NULL, 0, NULL, 0, 0, 0, NULL, 0 };
+    return reader;
+}
+
+static line_reader_t program_reader(const preproc_t *pp) {
+    line_reader_t reader = { NULL, NULL, NULL, NULL, NULL, 0, pp, 0, 0, 0, NULL, 0 };
+    return reader;
+}
+
+static line_reader_t array_reader(const source_line_t *lines, int count, const preproc_t *pp) {
+    line_reader_t reader = { NULL, NULL, NULL, NULL, NULL, 0, pp, 0, 0, 0, lines, count };
+    return reader;
+}
+
+// Start the next pass from the first line; streams cannot go back
+static void rewind_reader(line_reader_t *reader) {
+    if (reader->in) return;
+    reader->pos = reader->text;
+    reader->span = reader->next = 0;
+    reader->line_no = 0;
+}
+
+// Relaxation state flags per instruction
+#define RELAX_LONG 0x01         // operand needs the absolute form
+#define RELAX_FAR  0x02         // branch expanded to Bcc *+5 / JMP
+
+// All state of an assembler; contexts share nothing, so each may run on
+// its own thread
+struct asm6502_ctx {
+    int flags;
+    symbol_table_t symtab;
+    unsigned short program_counter;
+    byte_buffer_t *out;
+    size_t out_base;            // output offset of out->data[0]
+    int one_pass;
+    int last_pass;              // emitting pass, 0 until the layout settles
+    byte_buffer_t relax;        // RELAX_* flags indexed by instruction number
+    size_t relax_pos;
+    int relax_changed;
+    asm_stats_t relax_stats;
+    int object_mode;
+    section_t *sections;        // sections opened in the current pass
+    int section_count;
+    int section_cap;
+    int cur_section;
+    obj_reloc_t *relocs;        // relocations against assembler symbol indices
+    int reloc_count;
+    int reloc_cap;
+    const char *source_name;    // .include paths are relative to it
+    listing_t *listing;         // filled on the emitting pass when set
+    int line_instruction;       // instructions[] entry of the current line, -1 if none
+    int line_far;
+    int line_label;             // label defined on the current line, -1 if none
+    asm_phase_hook_t phase_hook;
+    void *phase_arg;
+};
+
+static void report_phase(asm6502_ctx *ctx, asm_phase_t phase, int end) {
+    if (ctx->phase_hook) ctx->phase_hook(phase, end, ctx->phase_arg);
+}
+
+// Pick the encodable mode: branches are always relative, zero page forms
+// the mnemonic lacks are widened to their absolute counterpart, and
+// absolute forms it lacks (STX $10,Y, STY $10,X) fall back to zero page
+static int resolve_instruction(const char *mnemonic, addr_mode_t *mode) {
+    if (find_instruction(mnemonic, REL) >= 0) *mode = REL;
+
+    int idx = find_instruction(mnemonic, *mode);
+    if (idx < 0) {
+        addr_mode_t wide = *mode == ZPG ? ABS : *mode == ZPX ? ABX : *mode == ZPY ? ABY : *mode;
+        if (wide != *mode && (idx = find_instruction(mnemonic, wide)) >= 0) *mode = wide;
+    }
+    if (idx < 0) {
+        addr_mode_t zp = zero_page_form(*mode);
+        if (zp != *mode && (idx = find_instruction(mnemonic, zp)) >= 0) *mode = zp;
+    }
+    return idx;
+}
+
+// Evaluate the address expression of an operand such as "#<label", "($20),Y"
+// or "table,X". *symbol is the referenced symbol entry or -1, and 0 is
+// returned if it is undefined. *part is '<' or '>' for low/high byte selection.
+// Operands with text around the expression that no addressing mode
+// accounts for return -1.
+static int operand_value(asm6502_ctx *ctx, str_view_t operand, int *value, int *symbol, int *part) {
+    str_view_t expr = operand, tail;
+    size_t n = 0;
+    int immediate = 0, indirect = 0;
+
+    *part = 0;
+    *symbol = -1;
+    *value = 0;
+    if (expr.len > 0 && expr.ptr[0] == '#') expr.ptr++, expr.len--, immediate = 1;
+    if (!immediate && expr.len > 0 && expr.ptr[0] == '(') expr.ptr++, expr.len--, indirect = 1;
+    if (expr.len > 0 && (expr.ptr[0] == '<' || expr.ptr[0] == '>')) *part = *expr.ptr++, expr.len--;
+    while (n < expr.len && expr.ptr[n] != ',' && expr.ptr[n] != ')') n++;
+    tail.ptr = expr.ptr + n;
+    tail.len = expr.len - n;
+    expr.len = n;
+
+    expr = view_trim(expr);
+    if (!valid_expression(expr) || !valid_operand_tail(tail, immediate, indirect)) return -1;
+    if (expr.len > 0 && (isalpha((unsigned char)expr.ptr[0]) || expr.ptr[0] == '_' || expr.ptr[0] == '.')) {
+        int idx = find_symbol_n(&ctx->symtab, expr.ptr, expr.len);
+        *symbol = idx >= 0 ? idx : reference_symbol_n(&ctx->symtab, expr.ptr, expr.len);
+        if (idx < 0 || !ctx->symtab.symbols[idx].defined) return 0;
+    }
+
+    *value = parse_number_n(&ctx->symtab, expr.ptr, expr.len);
+    if (*part == '<') *value &= 0xFF;
+    else if (*part == '>') *value = (*value >> 8) & 0xFF;
+    return 1;
+}
+
+// Patch every pending fixup of a symbol that has just been defined
+static int resolve_fixups(asm6502_ctx *ctx, int symbol) {
+    int errors = 0;
+    int value = ctx->symtab.symbols[symbol].address;
+
+    for (int f = ctx->symtab.symbols[symbol].fixups; f >= 0; f = ctx->symtab.fixups[f].next) {
+        fixup_t *fix = &ctx->symtab.fixups[f];
+        unsigned char *dst = ctx->out->data + (fix->offset - ctx->out_base);
+        switch (fix->kind) {
+            case FIXUP_ABS:
+                dst[0] = value & 0xFF;
+                dst[1] = (value >> 8) & 0xFF;
+                break;
+            case FIXUP_LO:
+                dst[0] = value & 0xFF;
+                break;
+            case FIXUP_HI:
+                dst[0] = (value >> 8) & 0xFF;
+                break;
+            case FIXUP_REL: {
+                int offset = value - (fix->pc + 2);
+                if (offset < -128 || offset > 127) {
+                    fprintf(stderr, "ERROR - line %d: branch out of range\n", fix->line);
+                    errors++;
+                }
+                dst[0] = offset & 0xFF;
+                break;
+            }
+        }
+        fix->symbol = -1;
+    }
+    ctx->symtab.symbols[symbol].fixups = -1;
+    return errors;
+}
+
+// Start a new output section at the current position
+static int open_section(asm6502_ctx *ctx, const char *name, size_t len, unsigned short org, int relocatable) {
+    if (ctx->section_count == ctx->section_cap) {
+        int cap = ctx->section_cap ? ctx->section_cap * 2 : 8;
+        section_t *table = realloc(ctx->sections, cap * sizeof(section_t));
+        if (!table) return 0;
+        ctx->sections = table;
+        ctx->section_cap = cap;
+    }
+    section_t *sec = &ctx->sections[ctx->section_count];
+    sec->name = intern_name_n(&ctx->symtab, name, len);
+    sec->org = org;
+    sec->relocatable = relocatable;
+    sec->offset = ctx->out_base + ctx->out->len;
+    sec->size = 0;
+    ctx->cur_section = ctx->section_count++;
+    ctx->program_counter = org;
+    return sec->name != NULL;
+}
+
+// Record a relocation at operand byte offset 'at' of the current instruction
+static int add_reloc(asm6502_ctx *ctx, int at, fixup_kind_t kind, int symbol) {
+    if (ctx->reloc_count == ctx->reloc_cap) {
+        int cap = ctx->reloc_cap ? ctx->reloc_cap * 2 : 256;
+        obj_reloc_t *table = realloc(ctx->relocs, cap * sizeof(obj_reloc_t));
+        if (!table) return 0;
+        ctx->relocs = table;
+        ctx->reloc_cap = cap;
+    }
+    obj_reloc_t *rel = &ctx->relocs[ctx->reloc_count++];
+    rel->section = ctx->cur_section;
+    rel->offset = ctx->out_base + ctx->out->len + at - ctx->sections[ctx->cur_section].offset;
+    rel->kind = kind;
+    rel->symbol = symbol;
+    return 1;
+}
+
+// Section a symbol value is relative to, -1 for absolute values
+static int symbol_section(asm6502_ctx *ctx, int symbol) {
+    return symbol >= 0 && ctx->symtab.symbols[symbol].defined ? ctx->symtab.symbols[symbol].section : -1;
+}
+
+// Define a label or equate; on relaxation passes a moved value means the
+// layout has not settled yet
+static int define_symbol(asm6502_ctx *ctx, str_view_t name, int value, int section, int pass, int line_no) {
+    int idx = find_symbol_n(&ctx->symtab, name.ptr, name.len);
+    if (pass == 1 && idx >= 0 && ctx->symtab.symbols[idx].defined) {
+        fprintf(stderr, "ERROR - line %d: duplicate label %.*s\n", line_no, (int)name.len, name.ptr);
+        return 1;
+    }
+    if (idx >= 0 && ctx->symtab.symbols[idx].defined && ctx->symtab.symbols[idx].address != (unsigned short)value) {
+        ctx->relax_changed = 1;
+    }
+    if ((idx = add_symbol_n(&ctx->symtab, name.ptr, name.len, value)) < 0) {
+        fprintf(stderr, "ERROR - out of memory\n");
+        return 1;
+    }
+    ctx->symtab.symbols[idx].section = section;
+    if (ctx->symtab.symbols[idx].fixups >= 0 && resolve_fixups(ctx, idx)) return 1;
+    return 0;
+}
+
+static int invalid_operand(str_view_t operand, int line_no) {
+    fprintf(stderr, "ERROR - line %d: invalid operand %.*s\n", line_no, (int)operand.len, operand.ptr);
+    return 1;
+}
+
+// Emit one .byte or .word value of 'size' bytes. Unknown values are
+// patched like instruction operands: relocations in objects, fixups in
+// single pass mode.
+static int emit_value(asm6502_ctx *ctx, str_view_t item, int size, int pass, int line_no) {
+    int value = 0, symbol = -1, part = 0;
+    int known = operand_value(ctx, item, &value, &symbol, &part);
+    if (known < 0) return invalid_operand(item, line_no);
+    if (!known && pass == 1) ctx->relax_changed = 1;
+
+    if (pass == ctx->last_pass) {
+        int reloc = ctx->object_mode && symbol >= 0 && (!known || ctx->symtab.symbols[symbol].section >= 0);
+        fixup_kind_t kind = part == '>' ? FIXUP_HI : part == '<' || size == 1 ? FIXUP_LO : FIXUP_ABS;
+        if (reloc) {
+            if (!add_reloc(ctx, 0, kind, symbol)) {
+                fprintf(stderr, "ERROR - out of memory\n");
+                return 1;
+            }
+        } else if (!known) {
+            if (!ctx->one_pass || symbol < 0 ||
+                !add_fixup(&ctx->symtab, symbol, kind, ctx->out_base + ctx->out->len, ctx->program_counter, line_no)) {
+                fprintf(stderr, "ERROR - line %d: undefined symbol in %.*s\n", line_no, (int)item.len, item.ptr);
+                return 1;
+            }
+        } else if (size == 1 && (value < -128 || value > 0xFF)) {
+            fprintf(stderr, "ERROR - line %d: byte value out of range: %.*s\n", line_no, (int)item.len, item.ptr);
+            return 1;
+        }
+
+        int ok = buffer_push(ctx->out, value & 0xFF);
+        if (size > 1) ok &= buffer_push(ctx->out, (value >> 8) & 0xFF);
+        if (!ok) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            return 1;
+        }
+    }
+    ctx->program_counter += size;
+    return 0;
+}
+
+// .byte and .word lists; .byte also takes "strings", emitted as they are
+static int assemble_data(asm6502_ctx *ctx, int size, str_view_t operand, int pass, int line_no) {
+    str_view_t rest = operand, item;
+    if (operand.len == 0) {
+        fprintf(stderr, "ERROR - line %d: data directive without values\n", line_no);
+        return 1;
+    }
+    while (view_next_item(&rest, &item)) {
+        if (size == 1 && item.len >= 2 && item.ptr[0] == '"' && item.ptr[item.len - 1] == '"') {
+            for (size_t i = 1; pass == ctx->last_pass && i + 1 < item.len; i++) {
+                if (!buffer_push(ctx->out, item.ptr[i])) {
+                    fprintf(stderr, "ERROR - out of memory\n");
+                    return 1;
+                }
+            }
+            ctx->program_counter += item.len - 2;
+            continue;
+        }
+        if (item.len == 0) {
+            fprintf(stderr, "ERROR - line %d: empty value in data list\n", line_no);
+            return 1;
+        }
+        if (emit_value(ctx, item, size, pass, line_no)) return 1;
+    }
+    return 0;
+}
+
+// .res count[, fill]: the count has to be known when the line is reached,
+// except on relaxation passes where a later pass will know it
+static int reserve_bytes(asm6502_ctx *ctx, str_view_t operand, int pass, int line_no) {
+    str_view_t rest = operand, item;
+    int count = 0, fill = 0, symbol, part, known;
+
+    view_next_item(&rest, &item);
+    if ((known = item.len ? operand_value(ctx, item, &count, &symbol, &part) : 0) < 0) {
+        return invalid_operand(item, line_no);
+    }
+    if (!known) {
+        if (item.len == 0 || ctx->one_pass || pass == ctx->last_pass) {
+            fprintf(stderr, "ERROR - line %d: .res needs a size that is known here\n", line_no);
+            return 1;
+        }
+        ctx->relax_changed = 1;
+        count = 0;
+    }
+    if (view_next_item(&rest, &item)) {
+        if ((known = item.len ? operand_value(ctx, item, &fill, &symbol, &part) : 0) < 0) {
+            return invalid_operand(item, line_no);
+        }
+        if (item.len == 0 || (!known && pass == ctx->last_pass)) {
+            fprintf(stderr, "ERROR - line %d: .res fill must be a known value\n", line_no);
+            return 1;
+        }
+    }
+    if (count < 0 || count > 0x10000) {
+        fprintf(stderr, "ERROR - line %d: .res size out of range\n", line_no);
+        return 1;
+    }
+
+    if (pass == ctx->last_pass && count > 0) {
+        if (!buffer_reserve(ctx->out, ctx->out->len + count)) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            return 1;
+        }
+        memset(ctx->out->data + ctx->out->len, fill & 0xFF, count);
+        ctx->out->len += count;
+    }
+    ctx->program_counter += count;
+    return 0;
+}
+
+// Assemble one tokenized source line; returns the number of errors found.
+// The line is only read, never modified.
+static int assemble_line(asm6502_ctx *ctx, const line_tokens_t *line, int pass, int line_no) {
+    line_tokens_t tok = *line;
+
+    // Equate: name = value
+    if (tok.equate) {
+        int value, symbol, part;
+        int known = operand_value(ctx, tok.operand, &value, &symbol, &part);
+        if (known < 0) return invalid_operand(tok.operand, line_no);
+        if (!known) {
+            if (pass == ctx->last_pass) {
+                fprintf(stderr, "ERROR - line %d: undefined symbol in equate %.*s\n", line_no,
+                        (int)tok.label.len, tok.label.ptr);
+                return 1;
+            }
+            if (pass == 1) ctx->relax_changed = 1;
+        }
+        return define_symbol(ctx, tok.label, value, symbol_section(ctx, symbol), pass, line_no);
+    }
+
+    // Label definition
+    if (tok.label.ptr) {
+        int section = ctx->sections[ctx->cur_section].relocatable ? ctx->cur_section : -1;
+        if (define_symbol(ctx, tok.label, ctx->program_counter, section, pass, line_no)) return 1;
+        ctx->line_label = find_symbol_n(&ctx->symtab, tok.label.ptr, tok.label.len);
+        set_symbol_scope_n(&ctx->symtab, tok.label.ptr, tok.label.len);
+    }
+    if (tok.mnemonic.len == 0) return 0;
+
+    // Mnemonics and directives are matched in upper case; longer words are
+    // left empty and reported as invalid
+    char mnemonic[MAX_MNEMONIC] = "";
+    if (tok.mnemonic.len < MAX_MNEMONIC) {
+        for (size_t i = 0; i < tok.mnemonic.len; i++) mnemonic[i] = toupper((unsigned char)tok.mnemonic.ptr[i]);
+        mnemonic[tok.mnemonic.len] = '\0';
+    }
+    str_view_t operand = tok.operand;
+
+    if (strcmp(mnemonic, ".ORG") == 0) {
+        const char *name = ctx->object_mode ? "abs" : "code";
+        if (!open_section(ctx, name, strlen(name), parse_number_n(&ctx->symtab, operand.ptr, operand.len), 0)) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (strcmp(mnemonic, ".SECTION") == 0) {
+        if (!ctx->object_mode || operand.len == 0) {
+            fprintf(stderr, "ERROR - line %d: .section needs a name and object output\n", line_no);
+            return 1;
+        }
+        if (!open_section(ctx, operand.ptr, operand.len, 0, 1)) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (strcmp(mnemonic, ".EXPORT") == 0) {
+        str_view_t rest = operand, name;
+        while (view_next_field(&rest, ", \t", &name)) {
+            int idx = reference_symbol_n(&ctx->symtab, name.ptr, name.len);
+            if (idx < 0) {
+                fprintf(stderr, "ERROR - out of memory\n");
+                return 1;
+            }
+            ctx->symtab.symbols[idx].exported = 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(mnemonic, ".BYTE") == 0 || strcmp(mnemonic, ".WORD") == 0) {
+        return assemble_data(ctx, mnemonic[1] == 'W' ? 2 : 1, operand, pass, line_no);
+    }
+    if (strcmp(mnemonic, ".RES") == 0) return reserve_bytes(ctx, operand, pass, line_no);
+    if (strcmp(mnemonic, ".MACRO") == 0 || strcmp(mnemonic, ".REPT") == 0 || strcmp(mnemonic, ".INCLUDE") == 0) {
+        fprintf(stderr, "ERROR - line %d: %s needs a source that can be read more than once\n", line_no, mnemonic);
+        return 1;
+    }
+
+    // "ASL A" style accumulator operands encode like implied
+    if (operand.len == 1 && (operand.ptr[0] == 'A' || operand.ptr[0] == 'a')) operand.len = 0;
+
+    addr_mode_t mode = detect_addressing_mode(operand);
+    addr_mode_t written = mode;
+    int idx = resolve_instruction(mnemonic, &mode);
+    if (idx < 0) {
+        fprintf(stderr, "ERROR - line %d: invalid instruction %.*s %.*s\n", line_no,
+                (int)tok.mnemonic.len, tok.mnemonic.ptr, (int)operand.len, operand.ptr);
+        return 1;
+    }
+
+    // Per-instruction relaxation state, only ever grows between passes
+    if (!buffer_reserve(&ctx->relax, ctx->relax_pos + 1)) {
+        fprintf(stderr, "ERROR - out of memory\n");
+        return 1;
+    }
+    if (ctx->relax_pos == ctx->relax.len) ctx->relax.data[ctx->relax.len++] = 0;
+    unsigned char *state = &ctx->relax.data[ctx->relax_pos++];
+
+    int value = 0, symbol = -1, part = 0;
+    int known = mode == IMP ? 1 : operand_value(ctx, operand, &value, &symbol, &part);
+    if (known < 0) return invalid_operand(operand, line_no);
+    if (!known && pass == 1) ctx->relax_changed = 1;
+
+    // In object output, relocatable labels and imports (still undefined
+    // after the first pass) only get their address at link time
+    int reloc = ctx->object_mode && symbol >= 0 && (!known || ctx->symtab.symbols[symbol].section >= 0);
+    int settled_reloc = reloc && (known || pass > 1);
+
+    // Narrow to zero page while the value fits; forward references start
+    // out optimistic except in single pass mode where they cannot shrink
+    addr_mode_t zp = zero_page_form(mode);
+    int narrowed = 0, wide = idx;
+    if (zp != mode && !(*state & RELAX_LONG) && find_instruction(mnemonic, zp) >= 0) {
+        if (!settled_reloc && (known ? value >= 0 && value <= 0xFF : !ctx->one_pass)) {
+            mode = zp;
+            idx = find_instruction(mnemonic, zp);
+            narrowed = 1;
+        } else {
+            *state |= RELAX_LONG;
+            if (pass > 1) ctx->relax_changed = 1;
+        }
+    }
+
+    // Branches that cannot reach become an inverted branch over a JMP, as
+    // do branches whose distance is only fixed at link time
+    int cur_rel = ctx->sections[ctx->cur_section].relocatable ? ctx->cur_section : -1;
+    if (mode == REL && !ctx->one_pass && !(*state & RELAX_FAR) && (known || settled_reloc)) {
+        int offset = value - (ctx->program_counter + 2);
+        if (offset < -128 || offset > 127 || (known ? symbol_section(ctx, symbol) : -2) != cur_rel) {
+            *state |= RELAX_FAR;
+            if (pass > 1) ctx->relax_changed = 1;
+        }
+    }
+    int far = mode == REL && (*state & RELAX_FAR);
+
+    int size = far ? 5 : get_instruction_bytes(mode);
+    ctx->line_instruction = idx;
+    ctx->line_far = far;
+    if (pass == ctx->last_pass) {
+        fixup_kind_t kind = mode == REL ? FIXUP_REL : part == '>' ? FIXUP_HI
+                          : size == 3 ? FIXUP_ABS : FIXUP_LO;
+        if (reloc && (mode != REL || far)) {
+            if (!add_reloc(ctx, far ? 3 : 1, far ? FIXUP_ABS : kind, symbol)) {
+                fprintf(stderr, "ERROR - out of memory\n");
+                return 1;
+            }
+        } else if (!known) {
+            // Only a single pass run can still see the definition later
+            if (!ctx->one_pass || symbol < 0 ||
+                !add_fixup(&ctx->symtab, symbol, kind, ctx->out_base + ctx->out->len + 1,
+                           ctx->program_counter, line_no)) {
+                fprintf(stderr, "ERROR - line %d: undefined symbol in %.*s\n", line_no,
+                        (int)operand.len, operand.ptr);
+                return 1;
+            }
+        } else if (mode == REL && !far) {
+            value -= ctx->program_counter + 2;
+            if (value < -128 || value > 127) {
+                fprintf(stderr, "ERROR - line %d: branch out of range\n", line_no);
+                return 1;
+            }
+        } else if (mode != written && zero_page_form(written) == mode && (value < 0 || value > 0xFF)) {
+            fprintf(stderr, "ERROR - line %d: zero page operand out of range: %.*s %.*s\n", line_no,
+                    (int)tok.mnemonic.len, tok.mnemonic.ptr, (int)operand.len, operand.ptr);
+            return 1;
+        }
+
+        if (narrowed) {
+            ctx->relax_stats.zero_page++;
+            ctx->relax_stats.bytes_saved++;
+            ctx->relax_stats.cycles_saved += instructions[wide].cycles - instructions[idx].cycles;
+        }
+
+        int ok;
+        if (far) {
+            ctx->relax_stats.branches_expanded++;
+            ok = buffer_push(ctx->out, instructions[idx].opcode ^ 0x20);
+            ok &= buffer_push(ctx->out, 3);
+            ok &= buffer_push(ctx->out, 0x4C);
+            ok &= buffer_push(ctx->out, value & 0xFF);
+            ok &= buffer_push(ctx->out, (value >> 8) & 0xFF);
+        } else {
+            ok = buffer_push(ctx->out, instructions[idx].opcode);
+            if (size > 1) ok &= buffer_push(ctx->out, value & 0xFF);
+            if (size > 2) ok &= buffer_push(ctx->out, (value >> 8) & 0xFF);
+        }
+        if (!ok) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            return 1;
+        }
+    }
+    ctx->program_counter += size;
+    return 0;
+}
+
+// Control transfers end a straight-line block
+static int ends_block(const instruction_t *ins) {
+    static const char *flow[] = { "JMP", "JSR", "RTS", "RTI", "BRK" };
+    if (ins->mode == REL) return 1;
+    for (size_t i = 0; i < sizeof(flow) / sizeof(flow[0]); i++) {
+        if (strcmp(ins->mnemonic, flow[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Listing entry for the line just assembled. A far branch costs 3-4 cycles
+// when the inverted branch skips the JMP, 2 + 3 when it falls through.
+static int list_line(asm6502_ctx *ctx, str_view_t text, int line_no, unsigned short pc, size_t offset) {
+    listing_line_t entry = { 0 };
+    entry.line = line_no;
+    entry.offset = offset;
+    entry.size = (int)(ctx->out_base + ctx->out->len - offset);
+    entry.address = entry.size ? pc : ctx->program_counter;
+    entry.instruction = ctx->line_instruction;
+    if (ctx->line_instruction >= 0) {
+        const instruction_t *ins = &instructions[ctx->line_instruction];
+        entry.min_cycles = ctx->line_far ? 3 : ins->cycles;
+        entry.max_cycles = ctx->line_far ? 5 : ins->cycles + ((ins->penalty & CYCLE_PAGE) ? 1 : 0)
+                                                      + ((ins->penalty & CYCLE_BRANCH) ? 2 : 0);
+        entry.ends_block = ends_block(ins);
+    }
+    const char *label = ctx->line_label >= 0 ? ctx->symtab.symbols[ctx->line_label].name : NULL;
+    return listing_add(ctx->listing, &entry, label, text.ptr, text.len);
+}
+
+// Move the unread part of the stream window to its start and fill the
+// rest; returns the number of bytes read
+static size_t refill_window(line_reader_t *reader) {
+    size_t left = reader->end - reader->pos;
+    memmove(reader->window, reader->pos, left);
+    size_t n = fread(reader->window + left, 1, STREAM_CHUNK - left, reader->in);
+    reader->pos = reader->window;
+    reader->end = reader->window + left + n;
+    return n;
+}
+
+// Next line, without its newline, and its fields; returns 0 at end of
+// input. The views stay valid until the next call.
+static int read_line(line_reader_t *reader, source_line_t *line, int *too_long) {
+    const char *eol;
+    *too_long = 0;
+
+    if (reader->lines) {
+        if (reader->next == reader->line_count) return 0;
+        *line = reader->lines[reader->next++];
+        return 1;
+    }
+    if (reader->pp) {
+        for (; reader->span < reader->pp->span_count; reader->span++, reader->next = 0) {
+            const pp_span_t *span = &reader->pp->spans[reader->span];
+            if (reader->next < span->count) {
+                *line = span->lines[reader->next++];
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (reader->discard) {
+        while (!(eol = memchr(reader->pos, '\n', reader->end - reader->pos))) {
+            reader->pos = reader->end;
+            if (!refill_window(reader)) return 0;
+        }
+        reader->pos = eol + 1;
+        reader->discard = 0;
+    }
+    while (!(eol = memchr(reader->pos, '\n', reader->end - reader->pos)) && reader->in) {
+        if (reader->end - reader->pos == STREAM_CHUNK) {
+            *too_long = 1;
+            reader->discard = 1;
+            break;
+        }
+        if (!refill_window(reader)) break;
+    }
+
+    const char *p = reader->pos;
+    if (p >= reader->end) return 0;
+    line->text.ptr = p;
+    line->text.len = eol ? (size_t)(eol - p) : (size_t)(reader->end - p);
+    line->line = ++reader->line_no;
+    line->file = 0;
+    reader->pos = eol ? eol + 1 : reader->end;
+    tokenize_line(line->text.ptr, line->text.len, &line->tokens);
+    return 1;
+}
 
-    // reset globals
-    symbol_count = 0;
-    program_counter = 0;
-    memset(hex_output, 0, sizeof(hex_output));
-    memset(binary, 0, sizeof(binary));
+// Write out everything that no pending fixup can still change
+static int flush_output(asm6502_ctx *ctx, FILE *sink, int final) {
+    size_t limit = final ? (size_t)-1 : oldest_pending_fixup(&ctx->symtab);
+    size_t end = ctx->out_base + ctx->out->len;
+    size_t n = limit == (size_t)-1 || limit > end ? ctx->out->len : limit - ctx->out_base;
+    if (n == 0) return 1;
+
+    byte_buffer_t head = *ctx->out;
+    head.len = n;
+    int ok = buffer_write_hex(&head, sink);
+    memmove(ctx->out->data, ctx->out->data + n, ctx->out->len - n);
+    ctx->out->len -= n;
+    ctx->out_base += n;
+    return ok;
+}
+
+// Multi-pass or single pass driver. With a sink, the output is flushed as
+// hex every OUTPUT_CHUNK bytes so memory stays bounded regardless of image
+// size; in single pass mode only bytes before the oldest pending fixup go.
+static int assemble_source(asm6502_ctx *ctx, line_reader_t *reader, byte_buffer_t *output, FILE *sink,
+                           int flags) {
+    int errors = 0;
+    source_line_t line;
+
+    // every run starts from a clean context
+    clear_symbols(&ctx->symtab);
+    ctx->out = output;
+    ctx->out_base = 0;
+    ctx->relax.len = 0;
+    memset(&ctx->relax_stats, 0, sizeof(ctx->relax_stats));
+
+    // Size instructions until symbol values and encodings reach a fixed
+    // point, then run the emitting pass with the settled layout
+    int settled = 0;
+    ctx->object_mode = (flags & ASM_OBJECT) != 0;
+    ctx->one_pass = !ctx->object_mode && (flags & ASM_ONE_PASS) != 0;
+    ctx->reloc_count = 0;
+    ctx->last_pass = ctx->one_pass ? 1 : 0;
+    for (int pass = 1; errors == 0; pass++) {
+        int too_long;
+        if (settled) {
+            ctx->last_pass = pass;
+        } else if (pass > MAX_RELAX_PASSES) {
+            fprintf(stderr, "ERROR - layout did not settle after %d passes\n", MAX_RELAX_PASSES);
+            errors++;
+            break;
+        }
+        report_phase(ctx, pass == ctx->last_pass ? ASM_PHASE_EMIT : ASM_PHASE_SIZE, 0);
+        rewind_reader(reader);
+        ctx->relax_pos = 0;
+        ctx->relax_changed = 0;
+        ctx->section_count = 0;
+        set_symbol_scope(&ctx->symtab, "");
+        if (!open_section(ctx, ctx->object_mode ? "text" : "code", 4, 0, ctx->object_mode)) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            errors++;
+            report_phase(ctx, pass == ctx->last_pass ? ASM_PHASE_EMIT : ASM_PHASE_SIZE, 1);
+            break;
+        }
+
+        while (read_line(reader, &line, &too_long)) {
+            if (too_long) {
+                fprintf(stderr, "ERROR - line %d: line too long\n", line.line);
+                errors++;
+            }
+            int listed = ctx->listing && pass == ctx->last_pass;
+            unsigned short pc = ctx->program_counter;
+            size_t offset = ctx->out_base + ctx->out->len;
+            ctx->line_instruction = ctx->line_label = -1;
+            int line_errors = assemble_line(ctx, &line.tokens, pass, line.line);
+            if (line_errors && line.file > 0) fprintf(stderr, "  in %s\n", reader->pp->files[line.file].path);
+            errors += line_errors;
+            if (listed && !list_line(ctx, line.text, line.line, pc, offset)) {
+                fprintf(stderr, "ERROR - out of memory\n");
+                errors++;
+            }
+
+            if (sink && ctx->out->len >= OUTPUT_CHUNK && !flush_output(ctx, sink, 0)) errors++;
+        }
+        ctx->relax_stats.passes = pass;
+        if (pass == ctx->last_pass) break;
+        report_phase(ctx, ASM_PHASE_SIZE, 1);
+        settled = !ctx->relax_changed;
+    }
+
+    for (int i = 0; i < ctx->section_count; i++) {
+        size_t end = i + 1 < ctx->section_count ? ctx->sections[i + 1].offset
+                                                : ctx->out_base + ctx->out->len;
+        ctx->sections[i].size = end - ctx->sections[i].offset;
+    }
+
+    // Anything still chained was never defined
+    for (int f = 0; f < ctx->symtab.fixup_count; f++) {
+        if (ctx->symtab.fixups[f].symbol >= 0) {
+            fprintf(stderr, "ERROR - line %d: undefined symbol %s\n",
+                    ctx->symtab.fixups[f].line, ctx->symtab.symbols[ctx->symtab.fixups[f].symbol].name);
+            errors++;
+        }
+    }
+
+    if (ctx->listing) listing_capture(ctx->listing, ctx->out);
+    if (sink && !flush_output(ctx, sink, 1)) errors++;
+    if (ctx->relax_stats.passes == ctx->last_pass) report_phase(ctx, ASM_PHASE_EMIT, 1);
+    return errors;
+}
+
+// Every line of a source that can be rewound, tokenized into one array;
+// the views still point into the source. NULL when out of memory.
+static source_line_t* collect_lines(line_reader_t *reader, int *count) {
+    source_line_t *lines = NULL, line;
+    int cap = 0, too_long;
+
+    *count = 0;
+    rewind_reader(reader);
+    while (read_line(reader, &line, &too_long)) {
+        if (*count == cap) {
+            source_line_t *grown = realloc(lines, (cap ? cap * 2 : 256) * sizeof(source_line_t));
+            if (!grown) {
+                free(lines);
+                return NULL;
+            }
+            lines = grown;
+            cap = cap ? cap * 2 : 256;
+        }
+        lines[(*count)++] = line;
+    }
+    return lines ? lines : malloc(sizeof(source_line_t));
+}
+
+// -O: assemble to decode every line, apply the peephole rules to the
+// tokenized lines and repeat while they still apply, then assemble the
+// result. Rewritten lines keep their file and line number.
+static int assemble_optimized(asm6502_ctx *ctx, line_reader_t *reader, byte_buffer_t *output, FILE *sink,
+                              int flags) {
+    peephole_stats_t stats;
+    listing_t *requested = ctx->listing;
+    arena_t strings;
+    int count, errors = 0;
+    source_line_t *program = collect_lines(reader, &count);
+    if (!program) {
+        fprintf(stderr, "ERROR - out of memory\n");
+        return 1;
+    }
+    line_reader_t lines = array_reader(program, count, reader->pp);
+
+    memset(&stats, 0, sizeof(stats));
+    arena_init(&strings);
+    flags &= ~ASM_OPTIMIZE;
+    for (int round = 0; round < MAX_PEEPHOLE_ROUNDS && errors == 0; round++) {
+        listing_t decoded;
+        byte_buffer_t scratch;
+
+        listing_init(&decoded);
+        buffer_init(&scratch);
+        ctx->listing = &decoded;
+        errors = assemble_source(ctx, &lines, &scratch, NULL, flags);
+        ctx->listing = requested;
+        int rewrites = errors ? 0 : peephole_optimize(&decoded, program, &strings, &stats);
+        listing_free(&decoded);
+        buffer_free(&scratch);
+        if (rewrites < 0) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            errors++;
+        }
+        if (rewrites <= 0) break;
+    }
+
+    if (errors == 0) {
+        errors = assemble_source(ctx, &lines, output, sink, flags);
+        ctx->relax_stats.peephole = stats;
+    }
+    arena_free(&strings);
+    free(program);
+    return errors;
+}
+
+// Sources in memory: macros, repeats and includes are expanded once per
+// run and every pass replays the tokenized program. Optimization also
+// needs a source it can read more than once.
+static int assemble_text(asm6502_ctx *ctx, line_reader_t *reader, byte_buffer_t *output, FILE *sink,
+                         int flags) {
+    preproc_t pp;
+    line_reader_t program;
+    int errors = 0;
+    report_phase(ctx, ASM_PHASE_PREPROCESS, 0);
+    int preprocess = pp_needed(reader->text, reader->end - reader->text);
+
+    if (preprocess) {
+        pp_init(&pp, ctx->source_name);
+        errors = pp_expand(&pp, reader->text, reader->end - reader->text);
+        program = program_reader(&pp);
+        reader = &program;
+    }
+    report_phase(ctx, ASM_PHASE_PREPROCESS, 1);
+    if (errors == 0) {
+        if (flags & ASM_OPTIMIZE) errors = assemble_optimized(ctx, reader, output, sink, flags);
+        else errors = assemble_source(ctx, reader, output, sink, flags);
+    }
+    if (preprocess) pp_free(&pp);
+    return errors;
+}
+
+// Package the sections, exported and imported symbols and relocations of
+// the last run into an object
+static int build_object(asm6502_ctx *ctx, object_t *obj) {
+    int errors = 0;
+    int *map = malloc((ctx->symtab.count ? ctx->symtab.count : 1) * sizeof(int));
+    if (!map) return 1;
+
+    if (ctx->section_count > OBJ_MAX_SECTIONS) {
+        fprintf(stderr, "ERROR - more than %d sections\n", OBJ_MAX_SECTIONS);
+        errors++;
+    }
+    for (int i = 0; i < ctx->section_count; i++) {
+        const section_t *sec = &ctx->sections[i];
+        if (sec->size > OBJ_MAX_SECTION) {
+            fprintf(stderr, "ERROR - section %s larger than %d bytes\n", sec->name, OBJ_MAX_SECTION);
+            errors++;
+        }
+        if (strlen(sec->name) > OBJ_MAX_SECTION_NAME) {
+            fprintf(stderr, "ERROR - section name %.20s... longer than %d bytes\n", sec->name, OBJ_MAX_SECTION_NAME);
+            errors++;
+        }
+        if (object_add_section(obj, sec->name, sec->org, sec->relocatable,
+                               ctx->out->data + sec->offset, sec->size) < 0) errors++;
+    }
+
+    for (int i = 0; i < ctx->symtab.count; i++) map[i] = -1;
+    for (int i = 0; i < ctx->reloc_count; i++) map[ctx->relocs[i].symbol] = 0;
+    for (int i = 0; i < ctx->symtab.count && errors == 0; i++) {
+        const symbol_t *sym = &ctx->symtab.symbols[i];
+        if (!sym->exported && map[i] < 0) continue;
+        if (sym->exported && !sym->defined) {
+            fprintf(stderr, "ERROR - exported symbol %s is not defined\n", sym->name);
+            errors++;
+            continue;
+        }
+        if (obj->symbol_count == OBJ_MAX_SYMBOLS) {
+            fprintf(stderr, "ERROR - more than %d symbols\n", OBJ_MAX_SYMBOLS);
+            errors++;
+            break;
+        }
+        if (strlen(sym->name) > OBJ_MAX_SYMBOL_NAME) {
+            fprintf(stderr, "ERROR - symbol name %.20s... longer than %d bytes\n", sym->name, OBJ_MAX_SYMBOL_NAME);
+            errors++;
+            continue;
+        }
+        int section = !sym->defined ? OBJ_IMPORT : sym->section >= 0 ? sym->section : OBJ_ABSOLUTE;
+        map[i] = object_add_symbol(obj, sym->name, section, sym->address, sym->exported ? OBJ_EXPORT : 0);
+        if (map[i] < 0) errors++;
+    }
+
+    for (int i = 0; i < ctx->reloc_count && errors == 0; i++) {
+        const obj_reloc_t *rel = &ctx->relocs[i];
+        if (object_add_reloc(obj, rel->section, rel->offset, rel->kind, map[rel->symbol]) < 0) errors++;
+    }
+    free(map);
+    if (errors) fprintf(stderr, "ERROR - could not build object\n");
+    return errors;
+}
+
+asm6502_ctx* asm6502_create(int flags) {
+    asm6502_ctx *ctx = calloc(1, sizeof(asm6502_ctx));
+    if (!ctx) return NULL;
+    ctx->flags = flags;
+    symbols_init(&ctx->symtab);
+    buffer_init(&ctx->relax);
+    return ctx;
+}
+
+// Forget the symbols and statistics of the last run; the tables keep their
+// capacity for the next one
+void asm6502_reset(asm6502_ctx *ctx) {
+    clear_symbols(&ctx->symtab);
+    ctx->relax.len = 0;
+    ctx->section_count = 0;
+    ctx->reloc_count = 0;
+    memset(&ctx->relax_stats, 0, sizeof(ctx->relax_stats));
+}
+
+void asm6502_destroy(asm6502_ctx *ctx) {
+    if (!ctx) return;
+    reset_symbols(&ctx->symtab);
+    buffer_free(&ctx->relax);
+    free(ctx->sections);
+    free(ctx->relocs);
+    free(ctx);
+}
+
+const asm_stats_t* asm6502_stats(const asm6502_ctx *ctx) {
+    return &ctx->relax_stats;
+}
+
+const symbol_table_t* asm6502_symbols(const asm6502_ctx *ctx) {
+    return &ctx->symtab;
+}
+
+void asm6502_set_source_name(asm6502_ctx *ctx, const char *path) {
+    ctx->source_name = path;
+}
+
+void asm6502_set_phase_hook(asm6502_ctx *ctx, asm_phase_hook_t hook, void *arg) {
+    ctx->phase_hook = hook;
+    ctx->phase_arg = arg;
+}
+
+int assemble_6502_ex(asm6502_ctx *ctx, const char *src, size_t len, byte_buffer_t *out_buf) {
+    line_reader_t reader = text_reader(src, len);
+    return assemble_text(ctx, &reader, out_buf, NULL, ctx->flags & ~ASM_OBJECT);
+}
+
+int assemble_6502_stream_ex(asm6502_ctx *ctx, const char *src, size_t len, FILE *sink) {
+    line_reader_t reader = text_reader(src, len);
+    byte_buffer_t output;
+    buffer_init(&output);
+    buffer_reserve(&output, OUTPUT_CHUNK + 3);
+    int errors = assemble_text(ctx, &reader, &output, sink, ctx->flags & ~ASM_OBJECT);
+    buffer_free(&output);
+    return errors;
+}
+
+int assemble_6502_file_ex(asm6502_ctx *ctx, FILE *in, FILE *sink) {
+    char *window = malloc(STREAM_CHUNK);
+    if (!window) {
+        fprintf(stderr, "ERROR - out of memory\n");
+        return 1;
+    }
+    line_reader_t reader = { NULL, window, window, in, window, 0, NULL, 0, 0, 0, NULL, 0 };
+    byte_buffer_t output;
+    buffer_init(&output);
+    buffer_reserve(&output, OUTPUT_CHUNK + 3);
+    int errors = assemble_source(ctx, &reader, &output, sink, ASM_ONE_PASS);
+    buffer_free(&output);
+    free(window);
+    return errors;
+}
+
+int assemble_6502_object_ex(asm6502_ctx *ctx, const char *src, size_t len, object_t *obj) {
+    line_reader_t reader = text_reader(src, len);
+    byte_buffer_t output;
+    buffer_init(&output);
+
+    object_init(obj);
+    int errors = assemble_text(ctx, &reader, &output, NULL, ASM_OBJECT);
+    if (errors == 0) errors = build_object(ctx, obj);
+    buffer_free(&output);
+    return errors;
+}
+
+int assemble_6502_image_ex(asm6502_ctx *ctx, const char *src, size_t len, object_t *image, listing_t *listing) {
+    line_reader_t reader = text_reader(src, len);
+    byte_buffer_t output;
+    buffer_init(&output);
+
+    object_init(image);
+    ctx->listing = listing;
+    int errors = assemble_text(ctx, &reader, &output, NULL, ctx->flags & ~ASM_OBJECT);
+    ctx->listing = NULL;
+    for (int i = 0; i < ctx->section_count && errors == 0; i++) {
+        const section_t *sec = &ctx->sections[i];
+        if (sec->size == 0) continue;
+        if (object_add_section(image, sec->name, sec->org, 0, output.data + sec->offset, sec->size) < 0) {
+            fprintf(stderr, "ERROR - out of memory\n");
+            errors++;
+        }
+    }
+    buffer_free(&output);
+    return errors;
+}
+
+// Context behind the original entry points, which are therefore not
+// reentrant; created on first use
+static asm6502_ctx *shared_ctx;
+
+static asm6502_ctx* shared_context(int flags) {
+    if (!shared_ctx && !(shared_ctx = asm6502_create(0))) {
+        fprintf(stderr, "ERROR - out of memory\n");
+        return NULL;
+    }
+    shared_ctx->flags = flags;
+    return shared_ctx;
+}
+
+int assemble_6502_bytes(char* assembly_code, byte_buffer_t *output, int flags) {
+    asm6502_ctx *ctx = shared_context(flags);
+    return ctx ? assemble_6502_ex(ctx, assembly_code, strlen(assembly_code), output) : 1;
+}
+
+int assemble_6502_stream(char* assembly_code, FILE *sink, int flags) {
+    asm6502_ctx *ctx = shared_context(flags);
+    return ctx ? assemble_6502_stream_ex(ctx, assembly_code, strlen(assembly_code), sink) : 1;
+}
+
+int assemble_6502_file(FILE *in, FILE *sink) {
+    asm6502_ctx *ctx = shared_context(ASM_ONE_PASS);
+    return ctx ? assemble_6502_file_ex(ctx, in, sink) : 1;
+}
+
+int assemble_6502_object(char* assembly_code, object_t *obj) {
+    asm6502_ctx *ctx = shared_context(ASM_OBJECT);
+    object_init(obj);
+    return ctx ? assemble_6502_object_ex(ctx, assembly_code, strlen(assembly_code), obj) : 1;
+}
+
+int assemble_6502_listing(char* assembly_code, object_t *image, int flags, listing_t *listing) {
+    asm6502_ctx *ctx = shared_context(flags);
+    object_init(image);
+    return ctx ? assemble_6502_image_ex(ctx, assembly_code, strlen(assembly_code), image, listing) : 1;
+}
+
+int assemble_6502_image(char* assembly_code, object_t *image, int flags) {
+    return assemble_6502_listing(assembly_code, image, flags, NULL);
+}
+
+const asm_stats_t* assemble_6502_stats(void) {
+    static const asm_stats_t none;
+    return shared_ctx ? asm6502_stats(shared_ctx) : &none;
+}
+
+char* assemble_6502(char* assembly_code) {
+    byte_buffer_t output;
+    buffer_init(&output);
 
-    // ... rest of the two-pass logic here ...
+    char *hex_output = NULL;
+    if (assemble_6502_bytes(assembly_code, &output, 0) == 0) {
+        hex_output = buffer_to_hex(&output);
+    }
+    buffer_free(&output);
+    return hex_output;
 }
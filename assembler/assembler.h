@@ -1,6 +1,103 @@
 #ifndef ASSEMBLER_H
 #define ASSEMBLER_H
 
+#include <stdio.h>
+#include "buffer.h"
+#include "object.h"
+#include "listing.h"
+#include "peephole.h"
+#include "symbols.h"
+
+// Part of object cache keys; bump when the encoding or object format changes
+#define ASM_VERSION "6502as 0.8"
+
+// Flags
+#define ASM_ONE_PASS 0x01   // emit immediately, patch forward references via fixups
+#define ASM_OBJECT   0x02   // relocatable sections, exports, imports and relocations
+#define ASM_OPTIMIZE 0x04   // peephole rewrites before encoding; not for streams or objects
+
+// Relaxation results of the last run
+typedef struct {
+    int passes;
+    int zero_page;          // operands narrowed to zero page
+    int bytes_saved;
+    int cycles_saved;       // per execution, ignoring page crossings
+    int branches_expanded;  // out of range branches rewritten as Bcc/JMP
+    peephole_stats_t peephole;  // with ASM_OPTIMIZE
+} asm_stats_t;
+
+// Phases of a run, in order. Sizing and emitting passes read and tokenize
+// the lines they assemble unless the preprocessor already did; with
+// ASM_OPTIMIZE the passes of every peephole round are reported too.
+typedef enum {
+    ASM_PHASE_PREPROCESS,   // sources in memory: macros, repeats and includes
+    ASM_PHASE_SIZE,         // relaxation passes until the layout settles
+    ASM_PHASE_EMIT,         // the emitting pass and the undefined symbol check
+    NUM_ASM_PHASES
+} asm_phase_t;
+
+// Called at the start (end == 0) and end of every phase, for profiling
+typedef void (*asm_phase_hook_t)(asm_phase_t phase, int end, void *arg);
+
+// Reentrant assembler: all state of a run lives in its context, so
+// different contexts can assemble on different threads at the same time
+typedef struct asm6502_ctx asm6502_ctx;
+
+asm6502_ctx* asm6502_create(int flags);
+void asm6502_reset(asm6502_ctx *ctx);
+void asm6502_destroy(asm6502_ctx *ctx);
+const asm_stats_t* asm6502_stats(const asm6502_ctx *ctx);
+const symbol_table_t* asm6502_symbols(const asm6502_ctx *ctx);
+
+// Path of the source assembled next, kept by reference; .include paths are
+// relative to its directory, or to the working directory when NULL
+void asm6502_set_source_name(asm6502_ctx *ctx, const char *path);
+
+// Hook called around the phases of the following runs, NULL for none
+void asm6502_set_phase_hook(asm6502_ctx *ctx, asm_phase_hook_t hook, void *arg);
+
+// Assemble len bytes of source with the flags of the context; these return
+// the number of errors. out_buf is appended to and owned by the caller.
+int assemble_6502_ex(asm6502_ctx *ctx, const char *src, size_t len, byte_buffer_t *out_buf);
+int assemble_6502_stream_ex(asm6502_ctx *ctx, const char *src, size_t len, FILE *sink);
+int assemble_6502_file_ex(asm6502_ctx *ctx, FILE *in, FILE *sink);
+int assemble_6502_object_ex(asm6502_ctx *ctx, const char *src, size_t len, object_t *obj);
+int assemble_6502_image_ex(asm6502_ctx *ctx, const char *src, size_t len, object_t *image, listing_t *listing);
+
+// One source of a batch; output and errors are filled in
+typedef struct {
+    const char *src;
+    size_t len;
+    byte_buffer_t output;   // initialized by the batch, freed by the caller
+    int errors;
+} asm6502_job_t;
+
+// Assemble jobs on up to 'threads' workers with one context each; returns
+// the number of jobs with errors
+int assemble_6502_batch(asm6502_job_t *jobs, int count, int threads, int flags);
+
+// The functions below share one context and must not be called
+// concurrently
+
+// Returns a heap allocated "XX XX ..." hex string (caller frees), NULL on error
 char* assemble_6502(char* assembly_code);
 
+// These return the number of errors; output is unbounded in size
+int assemble_6502_bytes(char* assembly_code, byte_buffer_t *out, int flags);
+int assemble_6502_stream(char* assembly_code, FILE *sink, int flags);
+
+// Single pass over a stream that cannot be rewound, e.g. stdin
+int assemble_6502_file(FILE *in, FILE *sink);
+
+// Relocatable object for the link step; returns the number of errors
+int assemble_6502_object(char* assembly_code, object_t *obj);
+
+// Absolute image with one section per .org, in source order
+int assemble_6502_image(char* assembly_code, object_t *image, int flags);
+
+// assemble_6502_image that also fills a listing with per line bytes and cycles
+int assemble_6502_listing(char* assembly_code, object_t *image, int flags, listing_t *listing);
+
+const asm_stats_t* assemble_6502_stats(void);
+
 #endif
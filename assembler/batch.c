@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include "assembler.h"
+#include "pool.h"
+
+typedef struct {
+    asm6502_job_t *jobs;
+    asm6502_ctx **contexts;     // one per worker, created on first use
+    int flags;
+} batch_t;
+
+static int assemble_job(int index, int worker, void *arg) {
+    batch_t *batch = arg;
+    asm6502_job_t *job = &batch->jobs[index];
+
+    if (!batch->contexts[worker] && !(batch->contexts[worker] = asm6502_create(batch->flags))) {
+        job->errors = 1;
+        return 1;
+    }
+    job->errors = assemble_6502_ex(batch->contexts[worker], job->src, job->len, &job->output);
+    return job->errors != 0;
+}
+
+int assemble_6502_batch(asm6502_job_t *jobs, int count, int threads, int flags) {
+    batch_t batch = { jobs, NULL, flags };
+    if (threads < 1) threads = 1;
+
+    for (int i = 0; i < count; i++) {
+        buffer_init(&jobs[i].output);
+        jobs[i].errors = 0;
+    }
+    if (!(batch.contexts = calloc(threads, sizeof(asm6502_ctx *)))) return count;
+
+    int failed = run_pool(count, threads, assemble_job, &batch);
+    for (int t = 0; t < threads; t++) asm6502_destroy(batch.contexts[t]);
+    free(batch.contexts);
+    return failed;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "assembler.h"
+#include "pool.h"
+
+// Batch throughput from 1 to 16 threads: many mid-sized sources with
+// labels, forward references and zero page relaxation, as a build server
+// would see them. Every run must produce the single-thread output.
+
+#define SOURCES 256
+#define ROUTINES 64
+#define MAX_THREADS 16
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* make_source(int seed, size_t *len) {
+    char *src = malloc(ROUTINES * 256);
+    char *p = src;
+    if (!src) return NULL;
+    p += sprintf(p, "        .ORG $%04X\n", 0x0800 + (seed & 0xFF) * 16);
+    for (int r = 0; r < ROUTINES; r++) {
+        p += sprintf(p, "r%d:     LDX #%d\n", r, (seed + r) & 0xFF);
+        p += sprintf(p, ".loop:  LDA table%d,X\n", (r + 1) % ROUTINES);
+        p += sprintf(p, "        STA $%02X\n", (seed * 7 + r) & 0xFF);
+        p += sprintf(p, "        ADC $%04X,Y\n", 0x0200 + r);
+        p += sprintf(p, "        DEX\n");
+        p += sprintf(p, "        BNE .loop\n");
+        p += sprintf(p, "        JSR r%d\n", (r + 7) % ROUTINES);
+        p += sprintf(p, "        RTS\n");
+        p += sprintf(p, "table%d: LDA $%02X\n", r, r);
+    }
+    *len = p - src;
+    return src;
+}
+
+int main(void) {
+    asm6502_job_t jobs[SOURCES], reference[SOURCES];
+    char *sources[SOURCES];
+
+    for (int i = 0; i < SOURCES; i++) {
+        if (!(sources[i] = make_source(i, &jobs[i].len))) {
+            perror("bench_batch");
+            return 1;
+        }
+        jobs[i].src = sources[i];
+        reference[i] = jobs[i];
+    }
+
+    if (assemble_6502_batch(reference, SOURCES, 1, 0) != 0) {
+        fprintf(stderr, "bench_batch: assembly failed\n");
+        return 1;
+    }
+
+    double base = 0;
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        double start = now();
+        int failed = assemble_6502_batch(jobs, SOURCES, threads, 0);
+        double t = now() - start;
+        if (threads == 1) base = t;
+
+        for (int i = 0; i < SOURCES && failed == 0; i++) {
+            failed += jobs[i].output.len != reference[i].output.len ||
+                      memcmp(jobs[i].output.data, reference[i].output.data, jobs[i].output.len) != 0;
+        }
+        if (failed) {
+            fprintf(stderr, "bench_batch: %d sources differ with %d threads\n", failed, threads);
+            return 1;
+        }
+        printf("bench_batch: %2d threads on %d cores, %d sources, %.1f ms, %.0f sources/s, %.2fx\n",
+               threads, default_jobs(), SOURCES, t * 1e3, SOURCES / t, base / t);
+        for (int i = 0; i < SOURCES; i++) buffer_free(&jobs[i].output);
+    }
+
+    for (int i = 0; i < SOURCES; i++) {
+        buffer_free(&reference[i].output);
+        free(sources[i]);
+    }
+    return 0;
+}
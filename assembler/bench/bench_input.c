@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "assembler.h"
+#include "source.h"
+
+// Memory and time to assemble a large generated source read three ways:
+// a private heap copy (fread), a read-only mapping (source_open) and the
+// single pass stream reader. Each runs in its own process so peak RSS is
+// per reader; the copy shows up as anonymous memory, the mapping as file
+// pages shared with the page cache.
+
+#define SOURCE_MB 32
+#define LABEL_EVERY 16
+
+typedef enum { READ_COPY, READ_MMAP, READ_STREAM, NUM_READERS } reader_t;
+
+static const char *reader_names[NUM_READERS] = { "fread copy", "mmap", "stdin stream" };
+
+typedef struct {
+    int errors;
+    double seconds;
+    long peak_kb;           // VmHWM
+    long anon_kb;           // RssAnon and RssFile once assembled
+    long file_kb;
+} result_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Backward references only, so the single pass reader needs no fixups
+static long write_source(FILE *f, size_t size) {
+    long lines = 0;
+    size_t written = 0;
+    while (written < size) {
+        int n;
+        if (lines % LABEL_EVERY == 0) {
+            n = fprintf(f, "l%ld:  LDA #$%02lX          ; entry %ld\n", lines, lines & 0xFF, lines);
+        } else if (lines % LABEL_EVERY == LABEL_EVERY - 1) {
+            n = fprintf(f, "        JMP l%ld         ; back to the label\n", lines - LABEL_EVERY + 1);
+        } else {
+            n = fprintf(f, "        STA $%04lX,X       ; store %ld\n", 0x0200 + (lines & 0x3FFF), lines);
+        }
+        if (n < 0) return -1;
+        written += n;
+        lines++;
+    }
+    return lines;
+}
+
+static void read_status(result_t *r) {
+    char line[256];
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "VmHWM: %ld", &r->peak_kb);
+        sscanf(line, "RssAnon: %ld", &r->anon_kb);
+        sscanf(line, "RssFile: %ld", &r->file_kb);
+    }
+    fclose(f);
+}
+
+static result_t run_reader(reader_t reader, const char *path, FILE *sink) {
+    result_t r = { 1, 0, 0, 0, 0 };
+    asm6502_ctx *ctx = asm6502_create(0);
+    if (!ctx) return r;
+
+    double start = now();
+    if (reader == READ_COPY) {
+        FILE *f = fopen(path, "rb");
+        if (!f) return r;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        char *text = malloc(size + 1);
+        if (!text || fread(text, 1, size, f) != (size_t)size) return r;
+        text[size] = '\0';
+        fclose(f);
+        r.errors = assemble_6502_stream_ex(ctx, text, size, sink);
+        read_status(&r);
+        free(text);
+    } else if (reader == READ_MMAP) {
+        source_t src;
+        if (!source_open(&src, path)) return r;
+        r.errors = assemble_6502_stream_ex(ctx, src.text, src.len, sink);
+        read_status(&r);
+        source_close(&src);
+    } else {
+        FILE *f = fopen(path, "rb");
+        if (!f) return r;
+        r.errors = assemble_6502_file_ex(ctx, f, sink);
+        read_status(&r);
+        fclose(f);
+    }
+    r.seconds = now() - start;
+    asm6502_destroy(ctx);
+    return r;
+}
+
+// Fork so that every reader starts from a fresh peak RSS
+static int measure(reader_t reader, const char *path, FILE *sink, result_t *r) {
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        close(fds[0]);
+        result_t child = run_reader(reader, path, sink);
+        fflush(sink);
+        _exit(write(fds[1], &child, sizeof(child)) == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    int ok = read(fds[0], r, sizeof(*r)) == sizeof(*r);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(void) {
+    char path[] = "/tmp/bench_inputXXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    FILE *sink = fopen("/dev/null", "w");
+    if (!f || !sink) {
+        perror("bench_input");
+        return 1;
+    }
+    long lines = write_source(f, (size_t)SOURCE_MB << 20);
+    if (fclose(f) != 0 || lines < 0) {
+        perror("bench_input");
+        unlink(path);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int reader = 0; reader < NUM_READERS; reader++) {
+        result_t r;
+        if (!measure(reader, path, sink, &r) || r.errors) {
+            fprintf(stderr, "bench_input: %s failed\n", reader_names[reader]);
+            failed = 1;
+            continue;
+        }
+        printf("bench_input: %-12s %d MB, %ld lines, %.3f s, %.2f MB/s, peak RSS %.1f MB "
+               "(anon %.1f MB, file %.1f MB)\n",
+               reader_names[reader], SOURCE_MB, lines, r.seconds, SOURCE_MB / r.seconds,
+               r.peak_kb / 1024.0, r.anon_kb / 1024.0, r.file_kb / 1024.0);
+    }
+    fclose(sink);
+    unlink(path);
+    return failed;
+}
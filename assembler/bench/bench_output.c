@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "assembler.h"
+
+// Throughput of the streaming output path on a full 64 KB image
+
+#define IMAGE_SIZE 65535
+#define RUNS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    // 21845 three byte instructions fill 65535 bytes
+    int lines = IMAGE_SIZE / 3;
+    char *src = malloc((size_t)lines * 16 + 1);
+    if (!src) {
+        perror("bench_output");
+        return 1;
+    }
+    char *p = src;
+    for (int i = 0; i < lines; i++) {
+        p += sprintf(p, "STA $%04X\n", 0x200 + (i & 0x3FFF));
+    }
+
+    FILE *sink = fopen("/dev/null", "w");
+    if (!sink) {
+        perror("bench_output");
+        return 1;
+    }
+
+    for (int flags = 0; flags <= ASM_ONE_PASS; flags++) {
+        double best = 1e9;
+        for (int r = 0; r < RUNS; r++) {
+            double start = now();
+            if (assemble_6502_stream(src, sink, flags) != 0) {
+                fprintf(stderr, "bench_output: assembly failed\n");
+                return 1;
+            }
+            double t = now() - start;
+            if (t < best) best = t;
+        }
+
+        printf("bench_output: %s, %d lines, %d bytes, best %.3f ms, %.2f MB/s\n",
+               flags ? "one pass" : "two pass", lines, lines * 3, best * 1e3, lines * 3 / best / 1e6);
+    }
+    fclose(sink);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,560 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "assembler.h"
+#include "buffer.h"
+#include "lexer.h"
+#include "source.h"
+#include "types.h"
+#include "utils.h"
+
+// Time the phases of assemble_6502() on a generated program: reading the
+// source, the preprocessor scan, the sizing passes, the emitting pass and
+// the hex output. The assembler reports its own phases through a hook, so
+// every phase is the real code and together they make up the whole run.
+// Tokenizing and detect_addressing_mode happen line by line inside every
+// pass; one pass of each over the corpus is timed apart as a breakdown.
+// The makefile links this with -Wl,--wrap for malloc, calloc, realloc and
+// free to count the heap calls of every phase, and the growth of the
+// resident set is taken around each phase.
+//
+// The corpus is set on the command line, -g prints it instead of timing
+// it, and -j writes the results as JSON for regression tracking.
+
+#define DEFAULT_LINES 200000
+#define DEFAULT_REPS 5
+#define CORPUS_ORG 0x0800       // labels never fit in zero page
+#define SEGMENT_LINES 16384     // lines per .ORG, at most 48 KB of code
+#define LABEL_WINDOW 64         // labels to either side a reference picks from
+#define BRANCH_LINES 40         // 40 lines of at most 3 bytes stay in branch range
+#define COMMENT_EVERY 4
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+static long mallocs, reallocs, frees;
+
+void *__wrap_malloc(size_t size) { mallocs++; return __real_malloc(size); }
+void *__wrap_calloc(size_t n, size_t size) { mallocs++; return __real_calloc(n, size); }
+void *__wrap_realloc(void *p, size_t size) { reallocs++; return __real_realloc(p, size); }
+void __wrap_free(void *p) { if (p) frees++; __real_free(p); }
+
+// The assembler's phases in asm_phase_t order, between read and output
+typedef enum {
+    PHASE_READ, PHASE_PREPROCESS, PHASE_SIZE, PHASE_EMIT, PHASE_OUTPUT, NUM_PHASES
+} phase_t;
+
+static const char *phase_names[NUM_PHASES] = {
+    "read", "preprocess", "size", "emit", "output"
+};
+
+// Library routines run once over the corpus by every pass
+typedef enum {
+    PART_TOKENIZE, PART_DETECT, NUM_PARTS
+} part_t;
+
+static const char *part_names[NUM_PARTS] = {
+    "tokenize_line", "detect_addressing_mode"
+};
+
+static const char *mode_names[NUM_ADDR_MODES] = {
+    "imp", "imm", "zpg", "zpx", "zpy", "abs", "abx", "aby", "ind", "izx", "izy", "rel"
+};
+
+// Mnemonics the generator picks from for each addressing mode
+static const char *mode_mnemonics[NUM_ADDR_MODES][16] = {
+    [IMP] = { "NOP", "INX", "INY", "DEX", "DEY", "CLC", "SEC", "TAX", "TAY", "TXA", "TYA", "PHA", "PLA", "RTS" },
+    [IMM] = { "LDA", "LDX", "LDY", "CMP", "ADC", "SBC", "AND", "ORA", "EOR", "CPX" },
+    [ZPG] = { "LDA", "STA", "LDX", "STX", "INC", "DEC", "BIT" },
+    [ZPX] = { "LDA", "STA", "INC", "ADC", "LDY", "STY" },
+    [ZPY] = { "LDX", "STX" },
+    [ABS] = { "LDA", "STA", "JSR", "JMP", "INC", "LDX", "BIT" },
+    [ABX] = { "LDA", "STA", "ADC", "INC", "LDY", "CMP" },
+    [ABY] = { "LDA", "STA", "LDX", "CMP", "ORA" },
+    [IND] = { "JMP" },
+    [IZX] = { "LDA", "STA", "ORA" },
+    [IZY] = { "LDA", "STA", "EOR", "ADC" },
+    [REL] = { "BNE", "BEQ", "BCC", "BCS", "BPL", "BMI", "BVC", "BVS" },
+};
+
+static const int default_mix[NUM_ADDR_MODES] = { 12, 18, 14, 4, 1, 20, 8, 4, 1, 2, 6, 10 };
+
+typedef struct {
+    long lines;
+    double label_density;   // share of lines with a label
+    double forward_ratio;   // share of label references to a later line
+    int mix[NUM_ADDR_MODES];
+    unsigned long seed;
+} corpus_config_t;
+
+typedef struct {
+    double seconds;         // of the fastest run
+    long mallocs;           // heap calls of the first run
+    long reallocs;
+    long frees;
+    long rss_kb;            // resident set growth in the first run
+} phase_result_t;
+
+typedef struct {
+    phase_result_t phases[NUM_PHASES];
+    phase_result_t total;   // the whole run, peak resident set in rss_kb
+    phase_result_t parts[NUM_PARTS];
+    int passes;
+    long output_bytes;
+    unsigned long hash;     // of the hex output
+} result_t;
+
+// Counters at the start of the phase running now
+typedef struct {
+    phase_result_t *phases;
+    double start;
+    long mallocs, reallocs, frees, rss_kb;
+} probe_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_kb(void) {
+    char line[256];
+    long kb = 0;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) sscanf(line, "VmHWM: %ld", &kb);
+    fclose(f);
+    return kb;
+}
+
+static unsigned long next_random(unsigned long *seed) {
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    return *seed >> 33;
+}
+
+static double next_uniform(unsigned long *seed) {
+    return (next_random(seed) & 0xFFFFFF) / 16777216.0;
+}
+
+static unsigned long hash_text(const char *s) {
+    unsigned long h = 14695981039346656037UL;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211UL;
+    return h;
+}
+
+// Whether line i may refer to a label on the given line: only within its
+// segment, and close enough for a branch to reach
+static int in_reach(long line, long i, int branch) {
+    if (line / SEGMENT_LINES != i / SEGMENT_LINES) return 0;
+    return !branch || labs(line - i) <= BRANCH_LINES;
+}
+
+// Label line a reference from line i goes to, or -1. labels[] holds the
+// lines with a label in order: before of them come before line i and
+// first is the first one after it.
+static long pick_label(const long *labels, long count, long before, long first, long i, int forward,
+                       int branch, unsigned long *seed) {
+    for (int tries = 0; tries < 2; tries++, forward = !forward) {
+        long n = 0, limit = branch ? 1 : LABEL_WINDOW;
+        while (n < limit) {
+            long k = forward ? first + n : before - 1 - n;
+            if (k < 0 || k >= count || !in_reach(labels[k], i, branch)) break;
+            n++;
+        }
+        if (n == 0) continue;
+        long k = next_random(seed) % n;
+        return forward ? labels[first + k] : labels[before - 1 - k];
+    }
+    return -1;
+}
+
+// Synthetic program: instructions in the given mode mix, labels on a share
+// of the lines and label operands for the absolute, indirect and branch
+// modes, a share of them forward. A new .ORG every SEGMENT_LINES lines
+// keeps the addresses in 64 KB; references stay within their segment.
+// Branches go to the nearest label within range and become NOPs when there
+// is none. Returns the source size.
+static long write_corpus(FILE *f, const corpus_config_t *cfg) {
+    unsigned long seed = cfg->seed;
+    char *has_label = malloc(cfg->lines + 1);
+    long *labels = malloc((cfg->lines + 1) * sizeof(long));
+    long count = 0, written = 0;
+    int weight = 0;
+
+    if (!has_label || !labels) {
+        free(has_label);
+        free(labels);
+        return -1;
+    }
+    for (long i = 0; i < cfg->lines; i++) {
+        has_label[i] = next_uniform(&seed) < cfg->label_density;
+        if (has_label[i]) labels[count++] = i;
+    }
+    for (int m = 0; m < NUM_ADDR_MODES; m++) weight += cfg->mix[m];
+
+    int n = 0;
+    long before = 0;
+    for (long i = 0; i < cfg->lines && n >= 0; i++) {
+        char label[32] = "", operand[32] = "";
+        if (i % SEGMENT_LINES == 0) {
+            if ((n = fprintf(f, "        .ORG $%04X\n", CORPUS_ORG)) < 0) break;
+            written += n;
+        }
+        addr_mode_t mode = IMP;
+        int pick = next_random(&seed) % weight;
+        while (pick >= cfg->mix[mode]) pick -= cfg->mix[mode++];
+
+        long first = before + has_label[i];
+        if (mode == ABS || mode == ABX || mode == ABY || mode == IND || mode == REL) {
+            int forward = next_uniform(&seed) < cfg->forward_ratio;
+            long target = pick_label(labels, count, before, first, i, forward, mode == REL, &seed);
+            if (target >= 0) {
+                snprintf(operand, sizeof(operand), mode == ABX ? "L%ld,X" : mode == ABY ? "L%ld,Y"
+                         : mode == IND ? "(L%ld)" : "L%ld", target);
+            } else if (mode == REL) {
+                mode = IMP;
+            } else {
+                snprintf(operand, sizeof(operand), mode == ABX ? "$%04lX,X" : mode == ABY ? "$%04lX,Y"
+                         : mode == IND ? "($%04lX)" : "$%04lX", 0x0200 + (next_random(&seed) & 0x3FF));
+            }
+        } else if (mode != IMP) {
+            unsigned byte = next_random(&seed) & 0xFF;
+            const char *format = mode == IMM ? "#$%02X" : mode == ZPX ? "$%02X,X" : mode == ZPY ? "$%02X,Y"
+                               : mode == IZX ? "($%02X,X)" : mode == IZY ? "($%02X),Y" : "$%02X";
+            snprintf(operand, sizeof(operand), format, byte);
+        }
+
+        const char **names = mode_mnemonics[mode];
+        int choices = 0;
+        while (choices < 16 && names[choices]) choices++;
+        const char *mnemonic = names[next_random(&seed) % choices];
+
+        if (has_label[i]) snprintf(label, sizeof(label), "L%ld:", i);
+        n = fprintf(f, "%-8s%s%s%s", label, mnemonic, *operand ? " " : "", operand);
+        if (n >= 0) written += n;
+        if (n >= 0 && next_random(&seed) % COMMENT_EVERY == 0) {
+            int pad = 12 - (int)strlen(operand);
+            n = fprintf(f, "%*s; line %ld", pad > 1 ? pad : 1, "", i);
+            if (n >= 0) written += n;
+        }
+        if (n >= 0 && (n = fprintf(f, "\n")) >= 0) written += n;
+        before = first;
+    }
+    free(has_label);
+    free(labels);
+    return n < 0 ? -1 : written;
+}
+
+
+static long rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void begin_phase(probe_t *probe) {
+    probe->rss_kb = rss_kb();
+    probe->mallocs = mallocs;
+    probe->reallocs = reallocs;
+    probe->frees = frees;
+    probe->start = now();
+}
+
+// Phases that run more than once, like the sizing passes, add up
+static void end_phase(probe_t *probe, phase_t phase) {
+    phase_result_t *r = &probe->phases[phase];
+    r->seconds += now() - probe->start;
+    r->mallocs += mallocs - probe->mallocs;
+    r->reallocs += reallocs - probe->reallocs;
+    r->frees += frees - probe->frees;
+    r->rss_kb += rss_kb() - probe->rss_kb;
+}
+
+static void assembler_phase(asm_phase_t phase, int end, void *arg) {
+    if (end) end_phase(arg, PHASE_PREPROCESS + phase);
+    else begin_phase(arg);
+}
+
+// One run of what assemble_6502() does, from the file, through a context
+// of its own so the hook can be set; 0 on errors
+static int run_once(asm6502_ctx *ctx, const char *path, phase_result_t *phases, result_t *r) {
+    probe_t probe = { phases, 0, 0, 0, 0, 0 };
+    source_t src;
+    byte_buffer_t out;
+    unsigned long touched = 0;
+
+    memset(phases, 0, NUM_PHASES * sizeof(phase_result_t));
+    asm6502_set_phase_hook(ctx, assembler_phase, &probe);
+    begin_phase(&probe);
+    if (!source_open(&src, path)) return 0;
+    for (size_t i = 0; i < src.len; i += 4096) touched += (unsigned char)src.text[i];
+    end_phase(&probe, PHASE_READ);
+
+    buffer_init(&out);
+    int errors = assemble_6502_ex(ctx, src.text, src.len, &out);
+
+    begin_phase(&probe);
+    char *hex = errors ? NULL : buffer_to_hex(&out);
+    end_phase(&probe, PHASE_OUTPUT);
+
+    r->passes = asm6502_stats(ctx)->passes;
+    r->output_bytes = out.len;
+    r->hash = hex ? hash_text(hex) : 0;
+    free(hex);
+    buffer_free(&out);
+    source_close(&src);
+    return hex != NULL && touched > 0;
+}
+
+// One pass worth of the line routines the passes call: every line
+// tokenized, and the addressing mode of every instruction detected
+static int time_parts(const char *path, phase_result_t *parts, int reps) {
+    source_t src;
+    if (!source_open(&src, path)) return 0;
+    long count = 0;
+    for (const char *p = src.text; (p = memchr(p, '\n', src.text + src.len - p)); p++) count++;
+    line_tokens_t *tokens = malloc((count + 1) * sizeof(line_tokens_t));
+    if (!tokens) {
+        source_close(&src);
+        return 0;
+    }
+
+    unsigned long modes = 0;
+    for (int rep = 0; rep < reps; rep++) {
+        const char *p = src.text, *end = src.text + src.len;
+        long n = 0;
+        double start = now();
+        while (p < end) {
+            const char *eol = memchr(p, '\n', end - p);
+            if (!eol) eol = end;
+            tokenize_line(p, eol - p, &tokens[n++]);
+            p = eol + 1;
+        }
+        double seconds = now() - start;
+        if (rep == 0 || seconds < parts[PART_TOKENIZE].seconds) parts[PART_TOKENIZE].seconds = seconds;
+
+        start = now();
+        for (long i = 0; i < n; i++) {
+            const line_tokens_t *tok = &tokens[i];
+            if (tok->mnemonic.len && tok->mnemonic.ptr[0] != '.') modes += detect_addressing_mode(tok->operand);
+        }
+        seconds = now() - start;
+        if (rep == 0 || seconds < parts[PART_DETECT].seconds) parts[PART_DETECT].seconds = seconds;
+    }
+    free(tokens);
+    source_close(&src);
+    return modes > 0;
+}
+
+// Best of reps by the whole run, with the phases of that run; heap calls
+// and resident set growth are those of the first run, before the context
+// and the allocator hold on to memory
+static int run_phases(const char *path, int reps, result_t *r) {
+    asm6502_ctx *ctx = asm6502_create(0);
+    if (!ctx) return 0;
+
+    memset(r, 0, sizeof(*r));
+    int ok = 1;
+    for (int rep = 0; rep < reps && ok; rep++) {
+        phase_result_t phases[NUM_PHASES];
+        double start = now();
+        ok = run_once(ctx, path, phases, r);
+        double seconds = now() - start;
+        if (rep > 0 && seconds >= r->total.seconds) continue;
+
+        r->total.seconds = seconds;
+        for (int p = 0; p < NUM_PHASES; p++) {
+            r->phases[p].seconds = phases[p].seconds;
+            if (rep > 0) continue;
+            r->phases[p] = phases[p];
+            r->total.mallocs += phases[p].mallocs;
+            r->total.reallocs += phases[p].reallocs;
+            r->total.frees += phases[p].frees;
+        }
+    }
+    asm6502_destroy(ctx);
+    r->total.rss_kb = peak_kb();
+    return ok && time_parts(path, r->parts, reps);
+}
+
+// assemble_6502() itself on the corpus, to check the phased runs match it
+static int check_output(const char *path, const result_t *r) {
+    source_t src;
+    if (!source_open(&src, path)) return 0;
+    char *text = malloc(src.len + 1);
+    if (text) {
+        memcpy(text, src.text, src.len);
+        text[src.len] = '\0';
+    }
+    source_close(&src);
+    char *hex = text ? assemble_6502(text) : NULL;
+    int ok = hex && hash_text(hex) == r->hash && (long)(strlen(hex) + 1) / 3 == r->output_bytes;
+    free(hex);
+    free(text);
+    return ok;
+}
+
+static void write_phase_json(FILE *f, const char *name, const phase_result_t *p, long lines, const char *rss,
+                             const char *end) {
+    fprintf(f, "    { \"name\": \"%s\", \"seconds\": %.6f, \"ns_per_line\": %.2f, \"mallocs\": %ld, "
+               "\"reallocs\": %ld, \"frees\": %ld, \"%s\": %ld }%s\n",
+            name, p->seconds, p->seconds * 1e9 / lines, p->mallocs, p->reallocs, p->frees, rss, p->rss_kb, end);
+}
+
+static void write_json(FILE *f, const corpus_config_t *cfg, long bytes, int reps, const result_t *r) {
+    fprintf(f, "{\n  \"bench\": \"bench_phases\",\n  \"corpus\": {\n");
+    fprintf(f, "    \"lines\": %ld,\n    \"bytes\": %ld,\n    \"label_density\": %.3f,\n"
+               "    \"forward_ratio\": %.3f,\n    \"seed\": %lu,\n    \"mode_mix\": {",
+            cfg->lines, bytes, cfg->label_density, cfg->forward_ratio, cfg->seed);
+    for (int m = 0; m < NUM_ADDR_MODES; m++) {
+        fprintf(f, "%s \"%s\": %d", m ? "," : "", mode_names[m], cfg->mix[m]);
+    }
+    fprintf(f, " }\n  },\n  \"repetitions\": %d,\n  \"passes\": %d,\n  \"output_bytes\": %ld,\n",
+            reps, r->passes, r->output_bytes);
+    fprintf(f, "  \"phases\": [\n");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        write_phase_json(f, phase_names[p], &r->phases[p], cfg->lines, "rss_delta_kb",
+                         p + 1 < NUM_PHASES ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"total\": [\n");
+    write_phase_json(f, "assemble_6502", &r->total, cfg->lines, "peak_rss_kb", "");
+    fprintf(f, "  ],\n  \"per_pass\": [\n");
+    for (int p = 0; p < NUM_PARTS; p++) {
+        fprintf(f, "    { \"name\": \"%s\", \"seconds\": %.6f, \"ns_per_line\": %.2f }%s\n", part_names[p],
+                r->parts[p].seconds, r->parts[p].seconds * 1e9 / cfg->lines, p + 1 < NUM_PARTS ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// "abs=20,rel=5": weights of the named modes, the others keep theirs
+static int parse_mix(const char *spec, int *mix) {
+    while (*spec) {
+        int m, weight, len;
+        for (m = 0; m < NUM_ADDR_MODES; m++) {
+            if (strncmp(spec, mode_names[m], 3) == 0 && spec[3] == '=') break;
+        }
+        if (m == NUM_ADDR_MODES || sscanf(spec + 4, "%d%n", &weight, &len) != 1 || weight < 0) return 0;
+        mix[m] = weight;
+        spec += 4 + len;
+        if (*spec == ',') spec++;
+        else if (*spec) return 0;
+    }
+    for (int m = 0; m < NUM_ADDR_MODES; m++) {
+        if (mix[m] > 0) return 1;
+    }
+    return 0;
+}
+
+static void print_usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n lines] [-l label_density] [-f forward_ratio] [-m mode=weight,...]\n"
+                    "       [-s seed] [-r repetitions] [-g] [-j file.json]\n"
+                    "  -g  print the generated program and exit\n"
+                    "  -j  write the results as JSON, - for standard output\n"
+                    "  modes: imp imm zpg zpx zpy abs abx aby ind izx izy rel\n", name);
+}
+
+int main(int argc, char **argv) {
+    corpus_config_t cfg = { DEFAULT_LINES, 0.125, 0.3, { 0 }, 6502 };
+    int reps = DEFAULT_REPS;
+    int generate = 0;
+    const char *json_file = NULL;
+
+    memcpy(cfg.mix, default_mix, sizeof(cfg.mix));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            cfg.lines = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            cfg.label_density = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            cfg.forward_ratio = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            if (!parse_mix(argv[++i], cfg.mix)) {
+                fprintf(stderr, "bench_phases: bad mode mix %s\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            cfg.seed = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-g") == 0) {
+            generate = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            json_file = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.lines <= 0 || reps <= 0 || cfg.label_density < 0 || cfg.label_density > 1 ||
+        cfg.forward_ratio < 0 || cfg.forward_ratio > 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (generate) return write_corpus(stdout, &cfg) < 0;
+
+    char path[] = "/tmp/bench_phasesXXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        perror("bench_phases");
+        return 1;
+    }
+    long bytes = write_corpus(f, &cfg);
+    if (fclose(f) != 0 || bytes < 0) {
+        perror("bench_phases");
+        unlink(path);
+        return 1;
+    }
+
+    result_t r;
+    int ok = run_phases(path, reps, &r) && check_output(path, &r);
+    unlink(path);
+    if (!ok) {
+        fprintf(stderr, "bench_phases: run failed or does not match assemble_6502\n");
+        return 1;
+    }
+
+    // JSON on standard output moves the report to standard error
+    FILE *report = json_file && strcmp(json_file, "-") == 0 ? stderr : stdout;
+    double sum = 0;
+    fprintf(report, "bench_phases: %ld lines, %.1f MB, %.0f%% labels, %.0f%% forward, %ld bytes out, "
+            "%d passes, best of %d\n", cfg.lines, bytes / 1048576.0, cfg.label_density * 100,
+            cfg.forward_ratio * 100, r.output_bytes, r.passes, reps);
+    for (int p = 0; p < NUM_PHASES; p++) {
+        const phase_result_t *phase = &r.phases[p];
+        sum += phase->seconds;
+        fprintf(report, "bench_phases: %-22s %8.3f ms %7.1f ns/line %7ld allocs %5ld reallocs, RSS %+.1f MB\n",
+                phase_names[p], phase->seconds * 1e3, phase->seconds * 1e9 / cfg.lines, phase->mallocs,
+                phase->reallocs, phase->rss_kb / 1024.0);
+    }
+    fprintf(report, "bench_phases: %-22s %8.3f ms %7.1f ns/line %7ld allocs %5ld reallocs, peak RSS %.1f MB "
+            "(phases %.0f%% of it)\n",
+            "assemble_6502", r.total.seconds * 1e3, r.total.seconds * 1e9 / cfg.lines,
+            r.total.mallocs, r.total.reallocs, r.total.rss_kb / 1024.0, sum * 100 / r.total.seconds);
+    for (int p = 0; p < NUM_PARTS; p++) {
+        fprintf(report, "bench_phases:   %-22s %6.3f ms %7.1f ns/line in every pass\n", part_names[p],
+                r.parts[p].seconds * 1e3, r.parts[p].seconds * 1e9 / cfg.lines);
+    }
+
+    if (json_file) {
+        FILE *out = report == stderr ? stdout : fopen(json_file, "w");
+        if (!out) {
+            perror(json_file);
+            return 1;
+        }
+        write_json(out, &cfg, bytes, reps, &r);
+        if (out != stdout && fclose(out) != 0) {
+            perror(json_file);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "symbols.h"
+
+// Insert and look up 100k labels in the symbol table
+
+#define NUM_SYMBOLS 100000
+#define LOOKUP_ROUNDS 10
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    char name[32];
+    symbol_table_t table;
+
+    symbols_init(&table);
+    double start = now();
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        sprintf(name, "label_%d", i);
+        if (add_symbol(&table, name, i & 0xFFFF) < 0) {
+            fprintf(stderr, "bench_symbols: out of memory\n");
+            return 1;
+        }
+    }
+    double insert = now() - start;
+
+    long found = 0;
+    start = now();
+    for (int r = 0; r < LOOKUP_ROUNDS; r++) {
+        for (int i = 0; i < NUM_SYMBOLS; i++) {
+            sprintf(name, "label_%d", (i * 7919) % NUM_SYMBOLS);
+            found += find_symbol(&table, name) >= 0;
+        }
+    }
+    double lookup = now() - start;
+
+    printf("bench_symbols: %d symbols, insert %.1f ns/op, lookup %.1f ns/op (%ld found)\n",
+           NUM_SYMBOLS, insert * 1e9 / NUM_SYMBOLS,
+           lookup * 1e9 / ((double)NUM_SYMBOLS * LOOKUP_ROUNDS), found);
+    reset_symbols(&table);
+    return 0;
+}
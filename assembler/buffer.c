@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+#define HEX_CHUNK 1024
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+void buffer_init(byte_buffer_t *buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void buffer_free(byte_buffer_t *buf) {
+    free(buf->data);
+    buffer_init(buf);
+}
+
+// Grow capacity geometrically so pushes stay amortized O(1)
+int buffer_reserve(byte_buffer_t *buf, size_t cap) {
+    if (cap <= buf->cap) return 1;
+    size_t new_cap = buf->cap ? buf->cap : 256;
+    while (new_cap < cap) new_cap *= 2;
+    unsigned char *data = realloc(buf->data, new_cap);
+    if (!data) return 0;
+    buf->data = data;
+    buf->cap = new_cap;
+    return 1;
+}
+
+int buffer_push(byte_buffer_t *buf, unsigned char byte) {
+    if (buf->len == buf->cap && !buffer_reserve(buf, buf->len + 1)) return 0;
+    buf->data[buf->len++] = byte;
+    return 1;
+}
+
+// Write bytes as "XX " hex text, encoding through a fixed stack chunk
+int buffer_write_hex(const byte_buffer_t *buf, FILE *sink) {
+    char chunk[HEX_CHUNK * 3];
+    size_t i = 0;
+    while (i < buf->len) {
+        size_t n = 0;
+        for (; i < buf->len && n < sizeof(chunk); i++) {
+            chunk[n++] = hex_digits[buf->data[i] >> 4];
+            chunk[n++] = hex_digits[buf->data[i] & 0x0F];
+            chunk[n++] = ' ';
+        }
+        if (fwrite(chunk, 1, n, sink) != n) return 0;
+    }
+    return 1;
+}
+
+// Encode the whole buffer as a NUL-terminated hex string; caller frees
+char* buffer_to_hex(const byte_buffer_t *buf) {
+    char *hex = malloc(buf->len * 3 + 1);
+    if (!hex) return NULL;
+    for (size_t i = 0; i < buf->len; i++) {
+        hex[i * 3] = hex_digits[buf->data[i] >> 4];
+        hex[i * 3 + 1] = hex_digits[buf->data[i] & 0x0F];
+        hex[i * 3 + 2] = ' ';
+    }
+    hex[buf->len ? buf->len * 3 - 1 : 0] = '\0';
+    return hex;
+}
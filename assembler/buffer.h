@@ -0,0 +1,21 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Growable byte buffer for emitted machine code
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} byte_buffer_t;
+
+void buffer_init(byte_buffer_t *buf);
+void buffer_free(byte_buffer_t *buf);
+int buffer_reserve(byte_buffer_t *buf, size_t cap);
+int buffer_push(byte_buffer_t *buf, unsigned char byte);
+int buffer_write_hex(const byte_buffer_t *buf, FILE *sink);
+char* buffer_to_hex(const byte_buffer_t *buf);
+
+#endif
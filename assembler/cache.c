@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "assembler.h"
+
+// Two FNV-1a streams with different offset bases give a 128-bit key
+static void hash_bytes(unsigned long long h[2], const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h[0] = (h[0] ^ p[i]) * 0x100000001B3ULL;
+        h[1] = (h[1] ^ p[i]) * 0x100000001B3ULL;
+    }
+}
+
+void cache_key(const char *source, size_t len, const preproc_t *includes, int flags, char key[CACHE_KEY_LEN + 1]) {
+    unsigned long long h[2] = { 0xCBF29CE484222325ULL, 0x84222325CBF29CE4ULL };
+    hash_bytes(h, ASM_VERSION, strlen(ASM_VERSION) + 1);
+    hash_bytes(h, &flags, sizeof(flags));
+    hash_bytes(h, &len, sizeof(len));
+    hash_bytes(h, source, len);
+    for (int i = 1; includes && i < includes->file_count; i++) {
+        const source_t *inc = &includes->files[i].source;
+        hash_bytes(h, &inc->len, sizeof(inc->len));
+        hash_bytes(h, inc->text, inc->len);
+    }
+    snprintf(key, CACHE_KEY_LEN + 1, "%016llx%016llx", h[0], h[1]);
+}
+
+static char* entry_path(const cache_t *cache, const char *key) {
+    size_t len = strlen(cache->dir) + CACHE_KEY_LEN + 4;
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/%s.o", cache->dir, key);
+    return path;
+}
+
+static int copy_file(const char *from, const char *to) {
+    char chunk[8192];
+    size_t n;
+    int ok = 1;
+
+    FILE *in = fopen(from, "rb");
+    if (!in) return 0;
+    FILE *out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return 0;
+    }
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        if (fwrite(chunk, 1, n, out) != n) ok = 0;
+    }
+    if (ferror(in)) ok = 0;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    return ok;
+}
+
+// Copy a cached object to dest; returns 1 on a hit
+int cache_fetch(cache_t *cache, const char *key, const char *dest) {
+    if (!cache->dir) return 0;
+    char *path = entry_path(cache, key);
+    int hit = path && access(path, R_OK) == 0 && copy_file(path, dest);
+    free(path);
+    if (hit) cache->hits++;
+    else cache->misses++;
+    return hit;
+}
+
+// Publish an object under its key; the rename keeps concurrent builds from
+// seeing half written entries
+int cache_store(const cache_t *cache, const char *key, const char *src) {
+    if (!cache->dir) return 1;
+    mkdir(cache->dir, 0777);
+
+    char *path = entry_path(cache, key);
+    if (!path) return 0;
+    size_t len = strlen(path) + 8;
+    char *tmp = malloc(len);
+    if (!tmp) {
+        free(path);
+        return 0;
+    }
+    snprintf(tmp, len, "%s.XXXXXX", path);
+
+    // Unique per writer, including threads storing the same key
+    int fd = mkstemp(tmp);
+    if (fd >= 0) close(fd);
+    int ok = fd >= 0 && copy_file(src, tmp) && rename(tmp, path) == 0;
+    if (!ok && fd >= 0) unlink(tmp);
+    free(tmp);
+    free(path);
+    return ok;
+}
@@ -0,0 +1,22 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include "preproc.h"
+
+#define CACHE_KEY_LEN 32
+
+// On-disk object cache keyed by source content, assembler version and options
+typedef struct {
+    const char *dir;        // NULL disables the cache
+    int hits;
+    int misses;
+} cache_t;
+
+// includes, when given, is the expanded source; the files it read are
+// part of the key
+void cache_key(const char *source, size_t len, const preproc_t *includes, int flags, char key[CACHE_KEY_LEN + 1]);
+int cache_fetch(cache_t *cache, const char *key, const char *dest);
+int cache_store(const cache_t *cache, const char *key, const char *src);
+
+#endif
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+#include "instructions.h"
+
+// Build time generator for opcode_index.h: finds a multiplicative perfect
+// hash over the packed mnemonics in instructions[] and emits a
+// [slot][addr_mode_t] table of instruction indices
+
+#define SLOTS 256
+
+static unsigned short keys[SLOTS];
+static short index_table[SLOTS][NUM_ADDR_MODES];
+
+static unsigned slot_of(unsigned short key, unsigned mul) {
+    return ((key * mul) >> 16) & (SLOTS - 1);
+}
+
+static int try_multiplier(unsigned mul) {
+    memset(keys, 0, sizeof(keys));
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        unsigned short key = pack_mnemonic(instructions[i].mnemonic);
+        unsigned slot = slot_of(key, mul);
+        if (keys[slot] && keys[slot] != key) return 0;
+        keys[slot] = key;
+    }
+    return 1;
+}
+
+int main(void) {
+    unsigned mul;
+    for (mul = 1; mul < 0x10000; mul += 2) {
+        if (try_multiplier(mul)) break;
+    }
+    if (mul >= 0x10000) {
+        fprintf(stderr, "gen_opcodes: no perfect hash found\n");
+        return 1;
+    }
+
+    memset(index_table, 0xFF, sizeof(index_table));
+    for (int i = NUM_INSTRUCTIONS - 1; i >= 0; i--) {
+        unsigned slot = slot_of(pack_mnemonic(instructions[i].mnemonic), mul);
+        index_table[slot][instructions[i].mode] = i;
+    }
+
+    printf("// Generated by gen_opcodes from instructions.c - do not edit\n");
+    printf("#define OPCODE_HASH_MUL %uu\n", mul);
+    printf("#define OPCODE_HASH_SLOTS %d\n\n", SLOTS);
+    printf("static const unsigned short opcode_keys[OPCODE_HASH_SLOTS] = {");
+    for (int s = 0; s < SLOTS; s++) printf("%s%u,", s % 16 ? " " : "\n    ", keys[s]);
+    printf("\n};\n\n");
+    printf("static const short opcode_index[OPCODE_HASH_SLOTS][NUM_ADDR_MODES] = {\n");
+    for (int s = 0; s < SLOTS; s++) {
+        if (!keys[s]) continue;
+        printf("    [%d] = {", s);
+        for (int m = 0; m < NUM_ADDR_MODES; m++) printf("%s%d", m ? ", " : "", index_table[s][m]);
+        printf("},\n");
+    }
+    printf("};\n");
+    return 0;
+}
@@ -1,233 +1,244 @@
 #include "instructions.h"
 
-// Complete 6502 instruction set with all addressing modes
+// Complete 6502 instruction set with all addressing modes, NMOS base cycles
+// and the conditions that add cycles on top
 instruction_t instructions[] = {
     // ADC - add with carry
-    {"ADC", 0x69, IMM}, 
-    {"ADC", 0x65, ZPG}, 
-    {"ADC", 0x75, ZPX},
-    {"ADC", 0x6D, ABS}, 
-    {"ADC", 0x7D, ABX}, 
-    {"ADC", 0x79, ABY},
-    {"ADC", 0x61, IZX}, 
-    {"ADC", 0x71, IZY},
+    {"ADC", 0x69, IMM, 2, 0}, 
+    {"ADC", 0x65, ZPG, 3, 0}, 
+    {"ADC", 0x75, ZPX, 4, 0},
+    {"ADC", 0x6D, ABS, 4, 0}, 
+    {"ADC", 0x7D, ABX, 4, CYCLE_PAGE}, 
+    {"ADC", 0x79, ABY, 4, CYCLE_PAGE},
+    {"ADC", 0x61, IZX, 6, 0}, 
+    {"ADC", 0x71, IZY, 5, CYCLE_PAGE},
     
     // AND - logic AND
-    {"AND", 0x29, IMM}, 
-    {"AND", 0x25, ZPG}, 
-    {"AND", 0x35, ZPX},
-    {"AND", 0x2D, ABS}, 
-    {"AND", 0x3D, ABX}, 
-    {"AND", 0x39, ABY},
-    {"AND", 0x21, IZX}, 
-    {"AND", 0x31, IZY},
+    {"AND", 0x29, IMM, 2, 0}, 
+    {"AND", 0x25, ZPG, 3, 0}, 
+    {"AND", 0x35, ZPX, 4, 0},
+    {"AND", 0x2D, ABS, 4, 0}, 
+    {"AND", 0x3D, ABX, 4, CYCLE_PAGE}, 
+    {"AND", 0x39, ABY, 4, CYCLE_PAGE},
+    {"AND", 0x21, IZX, 6, 0}, 
+    {"AND", 0x31, IZY, 5, CYCLE_PAGE},
     
     // ASL - arithmetic shift left
-    {"ASL", 0x0A, IMP}, 
-    {"ASL", 0x06, ZPG}, 
-    {"ASL", 0x16, ZPX},
-    {"ASL", 0x0E, ABS}, 
-    {"ASL", 0x1E, ABX},
+    {"ASL", 0x0A, IMP, 2, 0}, 
+    {"ASL", 0x06, ZPG, 5, 0}, 
+    {"ASL", 0x16, ZPX, 6, 0},
+    {"ASL", 0x0E, ABS, 6, 0}, 
+    {"ASL", 0x1E, ABX, 7, 0},
     
     // BCC, BCS, BEQ, BMI, BNE, BPL, BVC, BVS - branches
-    {"BCC", 0x90, REL}, 
-    {"BCS", 0xB0, REL}, 
-    {"BEQ", 0xF0, REL},
-    {"BMI", 0x30, REL}, 
-    {"BNE", 0xD0, REL}, 
-    {"BPL", 0x10, REL},
-    {"BVC", 0x50, REL}, 
-    {"BVS", 0x70, REL},
+    {"BCC", 0x90, REL, 2, CYCLE_BRANCH}, 
+    {"BCS", 0xB0, REL, 2, CYCLE_BRANCH}, 
+    {"BEQ", 0xF0, REL, 2, CYCLE_BRANCH},
+    {"BMI", 0x30, REL, 2, CYCLE_BRANCH}, 
+    {"BNE", 0xD0, REL, 2, CYCLE_BRANCH}, 
+    {"BPL", 0x10, REL, 2, CYCLE_BRANCH},
+    {"BVC", 0x50, REL, 2, CYCLE_BRANCH}, 
+    {"BVS", 0x70, REL, 2, CYCLE_BRANCH},
     
     // BIT - bit test
-    {"BIT", 0x24, ZPG}, 
-    {"BIT", 0x2C, ABS},
+    {"BIT", 0x24, ZPG, 3, 0}, 
+    {"BIT", 0x2C, ABS, 4, 0},
     
     // BRK - break
-    {"BRK", 0x00, IMP},
+    {"BRK", 0x00, IMP, 7, 0},
     
     // CLC, CLD, CLI, CLV - clear flags
-    {"CLC", 0x18, IMP}, 
-    {"CLD", 0xD8, IMP}, 
-    {"CLI", 0x58, IMP}, 
-    {"CLV", 0xB8, IMP},
+    {"CLC", 0x18, IMP, 2, 0}, 
+    {"CLD", 0xD8, IMP, 2, 0}, 
+    {"CLI", 0x58, IMP, 2, 0}, 
+    {"CLV", 0xB8, IMP, 2, 0},
     
     // CMP - compare Accumulator
-    {"CMP", 0xC9, IMM}, 
-    {"CMP", 0xC5, ZPG}, 
-    {"CMP", 0xD5, ZPX},
-    {"CMP", 0xCD, ABS}, 
-    {"CMP", 0xDD, ABX}, 
-    {"CMP", 0xD9, ABY},
-    {"CMP", 0xC1, IZX}, 
-    {"CMP", 0xD1, IZY},
+    {"CMP", 0xC9, IMM, 2, 0}, 
+    {"CMP", 0xC5, ZPG, 3, 0}, 
+    {"CMP", 0xD5, ZPX, 4, 0},
+    {"CMP", 0xCD, ABS, 4, 0}, 
+    {"CMP", 0xDD, ABX, 4, CYCLE_PAGE}, 
+    {"CMP", 0xD9, ABY, 4, CYCLE_PAGE},
+    {"CMP", 0xC1, IZX, 6, 0}, 
+    {"CMP", 0xD1, IZY, 5, CYCLE_PAGE},
     
     // CPX - compare X reg
-    {"CPX", 0xE0, IMM}, 
-    {"CPX", 0xE4, ZPG}, 
-    {"CPX", 0xEC, ABS},
+    {"CPX", 0xE0, IMM, 2, 0}, 
+    {"CPX", 0xE4, ZPG, 3, 0}, 
+    {"CPX", 0xEC, ABS, 4, 0},
     
     // CPY - Compare Y reg
-    {"CPY", 0xC0, IMM}, 
-    {"CPY", 0xC4, ZPG}, 
-    {"CPY", 0xCC, ABS},
+    {"CPY", 0xC0, IMM, 2, 0}, 
+    {"CPY", 0xC4, ZPG, 3, 0}, 
+    {"CPY", 0xCC, ABS, 4, 0},
     
     // DEC - dec Memory
-    {"DEC", 0xC6, ZPG}, 
-    {"DEC", 0xD6, ZPX}, 
-    {"DEC", 0xCE, ABS}, 
-    {"DEC", 0xDE, ABX},
+    {"DEC", 0xC6, ZPG, 5, 0}, 
+    {"DEC", 0xD6, ZPX, 6, 0}, 
+    {"DEC", 0xCE, ABS, 6, 0}, 
+    {"DEC", 0xDE, ABX, 7, 0},
     
     // DEX, DEY - dec X/Y
-    {"DEX", 0xCA, IMP}, 
-    {"DEY", 0x88, IMP},
+    {"DEX", 0xCA, IMP, 2, 0}, 
+    {"DEY", 0x88, IMP, 2, 0},
     
     // EOR - Exclusive OR
-    {"EOR", 0x49, IMM}, 
-    {"EOR", 0x45, ZPG}, 
-    {"EOR", 0x55, ZPX},
-    {"EOR", 0x4D, ABS}, 
-    {"EOR", 0x5D, ABX},
-    {"EOR", 0x59, ABY},
-    {"EOR", 0x41, IZX},
-    {"EOR", 0x51, IZY},
+    {"EOR", 0x49, IMM, 2, 0}, 
+    {"EOR", 0x45, ZPG, 3, 0}, 
+    {"EOR", 0x55, ZPX, 4, 0},
+    {"EOR", 0x4D, ABS, 4, 0}, 
+    {"EOR", 0x5D, ABX, 4, CYCLE_PAGE},
+    {"EOR", 0x59, ABY, 4, CYCLE_PAGE},
+    {"EOR", 0x41, IZX, 6, 0},
+    {"EOR", 0x51, IZY, 5, CYCLE_PAGE},
     
     // XOR -  XOR       *note this is the same as EOR instruction but makes it easier on my part to recognize
-    {"EOR", 0x49, IMM}, 
-    {"EOR", 0x45, ZPG}, 
-    {"EOR", 0x55, ZPX},
-    {"EOR", 0x4D, ABS}, 
-    {"EOR", 0x5D, ABX},
-    {"EOR", 0x59, ABY},
-    {"EOR", 0x41, IZX},
-    {"EOR", 0x51, IZY},
+    {"EOR", 0x49, IMM, 2, 0}, 
+    {"EOR", 0x45, ZPG, 3, 0}, 
+    {"EOR", 0x55, ZPX, 4, 0},
+    {"EOR", 0x4D, ABS, 4, 0}, 
+    {"EOR", 0x5D, ABX, 4, CYCLE_PAGE},
+    {"EOR", 0x59, ABY, 4, CYCLE_PAGE},
+    {"EOR", 0x41, IZX, 6, 0},
+    {"EOR", 0x51, IZY, 5, CYCLE_PAGE},
 
     // INC - inc Memory
-    {"INC", 0xE6, ZPG}, 
-    {"INC", 0xF6, ZPX}, 
-    {"INC", 0xEE, ABS}, 
-    {"INC", 0xFE, ABX},
+    {"INC", 0xE6, ZPG, 5, 0}, 
+    {"INC", 0xF6, ZPX, 6, 0}, 
+    {"INC", 0xEE, ABS, 6, 0}, 
+    {"INC", 0xFE, ABX, 7, 0},
     
     // INX, INY - inc X/Y
-    {"INX", 0xE8, IMP}, 
-    {"INY", 0xC8, IMP},
+    {"INX", 0xE8, IMP, 2, 0}, 
+    {"INY", 0xC8, IMP, 2, 0},
     
     // JMP - Jump
-    {"JMP", 0x4C, ABS}, 
-    {"JMP", 0x6C, IND},
+    {"JMP", 0x4C, ABS, 3, 0}, 
+    {"JMP", 0x6C, IND, 5, 0},
     
     // JSR - Jump to Subroutine
-    {"JSR", 0x20, ABS},
+    {"JSR", 0x20, ABS, 6, 0},
     
     // LDA - Load Accumulator
-    {"LDA", 0xA9, IMM}, 
-    {"LDA", 0xA5, ZPG}, 
-    {"LDA", 0xB5, ZPX},
-    {"LDA", 0xAD, ABS}, 
-    {"LDA", 0xBD, ABX}, 
-    {"LDA", 0xB9, ABY},
-    {"LDA", 0xA1, IZX}, 
-    {"LDA", 0xB1, IZY},
+    {"LDA", 0xA9, IMM, 2, 0}, 
+    {"LDA", 0xA5, ZPG, 3, 0}, 
+    {"LDA", 0xB5, ZPX, 4, 0},
+    {"LDA", 0xAD, ABS, 4, 0}, 
+    {"LDA", 0xBD, ABX, 4, CYCLE_PAGE}, 
+    {"LDA", 0xB9, ABY, 4, CYCLE_PAGE},
+    {"LDA", 0xA1, IZX, 6, 0}, 
+    {"LDA", 0xB1, IZY, 5, CYCLE_PAGE},
     
     // LDX - Load X Register
-    {"LDX", 0xA2, IMM}, 
-    {"LDX", 0xA6, ZPG}, 
-    {"LDX", 0xB6, ZPY},
-    {"LDX", 0xAE, ABS}, 
-    {"LDX", 0xBE, ABY},
+    {"LDX", 0xA2, IMM, 2, 0}, 
+    {"LDX", 0xA6, ZPG, 3, 0}, 
+    {"LDX", 0xB6, ZPY, 4, 0},
+    {"LDX", 0xAE, ABS, 4, 0}, 
+    {"LDX", 0xBE, ABY, 4, CYCLE_PAGE},
     
     // LDY - Load Y Register
-    {"LDY", 0xA0, IMM}, 
-    {"LDY", 0xA4, ZPG}, 
-    {"LDY", 0xB4, ZPX},
-    {"LDY", 0xAC, ABS}, 
-    {"LDY", 0xBC, ABX},
+    {"LDY", 0xA0, IMM, 2, 0}, 
+    {"LDY", 0xA4, ZPG, 3, 0}, 
+    {"LDY", 0xB4, ZPX, 4, 0},
+    {"LDY", 0xAC, ABS, 4, 0}, 
+    {"LDY", 0xBC, ABX, 4, CYCLE_PAGE},
     
     // LSR - logical Shift Right
-    {"LSR", 0x4A, IMP}, 
-    {"LSR", 0x46, ZPG}, 
-    {"LSR", 0x56, ZPX},
-    {"LSR", 0x4E, ABS}, 
-    {"LSR", 0x5E, ABX},
+    {"LSR", 0x4A, IMP, 2, 0}, 
+    {"LSR", 0x46, ZPG, 5, 0}, 
+    {"LSR", 0x56, ZPX, 6, 0},
+    {"LSR", 0x4E, ABS, 6, 0}, 
+    {"LSR", 0x5E, ABX, 7, 0},
     
     // NOP - No Operation
-    {"NOP", 0xEA, IMP},
+    {"NOP", 0xEA, IMP, 2, 0},
     
     // ORA - Logical OR
-    {"ORA", 0x09, IMM}, 
-    {"ORA", 0x05, ZPG}, 
-    {"ORA", 0x15, ZPX},
-    {"ORA", 0x0D, ABS}, 
-    {"ORA", 0x1D, ABX}, 
-    {"ORA", 0x19, ABY},
-    {"ORA", 0x01, IZX}, 
-    {"ORA", 0x11, IZY},
+    {"ORA", 0x09, IMM, 2, 0}, 
+    {"ORA", 0x05, ZPG, 3, 0}, 
+    {"ORA", 0x15, ZPX, 4, 0},
+    {"ORA", 0x0D, ABS, 4, 0}, 
+    {"ORA", 0x1D, ABX, 4, CYCLE_PAGE}, 
+    {"ORA", 0x19, ABY, 4, CYCLE_PAGE},
+    {"ORA", 0x01, IZX, 6, 0}, 
+    {"ORA", 0x11, IZY, 5, CYCLE_PAGE},
     
     // PHA, PHP, PLA, PLP - Stack operations
-    {"PHA", 0x48, IMP}, 
-    {"PHP", 0x08, IMP}, 
-    {"PLA", 0x68, IMP}, 
-    {"PLP", 0x28, IMP},
+    {"PHA", 0x48, IMP, 3, 0}, 
+    {"PHP", 0x08, IMP, 3, 0}, 
+    {"PLA", 0x68, IMP, 4, 0}, 
+    {"PLP", 0x28, IMP, 4, 0},
     
     // ROL - Rotate Left
-    {"ROL", 0x2A, IMP}, 
-    {"ROL", 0x26, ZPG}, 
-    {"ROL", 0x36, ZPX},
-    {"ROL", 0x2E, ABS}, 
-    {"ROL", 0x3E, ABX},
+    {"ROL", 0x2A, IMP, 2, 0}, 
+    {"ROL", 0x26, ZPG, 5, 0}, 
+    {"ROL", 0x36, ZPX, 6, 0},
+    {"ROL", 0x2E, ABS, 6, 0}, 
+    {"ROL", 0x3E, ABX, 7, 0},
     
     // ROR - Rotate Right
-    {"ROR", 0x6A, IMP}, 
-    {"ROR", 0x66, ZPG}, 
-    {"ROR", 0x76, ZPX},
-    {"ROR", 0x6E, ABS}, 
-    {"ROR", 0x7E, ABX},
+    {"ROR", 0x6A, IMP, 2, 0}, 
+    {"ROR", 0x66, ZPG, 5, 0}, 
+    {"ROR", 0x76, ZPX, 6, 0},
+    {"ROR", 0x6E, ABS, 6, 0}, 
+    {"ROR", 0x7E, ABX, 7, 0},
     
     // RTI, RTS - Return
-    {"RTI", 0x40, IMP},
-    {"RTS", 0x60, IMP},
+    {"RTI", 0x40, IMP, 6, 0},
+    {"RTS", 0x60, IMP, 6, 0},
     
     // SBC - Subtract with Carry
-    {"SBC", 0xE9, IMM}, 
-    {"SBC", 0xE5, ZPG}, 
-    {"SBC", 0xF5, ZPX},
-    {"SBC", 0xED, ABS}, 
-    {"SBC", 0xFD, ABX}, 
-    {"SBC", 0xF9, ABY},
-    {"SBC", 0xE1, IZX}, 
-    {"SBC", 0xF1, IZY},
+    {"SBC", 0xE9, IMM, 2, 0}, 
+    {"SBC", 0xE5, ZPG, 3, 0}, 
+    {"SBC", 0xF5, ZPX, 4, 0},
+    {"SBC", 0xED, ABS, 4, 0}, 
+    {"SBC", 0xFD, ABX, 4, CYCLE_PAGE}, 
+    {"SBC", 0xF9, ABY, 4, CYCLE_PAGE},
+    {"SBC", 0xE1, IZX, 6, 0}, 
+    {"SBC", 0xF1, IZY, 5, CYCLE_PAGE},
     
     // SEC, SED, SEI - Set flags
-    {"SEC", 0x38, IMP}, 
-    {"SED", 0xF8, IMP}, 
-    {"SEI", 0x78, IMP},
+    {"SEC", 0x38, IMP, 2, 0}, 
+    {"SED", 0xF8, IMP, 2, 0}, 
+    {"SEI", 0x78, IMP, 2, 0},
     
     // STA - Store Accumulator
-    {"STA", 0x85, ZPG}, 
-    {"STA", 0x95, ZPX}, 
-    {"STA", 0x8D, ABS},
-    {"STA", 0x9D, ABX}, 
-    {"STA", 0x99, ABY}, 
-    {"STA", 0x81, IZX}, 
-    {"STA", 0x91, IZY},
+    {"STA", 0x85, ZPG, 3, 0}, 
+    {"STA", 0x95, ZPX, 4, 0}, 
+    {"STA", 0x8D, ABS, 4, 0},
+    {"STA", 0x9D, ABX, 5, 0}, 
+    {"STA", 0x99, ABY, 5, 0}, 
+    {"STA", 0x81, IZX, 6, 0}, 
+    {"STA", 0x91, IZY, 6, 0},
     
     // STX - Store X Register
-    {"STX", 0x86, ZPG}, 
-    {"STX", 0x96, ZPY}, 
-    {"STX", 0x8E, ABS},
+    {"STX", 0x86, ZPG, 3, 0}, 
+    {"STX", 0x96, ZPY, 4, 0}, 
+    {"STX", 0x8E, ABS, 4, 0},
     
     // STY - Store Y Register
-    {"STY", 0x84, ZPG}, 
-    {"STY", 0x94, ZPX}, 
-    {"STY", 0x8C, ABS},
+    {"STY", 0x84, ZPG, 3, 0}, 
+    {"STY", 0x94, ZPX, 4, 0}, 
+    {"STY", 0x8C, ABS, 4, 0},
     
     // TAX, TAY, TSX, TXA, TXS, TYA - Transfer
-    {"TAX", 0xAA, IMP}, 
-    {"TAY", 0xA8, IMP}, 
-    {"TSX", 0xBA, IMP},
-    {"TXA", 0x8A, IMP}, 
-    {"TXS", 0x9A, IMP}, 
-    {"TYA", 0x98, IMP}
+    {"TAX", 0xAA, IMP, 2, 0}, 
+    {"TAY", 0xA8, IMP, 2, 0}, 
+    {"TSX", 0xBA, IMP, 2, 0},
+    {"TXA", 0x8A, IMP, 2, 0}, 
+    {"TXS", 0x9A, IMP, 2, 0}, 
+    {"TYA", 0x98, IMP, 2, 0}
 };
 
 const int NUM_INSTRUCTIONS = sizeof(instructions) / sizeof(instruction_t);
+
+// Pack a three letter mnemonic into 15 bits, 0 if it is not A-Z only
+unsigned short pack_mnemonic(const char *m) {
+    unsigned short key = 0;
+    for (int i = 0; i < 3; i++) {
+        if (m[i] < 'A' || m[i] > 'Z') return 0;
+        key = (key << 5) | (m[i] - 'A' + 1);
+    }
+    return m[3] == '\0' ? key : 0;
+}
@@ -6,4 +6,7 @@
 extern instruction_t instructions[];
 extern const int NUM_INSTRUCTIONS;
 
+unsigned short pack_mnemonic(const char *mnemonic);
+int find_instruction(const char *mnemonic, addr_mode_t mode);
+
 #endif
@@ -0,0 +1,120 @@
+#include <ctype.h>
+#include <string.h>
+#include "lexer.h"
+
+static str_view_t make_view(const char *ptr, size_t len) {
+    str_view_t view = { ptr, len };
+    return view;
+}
+
+str_view_t view_trim(str_view_t view) {
+    while (view.len > 0 && isspace((unsigned char)view.ptr[0])) {
+        view.ptr++;
+        view.len--;
+    }
+    while (view.len > 0 && isspace((unsigned char)view.ptr[view.len - 1])) view.len--;
+    return view;
+}
+
+int view_equals(str_view_t view, const char *str) {
+    return strncmp(view.ptr, str, view.len) == 0 && str[view.len] == '\0';
+}
+
+// Case-insensitive view_equals against an upper case word
+int view_equals_upper(str_view_t view, const char *upper) {
+    for (size_t i = 0; i < view.len; i++) {
+        if (toupper((unsigned char)view.ptr[i]) != upper[i]) return 0;
+    }
+    return upper[view.len] == '\0';
+}
+
+// First occurrence of needle inside the view, or NULL
+const char* view_find(str_view_t view, const char *needle) {
+    size_t n = strlen(needle);
+    const char *p = view.ptr, *end = view.ptr + view.len;
+    while (n <= (size_t)(end - p) && (p = memchr(p, needle[0], end - p + 1 - n))) {
+        if (memcmp(p, needle, n) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+// Case-insensitive view_find for an upper case needle
+const char* view_find_upper(str_view_t view, const char *upper) {
+    size_t n = strlen(upper);
+    for (size_t i = 0; i + n <= view.len; i++) {
+        if (view_equals_upper(make_view(view.ptr + i, n), upper)) return view.ptr + i;
+    }
+    return NULL;
+}
+
+// First c outside "double quoted" strings; quoted is 0 when the view is
+// known to hold no quotes, which makes this a plain memchr
+static const char* find_char(str_view_t view, char c, int quoted) {
+    if (!quoted) return memchr(view.ptr, c, view.len);
+    int in_string = 0;
+    for (size_t i = 0; i < view.len; i++) {
+        if (view.ptr[i] == '"') in_string = !in_string;
+        else if (view.ptr[i] == c && !in_string) return view.ptr + i;
+    }
+    return NULL;
+}
+
+const char* view_find_unquoted(str_view_t view, char c) {
+    return find_char(view, c, memchr(view.ptr, '"', view.len) != NULL);
+}
+
+// Next comma separated item of an operand list, trimmed; commas inside
+// strings do not separate. Returns 0 once the list is used up.
+int view_next_item(str_view_t *rest, str_view_t *item) {
+    if (!rest->ptr) return 0;
+    const char *comma = view_find_unquoted(*rest, ',');
+    size_t n = comma ? (size_t)(comma - rest->ptr) : rest->len;
+    *item = view_trim(make_view(rest->ptr, n));
+    *rest = comma ? make_view(comma + 1, rest->len - n - 1) : make_view(NULL, 0);
+    return 1;
+}
+
+// strtok over a view: the next run of characters outside delims, consumed
+// from rest; returns 0 when only delimiters are left
+int view_next_field(str_view_t *rest, const char *delims, str_view_t *field) {
+    size_t i = 0, n;
+    while (i < rest->len && strchr(delims, rest->ptr[i])) i++;
+    for (n = i; n < rest->len && !strchr(delims, rest->ptr[n]); n++);
+    *field = make_view(rest->ptr + i, n - i);
+    *rest = make_view(rest->ptr + n, rest->len - n);
+    return field->len > 0;
+}
+
+// Split "label: MNEMONIC operand ; comment" or "name = value"; ';', '='
+// and ':' inside strings are data
+void tokenize_line(const char *text, size_t len, line_tokens_t *tokens) {
+    int quoted = memchr(text, '"', len) != NULL;
+    const char *comment = find_char(make_view(text, len), ';', quoted);
+    str_view_t line = view_trim(make_view(text, comment ? (size_t)(comment - text) : len));
+
+    tokens->label = make_view(NULL, 0);
+    tokens->mnemonic = make_view(line.ptr, 0);
+    tokens->operand = make_view(line.ptr, 0);
+    tokens->equate = 0;
+    if (line.len == 0) return;
+
+    const char *equals = find_char(line, '=', quoted);
+    if (equals) {
+        tokens->equate = 1;
+        tokens->label = view_trim(make_view(line.ptr, equals - line.ptr));
+        tokens->operand = view_trim(make_view(equals + 1, line.ptr + line.len - equals - 1));
+        return;
+    }
+
+    const char *colon = find_char(line, ':', quoted);
+    if (colon) {
+        tokens->label = view_trim(make_view(line.ptr, colon - line.ptr));
+        line = view_trim(make_view(colon + 1, line.ptr + line.len - colon - 1));
+    }
+
+    size_t n = 0;
+    while (n < line.len && !isspace((unsigned char)line.ptr[n])) n++;
+    tokens->mnemonic = make_view(line.ptr, n);
+    tokens->operand = view_trim(make_view(line.ptr + n, line.len - n));
+}
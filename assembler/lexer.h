@@ -0,0 +1,34 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "types.h"
+
+// Fields of one source line as views into the line itself; the source is
+// never written to, so it can be a read-only mapping of the input file
+typedef struct {
+    str_view_t label;       // before ':' or the name of an equate; ptr NULL if none
+    str_view_t mnemonic;    // as written, empty on label-only lines
+    str_view_t operand;     // trimmed and without the comment; equate value
+    int equate;             // "name = value"
+} line_tokens_t;
+
+// A tokenized line and where it came from
+typedef struct {
+    str_view_t text;        // without the newline
+    line_tokens_t tokens;
+    int line;               // 1-based line number in its file
+    int file;               // 0 for the main source, else an included file
+} source_line_t;
+
+void tokenize_line(const char *text, size_t len, line_tokens_t *tokens);
+
+str_view_t view_trim(str_view_t view);
+int view_equals(str_view_t view, const char *str);
+const char* view_find(str_view_t view, const char *needle);
+const char* view_find_upper(str_view_t view, const char *upper);
+const char* view_find_unquoted(str_view_t view, char c);
+int view_equals_upper(str_view_t view, const char *upper);
+int view_next_field(str_view_t *rest, const char *delims, str_view_t *field);
+int view_next_item(str_view_t *rest, str_view_t *item);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "link.h"
+#include "symbols.h"
+
+// Final address of symbol 'idx' of object 'obj' given its section bases
+// and the table of exports
+static int symbol_address(symbol_table_t *exports, const object_t *obj, const int *bases, int idx,
+                          int *address) {
+    const obj_symbol_t *sym = &obj->symbols[idx];
+    if (sym->section == OBJ_IMPORT) {
+        int global = find_symbol(exports, sym->name);
+        if (global < 0 || !exports->symbols[global].defined) return 0;
+        *address = exports->symbols[global].address;
+    } else if (sym->section == OBJ_ABSOLUTE) {
+        *address = sym->value;
+    } else {
+        *address = bases[sym->section] + sym->value;
+    }
+    return 1;
+}
+
+static int compare_org(const void *a, const void *b) {
+    const obj_section_t *x = a, *y = b;
+    return (int)x->org - (int)y->org;
+}
+
+// Sort the sections of an image by address and reject overlaps or
+// sections running past $FFFF. Returns the number of errors.
+int finish_image(object_t *image) {
+    int errors = 0;
+    qsort(image->sections, image->section_count, sizeof(obj_section_t), compare_org);
+    for (int s = 0; s < image->section_count; s++) {
+        const obj_section_t *sec = &image->sections[s];
+        if (sec->org + sec->size > 0x10000) {
+            fprintf(stderr, "ERROR - section %s at $%04X runs past $FFFF\n", sec->name, sec->org);
+            errors++;
+        }
+        if (s > 0 && image->sections[s - 1].org + image->sections[s - 1].size > sec->org) {
+            fprintf(stderr, "ERROR - section %s at $%04X overlaps %s\n",
+                    sec->name, sec->org, image->sections[s - 1].name);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+// Place relocatable sections from 'base' on, grouped by name in order of
+// first appearance, resolve imports against the exports of all objects and
+// apply relocations. The image holds only absolute sections sorted by
+// address. Returns the number of errors.
+int link_objects(object_t *objs, int count, unsigned short base, object_t *image) {
+    int errors = 0;
+    long cursor = base;
+    int **bases = calloc(count ? count : 1, sizeof(int *));
+    if (!bases) return 1;
+
+    object_init(image);
+    for (int o = 0; o < count; o++) {
+        bases[o] = malloc((objs[o].section_count ? objs[o].section_count : 1) * sizeof(int));
+        if (!bases[o]) errors++;
+        for (int s = 0; bases[o] && s < objs[o].section_count; s++) {
+            bases[o][s] = objs[o].sections[s].relocatable ? -1 : objs[o].sections[s].org;
+        }
+    }
+
+    // Placement
+    for (int o = 0; o < count && errors == 0; o++) {
+        for (int s = 0; s < objs[o].section_count; s++) {
+            if (bases[o][s] >= 0) continue;
+            const char *name = objs[o].sections[s].name;
+            for (int o2 = o; o2 < count; o2++) {
+                for (int s2 = 0; s2 < objs[o2].section_count; s2++) {
+                    obj_section_t *sec = &objs[o2].sections[s2];
+                    if (bases[o2][s2] >= 0 || strcmp(sec->name, name) != 0) continue;
+                    bases[o2][s2] = cursor;
+                    cursor += sec->size;
+                }
+            }
+        }
+    }
+    if (cursor > 0x10000) {
+        fprintf(stderr, "ERROR - relocatable sections do not fit below $FFFF\n");
+        errors++;
+    }
+
+    // Exports
+    symbol_table_t exports;
+    symbols_init(&exports);
+    for (int o = 0; o < count && errors == 0; o++) {
+        for (int i = 0; i < objs[o].symbol_count; i++) {
+            const obj_symbol_t *sym = &objs[o].symbols[i];
+            int address;
+            if (!(sym->flags & OBJ_EXPORT)) continue;
+            int idx = find_symbol(&exports, sym->name);
+            if (idx >= 0 && exports.symbols[idx].defined) {
+                fprintf(stderr, "ERROR - symbol %s exported twice\n", sym->name);
+                errors++;
+                continue;
+            }
+            symbol_address(&exports, &objs[o], bases[o], i, &address);
+            if (add_symbol(&exports, sym->name, address) < 0) errors++;
+        }
+    }
+
+    // Relocations, then the image
+    for (int o = 0; o < count && errors == 0; o++) {
+        object_t *obj = &objs[o];
+        for (int r = 0; r < obj->reloc_count; r++) {
+            const obj_reloc_t *rel = &obj->relocs[r];
+            unsigned char *dst = obj->sections[rel->section].data + rel->offset;
+            int address;
+            if (!symbol_address(&exports, obj, bases[o], rel->symbol, &address)) {
+                fprintf(stderr, "ERROR - undefined symbol %s\n", obj->symbols[rel->symbol].name);
+                errors++;
+                continue;
+            }
+            switch (rel->kind) {
+                case FIXUP_ABS:
+                    dst[0] = address & 0xFF;
+                    dst[1] = (address >> 8) & 0xFF;
+                    break;
+                case FIXUP_LO:
+                    dst[0] = address & 0xFF;
+                    break;
+                case FIXUP_HI:
+                    dst[0] = (address >> 8) & 0xFF;
+                    break;
+                default:
+                    errors++;
+                    break;
+            }
+        }
+        for (int s = 0; s < obj->section_count; s++) {
+            const obj_section_t *sec = &obj->sections[s];
+            if (sec->size == 0) continue;
+            if (object_add_section(image, sec->name, bases[o][s], 0, sec->data, sec->size) < 0) errors++;
+        }
+    }
+
+    if (errors == 0) errors = finish_image(image);
+
+    for (int o = 0; o < count; o++) free(bases[o]);
+    free(bases);
+    reset_symbols(&exports);
+    return errors;
+}
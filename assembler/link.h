@@ -0,0 +1,11 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include "object.h"
+
+#define LINK_DEFAULT_BASE 0x0800
+
+int finish_image(object_t *image);
+int link_objects(object_t *objs, int count, unsigned short base, object_t *image);
+
+#endif
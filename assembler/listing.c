@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include "listing.h"
+
+void listing_init(listing_t *listing) {
+    listing->lines = NULL;
+    listing->count = 0;
+    listing->cap = 0;
+    arena_init(&listing->strings);
+}
+
+void listing_free(listing_t *listing) {
+    free(listing->lines);
+    arena_free(&listing->strings);
+    listing_init(listing);
+}
+
+int listing_add(listing_t *listing, const listing_line_t *line, const char *label, const char *text, size_t len) {
+    if (listing->count == listing->cap) {
+        int cap = listing->cap ? listing->cap * 2 : 256;
+        listing_line_t *lines = realloc(listing->lines, cap * sizeof(listing_line_t));
+        if (!lines) return 0;
+        listing->lines = lines;
+        listing->cap = cap;
+    }
+    listing_line_t *entry = &listing->lines[listing->count];
+    *entry = *line;
+    entry->text = arena_strndup(&listing->strings, text, len);
+    entry->label = label ? arena_strndup(&listing->strings, label, strlen(label)) : NULL;
+    if (!entry->text || (label && !entry->label)) return 0;
+    listing->count++;
+    return 1;
+}
+
+// Copy the emitted bytes once the output is final, i.e. after every
+// forward reference has been patched
+void listing_capture(listing_t *listing, const byte_buffer_t *out) {
+    for (int i = 0; i < listing->count; i++) {
+        listing_line_t *line = &listing->lines[i];
+        int n = line->size < LISTING_BYTES ? line->size : LISTING_BYTES;
+        if (n > 0 && line->offset + n <= out->len) memcpy(line->bytes, out->data + line->offset, n);
+    }
+}
+
+static void format_cycles(char *buf, int min, int max) {
+    if (min == 0) buf[0] = '\0';
+    else if (min == max) sprintf(buf, "%d", min);
+    else sprintf(buf, "%d-%d", min, max);
+}
+
+// Source lines with address, bytes, size and cycles, then per label
+// totals: every instruction once, and the slowest straight-line block, the
+// worst case of a run of instructions entered at the top and left at the
+// first branch, jump, call or return
+int write_listing(const listing_t *listing, FILE *f) {
+    char cycles[16], bytes[LISTING_BYTES * 3 + 3];
+
+    fprintf(f, " Line  Addr  Bytes              Size  Cycles  Source\n");
+    for (int i = 0; i < listing->count; i++) {
+        const listing_line_t *line = &listing->lines[i];
+        char *p = bytes;
+        int n = line->size < LISTING_BYTES ? line->size : LISTING_BYTES;
+        for (int b = 0; b < n; b++) p += sprintf(p, "%02X ", line->bytes[b]);
+        if (line->size > LISTING_BYTES) strcpy(p, "..");
+        else *p = '\0';
+        format_cycles(cycles, line->min_cycles, line->max_cycles);
+        if (line->size) {
+            fprintf(f, "%5d  %04X  %-18s %4d  %-6s  %s\n", line->line, line->address, bytes,
+                    line->size, cycles, line->text);
+        } else {
+            fprintf(f, "%5d  %04X  %-18s %4s  %-6s  %s\n", line->line, line->address, "", "", "", line->text);
+        }
+    }
+
+    fprintf(f, "\nLabel                    Address  Bytes  Cycles       Worst block\n");
+    int program_max = 0, program_at = -1;
+    for (int i = 0; i < listing->count; ) {
+        const listing_line_t *first = &listing->lines[i];
+        int size = 0, min = 0, max = 0;
+        int block = 0, block_at = first->address, worst = 0, worst_at = -1;
+
+        do {
+            const listing_line_t *line = &listing->lines[i];
+            if (line->min_cycles) {
+                if (block == 0) block_at = line->address;
+                block += line->max_cycles;
+                if (block > worst) {
+                    worst = block;
+                    worst_at = block_at;
+                }
+                if (line->ends_block) block = 0;
+            }
+            size += line->size;
+            min += line->min_cycles;
+            max += line->max_cycles;
+            i++;
+        } while (i < listing->count && !listing->lines[i].label);
+
+        if (worst > program_max) {
+            program_max = worst;
+            program_at = worst_at;
+        }
+        if (!first->label) continue;
+        format_cycles(cycles, min, max);
+        if (worst_at >= 0) {
+            fprintf(f, "%-24s $%04X   %5d  %-11s  %d at $%04X\n", first->label, first->address,
+                    size, cycles, worst, worst_at);
+        } else {
+            fprintf(f, "%-24s $%04X   %5d\n", first->label, first->address, size);
+        }
+    }
+
+    if (program_at >= 0) {
+        fprintf(f, "\nWorst straight-line block: %d cycles at $%04X\n", program_max, program_at);
+    }
+    return !ferror(f);
+}
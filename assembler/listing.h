@@ -0,0 +1,38 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stdio.h>
+#include "arena.h"
+#include "buffer.h"
+
+#define LISTING_BYTES 8     // bytes kept per line, longer lines end in ".."
+
+// One source line of the final pass
+typedef struct {
+    int line;
+    unsigned short address;
+    size_t offset;          // output offset of the first emitted byte
+    int size;
+    unsigned char bytes[LISTING_BYTES];
+    int instruction;        // instructions[] entry, -1 for other lines
+    int min_cycles;         // 0 for lines without an instruction
+    int max_cycles;
+    int ends_block;         // control transfer: branch, jump, call or return
+    const char *label;      // label defined on the line, or NULL
+    const char *text;
+} listing_line_t;
+
+typedef struct {
+    listing_line_t *lines;
+    int count;
+    int cap;
+    arena_t strings;
+} listing_t;
+
+void listing_init(listing_t *listing);
+void listing_free(listing_t *listing);
+int listing_add(listing_t *listing, const listing_line_t *line, const char *label, const char *text, size_t len);
+void listing_capture(listing_t *listing, const byte_buffer_t *out);
+int write_listing(const listing_t *listing, FILE *f);
+
+#endif
@@ -1,13 +1,225 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "assembler.h"
+#include "link.h"
+#include "pool.h"
+#include "cache.h"
+#include "preproc.h"
+#include "output.h"
+#include "source.h"
+
+// Translation units handed to workers
+typedef struct {
+    char **inputs;
+    char **outputs;         // object paths
+    source_t *sources;      // mapped inputs
+    char (*keys)[CACHE_KEY_LEN + 1];
+    int *todo;              // units the cache could not satisfy
+    cache_t *cache;
+    asm6502_ctx **contexts; // one per worker thread
+} unit_list_t;
 
 // Usage helper
 void print_usage(const char* prog_name) {
-    printf("Usage: %s [-o output_file] assembly_file\n", prog_name);
-    printf("  -o output_file   Write assembled hex to a file\n");
+    printf("Usage: %s [options] assembly_file...\n", prog_name);
+    printf("  -o output_file   Write assembled output (or the object with -c) to a file\n");
+    printf("  -f format        Output format: hex (default), raw, ihex, prg or srec\n");
+    printf("  --map            Print the address range of every output segment\n");
+    printf("  -l listing_file  Write a listing with addresses, bytes and cycle counts\n");
+    printf("  -c               Assemble each source to a relocatable object (.o)\n");
+    printf("  -j jobs          Assemble translation units on up to jobs workers\n");
+    printf("  -b address       Link base of relocatable sections (default $%04X)\n", LINK_DEFAULT_BASE);
+    printf("  --one-pass       Assemble in a single pass, patching forward references\n");
+    printf("  -O               Peephole optimize; memory operands must be free of side effects\n");
+    printf("  --stats          Report zero page and branch relaxation savings\n");
+    printf("  --cache-dir dir  Reuse objects of unchanged translation units from dir\n");
+    printf("  --cache-stats    Report object cache hits and misses\n");
     printf("If no output file is specified, hex is printed to stdout.\n");
+    printf("An assembly_file of - reads stdin; hex output is assembled in a single pass as it arrives,\n");
+    printf("so .macro, .rept and .include need a file.\n");
+    printf("Several inputs, or .o inputs, are assembled concurrently and linked.\n");
+}
+
+static int is_object_file(const char *path) {
+    size_t len = strlen(path);
+    return len > 2 && strcmp(path + len - 2, ".o") == 0;
+}
+
+// "dir/file.s" -> "dir/file.o"
+static char* object_path(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(path, '.');
+    size_t len = dot && (!slash || dot > slash) ? (size_t)(dot - path) : strlen(path);
+    char *obj = malloc(len + 3);
+    if (!obj) return NULL;
+    memcpy(obj, path, len);
+    strcpy(obj + len, ".o");
+    return obj;
+}
+
+// Worker: assemble one source into an object file and publish it to the cache
+static int compile_unit(int index, int worker, void *arg) {
+    unit_list_t *units = arg;
+    object_t obj;
+
+    index = units->todo[index];
+    asm6502_ctx *ctx = units->contexts[worker];
+    if (!ctx && !(ctx = units->contexts[worker] = asm6502_create(ASM_OBJECT))) {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    asm6502_set_source_name(ctx, units->inputs[index]);
+    int errors = assemble_6502_object_ex(ctx, units->sources[index].text, units->sources[index].len, &obj);
+    if (errors) {
+        fprintf(stderr, "%s: %d errors\n", units->inputs[index], errors);
+        return 1;
+    }
+
+    FILE *f = fopen(units->outputs[index], "wb");
+    if (!f) {
+        perror("ERROR - Failed to open object file");
+        object_free(&obj);
+        return 1;
+    }
+    int ok = object_write(&obj, f);
+    ok &= fclose(f) == 0;
+    object_free(&obj);
+    if (!ok) fprintf(stderr, "ERROR - could not write %s\n", units->outputs[index]);
+    if (ok && !cache_store(units->cache, units->keys[index], units->outputs[index])) {
+        fprintf(stderr, "warning: could not store %s in the cache\n", units->inputs[index]);
+    }
+    return !ok;
+}
+
+static int alloc_units(unit_list_t *units, int count, cache_t *cache) {
+    units->inputs = calloc(count, sizeof(char *));
+    units->outputs = calloc(count, sizeof(char *));
+    units->sources = calloc(count, sizeof(source_t));
+    units->keys = calloc(count, sizeof(*units->keys));
+    units->todo = calloc(count, sizeof(int));
+    units->cache = cache;
+    units->contexts = NULL;
+    return units->inputs && units->outputs && units->sources && units->keys && units->todo;
+}
+
+static void free_units(unit_list_t *units, int count) {
+    for (int i = 0; i < count; i++) {
+        free(units->outputs[i]);
+        source_close(&units->sources[i]);
+    }
+    free(units->inputs);
+    free(units->outputs);
+    free(units->sources);
+    free(units->keys);
+    free(units->todo);
+}
+
+// Cache key of a unit; with includes, their contents count as well
+static void source_key(unit_list_t *units, int i) {
+    const source_t *src = &units->sources[i];
+    preproc_t pp;
+    pp_init(&pp, units->inputs[i]);
+    pp.quiet = 1;
+    int expanded = units->cache->dir && pp_needed(src->text, src->len) && pp_expand(&pp, src->text, src->len) == 0;
+    cache_key(src->text, src->len, expanded ? &pp : NULL, ASM_OBJECT, units->keys[i]);
+    pp_free(&pp);
+}
+
+// Read the sources, take unchanged units from the cache and assemble the
+// rest concurrently. Returns the number of failed units.
+static int build_units(unit_list_t *units, int count, int jobs) {
+    int todo_count = 0, errors = 0;
+    for (int i = 0; i < count; i++) {
+        if (!source_open(&units->sources[i], units->inputs[i])) {
+            errors++;
+            continue;
+        }
+        source_key(units, i);
+        if (!cache_fetch(units->cache, units->keys[i], units->outputs[i])) units->todo[todo_count++] = i;
+    }
+    if (errors) return errors;
+
+    if (jobs < 1) jobs = 1;
+    if (!(units->contexts = calloc(jobs, sizeof(asm6502_ctx *)))) {
+        perror("Memory allocation failed");
+        return count;
+    }
+    errors = run_pool(todo_count, jobs, compile_unit, units);
+    for (int i = 0; i < jobs; i++) asm6502_destroy(units->contexts[i]);
+    free(units->contexts);
+    units->contexts = NULL;
+    return errors;
+}
+
+static int read_object(const char *path, object_t *obj) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("Failed to open object file");
+        return 0;
+    }
+    int ok = object_read(obj, f);
+    fclose(f);
+    if (!ok) fprintf(stderr, "ERROR - %s is not a valid object file\n", path);
+    return ok;
+}
+
+// Assemble the sources among the inputs into temporary objects, then link
+// everything into one image
+static int link_inputs(char **inputs, int count, int jobs, cache_t *cache, unsigned short base, object_t *image) {
+    unit_list_t units;
+    int sources = 0, errors = 0;
+    object_t *objs = calloc(count, sizeof(object_t));
+    if (!objs || !alloc_units(&units, count, cache)) {
+        perror("Memory allocation failed");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (is_object_file(inputs[i])) continue;
+        char tmp[] = "/tmp/6502asXXXXXX";
+        int fd = mkstemp(tmp);
+        if (fd < 0) {
+            perror("mkstemp");
+            errors++;
+            break;
+        }
+        close(fd);
+        units.inputs[sources] = inputs[i];
+        units.outputs[sources++] = strdup(tmp);
+    }
+
+    if (errors == 0) errors = build_units(&units, sources, jobs);
+
+    for (int i = 0, unit = 0; i < count && errors == 0; i++) {
+        const char *path = is_object_file(inputs[i]) ? inputs[i] : units.outputs[unit++];
+        if (!read_object(path, &objs[i])) errors++;
+    }
+
+    if (errors == 0) errors = link_objects(objs, count, base, image);
+
+    for (int i = 0; i < sources; i++) unlink(units.outputs[i]);
+    for (int i = 0; i < count; i++) object_free(&objs[i]);
+    free(objs);
+    free_units(&units, sources);
+    return errors;
+}
+
+static int save_listing(const listing_t *listing, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("ERROR - Failed to open listing file");
+        return 0;
+    }
+    int ok = write_listing(listing, f);
+    ok &= fclose(f) == 0;
+    if (!ok) perror("ERROR - Failed to write listing");
+    return ok;
+}
+
+static void print_cache_stats(const cache_t *cache) {
+    fprintf(stderr, "cache: %d hits, %d misses\n", cache->hits, cache->misses);
 }
 
 int main(int argc, char *argv[]) {
@@ -16,16 +228,55 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    const char *input_file = NULL;
+    char **inputs = calloc(argc, sizeof(char *));
+    int input_count = 0;
     const char *output_file = NULL;
+    const char *listing_file = NULL;
+    int flags = 0;
+    int show_stats = 0;
+    int compile_only = 0;
+    int show_map = 0;
+    output_format_t format = FORMAT_HEX;
+    int show_cache_stats = 0;
+    cache_t cache = { NULL, 0, 0 };
+    int jobs = default_jobs();
+    unsigned short base = LINK_DEFAULT_BASE;
 
     // Parse flags
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
             output_file = argv[i + 1];
             i++; // skip next arg since it's the filename
-        } else if (argv[i][0] != '-') {
-            input_file = argv[i];
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            if (!parse_output_format(argv[++i], &format)) {
+                printf("Unknown output format: %s\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            listing_file = argv[++i];
+        } else if (strcmp(argv[i], "--map") == 0) {
+            show_map = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            compile_only = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            base = strtol(argv[i + 1][0] == '$' ? argv[i + 1] + 1 : argv[i + 1], NULL,
+                          argv[i + 1][0] == '$' ? 16 : 0);
+            i++;
+        } else if (strcmp(argv[i], "--one-pass") == 0) {
+            flags |= ASM_ONE_PASS;
+        } else if (strcmp(argv[i], "-O") == 0) {
+            flags |= ASM_OPTIMIZE;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            cache.dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            show_cache_stats = 1;
+        } else if (argv[i][0] != '-' || argv[i][1] == '\0') {
+            inputs[input_count++] = argv[i];
         } else {
             printf("Unknown option: %s\n", argv[i]);
             print_usage(argv[0]);
@@ -33,51 +284,117 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (!input_file) {
+    if (input_count == 0) {
         printf("No assembly file specified.\n");
         print_usage(argv[0]);
         return 1;
     }
 
-    // Read input assembly file
-    FILE *f = fopen(input_file, "r");
-    if (!f) {
-        perror("Failed to open input file");
+    // -c: one object per source, written next to it unless -o names it
+    if (compile_only) {
+        unit_list_t units;
+        if (!alloc_units(&units, input_count, &cache)) {
+            perror("Memory allocation failed");
+            return 1;
+        }
+        for (int i = 0; i < input_count; i++) {
+            units.inputs[i] = inputs[i];
+            units.outputs[i] = output_file && input_count == 1 ? strdup(output_file) : object_path(inputs[i]);
+        }
+        int failed = build_units(&units, input_count, jobs);
+        free_units(&units, input_count);
+        free(inputs);
+        if (show_cache_stats) print_cache_stats(&cache);
+        return failed ? 1 : 0;
+    }
+
+    int linking = input_count > 1 || is_object_file(inputs[0]);
+    int streaming = !linking && format == FORMAT_HEX && !show_map && !listing_file;
+    // Anything but plain hex, or -O, needs all of standard input in memory
+    int stdin_stream = streaming && strcmp(inputs[0], "-") == 0 && !(flags & ASM_OPTIMIZE);
+    if (linking && listing_file) {
+        printf("A listing needs a single assembly file.\n");
         return 1;
     }
 
-    fseek(f, 0, SEEK_END);
-    long filesize = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    FILE *out = stdout;
+    if (output_file) {
+        out = fopen(output_file, format == FORMAT_HEX ? "w" : "wb");
+        if (!out) {
+            perror("ERROR - Failed to open output file; 0x");
+            return 1;
+        }
+    } else if (format == FORMAT_HEX) {
+        printf("Assembled hex:\n");
+    }
 
-    char *assembly_code = malloc(filesize + 1);
-    if (!assembly_code) {
+    asm6502_ctx *ctx = asm6502_create(flags);
+    if (!ctx) {
         perror("Memory allocation failed");
-        fclose(f);
         return 1;
     }
+    if (strcmp(inputs[0], "-") != 0) asm6502_set_source_name(ctx, inputs[0]);
 
-    fread(assembly_code, 1, filesize, f);
-    assembly_code[filesize] = '\0';
-    fclose(f);
+    int errors;
+    if (streaming) {
+        // Assemble, streaming hex to the sink as it is produced
+        if (stdin_stream) {
+            errors = assemble_6502_file_ex(ctx, stdin, out);
+        } else {
+            source_t src;
+            if (!source_open(&src, inputs[0])) return 1;
+            errors = assemble_6502_stream_ex(ctx, src.text, src.len, out);
+            source_close(&src);
+        }
+        fputc('\n', out);
+    } else {
+        // Whole image, written in the requested format
+        object_t image;
+        object_init(&image);
+        if (linking) {
+            errors = link_inputs(inputs, input_count, jobs, &cache, base, &image);
+        } else {
+            source_t src;
+            if (!source_open(&src, inputs[0])) return 1;
+            listing_t listing;
+            listing_init(&listing);
+            errors = assemble_6502_image_ex(ctx, src.text, src.len, &image, listing_file ? &listing : NULL);
+            if (errors == 0) errors = finish_image(&image);
+            if (errors == 0 && listing_file && !save_listing(&listing, listing_file)) errors++;
+            listing_free(&listing);
+            source_close(&src);
+        }
+        if (errors == 0 && !write_image(&image, format, out)) {
+            perror("ERROR - Failed to write output");
+            errors++;
+        }
+        if (errors == 0 && show_map) print_memory_map(&image, output_file ? stdout : stderr);
+        object_free(&image);
+    }
+    free(inputs);
+
+    if (show_stats) {
+        const asm_stats_t *stats = asm6502_stats(ctx);
+        fprintf(stderr, "%d passes, %d zero page operands: %d bytes and %d cycles saved, %d branches expanded\n",
+                stats->passes, stats->zero_page, stats->bytes_saved, stats->cycles_saved,
+                stats->branches_expanded);
+        if (flags & ASM_OPTIMIZE) fprintf(stderr, "peephole: %d rounds\n", stats->peephole.rounds);
+        for (int r = 0; (flags & ASM_OPTIMIZE) && r < PEEPHOLE_NUM_RULES; r++) {
+            const peephole_count_t *rule = &stats->peephole.rules[r];
+            fprintf(stderr, "  %-12s %5d rewrites: %d bytes and %d cycles saved\n",
+                    peephole_rule_name(r), rule->applied, rule->bytes_saved, rule->cycles_saved);
+        }
+    }
 
-    // Assemble
-    char *hex_output = assemble_6502(assembly_code);
-    free(assembly_code);
+    if (show_cache_stats) print_cache_stats(&cache);
+    asm6502_destroy(ctx);
 
-    // Output
     if (output_file) {
-        FILE *out = fopen(output_file, "w");
-        if (!out) {
-            perror("ERROR - Failed to open output file; 0x");
-            return 1;
-        }
-        fprintf(out, "%s\n", hex_output);
         fclose(out);
-        printf("Hex output written to %s\n", output_file);
-    } else {
-        printf("Assembled hex:\n%s\n", hex_output);
+        if (errors) return 1;
+        printf("%s output written to %s\n", format == FORMAT_HEX ? "Hex" : "Binary", output_file);
     }
 
+    if (errors) return 1;
     return 0;
 }
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+
+// Object file layout, all integers little endian:
+//   magic[4] u16 sections u16 symbols u32 relocs
+//   section: u8 flags, u16 org, u16 size, u8 name_len, name, data[size]
+//   symbol:  i16 section, u16 value, u8 flags, u16 name_len, name
+//   reloc:   u16 section, u16 offset, u8 kind, u16 symbol
+
+#define SECTION_RELOCATABLE 0x01
+
+void object_init(object_t *obj) {
+    memset(obj, 0, sizeof(*obj));
+}
+
+void object_free(object_t *obj) {
+    for (int i = 0; i < obj->section_count; i++) {
+        free(obj->sections[i].name);
+        free(obj->sections[i].data);
+    }
+    for (int i = 0; i < obj->symbol_count; i++) free(obj->symbols[i].name);
+    free(obj->sections);
+    free(obj->symbols);
+    free(obj->relocs);
+    object_init(obj);
+}
+
+// Make room for one more element; capacity doubles at powers of two
+static int grow(void **items, int count, size_t item_size) {
+    if (count < 4 ? count != 0 : (count & (count - 1)) != 0) return 1;
+    void *table = realloc(*items, (count ? count * 2 : 4) * item_size);
+    if (!table) return 0;
+    *items = table;
+    return 1;
+}
+
+static char* copy_string(const char *str, size_t len) {
+    char *copy = malloc(len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+int object_add_section(object_t *obj, const char *name, unsigned short org, int relocatable,
+                       const unsigned char *data, size_t size) {
+    if (size > 0x10000 || !grow((void **)&obj->sections, obj->section_count, sizeof(obj_section_t))) return -1;
+    obj_section_t *sec = &obj->sections[obj->section_count];
+    sec->name = copy_string(name, strlen(name));
+    sec->data = malloc(size ? size : 1);
+    if (!sec->name || !sec->data) {
+        free(sec->name);
+        free(sec->data);
+        return -1;
+    }
+    if (data) memcpy(sec->data, data, size);
+    else memset(sec->data, 0, size);
+    sec->org = org;
+    sec->relocatable = relocatable;
+    sec->size = size;
+    return obj->section_count++;
+}
+
+int object_add_symbol(object_t *obj, const char *name, int section, unsigned short value, int flags) {
+    if (!grow((void **)&obj->symbols, obj->symbol_count, sizeof(obj_symbol_t))) return -1;
+    obj_symbol_t *sym = &obj->symbols[obj->symbol_count];
+    if (!(sym->name = copy_string(name, strlen(name)))) return -1;
+    sym->section = section;
+    sym->value = value;
+    sym->flags = flags;
+    return obj->symbol_count++;
+}
+
+int object_add_reloc(object_t *obj, int section, unsigned short offset, fixup_kind_t kind, int symbol) {
+    if (!grow((void **)&obj->relocs, obj->reloc_count, sizeof(obj_reloc_t))) return -1;
+    obj_reloc_t *rel = &obj->relocs[obj->reloc_count];
+    rel->section = section;
+    rel->offset = offset;
+    rel->kind = kind;
+    rel->symbol = symbol;
+    return obj->reloc_count++;
+}
+
+static void put_u8(FILE *f, unsigned v) {
+    fputc(v & 0xFF, f);
+}
+
+static void put_u16(FILE *f, unsigned v) {
+    fputc(v & 0xFF, f);
+    fputc((v >> 8) & 0xFF, f);
+}
+
+static int get_u8(FILE *f, unsigned *v) {
+    int c = fgetc(f);
+    if (c == EOF) return 0;
+    *v = c;
+    return 1;
+}
+
+static int get_u16(FILE *f, unsigned *v) {
+    unsigned lo, hi;
+    if (!get_u8(f, &lo) || !get_u8(f, &hi)) return 0;
+    *v = lo | (hi << 8);
+    return 1;
+}
+
+static char* get_string(FILE *f, size_t len) {
+    char *str = malloc(len + 1);
+    if (!str) return NULL;
+    if (fread(str, 1, len, f) != len) {
+        free(str);
+        return NULL;
+    }
+    str[len] = '\0';
+    return str;
+}
+
+// Section sizes are stored in 16 bits, so a 64 KB section cannot be
+// written; it, or any count or name past the limits of the format, fails
+// the whole file before anything is written
+int object_write(const object_t *obj, FILE *f) {
+    if (obj->section_count > OBJ_MAX_SECTIONS || obj->symbol_count > OBJ_MAX_SYMBOLS) return 0;
+    for (int i = 0; i < obj->section_count; i++) {
+        if (obj->sections[i].size > OBJ_MAX_SECTION) return 0;
+        if (strlen(obj->sections[i].name) > OBJ_MAX_SECTION_NAME) return 0;
+    }
+    for (int i = 0; i < obj->symbol_count; i++) {
+        if (strlen(obj->symbols[i].name) > OBJ_MAX_SYMBOL_NAME) return 0;
+    }
+    fwrite(OBJ_MAGIC, 1, 4, f);
+    put_u16(f, obj->section_count);
+    put_u16(f, obj->symbol_count);
+    put_u16(f, obj->reloc_count);
+    put_u16(f, obj->reloc_count >> 16);
+
+    for (int i = 0; i < obj->section_count; i++) {
+        const obj_section_t *sec = &obj->sections[i];
+        size_t len = strlen(sec->name);
+        put_u8(f, sec->relocatable ? SECTION_RELOCATABLE : 0);
+        put_u16(f, sec->org);
+        put_u16(f, sec->size);
+        put_u8(f, len);
+        fwrite(sec->name, 1, len, f);
+        fwrite(sec->data, 1, sec->size, f);
+    }
+    for (int i = 0; i < obj->symbol_count; i++) {
+        const obj_symbol_t *sym = &obj->symbols[i];
+        size_t len = strlen(sym->name);
+        put_u16(f, (unsigned)sym->section);
+        put_u16(f, sym->value);
+        put_u8(f, sym->flags);
+        put_u16(f, len);
+        fwrite(sym->name, 1, len, f);
+    }
+    for (int i = 0; i < obj->reloc_count; i++) {
+        const obj_reloc_t *rel = &obj->relocs[i];
+        put_u16(f, rel->section);
+        put_u16(f, rel->offset);
+        put_u8(f, rel->kind);
+        put_u16(f, rel->symbol);
+    }
+    return !ferror(f);
+}
+
+// Returns 0 on a truncated or malformed file
+int object_read(object_t *obj, FILE *f) {
+    char magic[4];
+    unsigned sections, symbols, relocs_lo, relocs_hi;
+
+    object_init(obj);
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, OBJ_MAGIC, 4) != 0) return 0;
+    if (!get_u16(f, &sections) || !get_u16(f, &symbols) ||
+        !get_u16(f, &relocs_lo) || !get_u16(f, &relocs_hi)) return 0;
+
+    for (unsigned i = 0; i < sections; i++) {
+        unsigned flags, org, size, len;
+        if (!get_u8(f, &flags) || !get_u16(f, &org) || !get_u16(f, &size) || !get_u8(f, &len)) goto fail;
+        char *name = get_string(f, len);
+        if (!name) goto fail;
+        int idx = object_add_section(obj, name, org, flags & SECTION_RELOCATABLE, NULL, size);
+        free(name);
+        if (idx < 0 || fread(obj->sections[idx].data, 1, size, f) != size) goto fail;
+    }
+    for (unsigned i = 0; i < symbols; i++) {
+        unsigned section, value, flags, len;
+        if (!get_u16(f, &section) || !get_u16(f, &value) || !get_u8(f, &flags) || !get_u16(f, &len)) goto fail;
+        char *name = get_string(f, len);
+        if (!name) goto fail;
+        int idx = object_add_symbol(obj, name, (short)section, value, flags);
+        free(name);
+        if (idx < 0) goto fail;
+        int sec = obj->symbols[idx].section;
+        if (sec != OBJ_ABSOLUTE && sec != OBJ_IMPORT && (sec < 0 || sec >= (int)sections)) goto fail;
+    }
+    for (unsigned long i = 0; i < (relocs_lo | ((unsigned long)relocs_hi << 16)); i++) {
+        unsigned section, offset, kind, symbol;
+        if (!get_u16(f, &section) || !get_u16(f, &offset) || !get_u8(f, &kind) || !get_u16(f, &symbol)) goto fail;
+        if (section >= sections || symbol >= symbols || kind > FIXUP_HI ||
+            offset + (kind == FIXUP_ABS ? 2u : 1u) > obj->sections[section].size) goto fail;
+        if (object_add_reloc(obj, section, offset, kind, symbol) < 0) goto fail;
+    }
+    return 1;
+
+fail:
+    object_free(obj);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include "types.h"
+
+#define OBJ_MAGIC "65O\x01"
+
+// Object symbol sections besides real section indices
+#define OBJ_ABSOLUTE -1
+#define OBJ_IMPORT   -2
+
+#define OBJ_EXPORT 0x01
+
+// Largest section an object file holds; images may fill all 64 KB
+#define OBJ_MAX_SECTION 0xFFFF
+
+// Other limits of the file format: counts and name lengths are stored in
+// 16 bits, section name lengths in 8, and symbol sections as signed 16 bits
+#define OBJ_MAX_SECTIONS     0x7FFF
+#define OBJ_MAX_SYMBOLS      0xFFFF
+#define OBJ_MAX_SECTION_NAME 0xFF
+#define OBJ_MAX_SYMBOL_NAME  0xFFFF
+
+typedef struct {
+    char *name;
+    unsigned short org;
+    int relocatable;
+    unsigned char *data;
+    size_t size;
+} obj_section_t;
+
+typedef struct {
+    char *name;
+    int section;            // section index, OBJ_ABSOLUTE or OBJ_IMPORT
+    unsigned short value;   // section relative for relocatable sections
+    int flags;
+} obj_symbol_t;
+
+// Patch of section bytes with the final address of a symbol
+typedef struct {
+    int section;
+    unsigned short offset;
+    fixup_kind_t kind;      // FIXUP_ABS, FIXUP_LO or FIXUP_HI
+    int symbol;
+} obj_reloc_t;
+
+// Relocatable translation unit, or a linked image when every section is
+// absolute and there are no relocations
+typedef struct {
+    obj_section_t *sections;
+    int section_count;
+    obj_symbol_t *symbols;
+    int symbol_count;
+    obj_reloc_t *relocs;
+    int reloc_count;
+} object_t;
+
+void object_init(object_t *obj);
+void object_free(object_t *obj);
+int object_add_section(object_t *obj, const char *name, unsigned short org, int relocatable,
+                       const unsigned char *data, size_t size);
+int object_add_symbol(object_t *obj, const char *name, int section, unsigned short value, int flags);
+int object_add_reloc(object_t *obj, int section, unsigned short offset, fixup_kind_t kind, int symbol);
+int object_write(const object_t *obj, FILE *f);
+int object_read(object_t *obj, FILE *f);
+
+#endif
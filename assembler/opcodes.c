@@ -0,0 +1,10 @@
+#include "instructions.h"
+#include "opcode_index.h"
+
+// O(1) instructions[] index for a mnemonic/mode pair, -1 if illegal
+int find_instruction(const char *mnemonic, addr_mode_t mode) {
+    unsigned short key = pack_mnemonic(mnemonic);
+    unsigned slot = ((key * OPCODE_HASH_MUL) >> 16) & (OPCODE_HASH_SLOTS - 1);
+    if (!key || opcode_keys[slot] != key) return -1;
+    return opcode_index[slot][mode];
+}
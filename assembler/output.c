@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+#include "buffer.h"
+
+#define RECORD_BYTES 16
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+int parse_output_format(const char *name, output_format_t *format) {
+    static const struct { const char *name; output_format_t format; } formats[] = {
+        { "hex", FORMAT_HEX }, { "raw", FORMAT_RAW }, { "ihex", FORMAT_IHEX },
+        { "prg", FORMAT_PRG }, { "srec", FORMAT_SREC }
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(name, formats[i].name) == 0) {
+            *format = formats[i].format;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Flat image spanning all sections, written with a single fwrite. Sections
+// must be sorted by address.
+static int write_flat(const object_t *image, FILE *f, int load_header) {
+    if (image->section_count == 0) return 1;
+    unsigned start = image->sections[0].org;
+    const obj_section_t *last = &image->sections[image->section_count - 1];
+    size_t span = last->org + last->size - start;
+
+    unsigned char *flat = malloc(span + 2);
+    if (!flat) return 0;
+    unsigned char *data = flat + 2;
+    memset(data, OUTPUT_GAP_FILL, span);
+    for (int s = 0; s < image->section_count; s++) {
+        memcpy(data + (image->sections[s].org - start), image->sections[s].data, image->sections[s].size);
+    }
+    flat[0] = start & 0xFF;
+    flat[1] = (start >> 8) & 0xFF;
+
+    unsigned char *from = load_header ? flat : data;
+    size_t len = load_header ? span + 2 : span;
+    int ok = fwrite(from, 1, len, f) == len;
+    free(flat);
+    return ok;
+}
+
+// Append "XX" to a record and fold the byte into its checksum
+static char* put_hex_byte(char *p, unsigned byte, unsigned *sum) {
+    *p++ = hex_digits[(byte >> 4) & 0x0F];
+    *p++ = hex_digits[byte & 0x0F];
+    *sum += byte & 0xFF;
+    return p;
+}
+
+// Intel HEX data records per section, then the end of file record
+static int write_ihex(const object_t *image, FILE *f) {
+    char record[16 + RECORD_BYTES * 2];
+    for (int s = 0; s < image->section_count; s++) {
+        const obj_section_t *sec = &image->sections[s];
+        for (size_t i = 0; i < sec->size; i += RECORD_BYTES) {
+            size_t n = sec->size - i < RECORD_BYTES ? sec->size - i : RECORD_BYTES;
+            unsigned address = sec->org + i, sum = 0;
+            char *p = record;
+            *p++ = ':';
+            p = put_hex_byte(p, n, &sum);
+            p = put_hex_byte(p, address >> 8, &sum);
+            p = put_hex_byte(p, address, &sum);
+            p = put_hex_byte(p, 0x00, &sum);
+            for (size_t b = 0; b < n; b++) p = put_hex_byte(p, sec->data[i + b], &sum);
+            p = put_hex_byte(p, -sum, &sum);
+            *p++ = '\n';
+            if (fwrite(record, 1, p - record, f) != (size_t)(p - record)) return 0;
+        }
+    }
+    return fputs(":00000001FF\n", f) >= 0;
+}
+
+// S0 header, S1 data records, S5 record count and S9 entry at the lowest address
+static int write_srec(const object_t *image, FILE *f) {
+    char record[16 + RECORD_BYTES * 2];
+    unsigned count = 0, sum;
+    char *p;
+
+    if (fputs("S009000036353032617355\n", f) < 0) return 0;
+    for (int s = 0; s < image->section_count; s++) {
+        const obj_section_t *sec = &image->sections[s];
+        for (size_t i = 0; i < sec->size; i += RECORD_BYTES) {
+            size_t n = sec->size - i < RECORD_BYTES ? sec->size - i : RECORD_BYTES;
+            unsigned address = sec->org + i;
+            sum = 0;
+            p = record;
+            *p++ = 'S';
+            *p++ = '1';
+            p = put_hex_byte(p, n + 3, &sum);
+            p = put_hex_byte(p, address >> 8, &sum);
+            p = put_hex_byte(p, address, &sum);
+            for (size_t b = 0; b < n; b++) p = put_hex_byte(p, sec->data[i + b], &sum);
+            p = put_hex_byte(p, ~sum, &sum);
+            *p++ = '\n';
+            if (fwrite(record, 1, p - record, f) != (size_t)(p - record)) return 0;
+            count++;
+        }
+    }
+
+    unsigned entry = image->section_count ? image->sections[0].org : 0;
+    unsigned trailer[2][2] = { { '5', count }, { '9', entry } };
+    for (int t = 0; t < 2; t++) {
+        sum = 0;
+        p = record;
+        *p++ = 'S';
+        *p++ = trailer[t][0];
+        p = put_hex_byte(p, 3, &sum);
+        p = put_hex_byte(p, trailer[t][1] >> 8, &sum);
+        p = put_hex_byte(p, trailer[t][1], &sum);
+        p = put_hex_byte(p, ~sum, &sum);
+        *p++ = '\n';
+        if (fwrite(record, 1, p - record, f) != (size_t)(p - record)) return 0;
+    }
+    return 1;
+}
+
+// Sections must be sorted by address (see finish_image)
+int write_image(const object_t *image, output_format_t format, FILE *f) {
+    switch (format) {
+        case FORMAT_RAW: return write_flat(image, f, 0);
+        case FORMAT_PRG: return write_flat(image, f, 1);
+        case FORMAT_IHEX: return write_ihex(image, f);
+        case FORMAT_SREC: return write_srec(image, f);
+        case FORMAT_HEX:
+            for (int s = 0; s < image->section_count; s++) {
+                byte_buffer_t view = { image->sections[s].data, image->sections[s].size, image->sections[s].size };
+                if (!buffer_write_hex(&view, f)) return 0;
+            }
+            return fputc('\n', f) != EOF;
+    }
+    return 0;
+}
+
+void print_memory_map(const object_t *image, FILE *f) {
+    fprintf(f, "Segment          Start  End    Size\n");
+    for (int s = 0; s < image->section_count; s++) {
+        const obj_section_t *sec = &image->sections[s];
+        fprintf(f, "%-16s $%04X  $%04X  %5zu\n", sec->name, sec->org,
+                (unsigned)(sec->org + sec->size - 1), sec->size);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include "object.h"
+
+typedef enum {
+    FORMAT_HEX,     // "XX XX ..." text
+    FORMAT_RAW,     // flat binary from the lowest to the highest address
+    FORMAT_IHEX,    // Intel HEX
+    FORMAT_PRG,     // C64 PRG: load address then flat binary
+    FORMAT_SREC     // Motorola S-record (S1/S9)
+} output_format_t;
+
+// Fill byte for gaps in flat formats, the erased state of an EPROM
+#define OUTPUT_GAP_FILL 0xFF
+
+int parse_output_format(const char *name, output_format_t *format);
+int write_image(const object_t *image, output_format_t format, FILE *f);
+void print_memory_map(const object_t *image, FILE *f);
+
+#endif
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "peephole.h"
+#include "instructions.h"
+#include "utils.h"
+
+#define MAX_OPERAND 128
+
+// Status flags tracked for liveness
+#define P_C 0x01
+#define P_Z 0x02
+#define P_V 0x40
+#define P_N 0x80
+#define P_ALL (P_C | P_Z | P_V | P_N)
+
+// Flags each instruction reads and writes; control transfers and anything
+// missing here count as reading every flag
+static const struct {
+    char mnemonic[4];
+    unsigned char reads;
+    unsigned char writes;
+} flag_use[] = {
+    { "ADC", P_C, P_ALL },       { "AND", 0, P_N | P_Z },     { "ASL", 0, P_N | P_Z | P_C },
+    { "BIT", 0, P_N | P_V | P_Z }, { "CLC", 0, P_C },         { "CLD", 0, 0 },
+    { "CLI", 0, 0 },             { "CLV", 0, P_V },           { "CMP", 0, P_N | P_Z | P_C },
+    { "CPX", 0, P_N | P_Z | P_C }, { "CPY", 0, P_N | P_Z | P_C }, { "DEC", 0, P_N | P_Z },
+    { "DEX", 0, P_N | P_Z },     { "DEY", 0, P_N | P_Z },     { "EOR", 0, P_N | P_Z },
+    { "INC", 0, P_N | P_Z },     { "INX", 0, P_N | P_Z },     { "INY", 0, P_N | P_Z },
+    { "LDA", 0, P_N | P_Z },     { "LDX", 0, P_N | P_Z },     { "LDY", 0, P_N | P_Z },
+    { "LSR", 0, P_N | P_Z | P_C }, { "NOP", 0, 0 },           { "ORA", 0, P_N | P_Z },
+    { "PHA", 0, 0 },             { "PHP", P_ALL, 0 },         { "PLA", 0, P_N | P_Z },
+    { "PLP", 0, P_ALL },         { "ROL", P_C, P_N | P_Z | P_C }, { "ROR", P_C, P_N | P_Z | P_C },
+    { "SBC", P_C, P_ALL },       { "SEC", 0, P_C },           { "SED", 0, 0 },
+    { "SEI", 0, 0 },             { "STA", 0, 0 },             { "STX", 0, 0 },
+    { "STY", 0, 0 },             { "TAX", 0, P_N | P_Z },     { "TAY", 0, P_N | P_Z },
+    { "TSX", 0, P_N | P_Z },     { "TXA", 0, P_N | P_Z },     { "TXS", 0, 0 },
+    { "TYA", 0, P_N | P_Z }
+};
+
+static const char *rule_names[PEEPHOLE_NUM_RULES] = {
+    "store-load", "jmp-next", "add-zero", "jmp-chain"
+};
+
+// Program line with what the decoding run found out about it
+typedef struct {
+    const listing_line_t *line;
+    source_line_t *source;
+    int instruction;            // instructions[] entry, -1 for other lines
+    int directive;              // .ORG and friends: not straight-line code
+    int label_len;              // length of "name:" prefix, 0 if none
+    char operand[MAX_OPERAND];  // whitespace removed
+    int deleted;
+    const char *target;         // rewritten JMP operand, or NULL
+} decoded_line_t;
+
+// Global label in effect at each line, for qualifying ".local" operands
+typedef struct {
+    const char *name;
+    int line;
+} label_line_t;
+
+const char* peephole_rule_name(peephole_rule_t rule) {
+    return rule_names[rule];
+}
+
+static void decode_line(decoded_line_t *d, const listing_line_t *line, source_line_t *source) {
+    str_view_t text = source->text;
+    line_tokens_t tok = source->tokens;
+
+    memset(d, 0, sizeof(*d));
+    d->line = line;
+    d->source = source;
+    d->instruction = line->instruction;
+    if (tok.label.ptr && !tok.equate) d->label_len = (int)(view_find_unquoted(text, ':') - text.ptr) + 1;
+    d->directive = tok.mnemonic.len > 0 && tok.mnemonic.ptr[0] == '.';
+
+    int o = 0;
+    for (size_t i = 0; i < tok.operand.len && o < MAX_OPERAND - 1; i++) {
+        if (!isspace((unsigned char)tok.operand.ptr[i])) d->operand[o++] = tok.operand.ptr[i];
+    }
+    d->operand[o] = '\0';
+}
+
+static const instruction_t* instruction_of(const decoded_line_t *d) {
+    return d->instruction >= 0 && !d->deleted ? &instructions[d->instruction] : NULL;
+}
+
+static int is_mnemonic(const decoded_line_t *d, const char *mnemonic) {
+    const instruction_t *ins = instruction_of(d);
+    return ins && strcmp(ins->mnemonic, mnemonic) == 0;
+}
+
+static int transfers_control(const instruction_t *ins) {
+    return ins->mode == REL || strcmp(ins->mnemonic, "JMP") == 0 || strcmp(ins->mnemonic, "JSR") == 0 ||
+           strcmp(ins->mnemonic, "RTS") == 0 || strcmp(ins->mnemonic, "RTI") == 0 ||
+           strcmp(ins->mnemonic, "BRK") == 0;
+}
+
+// Next live instruction after i; *entered is set if a label or directive
+// lies between, i.e. the instruction can be reached other than from i
+static int next_instruction(const decoded_line_t *lines, int count, int i, int *entered) {
+    *entered = 0;
+    for (int j = i + 1; j < count; j++) {
+        if (lines[j].label_len || lines[j].directive) *entered = 1;
+        if (instruction_of(&lines[j])) return j;
+    }
+    return -1;
+}
+
+// Whether any flag in mask may be read before it is overwritten, starting
+// at line 'from'. Leaving straight-line code counts as a read.
+static int flags_live(const decoded_line_t *lines, int count, int from, unsigned mask) {
+    for (int j = from; j < count; j++) {
+        if (lines[j].directive) return 1;
+        const instruction_t *ins = instruction_of(&lines[j]);
+        if (!ins) continue;
+        if (transfers_control(ins)) return 1;
+
+        size_t k = 0, n = sizeof(flag_use) / sizeof(flag_use[0]);
+        while (k < n && strcmp(flag_use[k].mnemonic, ins->mnemonic) != 0) k++;
+        if (k == n || (flag_use[k].reads & mask)) return 1;
+        mask &= ~flag_use[k].writes;
+        if (mask == 0) return 0;
+    }
+    return 1;
+}
+
+static void count_rule(peephole_stats_t *stats, peephole_rule_t rule, int bytes, int cycles) {
+    stats->rules[rule].applied++;
+    stats->rules[rule].bytes_saved += bytes;
+    stats->rules[rule].cycles_saved += cycles;
+}
+
+static void delete_line(decoded_line_t *d, peephole_stats_t *stats, peephole_rule_t rule) {
+    d->deleted = 1;
+    count_rule(stats, rule, d->line->size, instructions[d->instruction].cycles);
+}
+
+// "#0", "#$00" or "#%0"
+static int is_zero_immediate(const char *op) {
+    char value[MAX_OPERAND];
+    if (op[0] != '#' || !(isdigit((unsigned char)op[1]) || op[1] == '$' || op[1] == '%')) return 0;
+    strcpy(value, op);
+    return parse_number(NULL, value) == 0;
+}
+
+// Operand that names a label, qualified with the scope of the line
+static int label_operand(const decoded_line_t *d, const char *scope, char *name, size_t size) {
+    const char *op = d->operand;
+    if (!(isalpha((unsigned char)op[0]) || op[0] == '_' || op[0] == '.')) return 0;
+    for (const char *p = op + 1; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_' && *p != '.') return 0;
+    }
+    int n = op[0] == '.' ? snprintf(name, size, "%s%s", scope, op) : snprintf(name, size, "%s", op);
+    return n > 0 && (size_t)n < size;
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(((const label_line_t *)a)->name, ((const label_line_t *)b)->name);
+}
+
+// Line of the first instruction at or after the definition of a label
+static int label_target(const label_line_t *labels, int label_count, const decoded_line_t *lines,
+                        int count, const char *name) {
+    label_line_t key = { name, 0 };
+    const label_line_t *found = bsearch(&key, labels, label_count, sizeof(label_line_t), by_name);
+    if (!found) return -1;
+    for (int j = found->line; j < count; j++) {
+        if (j > found->line && lines[j].directive) return -1;
+        if (instruction_of(&lines[j])) return j;
+    }
+    return -1;
+}
+
+static int apply_rules(decoded_line_t *lines, int count, const char **scopes, const label_line_t *labels,
+                       int label_count, arena_t *strings, peephole_stats_t *stats) {
+    char name[MAX_OPERAND * 2], next_name[MAX_OPERAND * 2];
+    static const char *pairs[][2] = { { "STA", "LDA" }, { "STX", "LDX" }, { "STY", "LDY" } };
+    int rewrites = 0, entered;
+
+    for (int i = 0; i < count; i++) {
+        const instruction_t *ins = instruction_of(&lines[i]);
+        if (!ins) continue;
+        int j = next_instruction(lines, count, i, &entered);
+
+        // The reload leaves memory and the register as they were; only N/Z
+        // change, so they must be dead. Memory must not be I/O.
+        for (size_t p = 0; p < 3 && j >= 0 && !entered; p++) {
+            if (strcmp(ins->mnemonic, pairs[p][0]) != 0 || !is_mnemonic(&lines[j], pairs[p][1])) continue;
+            if (instructions[lines[j].instruction].mode != ins->mode || ins->mode == IMM) continue;
+            if (strcmp(lines[i].operand, lines[j].operand) != 0) continue;
+            if (flags_live(lines, count, j + 1, P_N | P_Z)) continue;
+            delete_line(&lines[j], stats, PEEPHOLE_STORE_LOAD);
+            rewrites++;
+        }
+
+        // CLC / ADC #0 and SEC / SBC #0 only set flags
+        if (j >= 0 && !entered && ((is_mnemonic(&lines[i], "CLC") && is_mnemonic(&lines[j], "ADC")) ||
+                                   (is_mnemonic(&lines[i], "SEC") && is_mnemonic(&lines[j], "SBC")))) {
+            if (is_zero_immediate(lines[j].operand) && !flags_live(lines, count, j + 1, P_ALL)) {
+                lines[i].deleted = lines[j].deleted = 1;
+                count_rule(stats, PEEPHOLE_ADD_ZERO, lines[i].line->size + lines[j].line->size,
+                           ins->cycles + instructions[lines[j].instruction].cycles);
+                rewrites++;
+                continue;
+            }
+        }
+
+        if (strcmp(ins->mnemonic, "JMP") != 0 || ins->mode != ABS) continue;
+        if (!label_operand(&lines[i], scopes[i], name, sizeof(name))) continue;
+        int target = label_target(labels, label_count, lines, count, name);
+        if (target < 0) continue;
+
+        // Falling through reaches the same instruction
+        if (target == j) {
+            int straight = 1;
+            for (int k = i + 1; k < j; k++) straight &= !lines[k].directive;
+            if (straight) {
+                delete_line(&lines[i], stats, PEEPHOLE_JMP_NEXT);
+                rewrites++;
+                continue;
+            }
+        }
+
+        // Follow JMP chains to the final target, giving up on loops
+        int hops = 0, final = target;
+        while (hops < count && is_mnemonic(&lines[final], "JMP") &&
+               instructions[lines[final].instruction].mode == ABS &&
+               label_operand(&lines[final], scopes[final], next_name, sizeof(next_name))) {
+            int next = label_target(labels, label_count, lines, count, next_name);
+            if (next < 0 || next == final || next == i) break;
+            strcpy(name, next_name);
+            final = next;
+            hops++;
+        }
+        if (hops > 0 && (lines[i].target = arena_strndup(strings, name, strlen(name)))) {
+            count_rule(stats, PEEPHOLE_JMP_CHAIN, 0, 3 * hops);
+            rewrites++;
+        }
+    }
+    return rewrites;
+}
+
+// Edit the program lines: deleted instructions keep their label, and
+// rewritten jumps get the new target. The text follows so listings show
+// the code as assembled; file and line numbers are left alone.
+static int rewrite_lines(decoded_line_t *lines, int count, arena_t *strings) {
+    for (int i = 0; i < count; i++) {
+        decoded_line_t *d = &lines[i];
+        source_line_t *src = d->source;
+        if (!d->deleted && !d->target) continue;
+
+        src->tokens.mnemonic.len = 0;
+        src->tokens.operand.len = 0;
+        src->text.len = d->label_len;
+        if (d->deleted) continue;
+
+        size_t size = d->label_len + strlen(d->target) + 6;
+        char *text = arena_alloc(strings, size);
+        if (!text) return 0;
+        snprintf(text, size, "%.*s\tJMP %s", d->label_len, src->text.ptr, d->target);
+        src->text.ptr = text;
+        src->text.len = strlen(text);
+        src->tokens.mnemonic.ptr = text + d->label_len + 1;
+        src->tokens.mnemonic.len = 3;
+        src->tokens.operand.ptr = text + d->label_len + 5;
+        src->tokens.operand.len = strlen(d->target);
+    }
+    return 1;
+}
+
+int peephole_optimize(const listing_t *decoded, source_line_t *program, arena_t *strings,
+                      peephole_stats_t *stats) {
+    int count = decoded->count;
+    decoded_line_t *lines = calloc(count ? count : 1, sizeof(decoded_line_t));
+    const char **scopes = calloc(count ? count : 1, sizeof(char *));
+    label_line_t *labels = calloc(count ? count : 1, sizeof(label_line_t));
+    int label_count = 0, rewrites = -1;
+    if (!lines || !scopes || !labels) goto done;
+
+    const char *scope = "";
+    for (int i = 0; i < count; i++) {
+        decode_line(&lines[i], &decoded->lines[i], &program[i]);
+        const char *label = decoded->lines[i].label;
+        if (label) {
+            labels[label_count++] = (label_line_t){ label, i };
+            if (!strchr(label, '.')) scope = label;
+        }
+        scopes[i] = scope;
+    }
+    qsort(labels, label_count, sizeof(label_line_t), by_name);
+
+    stats->rounds++;
+    rewrites = apply_rules(lines, count, scopes, labels, label_count, strings, stats);
+    if (rewrites > 0 && !rewrite_lines(lines, count, strings)) rewrites = -1;
+
+done:
+    free(lines);
+    free(scopes);
+    free(labels);
+    return rewrites;
+}
@@ -0,0 +1,37 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "arena.h"
+#include "lexer.h"
+#include "listing.h"
+
+// Rewrite rules, in the order they are tried
+typedef enum {
+    PEEPHOLE_STORE_LOAD,    // STA x / LDA x: drop the reload
+    PEEPHOLE_JMP_NEXT,      // JMP to the instruction that follows
+    PEEPHOLE_ADD_ZERO,      // CLC / ADC #0 and SEC / SBC #0
+    PEEPHOLE_JMP_CHAIN,     // JMP to a JMP: jump to the final target
+    PEEPHOLE_NUM_RULES
+} peephole_rule_t;
+
+typedef struct {
+    int applied;
+    int bytes_saved;
+    int cycles_saved;       // per execution of the rewritten code
+} peephole_count_t;
+
+typedef struct {
+    int rounds;
+    peephole_count_t rules[PEEPHOLE_NUM_RULES];
+} peephole_stats_t;
+
+const char* peephole_rule_name(peephole_rule_t rule);
+
+// Rewrite the tokenized program behind a decoded run in place, one listing
+// entry per program line. Lines keep their file and line number; new
+// operands live in 'strings'. Returns the number of rewrites, 0 if nothing
+// applies, -1 when out of memory.
+int peephole_optimize(const listing_t *decoded, source_line_t *program, arena_t *strings,
+                      peephole_stats_t *stats);
+
+#endif
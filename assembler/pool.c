@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int count;
+    int failed;
+    pool_work_t work;
+    void *arg;
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    int worker;
+} pool_worker_t;
+
+int default_jobs(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// Take items off the shared counter until none are left
+static void* pool_thread(void *param) {
+    pool_worker_t *self = param;
+    pool_t *pool = self->pool;
+    int failed = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        int index = pool->next < pool->count ? pool->next++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+        if (index < 0) break;
+        failed += pool->work(index, self->worker, pool->arg) != 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->failed += failed;
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Run work(0..count-1) on up to 'jobs' threads, each item exactly once.
+// Returns the number of failed work items.
+int run_pool(int count, int jobs, pool_work_t work, void *arg) {
+    pool_t pool = { PTHREAD_MUTEX_INITIALIZER, 0, count, 0, work, arg };
+    if (jobs > count) jobs = count;
+
+    pthread_t *threads = jobs > 1 ? malloc(jobs * sizeof(pthread_t)) : NULL;
+    pool_worker_t *workers = jobs > 1 ? malloc(jobs * sizeof(pool_worker_t)) : NULL;
+    int started = 0;
+    for (int t = 0; threads && workers && t < jobs; t++) {
+        workers[t] = (pool_worker_t){ &pool, t };
+        if (pthread_create(&threads[t], NULL, pool_thread, &workers[t]) != 0) break;
+        started++;
+    }
+
+    // Without threads the caller does all the work as worker 0
+    if (started == 0) {
+        pool_worker_t self = { &pool, 0 };
+        pool_thread(&self);
+    }
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+
+    free(threads);
+    free(workers);
+    return pool.failed;
+}
@@ -0,0 +1,10 @@
+#ifndef POOL_H
+#define POOL_H
+
+// Work item 'index' run on thread 'worker' (0..jobs-1)
+typedef int (*pool_work_t)(int index, int worker, void *arg);
+
+int default_jobs(void);
+int run_pool(int count, int jobs, pool_work_t work, void *arg);
+
+#endif
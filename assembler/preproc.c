@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include "preproc.h"
+#include "utils.h"
+
+// Names bound while substituting a macro body or a repeat counter
+typedef struct {
+    const str_view_t *names;
+    const str_view_t *values;
+    int count;
+    int unique;             // value of \@
+} binding_t;
+
+static str_view_t make_view(const char *ptr, size_t len) {
+    str_view_t view = { ptr, len };
+    return view;
+}
+
+static void pp_error(preproc_t *pp, const source_line_t *line, const char *fmt, ...) {
+    if (pp->quiet) return;
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "ERROR - line %d: ", line->line);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    if (line->file > 0) fprintf(stderr, "  in %s\n", pp->files[line->file].path);
+}
+
+// Directives are only looked for behind a '.', so sources without any take
+// the plain path and are never copied into line arrays
+int pp_needed(const char *text, size_t len) {
+    static const char *words[] = { "MACRO", "ENDM", "REPT", "ENDR", "INCLUDE" };
+    const char *p = text, *end = text + len;
+    while (p < end && (p = memchr(p, '.', end - p))) {
+        p++;
+        for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+            size_t n = strlen(words[i]);
+            if ((size_t)(end - p) >= n && strncasecmp(p, words[i], n) == 0) return 1;
+        }
+    }
+    return 0;
+}
+
+void pp_init(preproc_t *pp, const char *name) {
+    memset(pp, 0, sizeof(*pp));
+    pp->name = name;
+    arena_init(&pp->strings);
+    buffer_init(&pp->scratch);
+}
+
+void pp_free(preproc_t *pp) {
+    for (int i = 0; i < pp->file_count; i++) {
+        free(pp->files[i].lines);
+        if (i > 0) source_close(&pp->files[i].source);
+    }
+    free(pp->files);
+    for (int i = 0; i < pp->macro_count; i++) free(pp->macros[i].substitute);
+    free(pp->macros);
+    free(pp->spans);
+    arena_free(&pp->strings);
+    buffer_free(&pp->scratch);
+    pp_init(pp, NULL);
+}
+
+static int grow(void **items, int *cap, int count, size_t size) {
+    if (count < *cap) return 1;
+    int n = *cap ? *cap * 2 : 16;
+    void *grown = realloc(*items, n * size);
+    if (!grown) return 0;
+    *items = grown;
+    *cap = n;
+    return 1;
+}
+
+static int add_span(preproc_t *pp, const source_line_t *lines, int count) {
+    if (count == 0) return 1;
+    if (pp->span_count > 0) {
+        pp_span_t *last = &pp->spans[pp->span_count - 1];
+        if (last->lines + last->count == lines) {
+            last->count += count;
+            return 1;
+        }
+    }
+    if (!grow((void **)&pp->spans, &pp->span_cap, pp->span_count, sizeof(pp_span_t))) return 0;
+    pp->spans[pp->span_count++] = (pp_span_t){ lines, count };
+    return 1;
+}
+
+// Tokenize every line of a file once
+static source_line_t* tokenize_file(const char *text, size_t len, int file, int *count) {
+    const char *p = text, *end = text + len;
+    int n = 0;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        p = eol ? eol + 1 : end;
+        n++;
+    }
+
+    source_line_t *lines = malloc((n ? n : 1) * sizeof(source_line_t));
+    if (!lines) return NULL;
+    p = text;
+    for (int i = 0; i < n; i++) {
+        const char *eol = memchr(p, '\n', end - p);
+        size_t line_len = eol ? (size_t)(eol - p) : (size_t)(end - p);
+        lines[i].text = make_view(p, line_len);
+        lines[i].line = i + 1;
+        lines[i].file = file;
+        tokenize_line(p, line_len, &lines[i].tokens);
+        p = eol ? eol + 1 : end;
+    }
+    *count = n;
+    return lines;
+}
+
+static int is_ident_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_ident_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Copy a field to scratch with bound identifiers replaced, or with out NULL
+// only report whether anything would be. Strings and the digits of $hex
+// and %binary literals are left alone.
+static int substitute_field(byte_buffer_t *out, str_view_t field, const binding_t *bind) {
+    int hits = 0, in_string = 0;
+    char number[16];
+    for (size_t i = 0; i < field.len; ) {
+        const char *from = field.ptr + i;
+        size_t n = 1;
+        const char *value = from;
+        size_t value_len = 1;
+
+        if (*from == '"') {
+            in_string = !in_string;
+        } else if (!in_string && *from == '\\' && i + 1 < field.len && from[1] == '@') {
+            n = 2;
+            value_len = snprintf(number, sizeof(number), "%d", bind->unique);
+            value = number;
+            hits++;
+        } else if (!in_string && (*from == '$' || *from == '%')) {
+            while (i + n < field.len && isalnum((unsigned char)from[n])) n++;
+            value_len = n;
+        } else if (!in_string && is_ident_start(*from)) {
+            while (i + n < field.len && is_ident_char(from[n])) n++;
+            value_len = n;
+            for (int b = 0; b < bind->count; b++) {
+                if (bind->names[b].len == n && memcmp(bind->names[b].ptr, from, n) == 0) {
+                    if (out) {
+                        value = bind->values[b].ptr;
+                        value_len = bind->values[b].len;
+                    }
+                    hits++;
+                    break;
+                }
+            }
+        }
+        for (size_t k = 0; out && k < value_len; k++) {
+            if (!buffer_push(out, value[k])) return -1;
+        }
+        i += n;
+    }
+    return hits;
+}
+
+static int line_uses(const source_line_t *line, const binding_t *bind) {
+    const line_tokens_t *tok = &line->tokens;
+    return (tok->label.ptr && substitute_field(NULL, tok->label, bind) > 0) ||
+           substitute_field(NULL, tok->mnemonic, bind) > 0 || substitute_field(NULL, tok->operand, bind) > 0;
+}
+
+// Rebuild a line from its substituted fields as "label: MNEMONIC operand"
+// or "name = value"; the new fields are views into the new text
+static int substitute_line(preproc_t *pp, const source_line_t *line, const binding_t *bind, source_line_t *out) {
+    const line_tokens_t *tok = &line->tokens;
+    byte_buffer_t *text = &pp->scratch;
+    size_t label_end = 0, mnemonic_start, mnemonic_end, operand_start;
+    int ok = 1;
+
+    text->len = 0;
+    if (tok->label.ptr) {
+        ok &= substitute_field(text, tok->label, bind) >= 0;
+        label_end = text->len;
+        if (tok->equate) {
+            for (const char *p = " = "; *p; p++) ok &= buffer_push(text, *p);
+        } else {
+            ok &= buffer_push(text, ':');
+        }
+    }
+    if (!tok->equate && tok->mnemonic.len > 0) ok &= buffer_push(text, '\t');
+    mnemonic_start = text->len;
+    ok &= substitute_field(text, tok->mnemonic, bind) >= 0;
+    mnemonic_end = text->len;
+    if (!tok->equate && tok->operand.len > 0) ok &= buffer_push(text, ' ');
+    operand_start = text->len;
+    ok &= substitute_field(text, tok->operand, bind) >= 0;
+    if (!ok) return 0;
+
+    char *copy = arena_strndup(&pp->strings, (const char *)text->data, text->len);
+    if (!copy) return 0;
+    *out = *line;
+    out->text = make_view(copy, text->len);
+    out->tokens.label = tok->label.ptr ? make_view(copy, label_end) : make_view(NULL, 0);
+    out->tokens.mnemonic = make_view(copy + mnemonic_start, mnemonic_end - mnemonic_start);
+    out->tokens.operand = make_view(copy + operand_start, text->len - operand_start);
+    return 1;
+}
+
+// Body lines with the bindings applied; lines in which nothing is bound
+// are copied as they are
+static source_line_t* bind_lines(preproc_t *pp, const source_line_t *body, int count,
+                                 const unsigned char *substitute, const binding_t *bind) {
+    source_line_t *lines = arena_alloc(&pp->strings, (count ? count : 1) * sizeof(source_line_t));
+    if (!lines) return NULL;
+    for (int i = 0; i < count; i++) {
+        if (!substitute[i]) lines[i] = body[i];
+        else if (!substitute_line(pp, &body[i], bind, &lines[i])) return NULL;
+    }
+    return lines;
+}
+
+// Keep the label of a directive line as a line of its own
+static int emit_label(preproc_t *pp, const source_line_t *line) {
+    if (!line->tokens.label.ptr) return 1;
+    source_line_t *label = arena_alloc(&pp->strings, sizeof(source_line_t));
+    char *text = label ? arena_alloc(&pp->strings, line->tokens.label.len + 2) : NULL;
+    if (!text) return 0;
+    memcpy(text, line->tokens.label.ptr, line->tokens.label.len);
+    text[line->tokens.label.len] = ':';
+    text[line->tokens.label.len + 1] = '\0';
+    *label = *line;
+    label->text = make_view(text, line->tokens.label.len + 1);
+    label->tokens.label = make_view(text, line->tokens.label.len);
+    label->tokens.mnemonic = label->tokens.operand = make_view(text + line->tokens.label.len + 1, 0);
+    return add_span(pp, label, 1);
+}
+
+static pp_macro_t* find_macro(preproc_t *pp, str_view_t name) {
+    for (int i = 0; i < pp->macro_count; i++) {
+        str_view_t m = pp->macros[i].name;
+        if (m.len == name.len && strncasecmp(m.ptr, name.ptr, name.len) == 0) return &pp->macros[i];
+    }
+    return NULL;
+}
+
+// Index of the line closing the block opened at lines[start], or -1
+static int block_end(const source_line_t *lines, int count, int start, const char *open, const char *close) {
+    int depth = 0;
+    for (int i = start; i < count; i++) {
+        if (view_equals_upper(lines[i].tokens.mnemonic, open)) depth++;
+        else if (view_equals_upper(lines[i].tokens.mnemonic, close) && --depth == 0) return i;
+    }
+    return -1;
+}
+
+static int define_macro(preproc_t *pp, const source_line_t *lines, int start, int end) {
+    str_view_t rest = lines[start].tokens.operand, name;
+    if (!view_next_field(&rest, " \t,", &name)) {
+        pp_error(pp, &lines[start], ".macro needs a name");
+        return 1;
+    }
+    if (find_macro(pp, name)) {
+        pp_error(pp, &lines[start], "duplicate macro %.*s", (int)name.len, name.ptr);
+        return 1;
+    }
+    if (!grow((void **)&pp->macros, &pp->macro_cap, pp->macro_count, sizeof(pp_macro_t))) return 1;
+
+    pp_macro_t *macro = &pp->macros[pp->macro_count];
+    macro->name = name;
+    macro->param_count = 0;
+    macro->body = lines + start + 1;
+    macro->count = end - start - 1;
+    str_view_t param;
+    while (view_next_field(&rest, " \t,", &param)) {
+        if (macro->param_count == PP_MAX_PARAMS) {
+            pp_error(pp, &lines[start], "more than %d macro parameters", PP_MAX_PARAMS);
+            return 1;
+        }
+        macro->params[macro->param_count++] = param;
+    }
+
+    // Decide once which body lines refer to a parameter
+    if (!(macro->substitute = malloc(macro->count ? macro->count : 1))) return 1;
+    binding_t bind = { macro->params, macro->params, macro->param_count, 0 };
+    macro->substituted = 0;
+    for (int i = 0; i < macro->count; i++) macro->substituted |= macro->substitute[i] = line_uses(&macro->body[i], &bind);
+    pp->macro_count++;
+    return 0;
+}
+
+static int expand(preproc_t *pp, const source_line_t *lines, int count, int depth);
+
+static int call_macro(preproc_t *pp, const pp_macro_t *macro, const source_line_t *line, int depth) {
+    str_view_t args[PP_MAX_PARAMS], rest = line->tokens.operand, arg;
+    int argc = 0;
+
+    if (rest.len > 0) {
+        while (view_next_item(&rest, &arg)) {
+            if (argc == macro->param_count) {
+                pp_error(pp, line, "too many arguments for macro %.*s", (int)macro->name.len, macro->name.ptr);
+                return 1;
+            }
+            args[argc++] = arg;
+        }
+    }
+    if (argc < macro->param_count) {
+        pp_error(pp, line, "too few arguments for macro %.*s", (int)macro->name.len, macro->name.ptr);
+        return 1;
+    }
+
+    binding_t bind = { macro->params, args, macro->param_count, pp->expansions++ };
+    const source_line_t *body = macro->substituted ? bind_lines(pp, macro->body, macro->count, macro->substitute, &bind)
+                                                   : macro->body;
+    if (!body) {
+        pp_error(pp, line, "out of memory");
+        return 1;
+    }
+    return expand(pp, body, macro->count, depth + 1);
+}
+
+static int repeat(preproc_t *pp, const source_line_t *lines, int start, int end, int depth) {
+    const source_line_t *line = &lines[start];
+    str_view_t rest = line->tokens.operand, count_item, counter = make_view(NULL, 0);
+
+    view_next_item(&rest, &count_item);
+    int has_counter = view_next_item(&rest, &counter);
+    if (count_item.len == 0 || !strchr("$%0123456789", count_item.ptr[0]) || rest.ptr ||
+        (has_counter && (counter.len == 0 || !is_ident_start(counter.ptr[0])))) {
+        pp_error(pp, line, ".rept needs a constant count and an optional counter name");
+        return 1;
+    }
+    int times = parse_number_n(NULL, count_item.ptr, count_item.len);
+    if (times < 0) {
+        pp_error(pp, line, "negative .rept count");
+        return 1;
+    }
+
+    const source_line_t *body = lines + start + 1;
+    int body_count = end - start - 1;
+    unsigned char *substitute = malloc(body_count ? body_count : 1);
+    if (!substitute) return 1;
+    binding_t bind = { &counter, NULL, has_counter, 0 };
+    int bound = 0;
+    for (int i = 0; i < body_count; i++) bound |= substitute[i] = line_uses(&body[i], &bind);
+
+    int errors = 0;
+    char number[16];
+    for (int k = 0; k < times && errors == 0; k++) {
+        str_view_t value = make_view(number, snprintf(number, sizeof(number), "%d", k));
+        bind.values = &value;
+        bind.unique = pp->expansions++;
+        const source_line_t *pass = bound ? bind_lines(pp, body, body_count, substitute, &bind) : body;
+        if (!pass) {
+            pp_error(pp, line, "out of memory");
+            errors++;
+            break;
+        }
+        errors += expand(pp, pass, body_count, depth + 1);
+    }
+    free(substitute);
+    return errors;
+}
+
+// Included file by path, opened and tokenized on first use
+static int include_file(preproc_t *pp, const source_line_t *line, int depth) {
+    str_view_t name = line->tokens.operand;
+    if (name.len < 2 || name.ptr[0] != '"' || name.ptr[name.len - 1] != '"') {
+        pp_error(pp, line, ".include needs a \"quoted\" path");
+        return 1;
+    }
+    name = make_view(name.ptr + 1, name.len - 2);
+
+    // Relative to the directory of the including file
+    const char *from = pp->files[line->file].path;
+    const char *slash = from && name.ptr[0] != '/' ? strrchr(from, '/') : NULL;
+    size_t dir = slash ? (size_t)(slash - from) + 1 : 0;
+    char *path = arena_alloc(&pp->strings, dir + name.len + 1);
+    if (!path) return 1;
+    if (dir) memcpy(path, from, dir);
+    memcpy(path + dir, name.ptr, name.len);
+    path[dir + name.len] = '\0';
+
+    int file = 1;
+    while (file < pp->file_count && strcmp(pp->files[file].path, path) != 0) file++;
+    if (file == pp->file_count) {
+        if (!grow((void **)&pp->files, &pp->file_cap, pp->file_count, sizeof(pp_file_t))) return 1;
+        pp_file_t *f = &pp->files[file];
+        if (!source_open(&f->source, path)) {
+            pp_error(pp, line, "cannot include %s", path);
+            return 1;
+        }
+        f->path = path;
+        if (!(f->lines = tokenize_file(f->source.text, f->source.len, file, &f->count))) {
+            source_close(&f->source);
+            return 1;
+        }
+        pp->file_count++;
+    }
+    return expand(pp, pp->files[file].lines, pp->files[file].count, depth + 1);
+}
+
+// Append lines to the program, running the directives among them; runs of
+// ordinary lines become spans over the array they are in
+static int expand(preproc_t *pp, const source_line_t *lines, int count, int depth) {
+    int errors = 0, start = 0;
+
+    for (int i = 0; i < count; i++) {
+        const line_tokens_t *tok = &lines[i].tokens;
+        const pp_macro_t *macro = NULL;
+        int directive = tok->mnemonic.len > 1 && tok->mnemonic.ptr[0] == '.';
+        if (!directive && !(tok->mnemonic.len > 0 && pp->macro_count && (macro = find_macro(pp, tok->mnemonic)))) {
+            continue;
+        }
+        if (directive && !view_equals_upper(tok->mnemonic, ".MACRO") && !view_equals_upper(tok->mnemonic, ".REPT") &&
+            !view_equals_upper(tok->mnemonic, ".INCLUDE") && !view_equals_upper(tok->mnemonic, ".ENDM") &&
+            !view_equals_upper(tok->mnemonic, ".ENDR")) {
+            continue;
+        }
+
+        if (!add_span(pp, lines + start, i - start) || !emit_label(pp, &lines[i])) {
+            pp_error(pp, &lines[i], "out of memory");
+            return errors + 1;
+        }
+        int end = i;
+        if (depth == PP_MAX_DEPTH && (macro || !view_equals_upper(tok->mnemonic, ".MACRO"))) {
+            pp_error(pp, &lines[i], "includes, macros or repeats nested more than %d deep", PP_MAX_DEPTH);
+            return errors + 1;
+        }
+        if (macro) {
+            errors += call_macro(pp, macro, &lines[i], depth);
+        } else if (view_equals_upper(tok->mnemonic, ".MACRO")) {
+            if ((end = block_end(lines, count, i, ".MACRO", ".ENDM")) < 0) {
+                pp_error(pp, &lines[i], ".macro without .endm");
+                return errors + 1;
+            }
+            errors += define_macro(pp, lines, i, end);
+        } else if (view_equals_upper(tok->mnemonic, ".REPT")) {
+            if ((end = block_end(lines, count, i, ".REPT", ".ENDR")) < 0) {
+                pp_error(pp, &lines[i], ".rept without .endr");
+                return errors + 1;
+            }
+            errors += repeat(pp, lines, i, end, depth);
+        } else if (view_equals_upper(tok->mnemonic, ".INCLUDE")) {
+            errors += include_file(pp, &lines[i], depth);
+        } else {
+            pp_error(pp, &lines[i], "%.*s without a matching block", (int)tok->mnemonic.len, tok->mnemonic.ptr);
+            errors++;
+        }
+        i = end;
+        start = end + 1;
+    }
+    if (!add_span(pp, lines + start, count - start)) {
+        pp_error(pp, &lines[0], "out of memory");
+        errors++;
+    }
+    return errors;
+}
+
+// Expand the main source into pp->spans; returns the number of errors
+int pp_expand(preproc_t *pp, const char *text, size_t len) {
+    if (!grow((void **)&pp->files, &pp->file_cap, 0, sizeof(pp_file_t))) return 1;
+    pp_file_t *main_file = &pp->files[0];
+    memset(main_file, 0, sizeof(*main_file));
+    main_file->path = pp->name;
+    if (!(main_file->lines = tokenize_file(text, len, 0, &main_file->count))) {
+        if (!pp->quiet) fprintf(stderr, "ERROR - out of memory\n");
+        return 1;
+    }
+    pp->file_count = 1;
+    return expand(pp, main_file->lines, main_file->count, 0);
+}
@@ -0,0 +1,63 @@
+#ifndef PREPROC_H
+#define PREPROC_H
+
+#include "arena.h"
+#include "buffer.h"
+#include "lexer.h"
+#include "source.h"
+
+#define PP_MAX_DEPTH 64     // nested includes, macro calls and repeats
+#define PP_MAX_PARAMS 16
+
+// A file read during one run; included files are tokenized once no
+// matter how often they are included
+typedef struct {
+    const char *path;       // as opened, NULL for an unnamed main source
+    source_t source;        // unused for the main source, which the caller owns
+    source_line_t *lines;
+    int count;
+} pp_file_t;
+
+// .macro name param, ... / .endm; the body stays in tokenized form
+typedef struct {
+    str_view_t name;
+    str_view_t params[PP_MAX_PARAMS];
+    int param_count;
+    const source_line_t *body;
+    int count;
+    unsigned char *substitute;  // per body line: uses a parameter or \@
+    int substituted;            // any line does; otherwise the body is shared
+} pp_macro_t;
+
+// Run of consecutive lines of the expanded program
+typedef struct {
+    const source_line_t *lines;
+    int count;
+} pp_span_t;
+
+// Expanded program as spans over the file, macro body and substituted line
+// arrays. Lines that need no substitution are shared, not copied, so a
+// .rept of a plain body costs one span per iteration.
+typedef struct {
+    const char *name;       // main source; include paths are relative to it
+    int quiet;              // no error messages, e.g. when computing cache keys
+    pp_file_t *files;
+    int file_count;
+    int file_cap;
+    pp_macro_t *macros;
+    int macro_count;
+    int macro_cap;
+    pp_span_t *spans;
+    int span_count;
+    int span_cap;
+    int expansions;         // numbers \@, unique per macro call or repetition
+    arena_t strings;        // substituted lines, paths and line arrays
+    byte_buffer_t scratch;
+} preproc_t;
+
+int pp_needed(const char *text, size_t len);
+void pp_init(preproc_t *pp, const char *name);
+int pp_expand(preproc_t *pp, const char *text, size_t len);
+void pp_free(preproc_t *pp);
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "assembler.h"
+#include "sim6502.h"
+#include "source.h"
+
+// Return address of the entry routine; a top level RTS ends the run there.
+// $FFFA holds the NMI vector, so it is never executed as code.
+#define DEFAULT_TRAP 0xFFFA
+
+#define DEFAULT_MAX_CYCLES 1000000000ULL
+#define DEFAULT_HOT_SPOTS 10
+
+// Code label with the cycles spent from it up to the next label
+typedef struct {
+    const char *name;
+    unsigned short address;
+    unsigned long long cycles;
+    unsigned long long instructions;
+} hot_spot_t;
+
+void print_usage(const char* prog_name) {
+    printf("Usage: %s [options] program\n", prog_name);
+    printf("  -e address       Entry point (default: start of the first segment)\n");
+    printf("  -t address       Stop when execution reaches address (default $%04X)\n", DEFAULT_TRAP);
+    printf("  -l address       Load address of raw binaries (.bin, .raw)\n");
+    printf("  -m cycles        Stop after this many cycles (default %llu)\n", DEFAULT_MAX_CYCLES);
+    printf("  -p count         Show the count hottest labels, 0 disables profiling (default %d)\n",
+           DEFAULT_HOT_SPOTS);
+    printf("A program is assembly source, or 6502as output: ihex, prg or raw.\n");
+    printf("The entry point is called as a subroutine; BRK or RTS ends the run.\n");
+}
+
+static long parse_address(const char *s) {
+    return strtol(s[0] == '$' ? s + 1 : s, NULL, s[0] == '$' ? 16 : 0);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int has_extension(const char *path, const char *ext) {
+    size_t len = strlen(path), n = strlen(ext);
+    return len > n && strcmp(path + len - n, ext) == 0;
+}
+
+static int hex_value(const char *p, int digits) {
+    int v = 0;
+    for (int i = 0; i < digits; i++) {
+        int c = p[i];
+        int d = c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10
+              : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (d < 0) return -1;
+        v = v * 16 + d;
+    }
+    return v;
+}
+
+// Intel HEX data records become one section each; checksums are verified
+static int load_ihex(const char *text, size_t len, object_t *image) {
+    const char *end = text + len;
+    unsigned char data[255];
+    int line = 0;
+
+    for (const char *p = text; p < end; ) {
+        line++;
+        while (p < end && (*p == '\r' || *p == '\n')) p++;
+        if (p == end) break;
+        // ':', count, address, type, count data bytes and the checksum
+        int count = *p == ':' && end - p >= 11 ? hex_value(p + 1, 2) : -1;
+        int address = count < 0 ? -1 : hex_value(p + 3, 4);
+        int type = count < 0 ? -1 : hex_value(p + 7, 2);
+        if (count < 0 || address < 0 || type < 0 || end - p < 11 + count * 2) {
+            fprintf(stderr, "ERROR - line %d: malformed Intel HEX record\n", line);
+            return 0;
+        }
+
+        unsigned sum = count + (address >> 8) + address + type;
+        for (int i = 0; i <= count; i++) {
+            int byte = hex_value(p + 9 + i * 2, 2);
+            if (byte < 0) {
+                fprintf(stderr, "ERROR - line %d: malformed Intel HEX record\n", line);
+                return 0;
+            }
+            if (i < count) data[i] = byte;
+            sum += byte;
+        }
+        if (sum & 0xFF) {
+            fprintf(stderr, "ERROR - line %d: Intel HEX checksum mismatch\n", line);
+            return 0;
+        }
+        if (type == 0x01) break;
+        if (type == 0x00 && object_add_section(image, "ihex", address, 0, data, count) < 0) return 0;
+        p += 11 + count * 2;
+        while (p < end && *p != '\n') p++;
+    }
+    return 1;
+}
+
+// Source is assembled in-process so its labels can name the hot spots
+static int load_program(asm6502_ctx *ctx, const char *path, long load_address, object_t *image) {
+    source_t src;
+    if (!source_open(&src, path)) return 0;
+    const char *data = src.text;
+    size_t size = src.len;
+
+    int ok;
+    if (has_extension(path, ".prg")) {
+        ok = size >= 2 && object_add_section(image, "prg", (unsigned char)data[0] | ((unsigned char)data[1] << 8),
+                                             0, (const unsigned char *)data + 2, size - 2) >= 0;
+        if (size < 2) fprintf(stderr, "ERROR - %s: missing PRG load address\n", path);
+    } else if (has_extension(path, ".bin") || has_extension(path, ".raw")) {
+        if (load_address < 0) {
+            fprintf(stderr, "ERROR - %s: raw binaries need a load address (-l)\n", path);
+            ok = 0;
+        } else {
+            ok = object_add_section(image, "raw", load_address, 0, (const unsigned char *)data, size) >= 0;
+        }
+    } else if (size > 0 && data[0] == ':') {
+        ok = load_ihex(data, size, image);
+    } else {
+        asm6502_set_source_name(ctx, path);
+        ok = assemble_6502_image_ex(ctx, data, size, image, NULL) == 0;
+    }
+    source_close(&src);
+    return ok;
+}
+
+static int by_address(const void *a, const void *b) {
+    const hot_spot_t *x = a, *y = b;
+    return x->address != y->address ? x->address - y->address : strcmp(x->name, y->name);
+}
+
+static int by_cycles(const void *a, const void *b) {
+    const hot_spot_t *x = a, *y = b;
+    return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : x->address - y->address;
+}
+
+static int in_image(const object_t *image, unsigned address) {
+    for (int s = 0; s < image->section_count; s++) {
+        const obj_section_t *sec = &image->sections[s];
+        if (address >= sec->org && address < sec->org + sec->size) return 1;
+    }
+    return 0;
+}
+
+// Attribute every opcode address to the closest label at or below it. Only
+// labels inside the image count, so zero page equates do not claim code.
+static void print_hot_spots(const symbol_table_t *labels, const object_t *image, const sim_profile_t *profile,
+                            unsigned long long total, int limit) {
+    hot_spot_t *spots = malloc((labels->count + 1) * sizeof(hot_spot_t));
+    int count = 0;
+    if (!spots) return;
+
+    spots[count++] = (hot_spot_t){ "(unlabelled)", 0, 0, 0 };
+    for (int i = 0; i < labels->count; i++) {
+        const symbol_t *sym = &labels->symbols[i];
+        if (!sym->defined || !in_image(image, sym->address)) continue;
+        spots[count++] = (hot_spot_t){ sym->name, sym->address, 0, 0 };
+    }
+    qsort(spots + 1, count - 1, sizeof(hot_spot_t), by_address);
+
+    int owner = 0;
+    for (unsigned address = 0; address < 0x10000; address++) {
+        while (owner + 1 < count && spots[owner + 1].address <= address) owner++;
+        spots[owner].cycles += profile->cycles[address];
+        spots[owner].instructions += profile->instructions[address];
+    }
+    qsort(spots, count, sizeof(hot_spot_t), by_cycles);
+
+    printf("Label                    Address      Cycles   Cycles%%  Instructions\n");
+    for (int i = 0; i < count && i < limit && spots[i].cycles; i++) {
+        printf("%-24s $%04X  %12llu   %6.2f%%  %12llu\n", spots[i].name, spots[i].address,
+               spots[i].cycles, total ? 100.0 * spots[i].cycles / total : 0.0, spots[i].instructions);
+    }
+    free(spots);
+}
+
+int main(int argc, char *argv[]) {
+    const char *input = NULL;
+    long entry = -1, trap = DEFAULT_TRAP, load_address = -1;
+    unsigned long long max_cycles = DEFAULT_MAX_CYCLES;
+    int hot_spots = DEFAULT_HOT_SPOTS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            entry = parse_address(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            trap = parse_address(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            load_address = parse_address(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            max_cycles = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            hot_spots = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && !input) {
+            input = argv[i];
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!input) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    object_t image;
+    object_init(&image);
+    asm6502_ctx *ctx = asm6502_create(0);
+    if (!ctx || !load_program(ctx, input, load_address, &image)) {
+        asm6502_destroy(ctx);
+        object_free(&image);
+        return 1;
+    }
+    if (image.section_count == 0) {
+        fprintf(stderr, "ERROR - %s: nothing to run\n", input);
+        asm6502_destroy(ctx);
+        object_free(&image);
+        return 1;
+    }
+
+    cpu_t *cpu = calloc(1, sizeof(cpu_t));
+    sim_profile_t *profile = hot_spots > 0 ? calloc(1, sizeof(sim_profile_t)) : NULL;
+    if (!cpu || (hot_spots > 0 && !profile)) {
+        perror("Memory allocation failed");
+        return 1;
+    }
+
+    for (int s = 0; s < image.section_count; s++) {
+        const obj_section_t *sec = &image.sections[s];
+        size_t size = sec->org + sec->size > 0x10000 ? (size_t)(0x10000 - sec->org) : sec->size;
+        memcpy(cpu->mem + sec->org, sec->data, size);
+    }
+
+    sim_init();
+    sim_reset(cpu, entry >= 0 ? entry : image.sections[0].org);
+    cpu->mem[0x100 | cpu->sp--] = ((trap - 1) >> 8) & 0xFF;
+    cpu->mem[0x100 | cpu->sp--] = (trap - 1) & 0xFF;
+
+    double start = now();
+    sim_status_t status = sim_run(cpu, max_cycles, trap, profile);
+    double elapsed = now() - start;
+
+    static const char *reasons[] = { "running", "BRK", "trap", "illegal opcode", "cycle limit" };
+    printf("Stopped: %s at $%04X\n", reasons[status], cpu->pc);
+    printf("Cycles: %llu\n", cpu->cycles);
+    printf("Instructions: %llu (%.2f cycles each)\n", cpu->instructions,
+           cpu->instructions ? (double)cpu->cycles / cpu->instructions : 0.0);
+    printf("A=$%02X X=$%02X Y=$%02X SP=$%02X P=$%02X\n", cpu->a, cpu->x, cpu->y, cpu->sp, cpu->p);
+    printf("Simulated in %.3f s (%.1f MHz)\n", elapsed, elapsed > 0 ? cpu->cycles / elapsed / 1e6 : 0.0);
+    if (hot_spots > 0) print_hot_spots(asm6502_symbols(ctx), &image, profile, cpu->cycles, hot_spots);
+
+    free(profile);
+    free(cpu);
+    object_free(&image);
+    asm6502_destroy(ctx);
+    return status == SIM_ILLEGAL || status == SIM_LIMIT;
+}
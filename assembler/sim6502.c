@@ -0,0 +1,333 @@
+#include <stddef.h>
+#include <string.h>
+#include "sim6502.h"
+#include "instructions.h"
+
+typedef void (*sim_op_t)(cpu_t *cpu, unsigned addr);
+
+// Per-opcode dispatch entry built from instructions[]
+typedef struct {
+    sim_op_t op;
+    addr_mode_t mode;
+    unsigned char cycles;
+    unsigned char page_penalty;     // +1 cycle when indexing crosses a page
+} sim_decode_t;
+
+static sim_decode_t decode[256];
+
+#define READ(addr) (cpu->mem[(addr) & 0xFFFF])
+#define WRITE(addr, v) (cpu->mem[(addr) & 0xFFFF] = (unsigned char)(v))
+#define PUSH(v) (cpu->mem[0x100 | cpu->sp--] = (unsigned char)(v))
+#define PULL() (cpu->mem[0x100 | ++cpu->sp])
+
+static inline void set_nz(cpu_t *cpu, unsigned v) {
+    cpu->p = (cpu->p & ~(FLAG_N | FLAG_Z)) | (v & FLAG_N) | ((v & 0xFF) ? 0 : FLAG_Z);
+}
+
+static inline void set_flag(cpu_t *cpu, unsigned char flag, int on) {
+    cpu->p = on ? cpu->p | flag : cpu->p & ~flag;
+}
+
+// Loads, stores and transfers
+static void op_lda(cpu_t *cpu, unsigned addr) { set_nz(cpu, cpu->a = READ(addr)); }
+static void op_ldx(cpu_t *cpu, unsigned addr) { set_nz(cpu, cpu->x = READ(addr)); }
+static void op_ldy(cpu_t *cpu, unsigned addr) { set_nz(cpu, cpu->y = READ(addr)); }
+static void op_sta(cpu_t *cpu, unsigned addr) { WRITE(addr, cpu->a); }
+static void op_stx(cpu_t *cpu, unsigned addr) { WRITE(addr, cpu->x); }
+static void op_sty(cpu_t *cpu, unsigned addr) { WRITE(addr, cpu->y); }
+static void op_tax(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, cpu->x = cpu->a); }
+static void op_tay(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, cpu->y = cpu->a); }
+static void op_txa(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, cpu->a = cpu->x); }
+static void op_tya(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, cpu->a = cpu->y); }
+static void op_tsx(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, cpu->x = cpu->sp); }
+static void op_txs(cpu_t *cpu, unsigned addr) { (void)addr; cpu->sp = cpu->x; }
+
+// Stack
+static void op_pha(cpu_t *cpu, unsigned addr) { (void)addr; PUSH(cpu->a); }
+static void op_php(cpu_t *cpu, unsigned addr) { (void)addr; PUSH(cpu->p | FLAG_B | FLAG_U); }
+static void op_pla(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, cpu->a = PULL()); }
+static void op_plp(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p = (PULL() & ~FLAG_B) | FLAG_U; }
+
+// Arithmetic, NMOS decimal mode included
+static void add(cpu_t *cpu, unsigned v) {
+    unsigned c = cpu->p & FLAG_C;
+    if (cpu->p & FLAG_D) {
+        unsigned lo = (cpu->a & 0x0F) + (v & 0x0F) + c;
+        unsigned hi = (cpu->a & 0xF0) + (v & 0xF0);
+        if (lo > 9) { lo += 6; hi += 0x10; }
+        set_flag(cpu, FLAG_Z, ((cpu->a + v + c) & 0xFF) == 0);
+        set_flag(cpu, FLAG_N, hi & 0x80);
+        set_flag(cpu, FLAG_V, ~(cpu->a ^ v) & (cpu->a ^ hi) & 0x80);
+        if (hi > 0x90) hi += 0x60;
+        set_flag(cpu, FLAG_C, hi > 0xFF);
+        cpu->a = (hi & 0xF0) | (lo & 0x0F);
+        return;
+    }
+    unsigned sum = cpu->a + v + c;
+    set_flag(cpu, FLAG_C, sum > 0xFF);
+    set_flag(cpu, FLAG_V, ~(cpu->a ^ v) & (cpu->a ^ sum) & 0x80);
+    set_nz(cpu, cpu->a = sum & 0xFF);
+}
+
+static void op_adc(cpu_t *cpu, unsigned addr) { add(cpu, READ(addr)); }
+
+static void op_sbc(cpu_t *cpu, unsigned addr) {
+    unsigned v = READ(addr);
+    if (cpu->p & FLAG_D) {
+        unsigned borrow = !(cpu->p & FLAG_C);
+        unsigned diff = cpu->a - v - borrow;
+        int lo = (cpu->a & 0x0F) - (v & 0x0F) - borrow;
+        int hi = (cpu->a & 0xF0) - (v & 0xF0);
+        if (lo < 0) { lo -= 6; hi -= 0x10; }
+        if (hi < 0) hi -= 0x60;
+        set_flag(cpu, FLAG_C, diff < 0x100);
+        set_flag(cpu, FLAG_V, (cpu->a ^ v) & (cpu->a ^ diff) & 0x80);
+        set_nz(cpu, diff & 0xFF);
+        cpu->a = (hi & 0xF0) | (lo & 0x0F);
+        return;
+    }
+    add(cpu, v ^ 0xFF);
+}
+
+static void compare(cpu_t *cpu, unsigned reg, unsigned v) {
+    set_flag(cpu, FLAG_C, reg >= v);
+    set_nz(cpu, (reg - v) & 0xFF);
+}
+
+static void op_cmp(cpu_t *cpu, unsigned addr) { compare(cpu, cpu->a, READ(addr)); }
+static void op_cpx(cpu_t *cpu, unsigned addr) { compare(cpu, cpu->x, READ(addr)); }
+static void op_cpy(cpu_t *cpu, unsigned addr) { compare(cpu, cpu->y, READ(addr)); }
+static void op_and(cpu_t *cpu, unsigned addr) { set_nz(cpu, cpu->a &= READ(addr)); }
+static void op_ora(cpu_t *cpu, unsigned addr) { set_nz(cpu, cpu->a |= READ(addr)); }
+static void op_eor(cpu_t *cpu, unsigned addr) { set_nz(cpu, cpu->a ^= READ(addr)); }
+
+static void op_bit(cpu_t *cpu, unsigned addr) {
+    unsigned v = READ(addr);
+    cpu->p = (cpu->p & ~(FLAG_N | FLAG_V | FLAG_Z)) | (v & (FLAG_N | FLAG_V)) | ((cpu->a & v) ? 0 : FLAG_Z);
+}
+
+// Increments and decrements
+static void op_inc(cpu_t *cpu, unsigned addr) { unsigned v = (READ(addr) + 1) & 0xFF; WRITE(addr, v); set_nz(cpu, v); }
+static void op_dec(cpu_t *cpu, unsigned addr) { unsigned v = (READ(addr) - 1) & 0xFF; WRITE(addr, v); set_nz(cpu, v); }
+static void op_inx(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, ++cpu->x); }
+static void op_iny(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, ++cpu->y); }
+static void op_dex(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, --cpu->x); }
+static void op_dey(cpu_t *cpu, unsigned addr) { (void)addr; set_nz(cpu, --cpu->y); }
+
+// Shifts and rotates, on memory or the accumulator
+static unsigned asl(cpu_t *cpu, unsigned v) { set_flag(cpu, FLAG_C, v & 0x80); v = (v << 1) & 0xFF; set_nz(cpu, v); return v; }
+static unsigned lsr(cpu_t *cpu, unsigned v) { set_flag(cpu, FLAG_C, v & 0x01); v >>= 1; set_nz(cpu, v); return v; }
+static unsigned rol(cpu_t *cpu, unsigned v) { unsigned c = cpu->p & FLAG_C; set_flag(cpu, FLAG_C, v & 0x80); v = ((v << 1) | c) & 0xFF; set_nz(cpu, v); return v; }
+static unsigned ror(cpu_t *cpu, unsigned v) { unsigned c = cpu->p & FLAG_C; set_flag(cpu, FLAG_C, v & 0x01); v = (v >> 1) | (c << 7); set_nz(cpu, v); return v; }
+
+static void op_asl(cpu_t *cpu, unsigned addr) { WRITE(addr, asl(cpu, READ(addr))); }
+static void op_lsr(cpu_t *cpu, unsigned addr) { WRITE(addr, lsr(cpu, READ(addr))); }
+static void op_rol(cpu_t *cpu, unsigned addr) { WRITE(addr, rol(cpu, READ(addr))); }
+static void op_ror(cpu_t *cpu, unsigned addr) { WRITE(addr, ror(cpu, READ(addr))); }
+static void op_asl_a(cpu_t *cpu, unsigned addr) { (void)addr; cpu->a = asl(cpu, cpu->a); }
+static void op_lsr_a(cpu_t *cpu, unsigned addr) { (void)addr; cpu->a = lsr(cpu, cpu->a); }
+static void op_rol_a(cpu_t *cpu, unsigned addr) { (void)addr; cpu->a = rol(cpu, cpu->a); }
+static void op_ror_a(cpu_t *cpu, unsigned addr) { (void)addr; cpu->a = ror(cpu, cpu->a); }
+
+// Flags
+static void op_clc(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p &= ~FLAG_C; }
+static void op_cld(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p &= ~FLAG_D; }
+static void op_cli(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p &= ~FLAG_I; }
+static void op_clv(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p &= ~FLAG_V; }
+static void op_sec(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p |= FLAG_C; }
+static void op_sed(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p |= FLAG_D; }
+static void op_sei(cpu_t *cpu, unsigned addr) { (void)addr; cpu->p |= FLAG_I; }
+
+// Control flow
+static void op_jmp(cpu_t *cpu, unsigned addr) { cpu->pc = addr; }
+static void op_nop(cpu_t *cpu, unsigned addr) { (void)cpu; (void)addr; }
+
+static void op_jsr(cpu_t *cpu, unsigned addr) {
+    unsigned ret = (cpu->pc - 1) & 0xFFFF;
+    PUSH(ret >> 8);
+    PUSH(ret);
+    cpu->pc = addr;
+}
+
+static void op_rts(cpu_t *cpu, unsigned addr) {
+    (void)addr;
+    unsigned lo = PULL();
+    cpu->pc = ((PULL() << 8) | lo) + 1;
+}
+
+static void op_rti(cpu_t *cpu, unsigned addr) {
+    (void)addr;
+    cpu->p = (PULL() & ~FLAG_B) | FLAG_U;
+    unsigned lo = PULL();
+    cpu->pc = (PULL() << 8) | lo;
+}
+
+// BRK and illegal opcodes stop the run with pc left on the opcode
+static void op_brk(cpu_t *cpu, unsigned addr) {
+    (void)addr;
+    cpu->pc--;
+    cpu->status = SIM_BRK;
+}
+
+static void op_illegal(cpu_t *cpu, unsigned addr) {
+    (void)addr;
+    cpu->pc--;
+    cpu->status = SIM_ILLEGAL;
+}
+
+// Taken branches cost one cycle, two when the target is on another page
+static inline void branch(cpu_t *cpu, unsigned addr, int taken) {
+    if (!taken) return;
+    cpu->cycles += 1 + ((addr ^ cpu->pc) > 0xFF);
+    cpu->pc = addr;
+}
+
+static void op_bcc(cpu_t *cpu, unsigned addr) { branch(cpu, addr, !(cpu->p & FLAG_C)); }
+static void op_bcs(cpu_t *cpu, unsigned addr) { branch(cpu, addr, cpu->p & FLAG_C); }
+static void op_bne(cpu_t *cpu, unsigned addr) { branch(cpu, addr, !(cpu->p & FLAG_Z)); }
+static void op_beq(cpu_t *cpu, unsigned addr) { branch(cpu, addr, cpu->p & FLAG_Z); }
+static void op_bpl(cpu_t *cpu, unsigned addr) { branch(cpu, addr, !(cpu->p & FLAG_N)); }
+static void op_bmi(cpu_t *cpu, unsigned addr) { branch(cpu, addr, cpu->p & FLAG_N); }
+static void op_bvc(cpu_t *cpu, unsigned addr) { branch(cpu, addr, !(cpu->p & FLAG_V)); }
+static void op_bvs(cpu_t *cpu, unsigned addr) { branch(cpu, addr, cpu->p & FLAG_V); }
+
+// Handlers by mnemonic, with the accumulator form of shifts and rotates
+static const struct {
+    char mnemonic[4];
+    sim_op_t op;
+    sim_op_t accumulator;
+} operations[] = {
+    { "ADC", op_adc, NULL }, { "AND", op_and, NULL }, { "ASL", op_asl, op_asl_a },
+    { "BCC", op_bcc, NULL }, { "BCS", op_bcs, NULL }, { "BEQ", op_beq, NULL },
+    { "BIT", op_bit, NULL }, { "BMI", op_bmi, NULL }, { "BNE", op_bne, NULL },
+    { "BPL", op_bpl, NULL }, { "BRK", op_brk, NULL }, { "BVC", op_bvc, NULL },
+    { "BVS", op_bvs, NULL }, { "CLC", op_clc, NULL }, { "CLD", op_cld, NULL },
+    { "CLI", op_cli, NULL }, { "CLV", op_clv, NULL }, { "CMP", op_cmp, NULL },
+    { "CPX", op_cpx, NULL }, { "CPY", op_cpy, NULL }, { "DEC", op_dec, NULL },
+    { "DEX", op_dex, NULL }, { "DEY", op_dey, NULL }, { "EOR", op_eor, NULL },
+    { "INC", op_inc, NULL }, { "INX", op_inx, NULL }, { "INY", op_iny, NULL },
+    { "JMP", op_jmp, NULL }, { "JSR", op_jsr, NULL }, { "LDA", op_lda, NULL },
+    { "LDX", op_ldx, NULL }, { "LDY", op_ldy, NULL }, { "LSR", op_lsr, op_lsr_a },
+    { "NOP", op_nop, NULL }, { "ORA", op_ora, NULL }, { "PHA", op_pha, NULL },
+    { "PHP", op_php, NULL }, { "PLA", op_pla, NULL }, { "PLP", op_plp, NULL },
+    { "ROL", op_rol, op_rol_a }, { "ROR", op_ror, op_ror_a }, { "RTI", op_rti, NULL },
+    { "RTS", op_rts, NULL }, { "SBC", op_sbc, NULL }, { "SEC", op_sec, NULL },
+    { "SED", op_sed, NULL }, { "SEI", op_sei, NULL }, { "STA", op_sta, NULL },
+    { "STX", op_stx, NULL }, { "STY", op_sty, NULL }, { "TAX", op_tax, NULL },
+    { "TAY", op_tay, NULL }, { "TSX", op_tsx, NULL }, { "TXA", op_txa, NULL },
+    { "TXS", op_txs, NULL }, { "TYA", op_tya, NULL }
+};
+
+// Build the dispatch table from instructions[]; timings come from its
+// base cycles and page penalty flags (branches charge their own)
+void sim_init(void) {
+    for (int i = 0; i < 256; i++) {
+        decode[i].op = op_illegal;
+        decode[i].mode = IMP;
+        decode[i].cycles = 2;
+        decode[i].page_penalty = 0;
+    }
+
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        const instruction_t *ins = &instructions[i];
+        for (size_t k = 0; k < sizeof(operations) / sizeof(operations[0]); k++) {
+            if (strcmp(operations[k].mnemonic, ins->mnemonic) != 0) continue;
+            sim_decode_t *d = &decode[ins->opcode];
+            d->op = ins->mode == IMP && operations[k].accumulator ? operations[k].accumulator : operations[k].op;
+            d->mode = ins->mode;
+            d->cycles = ins->cycles;
+            d->page_penalty = (ins->penalty & CYCLE_PAGE) != 0;
+            break;
+        }
+    }
+}
+
+void sim_reset(cpu_t *cpu, unsigned short pc) {
+    cpu->a = cpu->x = cpu->y = 0;
+    cpu->sp = 0xFD;
+    cpu->p = FLAG_U | FLAG_I;
+    cpu->pc = pc;
+    cpu->cycles = 0;
+    cpu->instructions = 0;
+    cpu->status = SIM_RUNNING;
+}
+
+// Fetch, address and execute one instruction
+static inline void step(cpu_t *cpu) {
+    const sim_decode_t *d = &decode[cpu->mem[cpu->pc]];
+    unsigned pc = cpu->pc + 1;
+    unsigned addr = 0, base;
+
+    switch (d->mode) {
+        case IMP: break;
+        case IMM: addr = pc++; break;
+        case ZPG: addr = READ(pc); pc++; break;
+        case ZPX: addr = (READ(pc) + cpu->x) & 0xFF; pc++; break;
+        case ZPY: addr = (READ(pc) + cpu->y) & 0xFF; pc++; break;
+        case ABS: addr = READ(pc) | (READ(pc + 1) << 8); pc += 2; break;
+        case ABX:
+            base = READ(pc) | (READ(pc + 1) << 8);
+            addr = (base + cpu->x) & 0xFFFF;
+            cpu->cycles += d->page_penalty & ((base ^ addr) > 0xFF);
+            pc += 2;
+            break;
+        case ABY:
+            base = READ(pc) | (READ(pc + 1) << 8);
+            addr = (base + cpu->y) & 0xFFFF;
+            cpu->cycles += d->page_penalty & ((base ^ addr) > 0xFF);
+            pc += 2;
+            break;
+        case IND:
+            // NMOS bug: the pointer high byte never carries into the next page
+            base = READ(pc) | (READ(pc + 1) << 8);
+            addr = READ(base) | (READ((base & 0xFF00) | ((base + 1) & 0xFF)) << 8);
+            pc += 2;
+            break;
+        case IZX:
+            base = (READ(pc) + cpu->x) & 0xFF;
+            addr = READ(base) | (READ((base + 1) & 0xFF) << 8);
+            pc++;
+            break;
+        case IZY:
+            base = READ(pc);
+            base = READ(base) | (READ((base + 1) & 0xFF) << 8);
+            addr = (base + cpu->y) & 0xFFFF;
+            cpu->cycles += d->page_penalty & ((base ^ addr) > 0xFF);
+            pc++;
+            break;
+        case REL:
+            addr = (pc + 1 + (signed char)READ(pc)) & 0xFFFF;
+            pc++;
+            break;
+        default: break;
+    }
+
+    cpu->pc = pc;
+    cpu->cycles += d->cycles;
+    cpu->instructions++;
+    d->op(cpu, addr);
+}
+
+// Run until BRK, an illegal opcode, the trap address (-1 for none) or
+// max_cycles. The profiled loop is kept apart so plain runs pay nothing for it.
+sim_status_t sim_run(cpu_t *cpu, unsigned long long max_cycles, long trap, sim_profile_t *profile) {
+    cpu->status = SIM_RUNNING;
+    if (profile) {
+        while (cpu->status == SIM_RUNNING) {
+            if (cpu->pc == trap) return cpu->status = SIM_TRAP;
+            if (cpu->cycles >= max_cycles) return cpu->status = SIM_LIMIT;
+            unsigned pc = cpu->pc;
+            unsigned long long before = cpu->cycles;
+            step(cpu);
+            profile->cycles[pc] += cpu->cycles - before;
+            profile->instructions[pc]++;
+        }
+    } else {
+        while (cpu->status == SIM_RUNNING) {
+            if (cpu->pc == trap) return cpu->status = SIM_TRAP;
+            if (cpu->cycles >= max_cycles) return cpu->status = SIM_LIMIT;
+            step(cpu);
+        }
+    }
+    return cpu->status;
+}
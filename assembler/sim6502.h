@@ -0,0 +1,44 @@
+#ifndef SIM6502_H
+#define SIM6502_H
+
+#include "types.h"
+
+// Status flags
+#define FLAG_C 0x01
+#define FLAG_Z 0x02
+#define FLAG_I 0x04
+#define FLAG_D 0x08
+#define FLAG_B 0x10
+#define FLAG_U 0x20
+#define FLAG_V 0x40
+#define FLAG_N 0x80
+
+// Why sim_run returned
+typedef enum {
+    SIM_RUNNING,
+    SIM_BRK,        // executed BRK
+    SIM_TRAP,       // reached the trap address
+    SIM_ILLEGAL,    // opcode not in instructions[]
+    SIM_LIMIT       // cycle limit hit
+} sim_status_t;
+
+typedef struct {
+    unsigned char a, x, y, sp, p;
+    unsigned short pc;
+    unsigned long long cycles;
+    unsigned long long instructions;
+    sim_status_t status;
+    unsigned char mem[0x10000];
+} cpu_t;
+
+// Per opcode address execution counts and cycles
+typedef struct {
+    unsigned long long cycles[0x10000];
+    unsigned long long instructions[0x10000];
+} sim_profile_t;
+
+void sim_init(void);
+void sim_reset(cpu_t *cpu, unsigned short pc);
+sim_status_t sim_run(cpu_t *cpu, unsigned long long max_cycles, long trap, sim_profile_t *profile);
+
+#endif
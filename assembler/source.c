@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.h"
+
+#define READ_CHUNK 65536
+
+// Read everything left in a stream into a growing heap buffer
+int source_read_stream(source_t *src, FILE *in) {
+    char *text = NULL;
+    size_t len = 0, cap = 0, n;
+
+    src->text = NULL;
+    src->len = 0;
+    src->mapped = 0;
+    do {
+        if (cap - len < READ_CHUNK) {
+            cap = cap ? cap * 2 : READ_CHUNK;
+            char *grown = realloc(text, cap);
+            if (!grown) {
+                perror("Memory allocation failed");
+                free(text);
+                return 0;
+            }
+            text = grown;
+        }
+        n = fread(text + len, 1, cap - len, in);
+        len += n;
+    } while (n > 0);
+
+    if (ferror(in)) {
+        perror("Failed to read input");
+        free(text);
+        return 0;
+    }
+    src->text = text;
+    src->len = len;
+    return 1;
+}
+
+int source_open(source_t *src, const char *path) {
+    int stdin_input = strcmp(path, "-") == 0;
+    int fd = stdin_input ? STDIN_FILENO : open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        perror("Failed to open input file");
+        return 0;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text != MAP_FAILED) {
+            // Every pass reads the text front to back
+            madvise(text, st.st_size, MADV_SEQUENTIAL);
+            if (!stdin_input) close(fd);
+            src->text = text;
+            src->len = st.st_size;
+            src->mapped = 1;
+            return 1;
+        }
+    }
+
+    // Pipes, terminals, empty files and file systems without mmap
+    if (stdin_input) return source_read_stream(src, stdin);
+    FILE *f = fdopen(fd, "rb");
+    if (!f) {
+        perror("Failed to open input file");
+        close(fd);
+        return 0;
+    }
+    int ok = source_read_stream(src, f);
+    fclose(f);
+    return ok;
+}
+
+void source_close(source_t *src) {
+    if (src->mapped) munmap((void *)src->text, src->len);
+    else free((void *)src->text);
+    src->text = NULL;
+    src->len = 0;
+    src->mapped = 0;
+}
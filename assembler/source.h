@@ -0,0 +1,21 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Read-only input text. Regular files are mapped, so the assembler reads
+// them through the page cache without a private copy; pipes and terminals
+// are read into the heap.
+typedef struct {
+    const char *text;       // not NUL-terminated
+    size_t len;
+    int mapped;
+} source_t;
+
+// Open a path, "-" being standard input; returns 0 and reports on failure
+int source_open(source_t *src, const char *path);
+int source_read_stream(source_t *src, FILE *in);
+void source_close(source_t *src);
+
+#endif
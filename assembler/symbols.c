@@ -1,26 +1,194 @@
+#include <stdlib.h>
 #include <string.h>
 #include "symbols.h"
 
-symbol_t symbols[MAX_SYMBOLS];
-int symbol_count = 0;
-unsigned short program_counter = 0;
+#define INITIAL_SLOTS 1024
+
+// FNV-1a
+static unsigned hash_name(const char *name, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+    return h;
+}
+
+// Expand local labels to "scope.local"; names are length delimited so
+// they can point straight into the source text
+static const char* qualify(symbol_table_t *table, const char *name, size_t *len) {
+    if (*len == 0 || name[0] != LOCAL_LABEL_PREFIX) return name;
+    size_t slen = strlen(table->scope), nlen = *len;
+    if (slen + nlen + 1 > table->qualified_cap) {
+        size_t cap = (slen + nlen + 1) * 2;
+        char *buf = realloc(table->qualified, cap);
+        if (!buf) return name;
+        table->qualified = buf;
+        table->qualified_cap = cap;
+    }
+    memcpy(table->qualified, table->scope, slen);
+    memcpy(table->qualified + slen, name, nlen);
+    table->qualified[slen + nlen] = '\0';
+    *len = slen + nlen;
+    return table->qualified;
+}
+
+static int find_slot(symbol_table_t *table, const char *name, size_t len, unsigned hash) {
+    unsigned i = hash & table->slot_mask;
+    while (table->slots[i] >= 0) {
+        symbol_t *sym = &table->symbols[table->slots[i]];
+        if (sym->hash == hash && strncmp(sym->name, name, len) == 0 && sym->name[len] == '\0') break;
+        i = (i + 1) & table->slot_mask;
+    }
+    return i;
+}
+
+// Double the slot table and rehash, keeping load under 50%
+static int grow_slots(symbol_table_t *table) {
+    unsigned count = table->slot_mask ? (table->slot_mask + 1) * 2 : INITIAL_SLOTS;
+    int *grown = malloc(count * sizeof(int));
+    if (!grown) return 0;
+    memset(grown, 0xFF, count * sizeof(int));
+    free(table->slots);
+    table->slots = grown;
+    table->slot_mask = count - 1;
+    for (int s = 0; s < table->count; s++) {
+        unsigned i = table->symbols[s].hash & table->slot_mask;
+        while (table->slots[i] >= 0) i = (i + 1) & table->slot_mask;
+        table->slots[i] = s;
+    }
+    return 1;
+}
+
+void symbols_init(symbol_table_t *table) {
+    memset(table, 0, sizeof(*table));
+    arena_init(&table->names);
+    table->scope = "";
+}
+
+// Free everything, leaving an empty table
+void reset_symbols(symbol_table_t *table) {
+    arena_free(&table->names);
+    free(table->slots);
+    free(table->symbols);
+    free(table->qualified);
+    free(table->fixups);
+    symbols_init(table);
+}
+
+// Forget every symbol and fixup; the tables and the name arena keep their
+// capacity for the next run
+void clear_symbols(symbol_table_t *table) {
+    if (table->slots) memset(table->slots, 0xFF, (table->slot_mask + 1) * sizeof(int));
+    table->count = 0;
+    table->fixup_count = 0;
+    table->fixup_head = 0;
+    arena_reset(&table->names);
+    table->scope = "";
+}
+
+// Global labels open a new scope for the local labels that follow
+void set_symbol_scope_n(symbol_table_t *table, const char *name, size_t len) {
+    if (len > 0 && name[0] == LOCAL_LABEL_PREFIX) return;
+    int idx = find_symbol_n(table, name, len);
+    table->scope = idx >= 0 ? table->symbols[idx].name : "";
+}
+
+void set_symbol_scope(symbol_table_t *table, const char *name) {
+    set_symbol_scope_n(table, name, strlen(name));
+}
 
 // Find symbol in symbol table
-int find_symbol(char *name) {
-    for (int i = 0; i < symbol_count; i++) {
-        if (strcmp(symbols[i].name, name) == 0) {
-            return i;
-        }
+int find_symbol_n(symbol_table_t *table, const char *name, size_t len) {
+    if (table->count == 0) return -1;
+    name = qualify(table, name, &len);
+    return table->slots[find_slot(table, name, len, hash_name(name, len))];
+}
+
+int find_symbol(symbol_table_t *table, const char *name) {
+    return find_symbol_n(table, name, strlen(name));
+}
+
+// Find or create a symbol entry; new entries start undefined
+static int intern_symbol(symbol_table_t *table, const char *name, size_t len) {
+    if ((unsigned)(table->count + 1) * 2 > table->slot_mask + 1 && !grow_slots(table)) return -1;
+    if (table->count == table->cap) {
+        int cap = table->cap ? table->cap * 2 : INITIAL_SLOTS / 2;
+        symbol_t *grown = realloc(table->symbols, cap * sizeof(symbol_t));
+        if (!grown) return -1;
+        table->symbols = grown;
+        table->cap = cap;
     }
-    return -1;
+
+    name = qualify(table, name, &len);
+    unsigned hash = hash_name(name, len);
+    int slot = find_slot(table, name, len, hash);
+    if (table->slots[slot] >= 0) return table->slots[slot];
+
+    symbol_t *sym = &table->symbols[table->count];
+    sym->name = arena_strndup(&table->names, name, len);
+    if (!sym->name) return -1;
+    sym->hash = hash;
+    sym->address = 0;
+    sym->defined = 0;
+    sym->section = -1;
+    sym->exported = 0;
+    sym->fixups = -1;
+    table->slots[slot] = table->count;
+    return table->count++;
+}
+
+// Add symbol to symbol table, returns its index or -1 when out of memory
+int add_symbol_n(symbol_table_t *table, const char *name, size_t len, unsigned short address) {
+    int idx = intern_symbol(table, name, len);
+    if (idx < 0) return -1;
+    table->symbols[idx].address = address;
+    table->symbols[idx].defined = 1;
+    return idx;
+}
+
+int add_symbol(symbol_table_t *table, const char *name, unsigned short address) {
+    return add_symbol_n(table, name, strlen(name), address);
 }
 
-// Add symbol to symbol table
-void add_symbol(char *name, unsigned short address) {
-    if (symbol_count < MAX_SYMBOLS) {
-        strcpy(symbols[symbol_count].name, name);
-        symbols[symbol_count].address = address;
-        symbols[symbol_count].defined = 1;
-        symbol_count++;
+// Copy a string into the symbol name arena
+const char* intern_name_n(symbol_table_t *table, const char *name, size_t len) {
+    return arena_strndup(&table->names, name, len);
+}
+
+const char* intern_name(symbol_table_t *table, const char *name) {
+    return intern_name_n(table, name, strlen(name));
+}
+
+// Entry for a symbol used before its definition
+int reference_symbol_n(symbol_table_t *table, const char *name, size_t len) {
+    return intern_symbol(table, name, len);
+}
+
+int reference_symbol(symbol_table_t *table, const char *name) {
+    return reference_symbol_n(table, name, strlen(name));
+}
+
+// Chain a fixup onto an undefined symbol; returns 0 when out of memory
+int add_fixup(symbol_table_t *table, int symbol, fixup_kind_t kind, size_t offset, unsigned short pc, int line) {
+    if (table->fixup_count == table->fixup_cap) {
+        int cap = table->fixup_cap ? table->fixup_cap * 2 : 256;
+        fixup_t *grown = realloc(table->fixups, cap * sizeof(fixup_t));
+        if (!grown) return 0;
+        table->fixups = grown;
+        table->fixup_cap = cap;
     }
+    fixup_t *fix = &table->fixups[table->fixup_count];
+    fix->offset = offset;
+    fix->pc = pc;
+    fix->kind = kind;
+    fix->line = line;
+    fix->symbol = symbol;
+    fix->next = table->symbols[symbol].fixups;
+    table->symbols[symbol].fixups = table->fixup_count++;
+    return 1;
+}
+
+// Output offset of the oldest unpatched fixup, (size_t)-1 if none. Fixups
+// are recorded in output order and patched ones have symbol -1.
+size_t oldest_pending_fixup(symbol_table_t *table) {
+    while (table->fixup_head < table->fixup_count && table->fixups[table->fixup_head].symbol < 0) table->fixup_head++;
+    return table->fixup_head < table->fixup_count ? table->fixups[table->fixup_head].offset : (size_t)-1;
 }
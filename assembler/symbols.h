@@ -2,14 +2,44 @@
 #define SYMBOLS_H
 
 #include "types.h"
+#include "arena.h"
 
-#define MAX_SYMBOLS 256
+// Labels starting with '.' are local to the last global label
+#define LOCAL_LABEL_PREFIX '.'
 
-extern symbol_t symbols[MAX_SYMBOLS];
-extern int symbol_count;
-extern unsigned short program_counter;
+// Symbols of one assembly or link run, with the fixups pending on them
+typedef struct {
+    symbol_t *symbols;
+    int count;
+    int cap;
+    int *slots;             // open addressing table of symbol indices, -1 empty
+    unsigned slot_mask;
+    arena_t names;
+    const char *scope;
+    char *qualified;        // scratch for "scope.local" keys
+    size_t qualified_cap;
+    fixup_t *fixups;
+    int fixup_count;
+    int fixup_cap;
+    int fixup_head;         // fixups before this index are resolved
+} symbol_table_t;
 
-int find_symbol(char *name);
-void add_symbol(char *name, unsigned short address);
+void symbols_init(symbol_table_t *table);
+void reset_symbols(symbol_table_t *table);
+void clear_symbols(symbol_table_t *table);
+int find_symbol(symbol_table_t *table, const char *name);
+int add_symbol(symbol_table_t *table, const char *name, unsigned short address);
+int reference_symbol(symbol_table_t *table, const char *name);
+const char* intern_name(symbol_table_t *table, const char *name);
+int add_fixup(symbol_table_t *table, int symbol, fixup_kind_t kind, size_t offset, unsigned short pc, int line);
+size_t oldest_pending_fixup(symbol_table_t *table);
+void set_symbol_scope(symbol_table_t *table, const char *name);
+
+// Variants taking names that are not NUL-terminated, e.g. source views
+int find_symbol_n(symbol_table_t *table, const char *name, size_t len);
+int add_symbol_n(symbol_table_t *table, const char *name, size_t len, unsigned short address);
+int reference_symbol_n(symbol_table_t *table, const char *name, size_t len);
+const char* intern_name_n(symbol_table_t *table, const char *name, size_t len);
+void set_symbol_scope_n(symbol_table_t *table, const char *name, size_t len);
 
 #endif
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assembler.h"
+
+// Encodings of single sources in two pass and single pass mode; a NULL
+// expectation means the source has to be rejected
+
+typedef struct {
+    const char *src;
+    const char *hex;
+} test_case_t;
+
+static const test_case_t cases[] = {
+    // Zero page indexed forms without an absolute counterpart
+    { "STX $10,Y\n", "96 10" },
+    { "STY $10,X\n", "94 10" },
+    { "ZP = $20\nSTX ZP,Y\nSTY ZP,X\n", "96 20 94 20" },
+    { "STX ZP,Y\nZP = $30\n", "96 30" },
+    { "STX $1234,Y\n", NULL },
+    { "STY $100,X\n", NULL },
+
+    // Index registers in either case; operands with text left over
+    { "lda $10,x\n", "B5 10" },
+    { "lda ($10),y\n", "B1 10" },
+    { "lda ($10,x)\n", "A1 10" },
+    { "sta $1234,y\n", "99 34 12" },
+    { "jmp ($1234)\n", "6C 34 12" },
+    { "LDA $10 junk\n", NULL },
+    { "LDA $10,Z\n", NULL },
+    { "LDA #$10,X\n", NULL },
+    { "LDA ($10),X\n", NULL },
+    { "LDA $1G\n", NULL },
+    { ".byte $10 $20\n", NULL },
+
+    // Macro calls need an argument per parameter
+    { ".macro m x\nLDA #x\n.endm\nm 5\n", "A9 05" },
+    { ".macro m x\nLDA #x\n.endm\nm\n", NULL },
+    { ".macro m x, y\nLDA x\n.endm\nm $10\n", NULL },
+    { ".macro m x\nLDA #x\n.endm\nm 1, 2\n", NULL },
+};
+
+static int run_case(const test_case_t *tc, int flags) {
+    byte_buffer_t out;
+    buffer_init(&out);
+    int errors = assemble_6502_bytes((char*)tc->src, &out, flags);
+    char *hex = errors ? NULL : buffer_to_hex(&out);
+    buffer_free(&out);
+
+    int ok = tc->hex ? hex && strcmp(hex, tc->hex) == 0 : errors > 0;
+    if (!ok) {
+        fprintf(stderr, "FAIL (%s): %s  expected %s, got %s\n", flags ? "one pass" : "two pass",
+                tc->src, tc->hex ? tc->hex : "an error", hex ? hex : "an error");
+    }
+    free(hex);
+    return ok;
+}
+
+int main(void) {
+    int count = sizeof(cases) / sizeof(cases[0]), failed = 0;
+    for (int i = 0; i < count; i++) {
+        for (int flags = 0; flags <= ASM_ONE_PASS; flags++) {
+            if (!run_case(&cases[i], flags)) failed++;
+        }
+    }
+    printf("test_assembler: %d of %d checks passed\n", count * 2 - failed, count * 2);
+    return failed != 0;
+}
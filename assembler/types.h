@@ -1,6 +1,8 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stddef.h>
+
 // Addressing modes
 typedef enum {
     IMP,    // Implied
@@ -14,22 +16,65 @@ typedef enum {
     IND,    // Indirect ($nnnn)
     IZX,    // Indexed Indirect ($nn,X)
     IZY,    // Indirect Indexed ($nn),Y
-    REL     // Relative (branches)
+    REL,    // Relative (branches)
+    NUM_ADDR_MODES
 } addr_mode_t;
 
+// Read-only slice of a larger text, not NUL-terminated
+typedef struct {
+    const char *ptr;
+    size_t len;
+} str_view_t;
+
+// Cycle penalties on top of the base count
+#define CYCLE_PAGE   0x01   // +1 when the indexed address crosses a page
+#define CYCLE_BRANCH 0x02   // +1 when taken, +1 more when the target is on another page
+
 // Instruction definition
 typedef struct {
     char mnemonic[4];
     unsigned char opcode;
     addr_mode_t mode;
+    unsigned char cycles;   // base cycles
+    unsigned char penalty;  // CYCLE_* flags
 } instruction_t;
 
 // Symbol table entry
 typedef struct {
-    char name[32];
+    const char *name;       // interned, local labels as "global.local"
+    unsigned int hash;
     unsigned short address;
     int defined;
+    int section;            // relocatable section index, -1 if absolute
+    int exported;
+    int fixups;             // head of pending fixup chain, -1 if none
 } symbol_t;
 
+// Forward reference patch kinds
+typedef enum {
+    FIXUP_ABS,  // 16-bit little endian address
+    FIXUP_LO,   // low byte
+    FIXUP_HI,   // high byte
+    FIXUP_REL   // signed branch offset from pc + 2
+} fixup_kind_t;
+
+// Pending patch of emitted bytes against an undefined symbol
+typedef struct {
+    size_t offset;          // output offset of the first operand byte
+    unsigned short pc;      // address of the referencing instruction
+    fixup_kind_t kind;
+    int line;
+    int symbol;
+    int next;               // next fixup on the same symbol, -1 ends
+} fixup_t;
+
+// Contiguous run of output placed at one origin
+typedef struct {
+    const char *name;
+    unsigned short org;     // load address, 0 for relocatable sections
+    int relocatable;
+    size_t offset;          // start in the output buffer
+    size_t size;
+} section_t;
 
 #endif
@@ -4,52 +4,106 @@
 #include <ctype.h>
 #include "utils.h"
 #include "symbols.h"
+#include "lexer.h"
 
-char* trim_whitespace(char *str) {
-    char *end;
-    while (isspace((unsigned char)*str)) str++;
-    if (*str == 0) return str;
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
-    end[1] = '\0';
-    return str;
-}
+#define MAX_NUMBER 64
 
-int parse_number(char *str) {
+// Numbers, or the value of a symbol when a table is given
+int parse_number(symbol_table_t *table, char *str) {
     if (!str) return 0;
     if (str[0] == '$') return strtol(str + 1, NULL, 16);
     if (str[0] == '#' && str[1] == '$') return strtol(str + 2, NULL, 16);
     if (str[0] == '#') return strtol(str + 1, NULL, 10);
     if (str[0] == '%') return strtol(str + 1, NULL, 2);
 
-    int idx = find_symbol(str);
-    if (idx >= 0) return symbols[idx].address;
+    int idx = table ? find_symbol(table, str) : -1;
+    if (idx >= 0) return table->symbols[idx].address;
 
     return strtol(str, NULL, 10);
 }
 
-addr_mode_t detect_addressing_mode(char *operand) {
-    if (!operand || strlen(operand) == 0) return IMP;
-    operand = trim_whitespace(operand);
-    if (operand[0] == '#') return IMM;
-    if (strstr(operand, ",X")) {
-        if (operand[0] == '(' && operand[strlen(operand)-3] == ')') return IZX;
-        if (strlen(operand) <= 5) return ZPX;
+// parse_number over a view: symbols are looked up in place, only literals
+// are copied since strtol needs a terminator
+int parse_number_n(symbol_table_t *table, const char *str, size_t len) {
+    char literal[MAX_NUMBER];
+    if (table && len > 0 && !strchr("$#%", str[0])) {
+        int idx = find_symbol_n(table, str, len);
+        if (idx >= 0) return table->symbols[idx].address;
+    }
+    if (len >= sizeof(literal)) len = sizeof(literal) - 1;
+    memcpy(literal, str, len);
+    literal[len] = '\0';
+    return parse_number(NULL, literal);
+}
+
+// Syntactic addressing mode; plain and indexed addresses come back in their
+// absolute form and the assembler narrows them once the value is known.
+// Index registers may be written in either case.
+addr_mode_t detect_addressing_mode(str_view_t operand) {
+    operand = view_trim(operand);
+    if (operand.len == 0) return IMP;
+    if (operand.ptr[0] == '#') return IMM;
+    if (view_find_upper(operand, ",X")) {
+        if (operand.ptr[0] == '(' && view_find_upper(operand, ",X)")) return IZX;
         return ABX;
     }
-    if (strstr(operand, ",Y")) {
-        if (operand[0] == '(' && strstr(operand, "),Y")) return IZY;
-        if (strlen(operand) <= 5) return ZPY;
+    if (view_find_upper(operand, ",Y")) {
+        if (operand.ptr[0] == '(' && view_find_upper(operand, "),Y")) return IZY;
         return ABY;
     }
-    if (operand[0] == '(' && operand[strlen(operand)-1] == ')') return IND;
-
-    int value = parse_number(operand);
-    if (value <= 0xFF && operand[0] == '$' && strlen(operand) <= 3) return ZPG;
+    if (operand.ptr[0] == '(' && operand.ptr[operand.len - 1] == ')') return IND;
 
     return ABS;
 }
 
+// Whether the text after the address expression of an operand is one
+// detect_addressing_mode knows: nothing or an index register, and the
+// closing parenthesis when the operand opened one
+int valid_operand_tail(str_view_t tail, int immediate, int indirect) {
+    static const char *direct[] = { "", ",X", ",Y" };
+    static const char *paren[] = { ")", ",X)", "),Y" };
+    const char **forms = indirect ? paren : direct;
+    int count = immediate ? 1 : 3;
+
+    tail = view_trim(tail);
+    for (int i = 0; i < count; i++) {
+        if (view_equals_upper(tail, forms[i])) return 1;
+    }
+    return 0;
+}
+
+// Whether an address expression is one whole symbol name or number literal
+int valid_expression(str_view_t expr) {
+    const char *digits = "0123456789";
+    size_t i = 0;
+
+    if (expr.len == 0) return 0;
+    if (isalpha((unsigned char)expr.ptr[0]) || expr.ptr[0] == '_' || expr.ptr[0] == '.') {
+        for (i = 1; i < expr.len; i++) {
+            if (isspace((unsigned char)expr.ptr[i])) return 0;
+        }
+        return 1;
+    }
+    if (expr.ptr[0] == '$') digits = "0123456789abcdefABCDEF", i = 1;
+    else if (expr.ptr[0] == '%') digits = "01", i = 1;
+    else if (expr.ptr[0] == '-') i = 1;
+    if (i == expr.len) return 0;
+    for (; i < expr.len; i++) {
+        if (!strchr(digits, expr.ptr[i])) return 0;
+    }
+    return 1;
+}
+
+// Zero page counterpart of an absolute mode, or the mode itself
+addr_mode_t zero_page_form(addr_mode_t mode) {
+    switch (mode) {
+        case ABS: return ZPG;
+        case ABX: return ZPX;
+        case ABY: return ZPY;
+        default: return mode;
+    }
+}
+
 int get_instruction_bytes(addr_mode_t mode) {
     switch (mode) {
         case IMP: return 1;
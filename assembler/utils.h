@@ -2,10 +2,14 @@
 #define UTILS_H
 
 #include "types.h"
+#include "symbols.h"
 
-int parse_number(char *str);
-addr_mode_t detect_addressing_mode(char *operand);
+int parse_number(symbol_table_t *table, char *str);
+int parse_number_n(symbol_table_t *table, const char *str, size_t len);
+addr_mode_t detect_addressing_mode(str_view_t operand);
+int valid_operand_tail(str_view_t tail, int immediate, int indirect);
+int valid_expression(str_view_t expr);
+addr_mode_t zero_page_form(addr_mode_t mode);
 int get_instruction_bytes(addr_mode_t mode);
-char* trim_whitespace(char *str);
 
 #endif
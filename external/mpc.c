@@ -68,13 +68,48 @@ enum {
 };
 
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_MEM_NUM = 512,
+  MPC_INPUT_MEM_BIG_NUM = 256
 };
 
 typedef struct {
   char mem[64];
 } mpc_mem_t;
 
+typedef struct {
+  char mem[128];
+} mpc_mem_big_t;
+
+/*
+** What a memoized parser did at one input position, see `mpc_memoize`.
+** A slot is empty while `p` is NULL.
+*/
+
+enum {
+  MPC_MEMO_FAILURE = 0,
+  MPC_MEMO_SUCCESS = 1,
+  MPC_MEMO_DROPPED = 2
+};
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  char term;
+  char suppress;
+} mpc_memo_key_t;
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  mpc_state_t state;
+  mpc_val_t *output;
+  mpc_err_t *error;
+  char term;
+  char suppress;
+  char outcome;
+  char last;
+} mpc_memo_t;
+
 typedef struct {
 
   int type;
@@ -94,12 +129,41 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
+  size_t mem_free_num;
+  size_t mem_big_free_num;
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  mpc_mem_big_t mem_big[MPC_INPUT_MEM_BIG_NUM];
+  unsigned short mem_free[MPC_INPUT_MEM_NUM];
+  unsigned short mem_big_free[MPC_INPUT_MEM_BIG_NUM];
+
+  size_t memo_slots;
+  size_t memo_num;
+  mpc_memo_t *memo;
+  size_t held_slots;
+  size_t held_num;
+  mpc_memo_key_t *held;
 
 } mpc_input_t;
 
+/*
+** The pool has a class of 64 byte slots and one of 128 bytes, which is
+** what most error messages need. Free slots are kept on a stack per class,
+** so `mpc_malloc` and `mpc_free` are O(1) and the most recently freed
+** (still cached) slot is reused first.
+*/
+
+static void mpc_input_mem_init(mpc_input_t *i) {
+  int j;
+  i->mem_free_num = MPC_INPUT_MEM_NUM;
+  for (j = 0; j < MPC_INPUT_MEM_NUM; j++) {
+    i->mem_free[j] = (unsigned short)(MPC_INPUT_MEM_NUM - 1 - j);
+  }
+  i->mem_big_free_num = MPC_INPUT_MEM_BIG_NUM;
+  for (j = 0; j < MPC_INPUT_MEM_BIG_NUM; j++) {
+    i->mem_big_free[j] = (unsigned short)(MPC_INPUT_MEM_BIG_NUM - 1 - j);
+  }
+}
+
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -123,8 +187,14 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_mem_init(i);
+
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  i->held_slots = 0;
+  i->held_num = 0;
+  i->held = NULL;
 
   return i;
 }
@@ -153,8 +223,14 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_mem_init(i);
+
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  i->held_slots = 0;
+  i->held_num = 0;
+  i->held = NULL;
 
   return i;
 
@@ -182,8 +258,14 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_mem_init(i);
+
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  i->held_slots = 0;
+  i->held_num = 0;
+  i->held = NULL;
 
   return i;
 
@@ -210,8 +292,14 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_mem_init(i);
+
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  i->held_slots = 0;
+  i->held_num = 0;
+  i->held = NULL;
 
   return i;
 }
@@ -225,6 +313,8 @@ static void mpc_input_delete(mpc_input_t *i) {
 
   free(i->marks);
   free(i->lasts);
+  free(i->memo);
+  free(i->held);
   free(i);
 }
 
@@ -234,23 +324,26 @@ static int mpc_mem_ptr(mpc_input_t *i, void *p) {
     (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
 }
 
-static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
-
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+static int mpc_mem_big_ptr(mpc_input_t *i, void *p) {
+  return
+    (char*)p >= (char*)(i->mem_big) &&
+    (char*)p <  (char*)(i->mem_big) + (MPC_INPUT_MEM_BIG_NUM * sizeof(mpc_mem_big_t));
+}
 
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+/* Size of the pool slot at `p`, or zero for heap memory */
+static size_t mpc_mem_size(mpc_input_t *i, void *p) {
+  if (mpc_mem_ptr(i, p)) { return sizeof(mpc_mem_t); }
+  if (mpc_mem_big_ptr(i, p)) { return sizeof(mpc_mem_big_t); }
+  return 0;
+}
 
+static void *mpc_malloc(mpc_input_t *i, size_t n) {
+  if (n <= sizeof(mpc_mem_t) && i->mem_free_num > 0) {
+    return (void*)(i->mem + i->mem_free[--i->mem_free_num]);
+  }
+  if (n <= sizeof(mpc_mem_big_t) && i->mem_big_free_num > 0) {
+    return (void*)(i->mem_big + i->mem_big_free[--i->mem_big_free_num]);
+  }
   return malloc(n);
 }
 
@@ -262,20 +355,27 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 
 static void mpc_free(mpc_input_t *i, void *p) {
   size_t j;
-  if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  if (mpc_mem_ptr(i, p)) {
+    j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
+    i->mem_free[i->mem_free_num++] = (unsigned short)j;
+  } else if (mpc_mem_big_ptr(i, p)) {
+    j = ((size_t)(((char*)p) - ((char*)i->mem_big))) / sizeof(mpc_mem_big_t);
+    i->mem_big_free[i->mem_big_free_num++] = (unsigned short)j;
+  } else {
+    free(p);
+  }
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
   char *q = NULL;
+  size_t m = mpc_mem_size(i, p);
 
-  if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  if (m == 0) { return realloc(p, n); }
 
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
+  if (n > m) {
+    q = mpc_malloc(i, n);
+    memcpy(q, p, m);
     mpc_free(i, p);
     return q;
   }
@@ -285,9 +385,10 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
-  if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  size_t m = mpc_mem_size(i, p);
+  if (m == 0) { return p; }
+  q = malloc(m);
+  memcpy(q, p, m);
   mpc_free(i, p);
   return q;
 }
@@ -737,10 +838,9 @@ static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expecte
   return 0;
 }
 
+/* The caller has made room for the entry */
 static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
-  (void)i;
   x->expected_num++;
-  x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
   x->expected[x->expected_num-1] = mpc_malloc(i, strlen(expected) + 1);
   strcpy(x->expected[x->expected_num-1], expected);
 }
@@ -770,6 +870,14 @@ static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
     if (x[j]->state.pos > e->state.pos) { e->state = x[j]->state; }
   }
 
+  /* Room for every expected entry, rather than growing it one at a time */
+  for (j = 0, k = 0; j < n; j++) {
+    if (x[j] == NULL) { continue; }
+    if (x[j]->state.pos < e->state.pos) { continue; }
+    k += x[j]->expected_num;
+  }
+  if (k > 0) { e->expected = mpc_malloc(i, sizeof(char*) * k); }
+
   for (j = 0; j < n; j++) {
     if (x[j] == NULL) { continue; }
     if (x[j]->state.pos < e->state.pos) { continue; }
@@ -878,6 +986,28 @@ static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
   return mpc_err_or(i, errs, 2);
 }
 
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
+  int j;
+  mpc_err_t *y = malloc(sizeof(mpc_err_t));
+  memcpy(y, x, sizeof(mpc_err_t));
+  y->filename = malloc(strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  if (x->failure) {
+    y->failure = malloc(strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  if (x->expected_num > 0) {
+    y->expected = malloc(sizeof(char*) * x->expected_num);
+    for (j = 0; j < x->expected_num; j++) {
+      y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+      strcpy(y->expected[j], x->expected[j]);
+    }
+  } else {
+    y->expected = NULL;
+  }
+  return y;
+}
+
 /*
 ** Parser Type
 */
@@ -918,7 +1048,11 @@ enum {
   MPC_TYPE_SOI        = 27,
   MPC_TYPE_EOI        = 28,
 
-  MPC_TYPE_SEPBY1     = 29
+  MPC_TYPE_SEPBY1     = 29,
+
+  MPC_TYPE_MEMO       = 30,
+
+  MPC_TYPE_DFA        = 31
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -939,6 +1073,8 @@ typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdat
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_parser_t *sep; } mpc_pdata_sepby1;
+typedef struct { mpc_parser_t *x; mpc_apply_t cp; mpc_dtor_t dx; } mpc_pdata_memo_t;
+typedef struct { int states_num; int classes_num; unsigned char *classes; unsigned short *table; char *accept; char *m; } mpc_pdata_dfa_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -959,6 +1095,8 @@ typedef union {
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
   mpc_pdata_sepby1 sepby1;
+  mpc_pdata_memo_t memo;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -968,6 +1106,57 @@ struct mpc_parser_t {
   char retained;
 };
 
+/*
+** A DFA regex runs its table straight over string input, remembering the
+** last accepting state, then consumes the longest match in one go. Other
+** inputs are read a character at a time and rewound to consume the match.
+*/
+
+static int mpc_input_dfa(mpc_input_t *i, mpc_pdata_dfa_t *d, char **o) {
+
+  const unsigned char *s;
+  long j, n = d->accept[1] ? 0 : -1;
+  int t = 1;
+  char c;
+
+  if (i->type == MPC_INPUT_STRING) {
+    s = (const unsigned char*)i->string + i->state.pos;
+    for (j = 0; s[j]; j++) {
+      t = d->table[t * d->classes_num + d->classes[s[j]]];
+      if (t == 0) { break; }
+      if (d->accept[t]) { n = j + 1; }
+    }
+    if (n < 0) { return 0; }
+    *o = mpc_malloc(i, n + 1);
+    memcpy(*o, s, n);
+    (*o)[n] = '\0';
+    for (j = 0; j < n; j++) { mpc_input_success(i, (char)s[j], NULL); }
+    return 1;
+  }
+
+  mpc_input_backtrack_enable(i);
+  mpc_input_mark(i);
+  for (j = 0; !mpc_input_terminated(i); j++) {
+    c = mpc_input_getc(i);
+    t = d->table[t * d->classes_num + d->classes[(unsigned char)c]];
+    if (t == 0) { mpc_input_failure(i, c); break; }
+    mpc_input_success(i, c, NULL);
+    if (d->accept[t]) { n = j + 1; }
+  }
+  mpc_input_rewind(i);
+  mpc_input_backtrack_disable(i);
+
+  if (n < 0) { return 0; }
+  *o = mpc_malloc(i, n + 1);
+  for (j = 0; j < n; j++) {
+    c = mpc_input_getc(i);
+    mpc_input_success(i, c, NULL);
+    (*o)[j] = c;
+  }
+  (*o)[n] = '\0';
+  return 1;
+}
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -1029,6 +1218,11 @@ static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   return f(mpc_export(i, x));
 }
 
+static mpc_val_t *mpc_parse_lift(mpc_input_t *i, mpc_ctor_t f) {
+  if (f == mpcf_ctor_str) { return mpc_calloc(i, 1, 1); }
+  return f();
+}
+
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
   return f(mpc_export(i, x), d);
 }
@@ -1065,6 +1259,156 @@ static mpc_result_t *mpc_grow_results(mpc_input_t *i, int j, mpc_result_t *resul
   return tmp_results;
 }
 
+/*
+** Memoization
+**
+** A `mpc_memoize` parser remembers what its child did at each input
+** position: the output or error and the state the input was left in.
+** Running it again at that position replays the entry instead, so grammars
+** that backtrack over shared prefixes parse in linear time. Outputs are
+** handed out as copies as callers own, and may modify or free, whatever
+** they are given. Errors merged on the way need no replaying: they went
+** into the one error of the whole parse, and merging them again would not
+** change it.
+**
+** Keeping a copy of every output would hold one copy of the tree per level
+** of nesting. Once a memoized parse succeeds the outputs kept while it ran
+** are dropped, as they are part of its own output now; their entries stay
+** to answer with errors but parse again if their output is wanted.
+**
+** Only string input is memoized, as files and pipes cannot jump forward
+** to the end of a remembered parse.
+*/
+
+enum {
+  MPC_MEMO_SLOTS_MIN = 1024
+};
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth);
+
+static size_t mpc_memo_hash(mpc_memo_key_t *k) {
+  size_t h = (size_t)k->pos * 2654435761u;
+  return h ^ (h >> 15) ^ ((size_t)k->p >> 4) ^ (size_t)(k->term << 1 | k->suppress);
+}
+
+static mpc_memo_t *mpc_memo_slot(mpc_input_t *i, mpc_memo_key_t *k) {
+  size_t mask = i->memo_slots - 1;
+  size_t j = mpc_memo_hash(k) & mask;
+  mpc_memo_t *m;
+  while ((m = &i->memo[j])->p != NULL) {
+    if (m->p == k->p && m->pos == k->pos
+    &&  m->term == k->term && m->suppress == k->suppress) { return m; }
+    j = (j + 1) & mask;
+  }
+  return m;
+}
+
+static void mpc_memo_grow(mpc_input_t *i) {
+  size_t j;
+  size_t slots = i->memo_slots;
+  mpc_memo_t *memo = i->memo;
+  mpc_memo_key_t k;
+
+  i->memo_slots = slots ? slots * 2 : MPC_MEMO_SLOTS_MIN;
+  i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+  for (j = 0; j < slots; j++) {
+    if (memo[j].p == NULL) { continue; }
+    k.p = memo[j].p;
+    k.pos = memo[j].pos;
+    k.term = memo[j].term;
+    k.suppress = memo[j].suppress;
+    *mpc_memo_slot(i, &k) = memo[j];
+  }
+  free(memo);
+}
+
+static void mpc_memo_hold(mpc_input_t *i, mpc_memo_key_t *k) {
+  if (i->held_num == i->held_slots) {
+    i->held_slots = i->held_slots ? i->held_slots * 2 : MPC_MEMO_SLOTS_MIN;
+    i->held = realloc(i->held, sizeof(mpc_memo_key_t) * i->held_slots);
+  }
+  i->held[i->held_num++] = *k;
+}
+
+/* Drop the outputs kept since `num` outputs were held */
+static void mpc_memo_release(mpc_input_t *i, size_t num) {
+  mpc_memo_t *m;
+  while (i->held_num > num) {
+    m = mpc_memo_slot(i, &i->held[--i->held_num]);
+    m->p->data.memo.dx(m->output);
+    m->output = NULL;
+    m->outcome = MPC_MEMO_DROPPED;
+  }
+}
+
+static void mpc_memo_clear(mpc_input_t *i) {
+  size_t j;
+  mpc_memo_release(i, 0);
+  for (j = 0; j < i->memo_slots; j++) {
+    if (i->memo[j].p && i->memo[j].error) { mpc_err_delete(i->memo[j].error); }
+  }
+  free(i->memo);
+  free(i->held);
+  i->memo = NULL;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->held = NULL;
+  i->held_slots = 0;
+}
+
+/* Kept outputs are freed when dropped, so they stay out of any arena */
+static mpc_val_t *mpc_memo_copy(mpc_parser_t *p, mpc_val_t *x) {
+  mpc_arena_t *arena = mpc_arena_use(NULL);
+  mpc_val_t *c = p->data.memo.cp(x);
+  mpc_arena_use(arena);
+  return c;
+}
+
+static int mpc_parse_memo(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+
+  mpc_memo_key_t k;
+  mpc_memo_t *m = NULL;
+  size_t held = i->held_num;
+  int x;
+
+  k.p = p;
+  k.pos = i->state.pos;
+  k.term = i->state.term;
+  k.suppress = i->suppress > 0;
+
+  if (i->memo_slots > 0) { m = mpc_memo_slot(i, &k); }
+
+  if (m && m->p && m->outcome != MPC_MEMO_DROPPED) {
+    i->state = m->state;
+    i->last = m->last;
+    if (m->outcome == MPC_MEMO_SUCCESS) {
+      r->output = m->output ? p->data.memo.cp(m->output) : NULL;
+      return 1;
+    }
+    r->error = m->error ? mpc_err_copy(m->error) : NULL;
+    return 0;
+  }
+
+  x = mpc_parse_run(i, p->data.memo.x, r, e, depth+1);
+  if (x) { mpc_memo_release(i, held); }
+
+  if ((i->memo_num + 1) * 4 > i->memo_slots * 3) { mpc_memo_grow(i); }
+  m = mpc_memo_slot(i, &k);
+  if (m->p == NULL) { i->memo_num++; }
+  m->p = p;
+  m->pos = k.pos;
+  m->term = k.term;
+  m->suppress = k.suppress;
+  m->outcome = x ? MPC_MEMO_SUCCESS : MPC_MEMO_FAILURE;
+  m->state = i->state;
+  m->last = i->last;
+  m->output = x && r->output ? mpc_memo_copy(p, r->output) : NULL;
+  m->error = !x && r->error ? mpc_err_copy(r->error) : NULL;
+  if (m->output) { mpc_memo_hold(i, &k); }
+
+  return x;
+}
+
 static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
 
   int j = 0, k = 0;
@@ -1091,12 +1435,19 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
     case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
 
+    case MPC_TYPE_DFA:
+      if (mpc_input_dfa(i, &p->data.dfa, (char**)&r->output)) {
+        MPC_SUCCESS(r->output);
+      } else {
+        MPC_FAILURE(mpc_err_new(i, p->data.dfa.m));
+      }
+
     /* Other parsers */
 
     case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
     case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
     case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+    case MPC_TYPE_LIFT:      MPC_SUCCESS(mpc_parse_lift(i, p->data.lift.lf));
     case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
     case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
 
@@ -1175,7 +1526,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       } else {
         mpc_input_unmark(i);
         mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
+        MPC_SUCCESS(mpc_parse_lift(i, p->data.not.lf));
       }
 
     case MPC_TYPE_MAYBE:
@@ -1183,7 +1534,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         MPC_SUCCESS(r->output);
       } else {
         *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
+        MPC_SUCCESS(mpc_parse_lift(i, p->data.not.lf));
       }
 
     /* Repeat Parsers */
@@ -1323,6 +1674,14 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
         if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
 
+    /* Memoized Parsers */
+
+    case MPC_TYPE_MEMO:
+      if (i->type == MPC_INPUT_STRING && i->backtrack > 0) {
+        return mpc_parse_memo(i, p, r, e, depth);
+      }
+      return mpc_parse_run(i, p->data.memo.x, r, e, depth+1);
+
     /* End */
 
     default:
@@ -1343,6 +1702,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
   x = mpc_parse_run(i, p, r, &e, 0);
+  mpc_memo_clear(i);
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
@@ -1466,6 +1826,15 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
       mpc_undefine_unretained(p->data.sepby1.sep, 0);
       break;
 
+    case MPC_TYPE_MEMO: mpc_undefine_unretained(p->data.memo.x, 0); break;
+
+    case MPC_TYPE_DFA:
+      free(p->data.dfa.classes);
+      free(p->data.dfa.table);
+      free(p->data.dfa.accept);
+      free(p->data.dfa.m);
+      break;
+
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
 
@@ -1580,6 +1949,20 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       p->data.sepby1.sep = mpc_copy(a->data.sepby1.sep);
       break;
 
+    case MPC_TYPE_MEMO: p->data.memo.x = mpc_copy(a->data.memo.x); break;
+
+    case MPC_TYPE_DFA:
+      p->data.dfa.classes = malloc(256);
+      memcpy(p->data.dfa.classes, a->data.dfa.classes, 256);
+      p->data.dfa.table = malloc(sizeof(unsigned short) * a->data.dfa.states_num * a->data.dfa.classes_num);
+      memcpy(p->data.dfa.table, a->data.dfa.table,
+        sizeof(unsigned short) * a->data.dfa.states_num * a->data.dfa.classes_num);
+      p->data.dfa.accept = malloc(a->data.dfa.states_num);
+      memcpy(p->data.dfa.accept, a->data.dfa.accept, a->data.dfa.states_num);
+      p->data.dfa.m = malloc(strlen(a->data.dfa.m)+1);
+      strcpy(p->data.dfa.m, a->data.dfa.m);
+      break;
+
     case MPC_TYPE_OR:
       p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
       for (i = 0; i < a->data.or.n; i++) {
@@ -1926,6 +2309,15 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_memoize(mpc_parser_t *a, mpc_apply_t cp, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.cp = cp;
+  p->data.memo.dx = da;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -2411,6 +2803,8 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *re, const char *pattern);
+
 mpc_parser_t *mpc_re(const char *re) {
   return mpc_re_mode(re, MPC_RE_DEFAULT);
 }
@@ -2478,10 +2872,318 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode) {
 
   mpc_optimise(r.output);
 
+  if (mode & MPC_RE_DFA) { r.output = mpc_re_dfa(r.output, re); }
+
   return r.output;
 
 }
 
+/*
+** Regular Expression DFAs
+**
+** `mpc_re_dfa` compiles the combinators built for a regex into a Thompson
+** NFA and that, by subset construction, into a table indexed by state and
+** byte class. Bytes that every character set treats alike share a class,
+** which keeps the table small. State 0 is dead and state 1 is the start.
+** Regexes using anything but characters, sequences, choices and repetition
+** (anchors, boundaries, `\D`) are left as combinators.
+*/
+
+enum {
+  MPC_DFA_STATES_MAX = 1024
+};
+
+typedef struct {
+  int set;
+  int out[2];
+} mpc_nfa_state_t;
+
+typedef struct {
+  int states_num;
+  mpc_nfa_state_t *states;
+  int sets_num;
+  unsigned char (*sets)[32];
+} mpc_nfa_t;
+
+#define MPC_SET_HAS(s, b) ((s)[(b) >> 3] & (1 << ((b) & 7)))
+#define MPC_SET_ADD(s, b) ((s)[(b) >> 3] |= (unsigned char)(1 << ((b) & 7)))
+
+/* A state crossing character set `set`, or with only empty moves for -1 */
+static int mpc_nfa_state(mpc_nfa_t *n, int set) {
+  n->states = realloc(n->states, sizeof(mpc_nfa_state_t) * (n->states_num + 1));
+  n->states[n->states_num].set = set;
+  n->states[n->states_num].out[0] = -1;
+  n->states[n->states_num].out[1] = -1;
+  return n->states_num++;
+}
+
+static void mpc_nfa_link(mpc_nfa_t *n, int from, int to) {
+  mpc_nfa_state_t *s = &n->states[from];
+  s->out[s->out[0] == -1 ? 0 : 1] = to;
+}
+
+/* The characters a single character parser accepts, zero for other parsers */
+static int mpc_nfa_chars(mpc_parser_t *p, unsigned char *set) {
+
+  int b, in;
+  char c;
+
+  memset(set, 0, 32);
+
+  for (b = 1; b < 256; b++) {
+    c = (char)b;
+    switch (p->type) {
+      case MPC_TYPE_ANY:     in = 1; break;
+      case MPC_TYPE_SINGLE:  in = c == p->data.single.x; break;
+      case MPC_TYPE_RANGE:   in = c >= p->data.range.x && c <= p->data.range.y; break;
+      case MPC_TYPE_ONEOF:   in = strchr(p->data.string.x, c) != NULL; break;
+      case MPC_TYPE_NONEOF:  in = strchr(p->data.string.x, c) == NULL; break;
+      case MPC_TYPE_SATISFY: in = p->data.satisfy.f(c) != 0; break;
+      default: return 0;
+    }
+    if (in) { MPC_SET_ADD(set, b); }
+  }
+
+  return 1;
+}
+
+static int mpc_nfa_compile(mpc_nfa_t *n, mpc_parser_t *p, int *s, int *e) {
+
+  int j, s1, e1, b;
+  unsigned char set[32];
+
+  if (mpc_nfa_chars(p, set)) {
+    n->sets = realloc(n->sets, sizeof(*n->sets) * (n->sets_num + 1));
+    memcpy(n->sets[n->sets_num], set, 32);
+    *s = mpc_nfa_state(n, n->sets_num++);
+    *e = mpc_nfa_state(n, -1);
+    mpc_nfa_link(n, *s, *e);
+    return 1;
+  }
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_nfa_compile(n, p->data.expect.x, s, e);
+
+    case MPC_TYPE_LIFT:
+      if (p->data.lift.lf != mpcf_ctor_str) { return 0; }
+      *s = *e = mpc_nfa_state(n, -1);
+      return 1;
+
+    case MPC_TYPE_STRING:
+      *s = *e = mpc_nfa_state(n, -1);
+      for (j = 0; p->data.string.x[j]; j++) {
+        memset(set, 0, 32);
+        b = (unsigned char)p->data.string.x[j];
+        MPC_SET_ADD(set, b);
+        n->sets = realloc(n->sets, sizeof(*n->sets) * (n->sets_num + 1));
+        memcpy(n->sets[n->sets_num], set, 32);
+        s1 = mpc_nfa_state(n, n->sets_num++);
+        mpc_nfa_link(n, *e, s1);
+        *e = mpc_nfa_state(n, -1);
+        mpc_nfa_link(n, s1, *e);
+      }
+      return 1;
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return 0; }
+      *s = *e = mpc_nfa_state(n, -1);
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_nfa_compile(n, p->data.and.xs[j], &s1, &e1)) { return 0; }
+        mpc_nfa_link(n, *e, s1);
+        *e = e1;
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      *s = mpc_nfa_state(n, -1);
+      *e = mpc_nfa_state(n, -1);
+      b = *s;
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_nfa_compile(n, p->data.or.xs[j], &s1, &e1)) { return 0; }
+        mpc_nfa_link(n, b, s1);
+        mpc_nfa_link(n, e1, *e);
+        if (j < p->data.or.n - 2) {
+          s1 = mpc_nfa_state(n, -1);
+          mpc_nfa_link(n, b, s1);
+          b = s1;
+        }
+      }
+      return 1;
+
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      if (!mpc_nfa_compile(n, p->data.not.x, &s1, &e1)) { return 0; }
+      *s = mpc_nfa_state(n, -1);
+      *e = mpc_nfa_state(n, -1);
+      mpc_nfa_link(n, *s, s1);
+      mpc_nfa_link(n, *s, *e);
+      mpc_nfa_link(n, e1, *e);
+      return 1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      if (!mpc_nfa_compile(n, p->data.repeat.x, &s1, &e1)) { return 0; }
+      *e = mpc_nfa_state(n, -1);
+      mpc_nfa_link(n, e1, s1);
+      mpc_nfa_link(n, e1, *e);
+      if (p->type == MPC_TYPE_MANY1) {
+        *s = s1;
+      } else {
+        *s = mpc_nfa_state(n, -1);
+        mpc_nfa_link(n, *s, s1);
+        mpc_nfa_link(n, *s, *e);
+      }
+      return 1;
+
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      *s = *e = mpc_nfa_state(n, -1);
+      for (j = 0; j < p->data.repeat.n; j++) {
+        if (!mpc_nfa_compile(n, p->data.repeat.x, &s1, &e1)) { return 0; }
+        mpc_nfa_link(n, *e, s1);
+        *e = e1;
+      }
+      return 1;
+
+    default: return 0;
+  }
+
+}
+
+/* Add the states reachable by empty moves to `set` */
+static void mpc_nfa_closure(mpc_nfa_t *n, unsigned char *set, int *stack) {
+  int j, k, q, num = 0;
+  for (j = 0; j < n->states_num; j++) {
+    if (MPC_SET_HAS(set, j)) { stack[num++] = j; }
+  }
+  while (num > 0) {
+    q = stack[--num];
+    if (n->states[q].set != -1) { continue; }
+    for (k = 0; k < 2; k++) {
+      j = n->states[q].out[k];
+      if (j == -1 || MPC_SET_HAS(set, j)) { continue; }
+      MPC_SET_ADD(set, j);
+      stack[num++] = j;
+    }
+  }
+}
+
+/* Split the bytes into classes no character set tells apart */
+static int mpc_dfa_classes(mpc_nfa_t *n, unsigned char *classes) {
+  int map[512];
+  int j, b, k, num = 1;
+  memset(classes, 0, 256);
+  for (j = 0; j < n->sets_num; j++) {
+    for (k = 0; k < 512; k++) { map[k] = -1; }
+    num = 0;
+    for (b = 0; b < 256; b++) {
+      k = classes[b] * 2 + (MPC_SET_HAS(n->sets[j], b) ? 1 : 0);
+      if (map[k] == -1) { map[k] = num++; }
+      classes[b] = (unsigned char)map[k];
+    }
+  }
+  return num;
+}
+
+static int mpc_dfa_build(mpc_nfa_t *n, int start, int end, mpc_pdata_dfa_t *d) {
+
+  int w = (n->states_num + 7) / 8;
+  int reps[256];
+  int *stack = malloc(sizeof(int) * n->states_num);
+  unsigned char *sets = calloc(2, w);
+  unsigned char *next = malloc(w);
+  int j, k, q, t, c, ok = 1;
+
+  d->classes = malloc(256);
+  d->classes_num = mpc_dfa_classes(n, d->classes);
+  for (j = 255; j >= 0; j--) { reps[d->classes[j]] = j; }
+
+  /* State 0 is the empty set and so dead, state 1 the start */
+  d->states_num = 2;
+  MPC_SET_ADD(sets + w, start);
+  mpc_nfa_closure(n, sets + w, stack);
+
+  d->table = calloc(2 * d->classes_num, sizeof(unsigned short));
+  d->accept = calloc(2, 1);
+
+  for (k = 1; k < d->states_num && ok; k++) {
+
+    d->accept[k] = MPC_SET_HAS(sets + k * w, end) ? 1 : 0;
+
+    for (c = 0; c < d->classes_num; c++) {
+
+      memset(next, 0, w);
+      for (q = 0; q < n->states_num; q++) {
+        if (!MPC_SET_HAS(sets + k * w, q)) { continue; }
+        if (n->states[q].set == -1) { continue; }
+        if (!MPC_SET_HAS(n->sets[n->states[q].set], reps[c])) { continue; }
+        MPC_SET_ADD(next, n->states[q].out[0]);
+      }
+      mpc_nfa_closure(n, next, stack);
+
+      for (t = 0; t < d->states_num; t++) {
+        if (memcmp(sets + t * w, next, w) == 0) { break; }
+      }
+
+      if (t == d->states_num) {
+        if (t == MPC_DFA_STATES_MAX) { ok = 0; break; }
+        d->states_num++;
+        sets = realloc(sets, d->states_num * w);
+        memcpy(sets + t * w, next, w);
+        d->table = realloc(d->table, sizeof(unsigned short) * d->states_num * d->classes_num);
+        memset(d->table + t * d->classes_num, 0, sizeof(unsigned short) * d->classes_num);
+        d->accept = realloc(d->accept, d->states_num);
+        d->accept[t] = 0;
+      }
+
+      d->table[k * d->classes_num + c] = (unsigned short)t;
+    }
+  }
+
+  free(stack);
+  free(sets);
+  free(next);
+
+  if (!ok) {
+    free(d->classes);
+    free(d->table);
+    free(d->accept);
+  }
+
+  return ok;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *re, const char *pattern) {
+
+  mpc_nfa_t n;
+  mpc_pdata_dfa_t d;
+  mpc_parser_t *p;
+  int s, e, ok;
+
+  n.states_num = 0;
+  n.states = NULL;
+  n.sets_num = 0;
+  n.sets = NULL;
+
+  ok = mpc_nfa_compile(&n, re, &s, &e) && mpc_dfa_build(&n, s, e, &d);
+
+  free(n.states);
+  free(n.sets);
+
+  if (!ok) { return re; }
+
+  d.m = malloc(strlen(pattern) + 3);
+  sprintf(d.m, "/%s/", pattern);
+
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa = d;
+  mpc_delete(re);
+  return p;
+}
+
 /*
 ** Common Fold Functions
 */
@@ -2753,6 +3455,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   }
 
   if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
+  if (p->type == MPC_TYPE_DFA) { printf("%s", p->data.dfa.m); }
   if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
 
   if (p->type == MPC_TYPE_SINGLE) {
@@ -2811,6 +3514,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_print_unretained(p->data.memo.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2930,6 +3634,131 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 }
 
 
+/*
+** Arenas
+**
+** An arena hands out memory by bumping a pointer through large blocks and
+** frees it all at once. While one is in use every AST node built goes into
+** it, so a whole tree costs a handful of allocations and `mpc_arena_delete`
+** frees it in one call, however long after the parse that is. Nodes know
+** their arena and `mpc_ast_delete` leaves them alone.
+**
+** Folds build nodes without seeing the input, so the arena in use is held
+** per thread rather than per parse; threads parsing at once each build
+** into their own.
+*/
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define MPC_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define MPC_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define MPC_THREAD_LOCAL __declspec(thread)
+#else
+#define MPC_THREAD_LOCAL
+#endif
+
+enum {
+  MPC_ARENA_BLOCK_SIZE = 65536
+};
+
+typedef struct mpc_arena_block_t {
+  struct mpc_arena_block_t *next;
+  size_t used;
+  size_t size;
+} mpc_arena_block_t;
+
+struct mpc_arena_t {
+  mpc_arena_block_t *head;
+  size_t allocs;
+  size_t bytes;
+};
+
+static MPC_THREAD_LOCAL mpc_arena_t *mpc_arena_current = NULL;
+
+mpc_arena_t *mpc_arena_new(void) {
+  mpc_arena_t *a = malloc(sizeof(mpc_arena_t));
+  a->head = NULL;
+  a->allocs = 0;
+  a->bytes = 0;
+  return a;
+}
+
+mpc_arena_t *mpc_arena_use(mpc_arena_t *a) {
+  mpc_arena_t *prev = mpc_arena_current;
+  mpc_arena_current = a;
+  return prev;
+}
+
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_arena_t *a) {
+  int x;
+  mpc_arena_t *prev = mpc_arena_use(a);
+  x = mpc_parse(filename, string, p, r);
+  mpc_arena_use(prev);
+  return x;
+}
+
+void mpc_arena_delete(mpc_arena_t *a) {
+  mpc_arena_block_t *b, *next;
+  if (a == NULL) { return; }
+  if (mpc_arena_current == a) { mpc_arena_current = NULL; }
+  for (b = a->head; b != NULL; b = next) {
+    next = b->next;
+    free(b);
+  }
+  free(a);
+}
+
+size_t mpc_arena_allocs(mpc_arena_t *a) { return a->allocs; }
+size_t mpc_arena_bytes(mpc_arena_t *a) { return a->bytes; }
+
+static void *mpc_arena_alloc(mpc_arena_t *a, size_t n) {
+
+  mpc_arena_block_t *b = a->head;
+  size_t size;
+  char *p;
+
+  n = (n + 7) & ~(size_t)7;
+
+  if (b == NULL || b->used + n > b->size) {
+    size = n > MPC_ARENA_BLOCK_SIZE ? n : MPC_ARENA_BLOCK_SIZE;
+    b = malloc(sizeof(mpc_arena_block_t) + size);
+    b->next = a->head;
+    b->used = 0;
+    b->size = size;
+    a->head = b;
+  }
+
+  p = (char*)(b + 1) + b->used;
+  b->used += n;
+  a->allocs++;
+  a->bytes += n;
+  return p;
+}
+
+/* Like `realloc`, growing `p` where it is when it was the last allocation */
+static void *mpc_arena_realloc(mpc_arena_t *a, void *p, size_t m, size_t n) {
+
+  mpc_arena_block_t *b = a->head;
+  char *data = b ? (char*)(b + 1) : NULL;
+  size_t off, used;
+  char *q;
+
+  if (b && (char*)p >= data && (char*)p < data + b->used) {
+    off = (size_t)((char*)p - data);
+    used = (off + n + 7) & ~(size_t)7;
+    if (((off + m + 7) & ~(size_t)7) == b->used && used <= b->size) {
+      a->bytes += used - b->used;
+      b->used = used;
+      return p;
+    }
+  }
+
+  q = mpc_arena_alloc(a, n);
+  memcpy(q, p, m < n ? m : n);
+  return q;
+}
+
 /*
 ** AST
 */
@@ -2939,6 +3768,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
   int i;
 
   if (a == NULL) { return; }
+  if (a->arena) { return; }
 
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
@@ -2952,6 +3782,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->arena) { return; }
   free(a->children);
   free(a->tag);
   free(a->contents);
@@ -2960,22 +3791,65 @@ static void mpc_ast_delete_no_children(mpc_ast_t *a) {
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
-  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+  mpc_ast_t *a;
+  size_t tag_len = strlen(tag) + 1;
+  size_t contents_len = strlen(contents) + 1;
 
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
+  if (mpc_arena_current) {
+    a = mpc_arena_alloc(mpc_arena_current, sizeof(mpc_ast_t) + contents_len + tag_len);
+    a->contents = (char*)(a + 1);
+    a->tag = a->contents + contents_len;
+  } else {
+    a = malloc(sizeof(mpc_ast_t));
+    a->tag = malloc(tag_len);
+    a->contents = malloc(contents_len);
+  }
 
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
+  memcpy(a->tag, tag, tag_len);
+  memcpy(a->contents, contents, contents_len);
 
   a->state = mpc_state_new();
 
   a->children_num = 0;
   a->children = NULL;
+  a->arena = mpc_arena_current;
   return a;
 
 }
 
+/*
+** Children arrays of arena nodes are allocated in powers of two, so adding
+** a child only moves the array when the count reaches the next one.
+*/
+
+static mpc_ast_t **mpc_ast_children_new(mpc_ast_t *a, int n) {
+  int slots = 1;
+  if (n == 0) { return NULL; }
+  if (a->arena == NULL) { return malloc(sizeof(mpc_ast_t*) * n); }
+  while (slots < n) { slots *= 2; }
+  return mpc_arena_alloc(a->arena, sizeof(mpc_ast_t*) * slots);
+}
+
+static char *mpc_ast_tag_resize(mpc_ast_t *a, size_t n) {
+  if (a->arena == NULL) { return realloc(a->tag, n); }
+  return mpc_arena_realloc(a->arena, a->tag, strlen(a->tag) + 1, n);
+}
+
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+
+  int i;
+  mpc_ast_t *c = mpc_ast_new(a->tag, a->contents);
+
+  c->state = a->state;
+  c->children_num = a->children_num;
+  c->children = mpc_ast_children_new(c, a->children_num);
+  for (i = 0; i < a->children_num; i++) {
+    c->children[i] = mpc_ast_copy(a->children[i]);
+  }
+  return c;
+
+}
+
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
 
   mpc_ast_t *a = mpc_ast_new(tag, "");
@@ -3023,15 +3897,22 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
+  int n = r->children_num;
+  if (r->arena == NULL) {
+    r->children = realloc(r->children, sizeof(mpc_ast_t*) * (n + 1));
+  } else if (n == 0) {
+    r->children = mpc_ast_children_new(r, 1);
+  } else if ((n & (n - 1)) == 0) {
+    r->children = mpc_arena_realloc(r->arena, r->children,
+      sizeof(mpc_ast_t*) * n, sizeof(mpc_ast_t*) * n * 2);
+  }
+  r->children[r->children_num++] = a;
   return r;
 }
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
+  a->tag = mpc_ast_tag_resize(a, strlen(t) + 1 + strlen(a->tag) + 1);
   memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, strlen(t));
   memmove(a->tag + strlen(t), "|", 1);
@@ -3040,14 +3921,14 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
+  a->tag = mpc_ast_tag_resize(a, (strlen(t)-1) + strlen(a->tag) + 1);
   memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, (strlen(t)-1));
   return a;
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
+  a->tag = mpc_ast_tag_resize(a, strlen(t) + 1);
   strcpy(a->tag, t);
   return a;
 }
@@ -3262,7 +4143,7 @@ void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
 
 mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
 
-  int i, j;
+  int i, j, k;
   mpc_ast_t** as = (mpc_ast_t**)xs;
   mpc_ast_t *r;
 
@@ -3273,18 +4154,25 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
 
   r = mpc_ast_new(">", "");
 
+  /* Size the children once rather than growing them a child at a time */
+  for (i = 0, k = 0; i < n; i++) {
+    if (as[i] == NULL) { continue; }
+    k += as[i]->children_num >= 2 ? as[i]->children_num : 1;
+  }
+  r->children = mpc_ast_children_new(r, k);
+
   for (i = 0; i < n; i++) {
 
     if (as[i] == NULL) { continue; }
 
     if        (as[i] && as[i]->children_num == 0) {
-      mpc_ast_add_child(r, as[i]);
+      r->children[r->children_num++] = as[i];
     } else if (as[i] && as[i]->children_num == 1) {
-      mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
+      r->children[r->children_num++] = mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag);
       mpc_ast_delete_no_children(as[i]);
     } else if (as[i] && as[i]->children_num >= 2) {
       for (j = 0; j < as[i]->children_num; j++) {
-        mpc_ast_add_child(r, as[i]->children[j]);
+        r->children[r->children_num++] = as[i]->children[j];
       }
       mpc_ast_delete_no_children(as[i]);
     }
@@ -3382,6 +4270,7 @@ mpc_parser_t *mpca_and(int n, ...) {
 }
 
 mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_memoize(mpc_parser_t *a) { return mpc_memoize(a, (mpc_apply_t)mpc_ast_copy, (mpc_dtor_t)mpc_ast_delete); }
 
 /*
 ** Grammar Parser
@@ -3492,6 +4381,7 @@ static mpc_val_t *mpcaf_fold_regex(int n, mpc_val_t **xs) {
   (void)n;
   if (strchr(m, 'm')) { mode |= MPC_RE_MULTILINE; }
   if (strchr(m, 's')) { mode |= MPC_RE_DOTALL; }
+  if (st->flags & MPCA_LANG_DFA) { mode |= MPC_RE_DFA; }
   y = mpcf_unescape_regex(y);
   p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re_mode(y, mode) : mpc_tok(mpc_re_mode(y, mode));
   free(y);
@@ -3632,6 +4522,8 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
 
   mpc_optimise(r.output);
 
+  if (st->flags & MPCA_LANG_MEMOIZE) { r.output = mpca_memoize(r.output); }
+
   return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
 
 }
@@ -3700,6 +4592,49 @@ static void mpca_stmt_list_delete(mpc_val_t *x) {
 
 }
 
+/*
+** Does a rule refer to other rules? One that only matches terminals is
+** cheaper to run again than to memoize.
+*/
+
+static int mpca_stmt_refers(mpc_parser_t *p) {
+
+  int i;
+
+  if (p->retained) { return 1; }
+
+  if (p->type == MPC_TYPE_EXPECT)     { return mpca_stmt_refers(p->data.expect.x); }
+  if (p->type == MPC_TYPE_APPLY)      { return mpca_stmt_refers(p->data.apply.x); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { return mpca_stmt_refers(p->data.apply_to.x); }
+  if (p->type == MPC_TYPE_PREDICT)    { return mpca_stmt_refers(p->data.predict.x); }
+  if (p->type == MPC_TYPE_CHECK)      { return mpca_stmt_refers(p->data.check.x); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { return mpca_stmt_refers(p->data.check_with.x); }
+  if (p->type == MPC_TYPE_NOT)        { return mpca_stmt_refers(p->data.not.x); }
+  if (p->type == MPC_TYPE_MAYBE)      { return mpca_stmt_refers(p->data.not.x); }
+  if (p->type == MPC_TYPE_MANY)       { return mpca_stmt_refers(p->data.repeat.x); }
+  if (p->type == MPC_TYPE_MANY1)      { return mpca_stmt_refers(p->data.repeat.x); }
+  if (p->type == MPC_TYPE_COUNT)      { return mpca_stmt_refers(p->data.repeat.x); }
+  if (p->type == MPC_TYPE_MEMO)       { return mpca_stmt_refers(p->data.memo.x); }
+  if (p->type == MPC_TYPE_SEPBY1) {
+    return mpca_stmt_refers(p->data.sepby1.x) || mpca_stmt_refers(p->data.sepby1.sep);
+  }
+
+  if (p->type == MPC_TYPE_OR) {
+    for (i = 0; i < p->data.or.n; i++) {
+      if (mpca_stmt_refers(p->data.or.xs[i])) { return 1; }
+    }
+  }
+
+  if (p->type == MPC_TYPE_AND) {
+    for (i = 0; i < p->data.and.n; i++) {
+      if (mpca_stmt_refers(p->data.and.xs[i])) { return 1; }
+    }
+  }
+
+  return 0;
+
+}
+
 static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
 
   mpca_grammar_st_t *st = s;
@@ -3712,6 +4647,9 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if ((st->flags & MPCA_LANG_MEMOIZE) && mpca_stmt_refers(stmt->grammar)) {
+      stmt->grammar = mpca_memoize(stmt->grammar);
+    }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
@@ -3906,6 +4844,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { return 1 + mpc_nodecount_unretained(p->data.memo.x, 0); }
 
   if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
@@ -3965,6 +4904,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)       { mpc_optimise_unretained(p->data.memo.x, 0); }
   if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
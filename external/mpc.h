@@ -147,6 +147,7 @@ mpc_parser_t *mpc_or(int n, ...);
 mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
+mpc_parser_t *mpc_memoize(mpc_parser_t *a, mpc_apply_t cp, mpc_dtor_t da);
 
 /*
 ** Common Parsers
@@ -267,17 +268,45 @@ mpc_val_t *mpcf_strfold(int n, mpc_val_t** xs);
 ** Regular Expression Parsers
 */
 
+/*
+** With `MPC_RE_DFA` the regex is compiled to a DFA transition table and
+** matches the longest prefix it can, rather than backtracking through a
+** tree of combinators in which repetition is greedy and never gives back.
+** The two agree for the usual token shapes. Regexes with anchors or
+** boundaries (`^`, `$`, `\b`, ...) stay combinators.
+*/
+
 enum {
   MPC_RE_DEFAULT   = 0,
   MPC_RE_M         = 1,
   MPC_RE_S         = 2,
   MPC_RE_MULTILINE = 1,
-  MPC_RE_DOTALL    = 2
+  MPC_RE_DOTALL    = 2,
+  MPC_RE_DFA       = 4
 };
 
 mpc_parser_t *mpc_re(const char *re);
 mpc_parser_t *mpc_re_mode(const char *re, int mode);
 
+/*
+** Arenas
+**
+** While an arena is in use, AST nodes are allocated from it and freed all
+** together by `mpc_arena_delete`; `mpc_ast_delete` does nothing to them.
+** The arena in use is per thread. `mpc_arena_use` returns the one the
+** calling thread used before, and `mpc_parse_arena` uses `a` for a single
+** parse only.
+*/
+
+typedef struct mpc_arena_t mpc_arena_t;
+
+mpc_arena_t *mpc_arena_new(void);
+mpc_arena_t *mpc_arena_use(mpc_arena_t *a);
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_arena_t *a);
+void mpc_arena_delete(mpc_arena_t *a);
+size_t mpc_arena_allocs(mpc_arena_t *a);
+size_t mpc_arena_bytes(mpc_arena_t *a);
+
 /*
 ** AST
 */
@@ -288,9 +317,11 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  mpc_arena_t *arena;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
@@ -341,6 +372,7 @@ mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_root(mpc_parser_t *a);
 mpc_parser_t *mpca_state(mpc_parser_t *a);
 mpc_parser_t *mpca_total(mpc_parser_t *a);
+mpc_parser_t *mpca_memoize(mpc_parser_t *a);
 
 mpc_parser_t *mpca_not(mpc_parser_t *a);
 mpc_parser_t *mpca_maybe(mpc_parser_t *a);
@@ -355,7 +387,9 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_MEMOIZE              = 4,
+  MPCA_LANG_DFA                  = 8
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);